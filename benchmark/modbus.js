@@ -0,0 +1,59 @@
+'use strict';
+// Measures how many Modbus RTU transactions per second the master completes
+// against a simulated slave on a fake port, and how close that comes to the
+// wire limit at the baud rate. Needs the fake driver from the test build.
+//
+//   node benchmark/modbus.js [baudRate] [transactions] [registers]
+const Fs = require('node:fs');
+const {
+  Binding,
+  FakeDriver,
+  openFakePort
+} = require('../test/fixtures');
+const { ModbusSlave } = require('../test/fixtures/modbus-slave');
+
+
+async function main() {
+  const baudRate = +(process.argv[2] ?? 115200);
+  const count = +(process.argv[3] ?? 1000);
+  const quantity = +(process.argv[4] ?? 10);
+
+  if (FakeDriver === null) {
+    throw new Error('the fake driver is not built');
+  }
+
+  const port = await openFakePort(baudRate);
+  const master = Binding.modbusCreate(port.handle, baudRate, 1000, 0, 0);
+  const slave = new ModbusSlave(port.fd, 1, baudRate);
+  const pdu = new Uint8Array([0x03, 0, 0, 0, quantity]).buffer;
+  const requests = Array.from({ length: count }, () => {
+    return { slaveId: 1, pdu };
+  });
+  const start = process.hrtime.bigint();
+  const results = Binding.modbusSubmit(master, requests);
+
+  slave.serve(count);
+
+  const failed = (await results).filter((result) => {
+    return result.error !== undefined;
+  }).length;
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+  // 11 bit times per character, and t3.5 of silence before each frame.
+  const charSeconds = 11 / baudRate;
+  const t35 = baudRate > 19200 ? 0.00175 : charSeconds * 3.5;
+  const frameSeconds = (8 + 5 + quantity * 2) * charSeconds + 2 * t35;
+
+  Binding.modbusClose(master);
+  await Binding.closePort(port.handle);
+  Fs.closeSync(port.fd);
+  FakeDriver.uninstall();
+
+  console.log(`${count} transactions of ${quantity} registers at ` +
+    `${baudRate} baud, ${failed} failed`);
+  console.log(`${(count / seconds).toFixed(1)} transactions/s, wire limit ` +
+    `${(1 / frameSeconds).toFixed(1)} transactions/s ` +
+    `(${(100 * frameSeconds * count / seconds).toFixed(1)}%)`);
+}
+
+
+main();
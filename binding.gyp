@@ -3,11 +3,36 @@
     {
       'target_name': 'webserial',
       'sources': [
+        'src/addon-data.cc',
+        'src/bridge.cc',
+        'src/dmx.cc',
+        'src/echo-filter.cc',
+        'src/fd-pipe.cc',
+        'src/frame-reader.cc',
+        'src/modbus.cc',
+        'src/reliable-link.cc',
+        'src/rfc2217.cc',
+        'src/rx-ring.cc',
+        'src/script.cc',
         'src/serial-handle.cc',
+        'src/signal-sequence.cc',
+        'src/timing.cc',
+        'src/tx-pacer.cc',
+        'src/util.cc',
         'src/webserial.cc',
       ],
       'include_dirs': ['libserialport'],
       'dependencies': ['libserialport'],
+      # std::regex reports invalid patterns by throwing.
+      'cflags_cc!': ['-fno-exceptions'],
+      'xcode_settings': {
+        'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',
+      },
+      'msvs_settings': {
+        'VCCLCompilerTool': {
+          'ExceptionHandling': 1,
+        },
+      },
     },
 
     # libserialport
@@ -39,7 +64,8 @@
       'conditions': [
         ['OS=="linux"', {
           'sources': [
-            'linux_termios.c',
+            'libserialport/linux.c',
+            'libserialport/linux_termios.c',
           ],
           'libraries': [
             '-ludev',
@@ -79,4 +105,20 @@
       ],
     },
   ],
+  'variables': {
+    # The published package leaves out the tests.
+    'has_tests': '<!(node -p "+require(\'fs\').existsSync(\'test\')")',
+  },
+  'conditions': [
+    # Fake serial driver for the tests. It runs ports on pseudo-terminals.
+    ['OS!="win" and has_tests==1', {
+      'targets': [
+        {
+          'target_name': 'fake-driver',
+          'sources': ['test/fixtures/fake-driver.cc'],
+          'include_dirs': ['src', 'libserialport'],
+        },
+      ],
+    }],
+  ],
 }
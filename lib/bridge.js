@@ -0,0 +1,53 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kDefaultBufferSize = 4096;
+
+
+class SerialBridge {
+  #bridge;
+  #closed;
+
+  constructor(token, handleA, handleB, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const { bufferSize = kDefaultBufferSize } = options;
+
+    if ((bufferSize >>> 0) !== bufferSize || bufferSize === 0) {
+      throw new TypeError('bufferSize must be a non-zero unsigned integer');
+    }
+
+    this.#bridge = Binding.bridgeCreate(handleA, handleB, bufferSize);
+    this.#closed = this.#bridge.closed;
+    // Failures are reported through the closed promise. Do not let them
+    // surface as unhandled rejections when nobody is watching it.
+    this.#closed.catch(() => {});
+  }
+
+  // Resolves with the final { aToB, bToA } byte counts once the bridge is
+  // closed, or rejects if either port fails while bridged.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Returns the number of bytes delivered in each direction so far.
+  getStats() {
+    return Binding.bridgeStats(this.#bridge);
+  }
+
+  // Stops the bridge. Both ports can be used normally again afterwards.
+  close() {
+    Binding.bridgeClose(this.#bridge);
+    return this.#closed;
+  }
+}
+
+
+function createBridge(handleA, handleB, options) {
+  return new SerialBridge(kCreate, handleA, handleB, options);
+}
+
+
+module.exports = { SerialBridge, createBridge };
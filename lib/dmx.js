@@ -0,0 +1,115 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kMaxSlots = 512;
+// A full universe takes 22.8ms to send, so 44Hz is just out of reach.
+const kDefaultRefreshRate = 40;
+const kMaxRefreshRate = 1000;
+// Defaults are the typical transmitter timings. The minimums are those a
+// DMX512 transmitter must keep.
+const kDefaultBreakMicros = 176;
+const kMinBreakMicros = 88;
+const kDefaultMarkAfterBreakMicros = 12;
+const kMinMarkAfterBreakMicros = 8;
+const kMaxMicros = 1000000;
+
+
+class DmxOutput {
+  #buffer;
+  #closed;
+  #dmx;
+  #universe;
+
+  constructor(token, handle, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const {
+      slots = kMaxSlots,
+      refreshRate = kDefaultRefreshRate,
+      breakMicros = kDefaultBreakMicros,
+      markAfterBreakMicros = kDefaultMarkAfterBreakMicros,
+      startCode = 0
+    } = options;
+
+    if (!Number.isInteger(slots) || slots < 1 || slots > kMaxSlots) {
+      throw new TypeError(`slots must be an integer from 1 to ${kMaxSlots}`);
+    }
+
+    if (typeof refreshRate !== 'number' || !(refreshRate > 0) ||
+        refreshRate > kMaxRefreshRate) {
+      throw new TypeError(
+        `refreshRate must be a number above 0 and up to ${kMaxRefreshRate}`
+      );
+    }
+
+    checkMicros(breakMicros, kMinBreakMicros, 'breakMicros');
+    checkMicros(markAfterBreakMicros, kMinMarkAfterBreakMicros,
+      'markAfterBreakMicros');
+
+    if ((startCode & 0xFF) !== startCode) {
+      throw new TypeError('startCode must be an integer from 0 to 255');
+    }
+
+    const buffer = new SharedArrayBuffer(slots + 1);
+
+    this.#buffer = buffer;
+    this.#universe = new Uint8Array(buffer);
+    this.#universe[0] = startCode;
+    this.#dmx = Binding.dmxCreate(handle, this.#universe, slots, refreshRate,
+      breakMicros, markAfterBreakMicros);
+    this.#closed = this.#dmx.closed;
+    // Failures are reported through the closed promise, so do not let them
+    // surface as unhandled rejections when nobody is watching it.
+    this.#closed.catch(() => {});
+  }
+
+  // The frame being transmitted: the start code at index 0, followed by the
+  // channel slots, so that universe[n] is channel n. Changes go out with the
+  // next frame.
+  get universe() {
+    return this.#universe;
+  }
+
+  // The memory behind universe. Post it to other threads to update the
+  // channels from there.
+  get buffer() {
+    return this.#buffer;
+  }
+
+  // Resolves with the final { frames, overruns } counts once the output is
+  // closed, or rejects if the port fails.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Returns { frames, overruns }, where overruns counts frames that could
+  // not be sent on time.
+  stats() {
+    return Binding.dmxStats(this.#dmx);
+  }
+
+  // Stops transmitting after the frame in progress.
+  close() {
+    Binding.dmxClose(this.#dmx);
+    return this.#closed;
+  }
+}
+
+
+function checkMicros(value, min, name) {
+  if (!Number.isInteger(value) || value < min || value > kMaxMicros) {
+    throw new TypeError(
+      `${name} must be an integer from ${min} to ${kMaxMicros}`
+    );
+  }
+}
+
+
+function createDmxOutput(handle, options) {
+  return new DmxOutput(kCreate, handle, options);
+}
+
+
+module.exports = { createDmxOutput, DmxOutput };
@@ -0,0 +1,55 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+
+
+class SerialFdPipe {
+  #done;
+  #pipe;
+
+  constructor(token, handle, fd, toFd, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const { length = 0 } = options;
+
+    if (!Number.isInteger(fd) || fd < 0 || fd > 2 ** 31 - 1) {
+      throw new TypeError('fd must be a file descriptor');
+    }
+
+    if (!Number.isSafeInteger(length) || length < 0) {
+      throw new TypeError('length must be a non-negative integer');
+    }
+
+    this.#pipe = Binding.fdPipeCreate(handle, fd, toFd, length);
+    this.#done = this.#pipe.done;
+    // Failures are reported through the done promise. Do not let them
+    // surface as unhandled rejections when nobody is watching it.
+    this.#done.catch(() => {});
+  }
+
+  // Resolves with the number of bytes moved once the pipe finishes or is
+  // closed, or rejects if either side fails.
+  get done() {
+    return this.#done;
+  }
+
+  get bytesTransferred() {
+    return Binding.fdPipeStats(this.#pipe);
+  }
+
+  // Stops the pipe early. The port can be used normally again afterwards.
+  close() {
+    Binding.fdPipeClose(this.#pipe);
+    return this.#done;
+  }
+}
+
+
+function createFdPipe(handle, fd, toFd, options) {
+  return new SerialFdPipe(kCreate, handle, fd, toFd, options);
+}
+
+
+module.exports = { SerialFdPipe, createFdPipe };
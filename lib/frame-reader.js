@@ -0,0 +1,162 @@
+'use strict';
+const { ReadableStream } = require('stream/web');
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+// Modbus RTU ends a frame after 3.5 character times of silence.
+const kDefaultGapChars = 3.5;
+const kDefaultMaxFrameLength = 4096;
+const kMaxFrameLength = 2 ** 24;
+const kDefaultMaxQueuedFrames = 1024;
+const kMaxQueuedFrames = 2 ** 20;
+
+
+// Splits a port's input into frames at every silence longer than a gap, on
+// a native thread that timestamps bytes as they are read. Frames come out
+// of readable as { data, timeMicros, durationMicros, gapMicros, truncated }:
+// the bytes, when the first of them was read (on the clock behind
+// process.hrtime()), how long after that the last was read, the silence
+// before the frame, and whether the frame was cut at maxFrameLength.
+//
+// Bytes are timestamped when the driver hands them over, so the gap has to
+// be longer than the driver's own delivery delay, such as the latency
+// timer of a USB adapter.
+class SerialFrameReader {
+  #closed;
+  #controller;
+  #reader;
+  #readable;
+
+  constructor(token, handle, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const {
+      gapMicros = 0,
+      gapChars = kDefaultGapChars,
+      maxFrameLength = kDefaultMaxFrameLength,
+      maxQueuedFrames = kDefaultMaxQueuedFrames
+    } = options;
+
+    if (typeof gapMicros !== 'number' || !Number.isFinite(gapMicros) ||
+        gapMicros < 0) {
+      throw new TypeError('gapMicros must be a non-negative number');
+    }
+
+    if (typeof gapChars !== 'number' || !Number.isFinite(gapChars) ||
+        !(gapChars > 0)) {
+      throw new TypeError('gapChars must be a positive number');
+    }
+
+    if (!Number.isInteger(maxFrameLength) || maxFrameLength < 1 ||
+        maxFrameLength > kMaxFrameLength) {
+      throw new TypeError(
+        `maxFrameLength must be an integer from 1 to ${kMaxFrameLength}`
+      );
+    }
+
+    if (!Number.isInteger(maxQueuedFrames) || maxQueuedFrames < 1 ||
+        maxQueuedFrames > kMaxQueuedFrames) {
+      throw new TypeError(
+        `maxQueuedFrames must be an integer from 1 to ${kMaxQueuedFrames}`
+      );
+    }
+
+    this.#controller = null;
+    this.#readable = new ReadableStream({
+      start: (controller) => {
+        this.#controller = controller;
+      },
+      pull: () => {
+        this.#deliver();
+      },
+      cancel: () => {
+        this.#controller = null;
+        this.close();
+      }
+    }, { highWaterMark: 16 });
+    this.#reader = Binding.frameReaderCreate(handle, gapMicros, gapChars,
+      maxFrameLength, maxQueuedFrames, () => {
+        this.#deliver();
+      });
+    this.#closed = this.#reader.closed;
+    // Frames still queued when the reader stops are delivered before the
+    // stream ends. Failures are reported through the closed promise too, so
+    // do not let them surface as unhandled rejections when nobody is
+    // watching it.
+    this.#closed.then(() => {
+      this.#finish(null);
+    }, (err) => {
+      this.#finish(err);
+    });
+  }
+
+  // A stream of frames. Frames that arrive while maxQueuedFrames are waiting
+  // to be read push out the oldest, which are counted as dropped.
+  get readable() {
+    return this.#readable;
+  }
+
+  // Resolves with the final { frames, bytes, dropped, truncated } counts
+  // once the reader is closed, or rejects if the port fails.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Stops reading. The frame being received, if any, is ended here, and the
+  // port can be read normally again once this returns.
+  close() {
+    Binding.frameReaderClose(this.#reader);
+    return this.#closed;
+  }
+
+  // Moves frames from the native queue into the stream while it wants more.
+  #deliver() {
+    const controller = this.#controller;
+
+    while (controller !== null && controller.desiredSize > 0) {
+      const frame = Binding.frameReaderRead(this.#reader);
+
+      if (frame === null) {
+        break;
+      }
+
+      controller.enqueue(frame);
+    }
+  }
+
+  #finish(err) {
+    const controller = this.#controller;
+
+    if (controller === null) {
+      return;
+    }
+
+    this.#controller = null;
+
+    if (err !== null) {
+      controller.error(err);
+      return;
+    }
+
+    for (;;) {
+      const frame = Binding.frameReaderRead(this.#reader);
+
+      if (frame === null) {
+        break;
+      }
+
+      controller.enqueue(frame);
+    }
+
+    controller.close();
+  }
+}
+
+
+function createFrameReader(handle, options) {
+  return new SerialFrameReader(kCreate, handle, options);
+}
+
+
+module.exports = { createFrameReader, SerialFrameReader };
@@ -1,10 +1,37 @@
-/* global EventTarget */
+/* global AbortSignal, EventTarget */
 'use strict';
 const { ReadableStream, WritableStream } = require('stream/web');
-const { types } = require('util');
 const Binding = require('../build/Release/webserial');
+const { createBridge, SerialBridge } = require('./bridge');
+const { createDmxOutput, DmxOutput } = require('./dmx');
+const { createFdPipe, SerialFdPipe } = require('./fd-pipe');
+const {
+  createFrameReader,
+  SerialFrameReader
+} = require('./frame-reader');
+const { createModbusMaster, ModbusMaster } = require('./modbus');
+const { decodePortTable } = require('./port-table');
 const { defaultRequestPortHook } = require('./request-port-hook');
+const {
+  createReliableLink,
+  SerialReliableLink
+} = require('./reliable-link');
+const { createRfc2217Server, Rfc2217Server } = require('./rfc2217');
+const {
+  createRxRing,
+  SerialRingReader,
+  SerialRxRing
+} = require('./rx-ring');
+const { normalizeEchoSuppression, normalizeRs485 } = require('./rs485');
+const { normalizeScript } = require('./script');
+const { normalizeSignalSequence } = require('./signal-sequence');
+const { normalizeTxPacing } = require('./tx-pacing');
+const { copyBufferSource } = require('./util');
 const kMaxBufferSize = 2 ** 31 - 1;
+const kDefaultDrainTimeout = 5000;
+const kDefaultMaxResponseLength = 4096;
+const kDefaultTransactTimeout = 1000;
+const kHandle = Symbol('handle'); // Do not export this from this file.
 const kPortName = Symbol('portName'); // Do not export this from this file.
 const kStateClosed = 1;
 const kStateClosing = 2;
@@ -70,87 +97,96 @@ class Serial extends EventTarget {
   requestPort(options) {
     // eslint-disable-next-line no-async-promise-executor
     return new Promise(async (resolve, reject) => {
-      if (!isObject(options)) {
-        options = {};
-      }
-
-      const filterMap = new Map();
-
-      if ('filters' in options) {
-        const { filters } = options;
-
-        if (!isObject(filters) && typeof filters !== 'function') {
-          throw new TypeError(
-            'the provided value cannot be converted to a sequence'
-          );
+      try {
+        if (!isObject(options)) {
+          options = {};
         }
 
-        if (typeof filters[Symbol.iterator] !== 'function') {
-          throw new TypeError(
-            'the object must have a callable @@iterator property'
-          );
-        }
+        // Filters are passed to the binding as [vendorId, productId] pairs,
+        // with a productId of -1 matching any product.
+        let filterPairs;
 
-        const iterator = filters[Symbol.iterator]();
+        if ('filters' in options) {
+          const { filters } = options;
 
-        for (const filter of iterator) {
-          if (!isObject(filter)) {
-            throw new TypeError('cannot convert signals to dictionary');
+          if (!isObject(filters) && typeof filters !== 'function') {
+            throw new TypeError(
+              'the provided value cannot be converted to a sequence'
+            );
           }
 
-          if (!('usbVendorId' in filter)) {
-            throw new TypeError('filter must provide a property to filter by');
+          if (typeof filters[Symbol.iterator] !== 'function') {
+            throw new TypeError(
+              'the object must have a callable @@iterator property'
+            );
           }
 
-          filterMap.set(+filter.usbVendorId, filter);
-        }
-      }
+          const iterator = filters[Symbol.iterator]();
+          const pairs = [];
 
-      let ports = Binding.listAllPorts();
+          for (const filter of iterator) {
+            if (!isObject(filter)) {
+              throw new TypeError('cannot convert signals to dictionary');
+            }
 
-      if (filterMap.size > 0) {
-        ports = ports.filter(({ vendorId, productId }) => {
-          const filter = filterMap.get(+vendorId);
+            if (!('usbVendorId' in filter)) {
+              throw new TypeError(
+                'filter must provide a property to filter by'
+              );
+            }
 
-          if (filter === undefined) {
-            return false;
+            pairs.push(
+              +filter.usbVendorId,
+              'usbProductId' in filter ? +filter.usbProductId : -1
+            );
           }
 
-          if ('usbProductId' in filter && +filter.usbProductId !== +productId) {
-            return false;
+          if (pairs.length > 0) {
+            filterPairs = new Int32Array(pairs);
           }
+        }
 
-          return true;
-        });
-      }
+        const ports = decodePortTable(
+          await Binding.listAllPortsAsync(false, filterPairs, true)
+        );
+        const selectedPort = await this.#requestPortHook(ports);
+
+        if (selectedPort === undefined) {
+          throwDomException('NotFoundError', 'no port selected');
+        }
 
-      const selectedPort = await this.#requestPortHook(ports);
+        let port = this.#availablePorts.get(selectedPort.name);
 
-      if (selectedPort === undefined) {
-        throwDomException('NotFoundError', 'no port selected');
-      }
+        if (port === undefined) {
+          const handle = await Binding.createHandleAsync(selectedPort.name);
 
-      let port = this.#availablePorts.get(selectedPort.name);
+          port = new SerialPort({ // eslint-disable-line no-use-before-define
+            [kHandle]: handle,
+            [kPortName]: selectedPort.name,
+            usbVendorId: selectedPort.vendorId,
+            usbProductId: selectedPort.productId,
+            parent: this
+          });
+          this.#availablePorts.set(selectedPort.name, port);
+        }
 
-      if (port === undefined) {
-        port = new SerialPort({ // eslint-disable-line no-use-before-define
-          [kPortName]: selectedPort.name,
-          usbVendorId: selectedPort.vendorId,
-          usbProductId: selectedPort.productId,
-          parent: this
-        });
-        this.#availablePorts.set(selectedPort.name, port);
+        resolve(port);
+      } catch (err) {
+        reject(err);
       }
-
-      resolve(port);
     });
   }
 }
 
 
 class SerialPort extends EventTarget {
+  #baudRate;
   #bufferSize;
+  #drainTimeout;
+  #echoTimeout;
   #handle;
+  #helpers;
+  #native;
   #onConnect;
   #onDisconnect;
   #parent;
@@ -159,6 +195,9 @@ class SerialPort extends EventTarget {
   #readable;
   #readFatal;
   #state;
+  #transaction;
+  #txPacer;
+  #txPacing;
   #usbProductId;
   #usbVendorId;
   #writable;
@@ -168,20 +207,27 @@ class SerialPort extends EventTarget {
     super();
 
     if (options === null || typeof options !== 'object' ||
-        !(kPortName in options)) {
+        !(kPortName in options) || !(kHandle in options)) {
       throw new TypeError('illegal constructor');
     }
 
     const name = options[kPortName];
 
     this.#bufferSize = undefined;
-    this.#handle = Binding.createHandle(name);
+    this.#drainTimeout = kDefaultDrainTimeout;
+    this.#echoTimeout = null;
+    this.#handle = options[kHandle];
+    this.#helpers = new Map();
+    this.#native = Promise.resolve();
     this.#parent = options.parent;
     this.#pendingClosePromiseResolve = null;
     this.#portName = name;
     this.#readable = null;
     this.#readFatal = false;
     this.#state = kStateClosed;
+    this.#transaction = Promise.resolve();
+    this.#txPacer = null;
+    this.#txPacing = null;
     this.#usbProductId = options.usbProductId;
     this.#usbVendorId = options.usbVendorId;
     this.#writable = null;
@@ -212,7 +258,15 @@ class SerialPort extends EventTarget {
     this.#onDisconnect = value;
   }
 
+  // Non-standard: the baud rate the driver actually programmed, which may
+  // differ from the requested one because of clock divisor rounding.
+  get baudRate() {
+    return this.#state === kStateOpened ? this.#baudRate : undefined;
+  }
+
   get readable() {
+    this.#assertUnclaimed(true, false);
+
     if (this.#readable !== null) {
       return this.#readable;
     }
@@ -232,6 +286,12 @@ class SerialPort extends EventTarget {
       type: 'bytes',
       pull(controller) {
         return new Promise((resolve, reject) => {
+          // A stream created before a helper took over the input must not
+          // compete with it for data.
+          if (self.#isClaimed(true, false)) {
+            return resolve();
+          }
+
           try {
             const buffer = Binding.readData(handle, controller.desiredSize);
 
@@ -270,6 +330,8 @@ class SerialPort extends EventTarget {
   }
 
   get writable() {
+    this.#assertUnclaimed(false, true);
+
     if (this.#writable !== null) {
       return this.#writable;
     }
@@ -288,17 +350,32 @@ class SerialPort extends EventTarget {
     this.#writable = new WritableStream({
       write(chunk, controller) {
         return new Promise((resolve, reject) => {
-          let bytes;
-
-          if (types.isArrayBufferView(chunk)) {
-            const start = chunk.byteOffset;
-            const end = start + chunk.byteLength;
-
-            bytes = chunk.buffer.slice(start, end);
-          } else if (types.isAnyArrayBuffer(chunk)) {
-            bytes = chunk.slice();
-          } else {
-            throw new TypeError('chunk must be a buffer source');
+          const bytes = copyBufferSource(chunk, 'chunk');
+
+          self.#assertUnclaimed(false, true);
+
+          if (self.#txPacer !== null) {
+            // Paced chunks are done once the pacer has sent all of them. The
+            // stream only aborts once the write in progress has settled, so
+            // stop it early rather than waiting for a slow chunk to finish.
+            const pacer = self.#txPacer;
+            const onAbort = () => {
+              Binding.txPacerDiscard(pacer);
+            };
+
+            controller.signal.addEventListener('abort', onAbort);
+            Binding.txPacerWrite(pacer, bytes).then(resolve, (err) => {
+              // The stream errors, and abort() is never called on an errored
+              // stream, so let go of it here, as a failed read does.
+              if (!controller.signal.aborted) {
+                self.#closeWritable();
+              }
+
+              reject(createDomException('UnknownError', err.message));
+            }).finally(() => {
+              controller.signal.removeEventListener('abort', onAbort);
+            });
+            return;
           }
 
           try {
@@ -312,18 +389,21 @@ class SerialPort extends EventTarget {
         });
       },
       close() {
-        return new Promise((resolve, reject) => {
-          try {
-            Binding.flushTxBuffer(handle);
-          } finally {
+        // The drain runs on the threadpool, so a slow or stalled port does
+        // not hold up the event loop while its output queue empties.
+        return Binding.drain(handle, self.#drainTimeout)
+          .catch(() => {})
+          .finally(() => {
             self.#closeWritable();
-            resolve();
-          }
-        });
+          });
       },
       abort(reason) {
         return new Promise((resolve, reject) => {
           try {
+            if (self.#txPacer !== null) {
+              Binding.txPacerDiscard(self.#txPacer);
+            }
+
             Binding.discardTxBuffer(handle);
           } finally {
             self.#closeWritable();
@@ -342,41 +422,159 @@ class SerialPort extends EventTarget {
     // Do nothing.
   }
 
-  close() {
+  // Non-standard: options.timeout limits, in milliseconds, how long to wait
+  // for the native close (0 for no limit). Native I/O still pending on the
+  // port is cancelled first. If the close takes longer, the port is still
+  // marked as closed, the returned promise rejects with a TimeoutError and
+  // the close finishes in the background before the port can be reopened.
+  // Helpers such as bridges, pipes and rings must be closed first.
+  close(options) {
     // eslint-disable-next-line no-async-promise-executor
     return new Promise(async (resolve, reject) => {
-      const cancelPromise = this.#readable === null ? Promise.resolve() :
-        this.#readable.cancel();
-      const abortPromise = this.#writable === null ? Promise.resolve() :
-        this.#writable.abort();
-      let pendingClosePromiseResolve = null;
-      const pendingClosePromise = new Promise((resolve, reject) => {
-        if (this.#readable === null && this.#writable === null) {
-          return resolve();
-        }
+      try {
+        this.#assertUnclaimed(true, true);
+      } catch (err) {
+        return reject(err);
+      }
 
-        pendingClosePromiseResolve = resolve;
-      });
-      this.#pendingClosePromiseResolve = pendingClosePromiseResolve;
-      this.#state = kStateClosing;
-      const combinedPromise = Promise.all(
-        [cancelPromise, abortPromise, pendingClosePromise]
-      );
+      if (!isObject(options)) {
+        options = {};
+      }
+
+      const { timeout = 0 } = options;
+      const handle = this.#handle;
+
+      if ((timeout >>> 0) !== timeout) {
+        return reject(new TypeError('timeout must be an unsigned integer'));
+      }
+
+      const combinedPromise = this.#releaseStreams();
 
       try {
         await combinedPromise;
-        Binding.closePort(this.#handle);
+      } finally {
+        this.#pendingClosePromiseResolve = null;
+      }
+
+      this.#closeTxPacer();
+      const closing = this.#native.then(() => {
+        return Binding.closePort(handle);
+      });
+
+      this.#native = closing.catch(() => {});
+
+      try {
+        await withTimeout(closing, timeout, 'close timed out');
+      } catch (err) {
+        return reject(err);
+      } finally {
         this.#state = kStateClosed;
         this.#readFatal = false;
         this.#writeFatal = false;
+      }
+
+      resolve();
+    });
+  }
+
+  // Non-standard: hands the open port over to another thread. The port is
+  // closed here and the returned plain object can be posted to a Worker,
+  // where SerialPort.adopt() turns it back into an open port using the same
+  // file descriptor and settings. Helpers such as bridges or Modbus masters
+  // must be closed first, and native I/O still pending on the port is
+  // cancelled and waited for, as by close(). A transfer that is never
+  // adopted keeps the port open until the process exits.
+  transfer() {
+    // eslint-disable-next-line no-async-promise-executor
+    return new Promise(async (resolve, reject) => {
+      try {
+        assertState(this.#state, kStateOpened, 'port is not open');
+        this.#assertUnclaimed(true, true);
+      } catch (err) {
+        return reject(err);
+      }
+
+      const combinedPromise = this.#releaseStreams();
+      const handle = this.#handle;
+      let handleId;
+
+      try {
+        await combinedPromise;
+        this.#closeTxPacer();
+        const detaching = this.#native.then(() => {
+          return Binding.detachHandle(handle);
+        });
+
+        this.#native = detaching.catch(() => {});
+        handleId = await detaching;
+        this.#state = kStateClosed;
+      } catch (err) {
+        this.#state = kStateOpened;
+        return reject(err);
       } finally {
         this.#pendingClosePromiseResolve = null;
       }
 
-      resolve();
+      resolve({
+        handleId,
+        portName: this.#portName,
+        usbVendorId: this.#usbVendorId,
+        usbProductId: this.#usbProductId,
+        baudRate: this.#baudRate,
+        bufferSize: this.#bufferSize,
+        drainTimeout: this.#drainTimeout,
+        echoTimeout: this.#echoTimeout,
+        txPacing: this.#txPacing
+      });
     });
   }
 
+  // Non-standard: the receiving end of transfer(). Returns an open port that
+  // belongs to the calling thread.
+  static adopt(transfer) {
+    if (!isObject(transfer) ||
+        (transfer.handleId >>> 0) !== transfer.handleId) {
+      throw new TypeError('transfer must come from SerialPort#transfer()');
+    }
+
+    let handle;
+
+    try {
+      handle = Binding.adoptHandle(transfer.handleId);
+    } catch (err) {
+      throwDomException('InvalidStateError', err.message);
+    }
+
+    const port = new SerialPort({
+      [kHandle]: handle,
+      [kPortName]: transfer.portName,
+      usbVendorId: transfer.usbVendorId,
+      usbProductId: transfer.usbProductId
+    });
+
+    port.#baudRate = transfer.baudRate;
+    port.#bufferSize = transfer.bufferSize;
+    port.#drainTimeout = transfer.drainTimeout;
+    port.#echoTimeout = transfer.echoTimeout ?? null;
+    port.#state = kStateOpened;
+
+    try {
+      if (port.#echoTimeout !== null) {
+        Binding.setEchoSuppression(handle, true, port.#echoTimeout);
+      }
+
+      port.#setTxPacing(transfer.txPacing ?? null);
+    } catch (err) {
+      // Nothing else can reach the adopted handle, so close it rather than
+      // leak the port.
+      port.#state = kStateClosed;
+      Binding.closePort(handle).catch(() => {});
+      throw err;
+    }
+
+    return port;
+  }
+
   open(options) {
     return new Promise((resolve, reject) => {
       assertState(this.#state, kStateClosed, 'port is already open');
@@ -391,7 +589,12 @@ class SerialPort extends EventTarget {
         stopBits = 1,
         parity = 'none',
         bufferSize = 255,
-        flowControl = 'none'
+        flowControl = 'none',
+        drainTimeout = kDefaultDrainTimeout,
+        openTimeout = 0,
+        txPacing,
+        rs485,
+        echoSuppression
       } = options;
       const mappedParity = parityMap.get(parity);
       const mappedFlowControl = flowControlMap.get(flowControl);
@@ -426,20 +629,505 @@ class SerialPort extends EventTarget {
         );
       }
 
-      this.#state = kStateOpening;
+      // Non-standard: how long, in milliseconds, closing the writable stream
+      // waits for the output queue to move before discarding what is left.
+      // 0 waits for as long as it takes.
+      if ((drainTimeout >>> 0) !== drainTimeout) {
+        throw new TypeError('drainTimeout must be an unsigned integer');
+      }
 
-      try {
-        Binding.openPort(this.#handle, baudRate, dataBits, stopBits,
+      // Non-standard: how long, in milliseconds, to wait for the port to
+      // open (0 for no limit). A port that opens after the limit has passed
+      // is closed again in the background.
+      if ((openTimeout >>> 0) !== openTimeout) {
+        throw new TypeError('openTimeout must be an unsigned integer');
+      }
+
+      // Non-standard: paces writes, as with setTxPacing(), from the start.
+      const pacing = normalizeTxPacing(txPacing);
+
+      // Non-standard: puts the driver in RS-485 half-duplex mode, where it
+      // drives the transmitter enable with RTS. { rtsOnSend, rtsAfterSend }
+      // are the RTS levels while and after sending, delayRtsBeforeSend and
+      // delayRtsAfterSend the turnaround delays in milliseconds, and
+      // rxDuringTx keeps the receiver on while sending. false turns the mode
+      // off. Linux only.
+      const halfDuplex = normalizeRs485(rs485);
+
+      // Non-standard: drops the echo of everything written from what is
+      // read, for adapters that hear their own transmissions. true or
+      // { timeout }, the milliseconds an echo may lag behind the data
+      // actually going out. Fd pipes bypass this.
+      const echoTimeout = normalizeEchoSuppression(echoSuppression);
+
+      const handle = this.#handle;
+      // Opening waits for any earlier close that has not finished yet.
+      const opening = this.#native.then(() => {
+        return Binding.openPort(handle, baudRate, dataBits, stopBits,
           mappedParity, mappedFlowControl);
+      }).then((actual) => {
+        try {
+          configureHalfDuplex(handle, halfDuplex, echoTimeout);
+        } catch (err) {
+          return Binding.closePort(handle).catch(() => {}).then(() => {
+            throw err;
+          });
+        }
+
+        return actual;
+      });
+
+      this.#state = kStateOpening;
+      this.#native = opening.then(() => {}, () => {});
+      withTimeout(opening, openTimeout, 'open timed out').then((actual) => {
+        this.#baudRate = actual;
+        this.#bufferSize = bufferSize;
+        this.#drainTimeout = drainTimeout;
+        this.#echoTimeout = echoTimeout;
         this.#state = kStateOpened;
-      } catch (err) {
+        this.#setTxPacing(pacing);
+        resolve();
+      }, (err) => {
         this.#state = kStateClosed;
+
+        if (err.name === 'TimeoutError') {
+          this.#native = opening.then(() => {
+            return Binding.closePort(handle);
+          }).catch(() => {});
+          return reject(err);
+        }
+
+        reject(createDomException('NetworkError', err.message));
+      });
+    });
+  }
+
+  // Non-standard: changes the settings of an open port without closing it,
+  // so buffered data and the streams are kept. Omitted settings keep their
+  // current values. If drain is true, data that has already been written is
+  // transmitted using the old settings before switching. That drain is
+  // bounded like drain() with the drainTimeout open option, and if it gives
+  // up the settings are left alone and the promise rejects in the same way.
+  // Closing the port first also rejects with an AbortError. Helpers time
+  // their work from the settings they started with, so reconfiguring is
+  // refused while one owns the port.
+  reconfigure(options) {
+    return new Promise((resolve, reject) => {
+      assertState(this.#state, kStateOpened, 'port is not open');
+      this.#assertUnclaimed(true, true);
+
+      if (!isObject(options)) {
+        options = {};
+      }
+
+      const {
+        baudRate,
+        dataBits,
+        stopBits,
+        parity,
+        flowControl,
+        drain = false
+      } = options;
+      const mappedParity = parity === undefined ? -1 : parityMap.get(parity);
+      const mappedFlowControl = flowControl === undefined ? -1 :
+        flowControlMap.get(flowControl);
+
+      if (baudRate !== undefined &&
+          ((baudRate >>> 0) !== baudRate || baudRate === 0)) {
+        throw new TypeError('baudRate must be a non-zero unsigned integer');
+      }
+
+      if (dataBits !== undefined && dataBits !== 7 && dataBits !== 8) {
+        throw new TypeError('dataBits must be 7 or 8');
+      }
+
+      if (stopBits !== undefined && stopBits !== 1 && stopBits !== 2) {
+        throw new TypeError('stopBits must be 1 or 2');
+      }
+
+      if (mappedParity === undefined) {
+        throw new TypeError('parity must be none, even, or odd');
+      }
+
+      if (mappedFlowControl === undefined) {
+        throw new TypeError('flowControl must be none or hardware');
+      }
+
+      Binding.reconfigurePort(this.#handle, baudRate ?? -1, dataBits ?? -1,
+        stopBits ?? -1, mappedParity, mappedFlowControl, !!drain,
+        this.#drainTimeout).then((result) => {
+        if (typeof result === 'number') {
+          this.#baudRate = result;
+          resolve();
+        } else if (result === 'timeout') {
+          reject(createDomException('TimeoutError', 'drain timed out'));
+        } else {
+          reject(createDomException('AbortError', 'reconfigure was aborted'));
+        }
+      }, (err) => {
+        reject(createDomException('NetworkError', err.message));
+      });
+    });
+  }
+
+  // Non-standard: resolves once everything written so far has left the
+  // port, without closing the writable stream. Draining runs off the event
+  // loop. It rejects with a TimeoutError if the output queue stops moving
+  // for timeout milliseconds (0 for never), or with an AbortError if signal
+  // is aborted or the port is closed. The untransmitted bytes are discarded
+  // in both cases, and aborting cancels every drain pending on the port.
+  drain(options) {
+    return new Promise((resolve, reject) => {
+      assertState(this.#state, kStateOpened, 'port is not open');
+
+      if (!isObject(options)) {
+        options = {};
+      }
+
+      const { timeout = this.#drainTimeout, signal } = options;
+      const handle = this.#handle;
+
+      if ((timeout >>> 0) !== timeout) {
+        throw new TypeError('timeout must be an unsigned integer');
+      }
+
+      if (signal !== undefined && !(signal instanceof AbortSignal)) {
+        throw new TypeError('signal must be an AbortSignal');
+      }
+
+      if (signal?.aborted) {
+        throwDomException('AbortError', 'drain was aborted');
+      }
+
+      const onAbort = () => {
+        Binding.cancelDrains(handle);
+      };
+
+      signal?.addEventListener('abort', onAbort, { once: true });
+      Binding.drain(handle, timeout).then((outcome) => {
+        if (outcome === 'drained') {
+          resolve();
+        } else if (outcome === 'timeout') {
+          reject(createDomException('TimeoutError', 'drain timed out'));
+        } else {
+          reject(createDomException('AbortError', 'drain was aborted'));
+        }
+      }, reject).finally(() => {
+        signal?.removeEventListener('abort', onAbort);
+      });
+    });
+  }
+
+  // Non-standard: counts kept by the echoSuppression open option, as
+  // { suppressed, mismatched, expired }: echoed bytes dropped, echoes cut
+  // short by a different byte, as in a collision, and written bytes whose
+  // echo never came back.
+  getEchoStats() {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    return Binding.getEchoStats(this.#handle);
+  }
+
+  // Non-standard: limits how fast the writable stream sends, for devices
+  // that lose data when written to faster than they can take it and have no
+  // flow control. options is { rate, burst, byteGap, chunkGap }: the average
+  // rate in bytes per second, the largest burst in bytes (by default what
+  // the rate allows in 1ms), and idle time in milliseconds to leave on the
+  // line after every byte and after every chunk written. A gap starts once
+  // the bytes before it have left the UART, which is bounded like drain()
+  // by the drainTimeout open option. Writes are timed by a native thread.
+  // Pass null to stop pacing. Transactions and scripts are not paced.
+  setTxPacing(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#setTxPacing(normalizeTxPacing(options));
+  }
+
+  // Non-standard: writes request and waits for the response natively, so a
+  // whole exchange costs one promise. The response ends after expectLength
+  // bytes, or once delimiter (or maxLength bytes) has been received.
+  // Resolves with { data, timedOut, writeTime, totalTime }, where the times
+  // are in milliseconds. Transactions on a port run one at a time, in the
+  // order they were requested.
+  transact(request, options) {
+    return new Promise((resolve, reject) => {
+      assertState(this.#state, kStateOpened, 'port is not open');
+
+      if (this.#readable !== null && this.#readable.locked) {
+        throwDomException('InvalidStateError', 'readable stream is locked');
+      }
+
+      this.#assertUnclaimed(true, true);
+
+      if (!isObject(options)) {
+        options = {};
+      }
+
+      const {
+        expectLength,
+        delimiter,
+        maxLength = kDefaultMaxResponseLength,
+        timeout = kDefaultTransactTimeout
+      } = options;
+      const bytes = copyBufferSource(request, 'request');
+      let delimiterBytes;
+
+      if (expectLength !== undefined) {
+        if ((expectLength >>> 0) !== expectLength || expectLength === 0) {
+          throw new TypeError(
+            'expectLength must be a non-zero unsigned integer'
+          );
+        }
+      } else if (delimiter === undefined) {
+        throw new TypeError('expectLength or delimiter must be provided');
+      } else {
+        delimiterBytes = copyBufferSource(delimiter, 'delimiter');
+
+        if (delimiterBytes.byteLength === 0) {
+          throw new TypeError('delimiter must not be empty');
+        }
+      }
+
+      if ((maxLength >>> 0) !== maxLength || maxLength === 0) {
+        throw new TypeError('maxLength must be a non-zero unsigned integer');
+      }
+
+      if ((timeout >>> 0) !== timeout) {
+        throw new TypeError('timeout must be an unsigned integer');
+      }
+
+      const handle = this.#handle;
+      const result = this.#transaction.then(() => {
+        return Binding.transact(handle, bytes, expectLength ?? 0,
+          delimiterBytes, maxLength, timeout);
+      });
+
+      this.#transaction = result.catch(() => {});
+      resolve(result.then((response) => {
+        response.data = new Uint8Array(response.data);
+        return response;
+      }, (err) => {
         throwDomException('NetworkError', err.message);
+      }));
+    });
+  }
+
+  // Non-standard: runs a whole send/expect script (see lib/script.js) in
+  // native code, so steps are not delayed by the event loop. Resolves with
+  // { ok, failedStep, steps }, where each step reports its status, the
+  // index of the matching pattern, the match groups, the output received,
+  // the number of attempts and the time taken in milliseconds. Scripts and
+  // transactions on a port run one at a time. Only the last 64 KiB of input
+  // is kept for matching, and a match is expected to be at most 4 KiB long.
+  // A pattern too complex to run against the input fails its step with
+  // status 'error' and a match of -1.
+  runScript(steps) {
+    return new Promise((resolve, reject) => {
+      assertState(this.#state, kStateOpened, 'port is not open');
+
+      if (this.#readable !== null && this.#readable.locked) {
+        throwDomException('InvalidStateError', 'readable stream is locked');
       }
 
-      this.#bufferSize = bufferSize;
-      resolve();
+      this.#assertUnclaimed(true, true);
+
+      const script = normalizeScript(steps);
+      const handle = this.#handle;
+      const result = this.#transaction.then(() => {
+        return Binding.runScript(handle, script);
+      });
+
+      this.#transaction = result.catch(() => {});
+      resolve(result.then((response) => {
+        for (const step of response.steps) {
+          step.output = new Uint8Array(step.output);
+        }
+
+        return response;
+      }, (err) => {
+        throwDomException('NetworkError', err.message);
+      }));
+    });
+  }
+
+  // Non-standard: starts a Modbus RTU master on this port. The master owns
+  // the port until it is closed: its streams, transactions and close() are
+  // refused meanwhile. The silent intervals are derived from the baud rate
+  // the port is running at, and so is the longest silence allowed within a
+  // response unless options.maxGapMicros is given. Raise that for adapters
+  // that deliver input in bursts, such as USB ones with a latency timer.
+  createModbusMaster(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const master = createModbusMaster(this.#handle, this.#baudRate, options);
+
+    this.#claim(master, master.closed, true, true);
+    return master;
+  }
+
+  // Non-standard: forwards everything received on this port to another open
+  // port and vice versa on a native thread, so the data never enters JS.
+  // Both ports belong to the bridge until it is closed: their streams,
+  // transactions and close() are refused meanwhile. When one side cannot
+  // keep up, the bridge stops reading the other, so enable hardware flow
+  // control on both ports to push the backpressure back to the senders.
+  bridgeTo(port, options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+
+    if (!(port instanceof SerialPort) || port === this) {
+      throw new TypeError('port must be another SerialPort');
+    }
+
+    assertState(port.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, true);
+    port.#assertAvailable(true, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const bridge = createBridge(this.#handle, port.#handle, options);
+
+    this.#claim(bridge, bridge.closed, true, true);
+    port.#claim(bridge, bridge.closed, true, true);
+    return bridge;
+  }
+
+  // Non-standard: copies everything received on this port to a file
+  // descriptor (file, pipe or socket) on a native thread, until length bytes
+  // have been copied (0 for no limit) or the returned pipe is closed. The
+  // pipe owns the port's input until then.
+  pipeToFd(fd, options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, false);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const pipe = createFdPipe(this.#handle, fd, true, options);
+
+    this.#claim(pipe, pipe.done, true, false);
+    return pipe;
+  }
+
+  // Non-standard: writes the contents of a file descriptor to this port on a
+  // native thread, until end of file or until length bytes have been written
+  // (0 for no limit). The pipe's done promise resolves once the last byte
+  // has been handed to the OS, which may still be transmitting it. The pipe
+  // owns the port's output until then.
+  pipeFromFd(fd, options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(false, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const pipe = createFdPipe(this.#handle, fd, false, options);
+
+    this.#claim(pipe, pipe.done, false, true);
+    return pipe;
+  }
+
+  // Non-standard: reads this port on a native thread straight into a ring in
+  // a SharedArrayBuffer. Post the ring's buffer to other threads and read it
+  // there with SerialRingReader, as one consumer and any number of
+  // observers. Bytes that arrive while the ring is full are dropped and
+  // counted. The ring owns the port's input until it is closed.
+  createRxRing(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, false);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const ring = createRxRing(this.#handle, options);
+
+    this.#claim(ring, ring.closed, true, false);
+    return ring;
+  }
+
+  // Non-standard: reads this port on a native thread and splits the input
+  // into frames wherever the line falls silent for longer than gapMicros
+  // or, by default, gapChars character times at the current settings. The
+  // reader owns the port's input until it is closed.
+  createFrameReader(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, false);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const reader = createFrameReader(this.#handle, options);
+
+    this.#claim(reader, reader.closed, true, false);
+    return reader;
+  }
+
+  // Non-standard: runs a reliable link layer over this port, so that bytes
+  // written to the link's writable arrive at the peer's readable in order
+  // and intact, even if the line drops or damages some of them. The peer
+  // must run a link with the same window. The link owns the port until it
+  // is closed: the port's streams and close() are refused meanwhile.
+  createReliableLink(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const link = createReliableLink(this.#handle, options);
+
+    this.#claim(link, link.closed, true, true);
+    return link;
+  }
+
+  // Non-standard: transmits a DMX512 universe continuously from a native
+  // thread, with the break and mark after break timed to the microsecond.
+  // Write channel values into the returned output's universe, from this or
+  // any other thread, and they go out with the next frame. The port must be
+  // open at 250000 baud with 2 stop bits, and the output owns the port's
+  // transmit side until it is closed.
+  createDmxOutput(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(false, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const output = createDmxOutput(this.#handle, options);
+
+    this.#claim(output, output.closed, false, true);
+    return output;
+  }
+
+  // Non-standard: serves this port over TCP as an RFC 2217 (Telnet COM Port
+  // Control) server, so remote tools can use it as if it were local. One
+  // client is served at a time, and its line setting and signal changes
+  // are applied to the port, so baudRate follows the client. The server
+  // owns the port until it is closed.
+  serveRfc2217(options) {
+    assertState(this.#state, kStateOpened, 'port is not open');
+    this.#assertAvailable(true, true);
+
+    if (!isObject(options)) {
+      options = {};
+    }
+
+    const server = createRfc2217Server(this.#handle, options, (config) => {
+      this.#baudRate = config.baudRate;
     });
+
+    this.#claim(server, server.closed, true, true);
+    return server;
   }
 
   getInfo() {
@@ -493,6 +1181,119 @@ class SerialPort extends EventTarget {
     });
   }
 
+  // Non-standard: changes DTR, RTS and break through a sequence of steps
+  // (see lib/signal-sequence.js) timed natively to the microsecond, for
+  // things like resetting a microcontroller into its bootloader or the break
+  // and mark-after-break of DMX512 and LIN. Resolves with { steps,
+  // totalMicros }, where each step reports its startMicros, the setMicros
+  // spent changing the signals, and the holdMicros they were actually held
+  // for. Sequences, scripts and transactions on a port run one at a time.
+  runSignalSequence(steps) {
+    return new Promise((resolve, reject) => {
+      assertState(this.#state, kStateOpened, 'port is not open');
+      this.#assertUnclaimed(false, true);
+
+      const sequence = normalizeSignalSequence(steps);
+      const handle = this.#handle;
+      const result = this.#transaction.then(() => {
+        return Binding.runSignalSequence(handle, sequence);
+      });
+
+      this.#transaction = result.catch(() => {});
+      resolve(result.catch((err) => {
+        throwDomException('NetworkError', err.message);
+      }));
+    });
+  }
+
+  // Once created, the pacer stays until the port is closed, even when pacing
+  // is turned off, so that writes already queued in it cannot be overtaken.
+  #setTxPacing(pacing) {
+    this.#txPacing = pacing;
+
+    if (this.#txPacer === null) {
+      if (pacing !== null) {
+        this.#txPacer = Binding.txPacerCreate(this.#handle, pacing.rate,
+          pacing.burst, pacing.byteGap, pacing.chunkGap, this.#drainTimeout);
+      }
+
+      return;
+    }
+
+    Binding.txPacerConfigure(this.#txPacer, pacing?.rate ?? 0,
+      pacing?.burst ?? 1, pacing?.byteGap ?? 0, pacing?.chunkGap ?? 0);
+  }
+
+  #closeTxPacer() {
+    if (this.#txPacer !== null) {
+      Binding.txPacerClose(this.#txPacer);
+      this.#txPacer = null;
+    }
+  }
+
+  // Throws unless the port's input, output or both, as asked for, are free:
+  // not held by a locked stream or by a helper.
+  #assertAvailable(input, output) {
+    if (input && this.#readable !== null && this.#readable.locked) {
+      throwDomException('InvalidStateError', 'readable stream is locked');
+    }
+
+    if (output && this.#writable !== null && this.#writable.locked) {
+      throwDomException('InvalidStateError', 'writable stream is locked');
+    }
+
+    this.#assertUnclaimed(input, output);
+  }
+
+  #assertUnclaimed(input, output) {
+    if (this.#isClaimed(input, output)) {
+      throwDomException('InvalidStateError', 'port is in use by a helper');
+    }
+  }
+
+  #isClaimed(input, output) {
+    for (const sides of this.#helpers.values()) {
+      if ((input && sides.input) || (output && sides.output)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Hands the port's input, output or both to a helper running on a native
+  // thread, until done settles.
+  #claim(helper, done, input, output) {
+    const release = () => {
+      this.#helpers.delete(helper);
+    };
+
+    this.#helpers.set(helper, { input, output });
+    done.then(release, release);
+  }
+
+  #releaseStreams() {
+    // A writable that is closing may be waiting for a drain. Cut it short,
+    // since aborting the stream discards the output anyway.
+    Binding.cancelDrains(this.#handle);
+
+    const cancelPromise = this.#readable === null ? Promise.resolve() :
+      this.#readable.cancel();
+    const abortPromise = this.#writable === null ? Promise.resolve() :
+      this.#writable.abort();
+    let pendingClosePromiseResolve = null;
+    const pendingClosePromise = new Promise((resolve, reject) => {
+      if (this.#readable === null && this.#writable === null) {
+        return resolve();
+      }
+
+      pendingClosePromiseResolve = resolve;
+    });
+    this.#pendingClosePromiseResolve = pendingClosePromiseResolve;
+    this.#state = kStateClosing;
+    return Promise.all([cancelPromise, abortPromise, pendingClosePromise]);
+  }
+
   #closeReadable() {
     this.#readable = null;
 
@@ -523,12 +1324,52 @@ function assertState(actual, expected, failMessage) {
 }
 
 
-function throwDomException(name, message) {
+function createDomException(name, message) {
   // TODO(cjihrig): Use DOMException once it is available.
   const err = new Error(message);
 
   err.name = name;
-  throw err;
+  return err;
+}
+
+
+// Applies the RS-485 and echo suppression open options to a newly opened
+// port. Throws if the driver refuses.
+function configureHalfDuplex(handle, rs485, echoTimeout) {
+  if (rs485 !== null) {
+    Binding.setRs485(handle, rs485.enabled, rs485.rtsOnSend,
+      rs485.rtsAfterSend, rs485.rxDuringTx, rs485.delayRtsBeforeSend,
+      rs485.delayRtsAfterSend);
+  }
+
+  if (echoTimeout !== null) {
+    Binding.setEchoSuppression(handle, true, echoTimeout);
+  }
+}
+
+
+// Settles like promise, or rejects with a TimeoutError once timeout
+// milliseconds have passed. A timeout of 0 waits for as long as it takes.
+function withTimeout(promise, timeout, message) {
+  if (timeout === 0) {
+    return promise;
+  }
+
+  let timer;
+  const timeoutPromise = new Promise((resolve, reject) => {
+    timer = setTimeout(() => {
+      reject(createDomException('TimeoutError', message));
+    }, timeout);
+  });
+
+  return Promise.race([promise, timeoutPromise]).finally(() => {
+    clearTimeout(timer);
+  });
+}
+
+
+function throwDomException(name, message) {
+  throw createDomException(name, message);
 }
 
 
@@ -540,4 +1381,17 @@ function registerGlobals(glblThis) {
 }
 
 
-module.exports = { Serial, SerialPort, registerGlobals };
+module.exports = {
+  DmxOutput,
+  ModbusMaster,
+  Rfc2217Server,
+  Serial,
+  SerialBridge,
+  SerialFdPipe,
+  SerialFrameReader,
+  SerialPort,
+  SerialReliableLink,
+  SerialRingReader,
+  SerialRxRing,
+  registerGlobals
+};
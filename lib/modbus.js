@@ -0,0 +1,233 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const { copyBufferSource } = require('./util');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kDefaultResponseTimeout = 1000;
+const kDefaultTurnaroundDelay = 100;
+const kMaxPduSize = 253;
+// Write Multiple Registers fits at most 123 registers in a PDU.
+const kMaxWriteRegisters = 123;
+const kMaxSlaveId = 247;
+
+
+class ModbusMaster {
+  #closed;
+  #master;
+  #resolveClosed;
+
+  constructor(token, handle, baudRate, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const {
+      responseTimeout = kDefaultResponseTimeout,
+      turnaroundDelay = kDefaultTurnaroundDelay,
+      maxGapMicros = 0
+    } = options;
+
+    if ((responseTimeout >>> 0) !== responseTimeout || responseTimeout === 0) {
+      throw new TypeError(
+        'responseTimeout must be a non-zero unsigned integer'
+      );
+    }
+
+    if ((turnaroundDelay >>> 0) !== turnaroundDelay) {
+      throw new TypeError('turnaroundDelay must be an unsigned integer');
+    }
+
+    if ((maxGapMicros >>> 0) !== maxGapMicros) {
+      throw new TypeError('maxGapMicros must be an unsigned integer');
+    }
+
+    this.#closed = new Promise((resolve) => {
+      this.#resolveClosed = resolve;
+    });
+    this.#master = Binding.modbusCreate(handle, baudRate, responseTimeout,
+      turnaroundDelay, maxGapMicros);
+  }
+
+  // Resolves once the master is closed.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Sends one request PDU (function code followed by data) and resolves with
+  // { slaveId, functionCode, data, responseTime, totalTime }. Errors carry a
+  // code of ETIMEDOUT, EBADCRC, EBADFRAME, EMODBUS (with exceptionCode),
+  // ECANCELED or EIO.
+  async request(slaveId, pdu) {
+    const [result] = await this.poll([{ slaveId, pdu }]);
+
+    if (result.error !== undefined) {
+      throw result.error;
+    }
+
+    return result;
+  }
+
+  // Runs a list of { slaveId, pdu } requests back to back in native code and
+  // resolves with one result per request. Failed requests have an error
+  // property instead of data, so one bad slave does not hide the others.
+  async poll(requests) {
+    if (this.#resolveClosed === null) {
+      throw new Error('Modbus master is closed');
+    }
+
+    if (!Array.isArray(requests)) {
+      throw new TypeError('requests must be an array');
+    }
+
+    const native = requests.map(({ slaveId, pdu }) => {
+      if ((slaveId >>> 0) !== slaveId || slaveId > kMaxSlaveId) {
+        throw new TypeError(
+          `slaveId must be an integer from 0 to ${kMaxSlaveId}`
+        );
+      }
+
+      const bytes = copyBufferSource(pdu, 'pdu');
+
+      if (bytes.byteLength === 0 || bytes.byteLength > kMaxPduSize) {
+        throw new TypeError(`pdu must contain 1 to ${kMaxPduSize} bytes`);
+      }
+
+      return { slaveId, pdu: bytes };
+    });
+    const results = await Binding.modbusSubmit(this.#master, native);
+
+    for (const result of results) {
+      if (result.data !== undefined) {
+        result.data = new Uint8Array(result.data);
+      }
+    }
+
+    return results;
+  }
+
+  async readCoils(slaveId, address, quantity) {
+    const { data } = await this.request(slaveId,
+      encodeRequest(0x01, address, quantity));
+
+    return unpackBits(data, quantity);
+  }
+
+  async readDiscreteInputs(slaveId, address, quantity) {
+    const { data } = await this.request(slaveId,
+      encodeRequest(0x02, address, quantity));
+
+    return unpackBits(data, quantity);
+  }
+
+  async readHoldingRegisters(slaveId, address, quantity) {
+    const { data } = await this.request(slaveId,
+      encodeRequest(0x03, address, quantity));
+
+    return unpackRegisters(data, quantity);
+  }
+
+  async readInputRegisters(slaveId, address, quantity) {
+    const { data } = await this.request(slaveId,
+      encodeRequest(0x04, address, quantity));
+
+    return unpackRegisters(data, quantity);
+  }
+
+  async writeSingleCoil(slaveId, address, value) {
+    await this.request(slaveId,
+      encodeRequest(0x05, address, value ? 0xFF00 : 0x0000));
+  }
+
+  async writeSingleRegister(slaveId, address, value) {
+    await this.request(slaveId, encodeRequest(0x06, address, value));
+  }
+
+  async writeMultipleRegisters(slaveId, address, values) {
+    if (!(values?.length >= 1 && values.length <= kMaxWriteRegisters)) {
+      throw new RangeError(
+        `values must hold 1 to ${kMaxWriteRegisters} registers`
+      );
+    }
+
+    const pdu = new Uint8Array(6 + values.length * 2);
+    const view = new DataView(pdu.buffer);
+
+    pdu[0] = 0x10;
+    view.setUint16(1, address);
+    view.setUint16(3, values.length);
+    pdu[5] = values.length * 2;
+
+    for (let i = 0; i < values.length; i++) {
+      view.setUint16(6 + i * 2, values[i]);
+    }
+
+    await this.request(slaveId, pdu);
+  }
+
+  // Stops the master. Requests that have not started are rejected with
+  // ECANCELED, and the port can be read and written normally again.
+  close() {
+    if (this.#resolveClosed !== null) {
+      Binding.modbusClose(this.#master);
+      this.#resolveClosed();
+      this.#resolveClosed = null;
+    }
+
+    return this.#closed;
+  }
+}
+
+
+function checkByteCount(data, expected) {
+  if (data[0] !== expected || data.byteLength !== expected + 1) {
+    const err = new Error('Response does not match the requested quantity');
+
+    err.code = 'EBADFRAME';
+    throw err;
+  }
+}
+
+
+function createModbusMaster(handle, baudRate, options) {
+  return new ModbusMaster(kCreate, handle, baudRate, options);
+}
+
+
+function encodeRequest(functionCode, first, second) {
+  const pdu = new Uint8Array(5);
+  const view = new DataView(pdu.buffer);
+
+  pdu[0] = functionCode;
+  view.setUint16(1, first);
+  view.setUint16(3, second);
+  return pdu;
+}
+
+
+function unpackBits(data, quantity) {
+  checkByteCount(data, Math.ceil(quantity / 8));
+
+  const bits = new Array(quantity);
+
+  for (let i = 0; i < quantity; i++) {
+    bits[i] = (data[1 + (i >> 3)] & (1 << (i & 7))) !== 0;
+  }
+
+  return bits;
+}
+
+
+function unpackRegisters(data, quantity) {
+  checkByteCount(data, quantity * 2);
+
+  const view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+  const registers = new Uint16Array(quantity);
+
+  for (let i = 0; i < quantity; i++) {
+    registers[i] = view.getUint16(1 + i * 2);
+  }
+
+  return registers;
+}
+
+
+module.exports = { ModbusMaster, createModbusMaster };
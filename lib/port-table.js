@@ -0,0 +1,101 @@
+'use strict';
+const { TextDecoder } = require('util');
+// Must match the compact port table layout in src/webserial.cc.
+const kNumStrings = 4;
+const kRowSize = 5 + 2 * kNumStrings;
+const kNameIndex = 0;
+const kManufacturerIndex = 1;
+const kProductIndex = 2;
+const kSerialNumberIndex = 3;
+const kState = Symbol('state');
+const decoder = new TextDecoder();
+
+
+function decodeNumber(entry, index) {
+  const { fields, row } = entry[kState];
+  const value = fields[row + index];
+
+  return value === -1 ? undefined : value;
+}
+
+
+function decodeString(entry, index) {
+  const state = entry[kState];
+  const { decoded, fields, row, strings } = state;
+
+  if (index in decoded) {
+    return decoded[index];
+  }
+
+  const field = row + 5 + 2 * index;
+  const offset = fields[field];
+  const length = fields[field + 1];
+  const value = length === -1 ? undefined :
+    decoder.decode(strings.subarray(offset, offset + length));
+
+  decoded[index] = value;
+  return value;
+}
+
+
+function accessor(get) {
+  return { configurable: true, enumerable: true, get };
+}
+
+
+// The fields are own enumerable getters rather than prototype getters, so
+// request port hooks can spread, copy or JSON.stringify the entries like the
+// plain objects they used to get, while the strings are still only decoded
+// when something reads them.
+const kFieldDescriptors = {
+  vendorId: accessor(function() { return decodeNumber(this, 0); }),
+  productId: accessor(function() { return decodeNumber(this, 1); }),
+  usbBus: accessor(function() { return decodeNumber(this, 2); }),
+  usbAddress: accessor(function() { return decodeNumber(this, 3); }),
+  transport: accessor(function() {
+    const { fields, row } = this[kState];
+
+    return fields[row + 4];
+  }),
+  name: accessor(function() { return decodeString(this, kNameIndex); }),
+  manufacturer: accessor(function() {
+    return decodeString(this, kManufacturerIndex);
+  }),
+  product: accessor(function() {
+    return decodeString(this, kProductIndex);
+  }),
+  serialNumber: accessor(function() {
+    return decodeString(this, kSerialNumberIndex);
+  })
+};
+
+
+class PortTableEntry {
+  constructor(fields, strings, row) {
+    Object.defineProperty(this, kState, {
+      value: {
+        fields,
+        row: row * kRowSize,
+        strings,
+        decoded: new Array(kNumStrings)
+      }
+    });
+    Object.defineProperties(this, kFieldDescriptors);
+  }
+}
+
+
+function decodePortTable(table) {
+  const fields = new Int32Array(table.fields);
+  const strings = new Uint8Array(table.strings);
+  const count = fields.length / kRowSize;
+  const ports = new Array(count);
+
+  for (let i = 0; i < count; i++) {
+    ports[i] = new PortTableEntry(fields, strings, i);
+  }
+
+  return ports;
+}
+
+module.exports = { decodePortTable };
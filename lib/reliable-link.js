@@ -0,0 +1,218 @@
+'use strict';
+const { ReadableStream, WritableStream } = require('stream/web');
+const Binding = require('../build/Release/webserial');
+const { copyBufferSource } = require('./util');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kDefaultWindow = 32;
+// Sequence numbers are 8 bits, and selective repeat needs the window to be
+// at most half of their range.
+const kMaxWindow = 127;
+const kDefaultMaxPayload = 256;
+const kMaxPayload = 4096;
+const kDefaultReceiveBufferSize = 65536;
+const kMaxReceiveBufferSize = 2 ** 31 - 1;
+
+
+function checkRate(value, name) {
+  if (typeof value !== 'number' || !(value >= 0 && value <= 1)) {
+    throw new TypeError(`${name} must be a number from 0 to 1`);
+  }
+}
+
+
+// Carries a loss-free byte stream over a port that may drop or damage data.
+// Data goes out in HDLC-style frames, each with a sequence number, a CRC-32
+// and the acknowledgement of what has been received, so a busy link needs
+// no separate acknowledgement frames. Up to window frames are in flight at
+// once. The receiver asks again for exactly the frames that were lost or
+// damaged, and everything else keeps flowing, so a clean line runs at
+// nearly its full rate.
+//
+// Both ends must run a link with the same window, and both must start
+// fresh: there is no handshake to resynchronize sequence numbers.
+class SerialReliableLink {
+  #closed;
+  #controller;
+  #link;
+  #readable;
+  #writable;
+
+  constructor(token, handle, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const {
+      window = kDefaultWindow,
+      maxPayload = kDefaultMaxPayload,
+      retransmitTimeout = 0,
+      maxRetransmits = 0,
+      receiveBufferSize = kDefaultReceiveBufferSize,
+      faults = {}
+    } = options;
+
+    if (!Number.isInteger(window) || window < 1 || window > kMaxWindow) {
+      throw new TypeError(`window must be an integer from 1 to ${kMaxWindow}`);
+    }
+
+    if (!Number.isInteger(maxPayload) || maxPayload < 1 ||
+        maxPayload > kMaxPayload) {
+      throw new TypeError(
+        `maxPayload must be an integer from 1 to ${kMaxPayload}`
+      );
+    }
+
+    if (!Number.isInteger(retransmitTimeout) || retransmitTimeout < 0 ||
+        retransmitTimeout > 2 ** 32 - 1) {
+      throw new TypeError('retransmitTimeout must be a non-negative integer');
+    }
+
+    if (!Number.isInteger(maxRetransmits) || maxRetransmits < 0 ||
+        maxRetransmits > 2 ** 32 - 1) {
+      throw new TypeError('maxRetransmits must be a non-negative integer');
+    }
+
+    if (!Number.isInteger(receiveBufferSize) ||
+        receiveBufferSize < maxPayload ||
+        receiveBufferSize > kMaxReceiveBufferSize) {
+      throw new TypeError(
+        'receiveBufferSize must be an integer from maxPayload to ' +
+        kMaxReceiveBufferSize
+      );
+    }
+
+    if (faults === null || typeof faults !== 'object') {
+      throw new TypeError('faults must be an object');
+    }
+
+    const { dropRate = 0, bitErrorRate = 0, seed = 0 } = faults;
+
+    checkRate(dropRate, 'faults.dropRate');
+    checkRate(bitErrorRate, 'faults.bitErrorRate');
+
+    if (!Number.isSafeInteger(seed)) {
+      throw new TypeError('faults.seed must be an integer');
+    }
+
+    this.#controller = null;
+    this.#readable = new ReadableStream({
+      start: (controller) => {
+        this.#controller = controller;
+      },
+      pull: () => {
+        this.#deliver();
+      },
+      cancel: () => {
+        this.#controller = null;
+        this.close();
+      }
+    }, { highWaterMark: 1 });
+    this.#writable = new WritableStream({
+      write: (chunk) => {
+        const data = copyBufferSource(chunk, 'chunk');
+
+        return Binding.reliableLinkWrite(this.#link, data);
+      },
+      close: () => {
+        return Binding.reliableLinkFlush(this.#link);
+      },
+      abort: () => {
+        this.close();
+      }
+    });
+    this.#link = Binding.reliableLinkCreate(handle, window, maxPayload,
+      retransmitTimeout, maxRetransmits, receiveBufferSize, dropRate,
+      bitErrorRate, seed, () => {
+        this.#deliver();
+      });
+    this.#closed = this.#link.closed;
+    // Data received before the link stops is delivered before the stream
+    // ends. Failures are reported through the closed promise too, so do not
+    // let them surface as unhandled rejections when nobody is watching it.
+    this.#closed.then(() => {
+      this.#finish(null);
+    }, (err) => {
+      this.#finish(err);
+    });
+  }
+
+  // The bytes received from the peer, in order and without gaps. Once
+  // receiveBufferSize bytes are waiting to be read, the link stops
+  // acknowledging, which holds the peer back.
+  get readable() {
+    return this.#readable;
+  }
+
+  // Bytes to send to the peer. A write resolves once its data has gone out
+  // in frames, and closing the stream resolves once the peer has
+  // acknowledged all of it.
+  get writable() {
+    return this.#writable;
+  }
+
+  // Resolves with the final { framesSent, framesReceived, retransmits,
+  // naksSent, crcErrors, duplicates, bytesSent, bytesReceived } counts once
+  // the link is closed, or rejects if the port fails or the peer stops
+  // answering.
+  get closed() {
+    return this.#closed;
+  }
+
+  // The same counts as closed resolves with, so far.
+  stats() {
+    return Binding.reliableLinkStats(this.#link);
+  }
+
+  // Stops the link. Data not yet acknowledged may be lost. The port can be
+  // used directly again once the returned promise settles.
+  close() {
+    Binding.reliableLinkClose(this.#link);
+    return this.#closed;
+  }
+
+  // Moves received bytes into the stream while it wants more.
+  #deliver() {
+    const controller = this.#controller;
+
+    if (controller === null || controller.desiredSize <= 0) {
+      return;
+    }
+
+    const data = Binding.reliableLinkRead(this.#link);
+
+    if (data !== null) {
+      controller.enqueue(data);
+    }
+  }
+
+  #finish(err) {
+    const controller = this.#controller;
+
+    if (controller === null) {
+      return;
+    }
+
+    this.#controller = null;
+
+    if (err !== null) {
+      controller.error(err);
+      return;
+    }
+
+    const data = Binding.reliableLinkRead(this.#link);
+
+    if (data !== null) {
+      controller.enqueue(data);
+    }
+
+    controller.close();
+  }
+}
+
+
+function createReliableLink(handle, options) {
+  return new SerialReliableLink(kCreate, handle, options);
+}
+
+
+module.exports = { createReliableLink, SerialReliableLink };
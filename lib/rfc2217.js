@@ -0,0 +1,69 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kDefaultHost = '127.0.0.1';
+
+
+class Rfc2217Server {
+  #closed;
+  #host;
+  #server;
+
+  constructor(token, handle, options, onConfig) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const { host = kDefaultHost, port = 0 } = options;
+
+    if (typeof host !== 'string') {
+      throw new TypeError('host must be a numeric IP address string');
+    }
+
+    if ((port >>> 0) !== port || port > 65535) {
+      throw new TypeError('port must be an integer from 0 to 65535');
+    }
+
+    this.#host = host;
+    this.#server = Binding.rfc2217Create(handle, host, port, onConfig);
+    this.#closed = this.#server.closed;
+    // Failures are reported through the closed promise. Do not let them
+    // surface as unhandled rejections when nobody is watching it.
+    this.#closed.catch(() => {});
+  }
+
+  // The address the server listens on. The port is the one actually bound,
+  // which matters when 0 was requested.
+  get address() {
+    return { host: this.#host, port: this.#server.port };
+  }
+
+  // Resolves with the final stats once the server is closed, or rejects if
+  // the serial port fails while being served.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Returns { connected, connections, toNetwork, toSerial }, where the byte
+  // counts are serial data without Telnet escaping.
+  getStats() {
+    return Binding.rfc2217Stats(this.#server);
+  }
+
+  // Stops listening and drops the client. The port can be used normally
+  // again afterwards.
+  close() {
+    Binding.rfc2217Close(this.#server);
+    return this.#closed;
+  }
+}
+
+
+// onConfig is called with the port's { baudRate, dataBits, stopBits,
+// parity, flowControl } whenever the client changes them.
+function createRfc2217Server(handle, options, onConfig) {
+  return new Rfc2217Server(kCreate, handle, options, onConfig);
+}
+
+
+module.exports = { Rfc2217Server, createRfc2217Server };
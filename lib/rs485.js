@@ -0,0 +1,98 @@
+'use strict';
+// Long enough for a USB adapter to hand back what it heard itself send.
+const kDefaultEchoTimeout = 50;
+
+
+// Checks the rs485 open option and fills in defaults. Delays are in
+// milliseconds, the unit the kernel takes. false turns RS-485 mode off.
+// Returns null when the driver's current mode is to be left alone.
+function normalizeRs485(options) {
+  if (options === null || options === undefined) {
+    return null;
+  }
+
+  if (options === false) {
+    return {
+      enabled: false,
+      rtsOnSend: false,
+      rtsAfterSend: false,
+      delayRtsBeforeSend: 0,
+      delayRtsAfterSend: 0,
+      rxDuringTx: false
+    };
+  }
+
+  if (options === true) {
+    options = {};
+  }
+
+  if (typeof options !== 'object') {
+    throw new TypeError('rs485 must be a boolean or an object');
+  }
+
+  const {
+    rtsOnSend = true,
+    rtsAfterSend = false,
+    delayRtsBeforeSend = 0,
+    delayRtsAfterSend = 0,
+    rxDuringTx = false
+  } = options;
+
+  if (typeof rtsOnSend !== 'boolean') {
+    throw new TypeError('rtsOnSend must be a boolean');
+  }
+
+  if (typeof rtsAfterSend !== 'boolean') {
+    throw new TypeError('rtsAfterSend must be a boolean');
+  }
+
+  if ((delayRtsBeforeSend >>> 0) !== delayRtsBeforeSend) {
+    throw new TypeError('delayRtsBeforeSend must be an unsigned integer');
+  }
+
+  if ((delayRtsAfterSend >>> 0) !== delayRtsAfterSend) {
+    throw new TypeError('delayRtsAfterSend must be an unsigned integer');
+  }
+
+  if (typeof rxDuringTx !== 'boolean') {
+    throw new TypeError('rxDuringTx must be a boolean');
+  }
+
+  return {
+    enabled: true,
+    rtsOnSend,
+    rtsAfterSend,
+    delayRtsBeforeSend,
+    delayRtsAfterSend,
+    rxDuringTx
+  };
+}
+
+
+// Checks the echoSuppression open option, which is a boolean or
+// { timeout } in milliseconds. Returns the timeout, or null when echoes are
+// to be left alone.
+function normalizeEchoSuppression(options) {
+  if (options === null || options === undefined || options === false) {
+    return null;
+  }
+
+  if (options === true) {
+    options = {};
+  }
+
+  if (typeof options !== 'object') {
+    throw new TypeError('echoSuppression must be a boolean or an object');
+  }
+
+  const { timeout = kDefaultEchoTimeout } = options;
+
+  if ((timeout >>> 0) !== timeout) {
+    throw new TypeError('timeout must be an unsigned integer');
+  }
+
+  return timeout;
+}
+
+
+module.exports = { normalizeEchoSuppression, normalizeRs485 };
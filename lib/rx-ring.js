@@ -0,0 +1,313 @@
+'use strict';
+const Binding = require('../build/Release/webserial');
+const kCreate = Symbol('create'); // Do not export this from this file.
+const kDefaultBufferSize = 65536;
+const kMinBufferSize = 16;
+const kMaxBufferSize = 2 ** 30;
+
+// Ring layout, shared with src/rx-ring.h. The SharedArrayBuffer starts with
+// a 64 byte header of 32-bit slots, followed by the data area. Positions are
+// byte counts that wrap at 2^32, and a position maps to the data area at
+// (position & (capacity - 1)).
+//
+//   slot 0  write     bytes written; only the native reader advances it
+//   slot 1  read      bytes consumed; only the claimed consumer advances it
+//   slot 2  dropped   bytes dropped because the ring was full
+//   slot 3  state     0 while open, 1 once closed, 2 if the port failed
+//   slot 4  waiters   readers blocked in Atomics.wait() on slot 7
+//   slot 5  capacity  size of the data area, a power of two
+//   slot 6  consumer  1 while a consumer holds the claim on slot 1
+//   slot 7  signal    bumped after every write and state change
+//
+// The native reader never writes past the read position, so bytes between
+// read and write stay valid until the consumer moves on. Observers follow
+// along without moving the read position, and lose data if they fall more
+// than a whole ring behind the writer.
+const kHeaderSize = 64;
+const kWrite = 0;
+const kRead = 1;
+const kDropped = 2;
+const kState = 3;
+const kWaiters = 4;
+const kCapacity = 5;
+const kConsumer = 6;
+const kSignal = 7;
+const kStateOpen = 0;
+
+
+class SerialRxRing {
+  #buffer;
+  #closed;
+  #ring;
+
+  constructor(token, handle, options) {
+    if (token !== kCreate) {
+      throw new TypeError('illegal constructor');
+    }
+
+    const { bufferSize = kDefaultBufferSize } = options;
+
+    if (!Number.isInteger(bufferSize) ||
+        bufferSize < kMinBufferSize ||
+        bufferSize > kMaxBufferSize ||
+        (bufferSize & (bufferSize - 1)) !== 0) {
+      throw new TypeError(
+        `bufferSize must be a power of two from ${kMinBufferSize} to ` +
+        `${kMaxBufferSize}`
+      );
+    }
+
+    const buffer = new SharedArrayBuffer(kHeaderSize + bufferSize);
+    const header = new Int32Array(buffer, 0, kHeaderSize / 4);
+    const notify = () => {
+      Atomics.notify(header, kSignal);
+    };
+
+    this.#buffer = buffer;
+    this.#ring = Binding.rxRingCreate(handle, new Uint8Array(buffer), notify);
+    this.#closed = this.#ring.closed;
+    // Blocked consumers need to see the final state. Failures are reported
+    // through the closed promise, so do not let them surface as unhandled
+    // rejections when nobody is watching it.
+    this.#closed.then(notify, notify);
+  }
+
+  // The ring's memory. Post it to other threads and wrap it in a
+  // SerialRingReader there.
+  get buffer() {
+    return this.#buffer;
+  }
+
+  // Resolves with the final { received, dropped } byte counts once the ring
+  // is closed, or rejects if the port fails.
+  get closed() {
+    return this.#closed;
+  }
+
+  // Stops filling the ring. Readers can still drain what is left in it, and
+  // the port can be read normally again afterwards.
+  close() {
+    Binding.rxRingClose(this.#ring);
+    return this.#closed;
+  }
+}
+
+
+// Reads a ring from any thread. A consumer claims the ring's read position,
+// so that the native reader can reuse the space it has read, and only one
+// can exist at a time. Observers see the same bytes without consuming them.
+//
+// Wakeups are delivered by the event loop of the thread that owns the port,
+// so that thread must not block in readSync() itself, and readers on other
+// threads should pass a finite timeout if the owner may exit without
+// closing the ring.
+class SerialRingReader {
+  #capacity;
+  #data;
+  #header;
+  #missed;
+  #observe;
+  #position;
+  #reading;
+
+  constructor(buffer, options) {
+    if (!(buffer instanceof SharedArrayBuffer) ||
+        buffer.byteLength < kHeaderSize + kMinBufferSize) {
+      throw new TypeError('buffer must be a serial ring buffer');
+    }
+
+    const { observe = false } = options ?? {};
+    const header = new Int32Array(buffer, 0, kHeaderSize / 4);
+    const capacity = Atomics.load(header, kCapacity);
+
+    if (capacity !== buffer.byteLength - kHeaderSize) {
+      throw new TypeError('buffer must be a serial ring buffer');
+    }
+
+    if (!observe && Atomics.compareExchange(header, kConsumer, 0, 1) !== 0) {
+      throw new Error('ring already has a consumer');
+    }
+
+    this.#capacity = capacity;
+    this.#data = new Uint8Array(buffer, kHeaderSize, capacity);
+    this.#header = header;
+    this.#missed = 0;
+    this.#observe = Boolean(observe);
+    this.#position = Atomics.load(header, observe ? kWrite : kRead);
+    this.#reading = false;
+  }
+
+  // Bytes that can be read without waiting.
+  get available() {
+    return Math.min(this.#available(), this.#capacity);
+  }
+
+  // Bytes the native reader dropped because the consumer fell behind.
+  get dropped() {
+    return Atomics.load(this.#header, kDropped) >>> 0;
+  }
+
+  // Bytes this observer skipped because it fell behind the writer.
+  get missed() {
+    return this.#missed;
+  }
+
+  // True once the ring has stopped filling. Data may still be left in it.
+  get closed() {
+    return Atomics.load(this.#header, kState) !== kStateOpen;
+  }
+
+  // Copies received bytes into target, waiting up to timeout milliseconds
+  // for some to arrive. Returns the number of bytes copied, 0 on timeout, or
+  // null once the ring is closed and drained.
+  readSync(target, timeout = Infinity) {
+    this.#startRead(target);
+
+    try {
+      for (;;) {
+        // Read the signal first. If anything changes after this point, the
+        // wait below returns at once instead of sleeping.
+        const signal = Atomics.load(this.#header, kSignal);
+        let available = this.#available();
+
+        if (available === 0 && !this.closed) {
+          Atomics.add(this.#header, kWaiters, 1);
+
+          try {
+            Atomics.wait(this.#header, kSignal, signal, timeout);
+          } finally {
+            Atomics.sub(this.#header, kWaiters, 1);
+          }
+
+          available = this.#available();
+        }
+
+        const n = this.#copy(target, available);
+
+        if (n >= 0) {
+          return n;
+        }
+      }
+    } finally {
+      this.#reading = false;
+    }
+  }
+
+  // Like readSync(), but waits without blocking the thread.
+  async read(target, timeout = Infinity) {
+    this.#startRead(target);
+
+    try {
+      for (;;) {
+        const signal = Atomics.load(this.#header, kSignal);
+        let available = this.#available();
+
+        if (available === 0 && !this.closed) {
+          Atomics.add(this.#header, kWaiters, 1);
+
+          try {
+            const result = Atomics.waitAsync(
+              this.#header,
+              kSignal,
+              signal,
+              timeout
+            );
+
+            if (result.async) {
+              await result.value;
+            }
+          } finally {
+            Atomics.sub(this.#header, kWaiters, 1);
+          }
+
+          available = this.#available();
+        }
+
+        const n = this.#copy(target, available);
+
+        if (n >= 0) {
+          return n;
+        }
+      }
+    } finally {
+      this.#reading = false;
+    }
+  }
+
+  // Gives up a consumer's claim, so another consumer can take over from the
+  // current read position.
+  release() {
+    if (!this.#observe && this.#header !== null) {
+      Atomics.store(this.#header, kConsumer, 0);
+    }
+
+    this.#header = null;
+  }
+
+  #startRead(target) {
+    if (this.#header === null) {
+      throw new Error('reader has been released');
+    }
+
+    if (!(target instanceof Uint8Array) || target.length === 0) {
+      throw new TypeError('target must be a non-empty Uint8Array');
+    }
+
+    if (this.#reading) {
+      throw new Error('a read is already in progress');
+    }
+
+    this.#reading = true;
+  }
+
+  #available() {
+    return (Atomics.load(this.#header, kWrite) - this.#position) >>> 0;
+  }
+
+  // Returns the number of bytes copied, or -1 if an observer fell behind
+  // and had to skip ahead, in which case nothing was copied.
+  #copy(target, available) {
+    if (available === 0) {
+      return this.closed && this.#available() === 0 ? null : 0;
+    }
+
+    const capacity = this.#capacity;
+    const position = this.#position;
+    const offset = position & (capacity - 1);
+    const n = Math.min(available, target.length, capacity);
+    const first = Math.min(n, capacity - offset);
+
+    target.set(this.#data.subarray(offset, offset + first));
+
+    if (n > first) {
+      target.set(this.#data.subarray(0, n - first), first);
+    }
+
+    if (this.#observe) {
+      // The writer may have lapped an observer while it was copying.
+      const write = Atomics.load(this.#header, kWrite);
+      const behind = (write - position) >>> 0;
+
+      if (behind > capacity) {
+        this.#missed += behind;
+        this.#position = write;
+        return -1;
+      }
+
+      this.#position = (position + n) | 0;
+      return n;
+    }
+
+    this.#position = (position + n) | 0;
+    Atomics.store(this.#header, kRead, this.#position);
+    return n;
+  }
+}
+
+
+function createRxRing(handle, options) {
+  return new SerialRxRing(kCreate, handle, options);
+}
+
+
+module.exports = { createRxRing, SerialRingReader, SerialRxRing };
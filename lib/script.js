@@ -0,0 +1,92 @@
+'use strict';
+const { copyBufferSource } = require('./util');
+const kDefaultStepTimeout = 1000;
+const encoder = new TextEncoder();
+
+
+// Converts the steps of a send/expect script into the form the binding
+// expects. Each step is { send, expect, error, timeout, retries, delay }.
+// send is a string or buffer source. expect and error are strings, which
+// match literally, regular expressions, or arrays of either.
+function normalizeScript(steps) {
+  if (!Array.isArray(steps)) {
+    throw new TypeError('steps must be an array');
+  }
+
+  return steps.map((step, i) => {
+    if (typeof step !== 'object' || step === null) {
+      throw new TypeError(`step ${i} must be an object`);
+    }
+
+    const {
+      send,
+      expect = [],
+      error = [],
+      timeout = kDefaultStepTimeout,
+      retries = 0,
+      delay = 0
+    } = step;
+
+    if ((timeout >>> 0) !== timeout) {
+      throw new TypeError('timeout must be an unsigned integer');
+    }
+
+    if ((retries >>> 0) !== retries) {
+      throw new TypeError('retries must be an unsigned integer');
+    }
+
+    if ((delay >>> 0) !== delay) {
+      throw new TypeError('delay must be an unsigned integer');
+    }
+
+    return {
+      send: send === undefined ? undefined : toBytes(send),
+      expect: toPatterns(expect, 'expect'),
+      error: toPatterns(error, 'error'),
+      timeout,
+      retries,
+      delay
+    };
+  });
+}
+
+
+function toBytes(value) {
+  if (typeof value === 'string') {
+    return encoder.encode(value).buffer;
+  }
+
+  return copyBufferSource(value, 'send');
+}
+
+
+function toPatterns(value, name) {
+  const patterns = Array.isArray(value) ? value : [value];
+
+  return patterns.map((pattern) => {
+    if (typeof pattern === 'string') {
+      return { source: escapeRegExp(pattern), ignoreCase: false };
+    }
+
+    if (pattern instanceof RegExp) {
+      // Matching always searches the whole input, so g and y do not apply.
+      if (/[^giy]/.test(pattern.flags)) {
+        throw new TypeError(`${name} patterns only support the i flag`);
+      }
+
+      return { source: pattern.source, ignoreCase: pattern.ignoreCase };
+    }
+
+    throw new TypeError(
+      `${name} patterns must be strings or regular expressions`
+    );
+  });
+}
+
+
+function escapeRegExp(value) {
+  return value.replace(/[\\^$.*+?()[\]{}|]/g, '\\$&');
+}
+
+
+module.exports = { normalizeScript };
@@ -0,0 +1,44 @@
+'use strict';
+// Longest hold of a single step, which keeps it within a uint32.
+const kMaxHoldMicros = 2 ** 32 - 1;
+
+
+// Converts the steps of a signal sequence into the form the binding
+// expects. Each step is { dtr, rts, break, holdMicros }, where a signal is
+// true to set it, false to clear it or undefined to leave it alone, and
+// holdMicros is how long to keep the result before the next step.
+function normalizeSignalSequence(steps) {
+  if (!Array.isArray(steps)) {
+    throw new TypeError('steps must be an array');
+  }
+
+  return steps.map((step, i) => {
+    if (typeof step !== 'object' || step === null) {
+      throw new TypeError(`step ${i} must be an object`);
+    }
+
+    const { dtr, rts, break: brk, holdMicros = 0 } = step;
+
+    if (!Number.isInteger(holdMicros) || holdMicros < 0 ||
+        holdMicros > kMaxHoldMicros) {
+      throw new TypeError(
+        `holdMicros must be an integer from 0 to ${kMaxHoldMicros}`
+      );
+    }
+
+    return {
+      dtr: toSignal(dtr),
+      rts: toSignal(rts),
+      brk: toSignal(brk),
+      holdMicros
+    };
+  });
+}
+
+
+function toSignal(value) {
+  return value === undefined ? -1 : +!!value;
+}
+
+
+module.exports = { normalizeSignalSequence };
@@ -0,0 +1,54 @@
+'use strict';
+// By default a burst is whatever the rate allows in a millisecond.
+const kDefaultBurstTime = 0.001;
+
+
+// Checks the options of SerialPort#setTxPacing() and fills in defaults.
+// rate is in bytes per second and burst in bytes. byteGap and chunkGap are
+// in milliseconds and may be fractional. Returns null when the options ask
+// for no pacing at all.
+function normalizeTxPacing(options) {
+  if (options === null || options === undefined) {
+    return null;
+  }
+
+  if (typeof options !== 'object') {
+    throw new TypeError('txPacing must be an object');
+  }
+
+  const { rate = 0, byteGap = 0, chunkGap = 0 } = options;
+
+  if (!isNonNegative(rate)) {
+    throw new TypeError('rate must be a non-negative number');
+  }
+
+  const {
+    burst = Math.max(1, Math.ceil(rate * kDefaultBurstTime))
+  } = options;
+
+  if (!Number.isInteger(burst) || burst < 1) {
+    throw new TypeError('burst must be a positive integer');
+  }
+
+  if (!isNonNegative(byteGap)) {
+    throw new TypeError('byteGap must be a non-negative number');
+  }
+
+  if (!isNonNegative(chunkGap)) {
+    throw new TypeError('chunkGap must be a non-negative number');
+  }
+
+  if (rate === 0 && byteGap === 0 && chunkGap === 0) {
+    return null;
+  }
+
+  return { rate, burst, byteGap, chunkGap };
+}
+
+
+function isNonNegative(value) {
+  return typeof value === 'number' && Number.isFinite(value) && value >= 0;
+}
+
+
+module.exports = { normalizeTxPacing };
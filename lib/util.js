@@ -0,0 +1,21 @@
+'use strict';
+const { types } = require('util');
+
+
+function copyBufferSource(value, name) {
+  if (types.isArrayBufferView(value)) {
+    const start = value.byteOffset;
+    const end = start + value.byteLength;
+
+    return value.buffer.slice(start, end);
+  }
+
+  if (types.isAnyArrayBuffer(value)) {
+    return value.slice();
+  }
+
+  throw new TypeError(`${name} must be a buffer source`);
+}
+
+
+module.exports = { copyBufferSource };
@@ -465,6 +465,19 @@ struct sp_port;
  */
 struct sp_port_config;
 
+/**
+ * @struct sp_usb_filter
+ * A USB vendor and product ID pair to match ports against.
+ *
+ * @since 0.1.2
+ */
+struct sp_usb_filter {
+	/** USB vendor ID to match. */
+	int vid;
+	/** USB product ID to match, or -1 to match any product. */
+	int pid;
+};
+
 /**
  * @struct sp_event_set
  * A set of handles to wait on for events.
@@ -537,6 +550,54 @@ SP_API void sp_free_port(struct sp_port *port);
  */
 SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr);
 
+/**
+ * List the serial ports available on the system, reusing the results of
+ * earlier enumerations where possible.
+ *
+ * This behaves like sp_list_ports(), but on Linux the details of each port
+ * are remembered between calls. The cache is only revalidated when a device
+ * node is added or removed, and then only new or replaced devices are probed
+ * again. On other platforms this is equivalent to sp_list_ports().
+ *
+ * The result should be freed after use by calling sp_free_port_list().
+ *
+ * @param[out] list_ptr If any error is returned, the variable pointed to by
+ *                      list_ptr will be set to NULL. Otherwise, it will be set
+ *                      to point to the newly allocated array. Must not be NULL.
+ * @param[in] rescan If non-zero, discard all cached results and probe every
+ *                   port again.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_list_ports_cached(struct sp_port ***list_ptr, int rescan);
+
+/**
+ * List the USB serial ports whose VID:PID matches any of the given filters.
+ *
+ * This behaves like sp_list_ports_cached(), but the VID:PID of each port is
+ * checked before any of its other details are looked up, so ports which do
+ * not match cost almost nothing to skip. Ports without a USB VID:PID never
+ * match. If num_filters is zero, all ports are listed.
+ *
+ * The result should be freed after use by calling sp_free_port_list().
+ *
+ * @param[out] list_ptr If any error is returned, the variable pointed to by
+ *                      list_ptr will be set to NULL. Otherwise, it will be set
+ *                      to point to the newly allocated array. Must not be NULL.
+ * @param[in] filters Array of filters. May be NULL if num_filters is zero.
+ * @param[in] num_filters Number of filters in the array.
+ * @param[in] rescan If non-zero, discard all cached results and probe every
+ *                   port again.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_list_ports_matching(struct sp_port ***list_ptr,
+	const struct sp_usb_filter *filters, size_t num_filters, int rescan);
+
 /**
  * Make a new copy of an sp_port structure.
  *
@@ -557,7 +618,8 @@ SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr);
 SP_API enum sp_return sp_copy_port(const struct sp_port *port, struct sp_port **copy_ptr);
 
 /**
- * Free a port list obtained from sp_list_ports().
+ * Free a port list obtained from sp_list_ports(), sp_list_ports_cached() or
+ * sp_list_ports_matching().
  *
  * This will also free all the sp_port structures referred to from the list;
  * any that are to be retained must be copied first using sp_copy_port().
@@ -591,6 +653,27 @@ SP_API void sp_free_port_list(struct sp_port **ports);
  */
 SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags);
 
+/**
+ * Open the specified serial port and apply a configuration to it.
+ *
+ * This is equivalent to calling sp_open() followed by sp_set_config(), but
+ * the port settings are read and written only once, with the raw mode that
+ * sp_open() applies and the given configuration combined into a single
+ * update. Any configuration fields left at -1 keep their current values.
+ *
+ * If the configuration cannot be applied, the port is closed again.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] flags Flags to use when opening the serial port.
+ * @param[in] config Pointer to a configuration structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_open_with_config(struct sp_port *port,
+	enum sp_mode flags, const struct sp_port_config *config);
+
 /**
  * Close the specified serial port.
  *
@@ -898,6 +981,42 @@ SP_API enum sp_return sp_get_config(struct sp_port *port, struct sp_port_config
  */
 SP_API enum sp_return sp_set_config(struct sp_port *port, const struct sp_port_config *config);
 
+/**
+ * Callback for sp_update_config().
+ *
+ * @param[in] current The configuration the port has now.
+ * @param[out] changes The settings to apply. Every field starts at -1, which
+ *                     leaves the setting unchanged.
+ * @param[in] user_data The pointer passed to sp_update_config().
+ *
+ * @return A positive value to apply changes, 0 to leave the port as it is,
+ *         or a negative error code to return from sp_update_config().
+ *
+ * @since 0.1.2
+ */
+typedef int (*sp_config_update_fn)(const struct sp_port_config *current,
+	struct sp_port_config *changes, void *user_data);
+
+/**
+ * Update the configuration for the specified serial port.
+ *
+ * The current configuration is read once and handed to the callback, which
+ * decides what to change. This is equivalent to sp_get_config() followed by
+ * sp_set_config(), without reading the port settings a second time. The
+ * callback may block, for example to wait for output to drain before the
+ * settings change.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] update Callback deciding the changes. Must not be NULL.
+ * @param[in] user_data Pointer passed through to the callback.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_update_config(struct sp_port *port,
+	sp_config_update_fn update, void *user_data);
+
 /**
  * Set the baud rate for the specified serial port.
  *
@@ -910,6 +1029,26 @@ SP_API enum sp_return sp_set_config(struct sp_port *port, const struct sp_port_c
  */
 SP_API enum sp_return sp_set_baudrate(struct sp_port *port, int baudrate);
 
+/**
+ * Get the baud rate the specified serial port is actually running at.
+ *
+ * Drivers round a requested rate to the nearest one their clock divisors
+ * can produce. Where the OS reports the programmed rate back (Linux, via
+ * termios2), that value is returned, otherwise this is the same as the
+ * baud rate returned by sp_get_config().
+ *
+ * The user should allocate a variable of type int and
+ * pass a pointer to this to receive the result.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] baudrate_ptr Pointer to a variable to store the result. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_actual_baudrate(struct sp_port *port, int *baudrate_ptr);
+
 /**
  * Get the baud rate from a port configuration.
  *
@@ -1681,6 +1820,50 @@ SP_API void sp_set_debug_handler(void (*handler)(const char *format, ...));
  */
 SP_API void sp_default_debug_handler(const char *format, ...);
 
+/**
+ * Replacement for ioctl(), for sp_set_ioctl_function().
+ *
+ * @param[in] fd The file descriptor of the port.
+ * @param[in] request The ioctl request.
+ * @param[in,out] arg The request's argument, or NULL if it takes none.
+ *
+ * @return What ioctl() would: -1 with errno set upon errors.
+ *
+ * @since 0.1.2
+ */
+typedef int (*sp_ioctl_fn)(int fd, unsigned long request, void *arg);
+
+/**
+ * Set a function to make every ioctl() the library issues on a port.
+ *
+ * This is meant for testing against a fake driver, and affects all ports
+ * in the process. Settings changed through tcgetattr(), tcsetattr(),
+ * tcflush() and tcdrain() still go to the real file descriptor, so a fake
+ * driver needs a real terminal, such as a pseudo-terminal, underneath.
+ * Has no effect on Windows.
+ *
+ * @param[in] function The function to use, or NULL for ioctl() itself.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_set_ioctl_function(sp_ioctl_fn function);
+
+/**
+ * Set the directory listed in place of /sys/class/tty.
+ *
+ * This is meant for testing enumeration against a fake sysfs tree, and
+ * affects all enumeration in the process. Each entry must look like a
+ * /sys/class/tty entry: a link to, or a directory with a device link to, a
+ * device directory, with the USB attributes a few levels above it for USB
+ * ports. The ports are still named /dev/<entry>. The enumeration cache is
+ * discarded. Has no effect on platforms other than Linux.
+ *
+ * @param[in] path The directory to use, or NULL for /sys/class/tty itself.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_set_tty_class_dir(const char *path);
+
 /** @} */
 
 /**
@@ -126,8 +126,11 @@
 #endif
 #endif
 
-/* Non-standard baudrates are not available everywhere. */
-#if (defined(HAVE_TERMIOS_SPEED) || defined(HAVE_TERMIOS2_SPEED)) && HAVE_DECL_BOTHER
+/* Non-standard baudrates are not available everywhere. On Linux they are
+   set through termios2/BOTHER, detected from the kernel headers by
+   linux_termios.c, so they do not depend on configure having been run. */
+#if defined(__linux__) || \
+	((defined(HAVE_TERMIOS_SPEED) || defined(HAVE_TERMIOS2_SPEED)) && HAVE_DECL_BOTHER)
 #define USE_TERMIOS_SPEED
 #endif
 
@@ -271,11 +274,21 @@ extern void (*sp_debug_handler)(const char *format, ...);
 
 #define TRY(x) do { int retval = x; if (retval != SP_OK) RETURN_CODEVAL(retval); } while (0)
 
+SP_PRIV struct sp_port *alloc_port(const char *portname);
 SP_PRIV struct sp_port **list_append(struct sp_port **list, const char *portname);
+SP_PRIV struct sp_port **list_append_copy(struct sp_port **list, const struct sp_port *port);
+#ifndef _WIN32
+SP_PRIV int port_ioctl(int fd, unsigned long request, void *arg);
+#endif
 
 /* OS-specific Helper functions. */
 SP_PRIV enum sp_return get_port_details(struct sp_port *port);
 SP_PRIV enum sp_return list_ports(struct sp_port ***list);
+#ifdef __linux__
+SP_PRIV enum sp_return list_ports_cached(struct sp_port ***list,
+	const struct sp_usb_filter *filters, size_t num_filters, int rescan);
+SP_PRIV void set_tty_class_dir(const char *path);
+#endif
 
 /* Timing abstraction */
 
@@ -21,45 +21,191 @@
 #include <config.h>
 #include "libserialport.h"
 #include "libserialport_internal.h"
+#include <pthread.h>
 
 /*
- * The 'e' modifier for O_CLOEXEC is glibc >= 2.7 only, hence not
- * portable, so provide an own wrapper for this functionality.
+ * Where the tty class lives in sysfs, leaving room in PATH_MAX for the
+ * entries below it. See sp_set_tty_class_dir().
  */
-static FILE *fopen_cloexec_rdonly(const char *pathname)
+static char tty_class_dir[PATH_MAX / 2] = "/sys/class/tty";
+
+/*
+ * Read a sysfs attribute relative to an open directory with a single read()
+ * into buf, stripping the trailing newline. Returns the length of the value,
+ * or -1 if the attribute could not be read.
+ */
+static int read_attr(int dirfd, const char *attr, char *buf, size_t size)
 {
+	ssize_t len;
 	int fd;
-	if ((fd = open(pathname, O_RDONLY | O_CLOEXEC)) < 0)
-		return NULL;
-	return fdopen(fd, "r");
+
+	if ((fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = 0;
+
+	return len;
 }
 
-SP_PRIV enum sp_return get_port_details(struct sp_port *port)
+static int read_attr_int(int dirfd, const char *attr, int base, int *value)
+{
+	char buf[16], *end;
+	long result;
+
+	if (read_attr(dirfd, attr, buf, sizeof(buf)) <= 0)
+		return -1;
+	result = strtol(buf, &end, base);
+	if (end == buf)
+		return -1;
+	*value = result;
+
+	return 0;
+}
+
+/*
+ * Find the sysfs directory of the USB device a tty belongs to. The device
+ * link is resolved once, then its parents are searched for the directory
+ * carrying the USB device attributes, at most five levels up.
+ * Returns 0 on success, -1 if no USB device directory was found.
+ */
+static int usb_device_path(const char *dev, char *path, size_t size)
+{
+	char link_name[PATH_MAX], resolved[PATH_MAX], attr[PATH_MAX + 16];
+	char *slash;
+	int i;
+
+	snprintf(link_name, sizeof(link_name), "%s/%s/device", tty_class_dir, dev);
+	if (!realpath(link_name, resolved))
+		return -1;
+
+	for (i = 0; i < 5; i++) {
+		if (!(slash = strrchr(resolved, '/')) || slash == resolved)
+			return -1;
+		*slash = 0;
+		snprintf(attr, sizeof(attr), "%s/idVendor", resolved);
+		if (access(attr, F_OK) == 0) {
+			if (strlen(resolved) >= size)
+				return -1;
+			strcpy(path, resolved);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Read only the VID:PID of a USB device directory. */
+static int read_usb_ids(const char *path, int *vid, int *pid)
+{
+	int dirfd, ret;
+
+	if ((dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	ret = (read_attr_int(dirfd, "idVendor", 16, vid) < 0 ||
+	       read_attr_int(dirfd, "idProduct", 16, pid) < 0) ? -1 : 0;
+	close(dirfd);
+
+	return ret;
+}
+
+static enum sp_return read_usb_details(struct sp_port *port, const char *dev,
+                                       const char *path)
 {
 	/*
 	 * Description limited to 127 char, anything longer
 	 * would not be user friendly anyway.
 	 */
 	char description[128];
-	int bus, address;
-	unsigned int vid, pid;
 	char manufacturer[128], product[128], serial[128];
+	int bus, address, vid, pid;
+	int dirfd;
+
+	if ((dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		RETURN_OK();
+
+	if (read_attr_int(dirfd, "busnum", 10, &bus) < 0 ||
+	    read_attr_int(dirfd, "devnum", 10, &address) < 0 ||
+	    read_attr_int(dirfd, "idVendor", 16, &vid) < 0 ||
+	    read_attr_int(dirfd, "idProduct", 16, &pid) < 0) {
+		close(dirfd);
+		RETURN_OK();
+	}
+
+	port->usb_bus = bus;
+	port->usb_address = address;
+	port->usb_vid = vid;
+	port->usb_pid = pid;
+
+	if (read_attr(dirfd, "product", product, sizeof(product)) > 0) {
+		port->usb_product = strdup(product);
+		port->description = strdup(product);
+	} else {
+		port->description = strdup(dev);
+	}
+
+	if (read_attr(dirfd, "manufacturer", manufacturer, sizeof(manufacturer)) > 0)
+		port->usb_manufacturer = strdup(manufacturer);
+
+	if (read_attr(dirfd, "serial", serial, sizeof(serial)) > 0)
+		port->usb_serial = strdup(serial);
+
+	close(dirfd);
+
+	/* If present, add serial to description for better identification. */
+	if (port->usb_serial && strlen(port->usb_serial)) {
+		snprintf(description, sizeof(description),
+			"%s - %s", port->description, port->usb_serial);
+		if (port->description)
+			free(port->description);
+		port->description = strdup(description);
+	}
+
+	RETURN_OK();
+}
+
+static enum sp_return get_usb_details(struct sp_port *port, const char *dev)
+{
+	char path[PATH_MAX];
+
+	if (usb_device_path(dev, path, sizeof(path)) < 0)
+		RETURN_OK();
+
+	return read_usb_details(port, dev, path);
+}
+
+SP_PRIV enum sp_return get_port_details(struct sp_port *port)
+{
 	char baddr[32];
-	const char dir_name[] = "/sys/class/tty/%s/device/%s%s";
-	char sub_dir[32] = "", link_name[PATH_MAX], file_name[PATH_MAX];
-	char *ptr, *dev = port->name + 5;
-	FILE *file;
-	int i, count;
+	char link_name[PATH_MAX], file_name[PATH_MAX];
+	char *dev = port->name + 5;
+	int count, dirfd;
 	struct stat statbuf;
 
 	if (strncmp(port->name, "/dev/", 5))
 		RETURN_ERROR(SP_ERR_ARG, "Device name not recognized");
 
-	snprintf(link_name, sizeof(link_name), "/sys/class/tty/%s", dev);
+	/*
+	 * Pseudo-terminals have no sysfs entry. They stand in for serial ports
+	 * in tests and under tools such as socat, so they are accepted as
+	 * native ports without details.
+	 */
+	if (!strncmp(dev, "pts/", 4) && stat(port->name, &statbuf) == 0 &&
+	    S_ISCHR(statbuf.st_mode)) {
+		port->description = strdup(dev);
+		RETURN_OK();
+	}
+
+	snprintf(link_name, sizeof(link_name), "%s/%s", tty_class_dir, dev);
 	if (lstat(link_name, &statbuf) == -1)
 		RETURN_ERROR(SP_ERR_ARG, "Device not found");
 	if (!S_ISLNK(statbuf.st_mode))
-		snprintf(link_name, sizeof(link_name), "/sys/class/tty/%s/device", dev);
+		snprintf(link_name, sizeof(link_name), "%s/%s/device",
+			tty_class_dir, dev);
 	count = readlink(link_name, file_name, sizeof(file_name));
 	if (count <= 0 || count >= (int)(sizeof(file_name) - 1))
 		RETURN_ERROR(SP_ERR_ARG, "Device not found");
@@ -69,183 +215,105 @@ SP_PRIV enum sp_return get_port_details(struct sp_port *port)
 	else if (strstr(file_name, "usb"))
 		port->transport = SP_TRANSPORT_USB;
 
-	if (port->transport == SP_TRANSPORT_USB) {
-		for (i = 0; i < 5; i++) {
-			strcat(sub_dir, "../");
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "busnum");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%d", &bus);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "devnum");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%d", &address);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "idVendor");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%4x", &vid);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "idProduct");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%4x", &pid);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			port->usb_bus = bus;
-			port->usb_address = address;
-			port->usb_vid = vid;
-			port->usb_pid = pid;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "product");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(description, sizeof(description), file))) {
-					ptr = description + strlen(description) - 1;
-					if (ptr >= description && *ptr == '\n')
-						*ptr = 0;
-					port->description = strdup(description);
-				}
-				fclose(file);
-			}
-			if (!file || !ptr)
-				port->description = strdup(dev);
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "manufacturer");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(manufacturer, sizeof(manufacturer), file))) {
-					ptr = manufacturer + strlen(manufacturer) - 1;
-					if (ptr >= manufacturer && *ptr == '\n')
-						*ptr = 0;
-					port->usb_manufacturer = strdup(manufacturer);
-				}
-				fclose(file);
-			}
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "product");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(product, sizeof(product), file))) {
-					ptr = product + strlen(product) - 1;
-					if (ptr >= product && *ptr == '\n')
-						*ptr = 0;
-					port->usb_product = strdup(product);
-				}
-				fclose(file);
-			}
+	if (port->transport == SP_TRANSPORT_USB)
+		return get_usb_details(port, dev);
 
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "serial");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(serial, sizeof(serial), file))) {
-					ptr = serial + strlen(serial) - 1;
-					if (ptr >= serial && *ptr == '\n')
-						*ptr = 0;
-					port->usb_serial = strdup(serial);
-				}
-				fclose(file);
-			}
-
-			/* If present, add serial to description for better identification. */
-			if (port->usb_serial && strlen(port->usb_serial)) {
-				snprintf(description, sizeof(description),
-					"%s - %s", port->description, port->usb_serial);
-				if (port->description)
-					free(port->description);
-				port->description = strdup(description);
-			}
-
-			break;
-		}
-	} else {
-		port->description = strdup(dev);
+	port->description = strdup(dev);
 
-		if (port->transport == SP_TRANSPORT_BLUETOOTH) {
-			snprintf(file_name, sizeof(file_name), dir_name, dev, "", "address");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(baddr, sizeof(baddr), file))) {
-					ptr = baddr + strlen(baddr) - 1;
-					if (ptr >= baddr && *ptr == '\n')
-						*ptr = 0;
-					port->bluetooth_address = strdup(baddr);
-				}
-				fclose(file);
-			}
+	if (port->transport == SP_TRANSPORT_BLUETOOTH) {
+		snprintf(file_name, sizeof(file_name), "%s/%s/device",
+			tty_class_dir, dev);
+		if ((dirfd = open(file_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+			if (read_attr(dirfd, "address", baddr, sizeof(baddr)) > 0)
+				port->bluetooth_address = strdup(baddr);
+			close(dirfd);
 		}
 	}
 
 	RETURN_OK();
 }
 
-SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+/*
+ * Resolve the device link of a /sys/class/tty entry into target.
+ * Returns 0 if the entry may be a serial port, -1 if it should be skipped.
+ */
+static int read_tty_target(const char *entry, char *target, size_t size)
+{
+	char buf[PATH_MAX];
+	struct stat statbuf;
+	int len;
+
+	snprintf(buf, sizeof(buf), "%s/%s", tty_class_dir, entry);
+	if (lstat(buf, &statbuf) == -1)
+		return -1;
+	if (!S_ISLNK(statbuf.st_mode))
+		snprintf(buf, sizeof(buf), "%s/%s/device", tty_class_dir, entry);
+	len = readlink(buf, target, size);
+	if (len <= 0 || len >= (int)(size - 1))
+		return -1;
+	target[len] = 0;
+	if (strstr(target, "virtual"))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The serial8250 driver has a hardcoded number of ports.
+ * The only way to tell which actually exist on a given system
+ * is to try to open them and make an ioctl call.
+ * Returns 1 if the port exists, 0 otherwise.
+ */
+static int probe_serial8250(const char *name)
 {
-	char name[PATH_MAX], target[PATH_MAX];
-	struct dirent *entry;
 #ifdef HAVE_STRUCT_SERIAL_STRUCT
 	struct serial_struct serial_info;
 	int ioctl_result;
 #endif
-	char buf[sizeof(entry->d_name) + 23];
-	int len, fd;
+	int fd;
+
+	DEBUG("serial8250 device, attempting to open");
+	if ((fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) < 0) {
+		DEBUG("Open failed, skipping");
+		return 0;
+	}
+#ifdef HAVE_STRUCT_SERIAL_STRUCT
+	ioctl_result = port_ioctl(fd, TIOCGSERIAL, &serial_info);
+#endif
+	close(fd);
+#ifdef HAVE_STRUCT_SERIAL_STRUCT
+	if (ioctl_result != 0) {
+		DEBUG("ioctl failed, skipping");
+		return 0;
+	}
+	if (serial_info.type == PORT_UNKNOWN) {
+		DEBUG("Port type is unknown, skipping");
+		return 0;
+	}
+#endif
+
+	return 1;
+}
+
+SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+{
+	char name[PATH_MAX], target[PATH_MAX];
+	struct dirent *entry;
 	DIR *dir;
 	int ret = SP_OK;
-	struct stat statbuf;
 
 	DEBUG("Enumerating tty devices");
-	if (!(dir = opendir("/sys/class/tty")))
+	if (!(dir = opendir(tty_class_dir)))
 		RETURN_FAIL("Could not open /sys/class/tty");
 
 	DEBUG("Iterating over results");
 	while ((entry = readdir(dir))) {
-		snprintf(buf, sizeof(buf), "/sys/class/tty/%s", entry->d_name);
-		if (lstat(buf, &statbuf) == -1)
-			continue;
-		if (!S_ISLNK(statbuf.st_mode))
-			snprintf(buf, sizeof(buf), "/sys/class/tty/%s/device", entry->d_name);
-		len = readlink(buf, target, sizeof(target));
-		if (len <= 0 || len >= (int)(sizeof(target) - 1))
-			continue;
-		target[len] = 0;
-		if (strstr(target, "virtual"))
+		if (read_tty_target(entry->d_name, target, sizeof(target)) < 0)
 			continue;
 		snprintf(name, sizeof(name), "/dev/%s", entry->d_name);
 		DEBUG_FMT("Found device %s", name);
-		if (strstr(target, "serial8250")) {
-			/*
-			 * The serial8250 driver has a hardcoded number of ports.
-			 * The only way to tell which actually exist on a given system
-			 * is to try to open them and make an ioctl call.
-			 */
-			DEBUG("serial8250 device, attempting to open");
-			if ((fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) < 0) {
-				DEBUG("Open failed, skipping");
-				continue;
-			}
-#ifdef HAVE_STRUCT_SERIAL_STRUCT
-			ioctl_result = ioctl(fd, TIOCGSERIAL, &serial_info);
-#endif
-			close(fd);
-#ifdef HAVE_STRUCT_SERIAL_STRUCT
-			if (ioctl_result != 0) {
-				DEBUG("ioctl failed, skipping");
-				continue;
-			}
-			if (serial_info.type == PORT_UNKNOWN) {
-				DEBUG("Port type is unknown, skipping");
-				continue;
-			}
-#endif
-		}
+		if (strstr(target, "serial8250") && !probe_serial8250(name))
+			continue;
 		DEBUG_FMT("Found port %s", name);
 		*list = list_append(*list, name);
 		if (!*list) {
@@ -257,3 +325,288 @@ SP_PRIV enum sp_return list_ports(struct sp_port ***list)
 
 	return ret;
 }
+
+/*
+ * Enumeration cache.
+ *
+ * Each /sys/class/tty entry is remembered together with its device link
+ * target and the identity of its /dev node. Creating or removing a device
+ * node changes the modification time of /dev (and usually of
+ * /sys/class/tty), so the cache is only revalidated when either directory
+ * changes. Revalidation is incremental: entries whose link target and
+ * device node are unchanged are reused as they are, and new or replaced
+ * entries only have their USB device directory and VID:PID looked up.
+ * The serial8250 probe and the remaining port details are deferred until
+ * an entry is actually listed, so entries rejected by a filter never pay
+ * for them.
+ */
+struct tty_cache_entry {
+	char *entry;
+	char *target;
+	char *usb_path;
+	int usb_vid;
+	int usb_pid;
+	dev_t rdev;
+	ino_t ino;
+	struct timespec ctime;
+	bool probed;
+	bool present;
+	struct sp_port *port;
+	bool seen;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct tty_cache_entry *entries;
+	size_t count;
+	size_t alloc;
+	struct timespec dev_mtime;
+	struct timespec sys_mtime;
+	bool valid;
+} tty_cache = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, {0, 0}, {0, 0}, false };
+
+static bool timespec_equal(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void tty_cache_free_entry(struct tty_cache_entry *e)
+{
+	free(e->entry);
+	free(e->target);
+	free(e->usb_path);
+	if (e->port)
+		sp_free_port(e->port);
+	e->entry = NULL;
+	e->target = NULL;
+	e->usb_path = NULL;
+	e->port = NULL;
+}
+
+static void tty_cache_clear(void)
+{
+	size_t i;
+
+	for (i = 0; i < tty_cache.count; i++)
+		tty_cache_free_entry(&tty_cache.entries[i]);
+	tty_cache.count = 0;
+	tty_cache.valid = false;
+}
+
+SP_PRIV void set_tty_class_dir(const char *path)
+{
+	pthread_mutex_lock(&tty_cache.lock);
+	snprintf(tty_class_dir, sizeof(tty_class_dir), "%s",
+		path ? path : "/sys/class/tty");
+	tty_cache_clear();
+	pthread_mutex_unlock(&tty_cache.lock);
+}
+
+static struct tty_cache_entry *tty_cache_find(const char *entry)
+{
+	size_t i;
+
+	for (i = 0; i < tty_cache.count; i++)
+		if (!strcmp(tty_cache.entries[i].entry, entry))
+			return &tty_cache.entries[i];
+
+	return NULL;
+}
+
+static enum sp_return tty_cache_update(struct timespec *dev_mtime,
+                                       struct timespec *sys_mtime)
+{
+	char name[PATH_MAX], target[PATH_MAX], path[PATH_MAX];
+	struct tty_cache_entry *e;
+	struct dirent *entry;
+	struct stat statbuf;
+	size_t i, j;
+	DIR *dir;
+
+	DEBUG("Revalidating tty device cache");
+	if (!(dir = opendir(tty_class_dir)))
+		RETURN_FAIL("Could not open /sys/class/tty");
+
+	for (i = 0; i < tty_cache.count; i++)
+		tty_cache.entries[i].seen = false;
+
+	while ((entry = readdir(dir))) {
+		if (read_tty_target(entry->d_name, target, sizeof(target)) < 0)
+			continue;
+		snprintf(name, sizeof(name), "/dev/%s", entry->d_name);
+		if (stat(name, &statbuf) == -1)
+			memset(&statbuf, 0, sizeof(statbuf));
+
+		e = tty_cache_find(entry->d_name);
+		if (e && !strcmp(e->target, target) &&
+		    e->rdev == statbuf.st_rdev && e->ino == statbuf.st_ino &&
+		    timespec_equal(&e->ctime, &statbuf.st_ctim)) {
+			e->seen = true;
+			continue;
+		}
+
+		DEBUG_FMT("Found new or changed device %s", name);
+		if (e) {
+			tty_cache_free_entry(e);
+		} else {
+			if (tty_cache.count == tty_cache.alloc) {
+				size_t alloc = tty_cache.alloc ? tty_cache.alloc * 2 : 32;
+				void *tmp = realloc(tty_cache.entries, alloc * sizeof(*e));
+
+				if (!tmp)
+					goto fail_mem;
+				tty_cache.entries = tmp;
+				tty_cache.alloc = alloc;
+			}
+			e = &tty_cache.entries[tty_cache.count++];
+		}
+
+		e->entry = strdup(entry->d_name);
+		e->target = strdup(target);
+		e->usb_path = NULL;
+		e->usb_vid = -1;
+		e->usb_pid = -1;
+		e->rdev = statbuf.st_rdev;
+		e->ino = statbuf.st_ino;
+		e->ctime = statbuf.st_ctim;
+		e->probed = !strstr(target, "serial8250");
+		e->present = e->probed;
+		e->port = NULL;
+		e->seen = true;
+		if (!e->entry || !e->target)
+			goto fail_mem;
+
+		if (strstr(target, "usb") && !strstr(target, "bluetooth") &&
+		    usb_device_path(entry->d_name, path, sizeof(path)) == 0) {
+			if (!(e->usb_path = strdup(path)))
+				goto fail_mem;
+			if (read_usb_ids(path, &e->usb_vid, &e->usb_pid) < 0)
+				e->usb_vid = e->usb_pid = -1;
+		}
+	}
+	closedir(dir);
+
+	/* Drop entries which have disappeared. */
+	for (i = 0, j = 0; i < tty_cache.count; i++) {
+		if (tty_cache.entries[i].seen)
+			tty_cache.entries[j++] = tty_cache.entries[i];
+		else
+			tty_cache_free_entry(&tty_cache.entries[i]);
+	}
+	tty_cache.count = j;
+
+	tty_cache.dev_mtime = *dev_mtime;
+	tty_cache.sys_mtime = *sys_mtime;
+	tty_cache.valid = true;
+
+	RETURN_OK();
+
+fail_mem:
+	closedir(dir);
+	tty_cache_clear();
+	RETURN_ERROR(SP_ERR_MEM, "Cache entry allocation failed");
+}
+
+static bool tty_cache_matches(const struct tty_cache_entry *e,
+                              const struct sp_usb_filter *filters,
+                              size_t num_filters)
+{
+	size_t i;
+
+	if (e->usb_vid < 0)
+		return false;
+
+	for (i = 0; i < num_filters; i++) {
+		if (filters[i].vid != e->usb_vid)
+			continue;
+		if (filters[i].pid >= 0 && filters[i].pid != e->usb_pid)
+			continue;
+		return true;
+	}
+
+	return false;
+}
+
+/* Complete the details of an entry that is about to be listed. */
+static enum sp_return tty_cache_fill(struct tty_cache_entry *e)
+{
+	char name[PATH_MAX];
+	enum sp_return ret;
+
+	snprintf(name, sizeof(name), "/dev/%s", e->entry);
+
+	if (!e->probed) {
+		e->present = probe_serial8250(name);
+		e->probed = true;
+	}
+
+	if (!e->present || e->port)
+		RETURN_OK();
+
+	DEBUG_FMT("Found port %s", name);
+	if (!e->usb_path)
+		return sp_get_port_by_name(name, &e->port);
+
+	/* Reuse the USB device directory found during revalidation. */
+	if (!(e->port = alloc_port(name)))
+		RETURN_ERROR(SP_ERR_MEM, "Port structure allocation failed");
+	e->port->transport = SP_TRANSPORT_USB;
+	ret = read_usb_details(e->port, e->entry, e->usb_path);
+	if (ret != SP_OK) {
+		sp_free_port(e->port);
+		e->port = NULL;
+	}
+
+	return ret;
+}
+
+SP_PRIV enum sp_return list_ports_cached(struct sp_port ***list,
+                                         const struct sp_usb_filter *filters,
+                                         size_t num_filters, int rescan)
+{
+	struct timespec dev_mtime = {0, 0}, sys_mtime = {0, 0};
+	struct tty_cache_entry *e;
+	struct stat statbuf;
+	int ret = SP_OK;
+	size_t i;
+
+	/*
+	 * The directory times are sampled before scanning, so that a change
+	 * made while the scan is in progress is picked up by the next call.
+	 */
+	if (stat("/dev", &statbuf) == 0)
+		dev_mtime = statbuf.st_mtim;
+	if (stat(tty_class_dir, &statbuf) == 0)
+		sys_mtime = statbuf.st_mtim;
+
+	pthread_mutex_lock(&tty_cache.lock);
+
+	if (rescan) {
+		DEBUG("Rescan requested, discarding tty device cache");
+		tty_cache_clear();
+	}
+
+	if (!tty_cache.valid ||
+	    !timespec_equal(&tty_cache.dev_mtime, &dev_mtime) ||
+	    !timespec_equal(&tty_cache.sys_mtime, &sys_mtime))
+		ret = tty_cache_update(&dev_mtime, &sys_mtime);
+
+	for (i = 0; ret == SP_OK && i < tty_cache.count; i++) {
+		e = &tty_cache.entries[i];
+		if (num_filters > 0 && !tty_cache_matches(e, filters, num_filters))
+			continue;
+		if ((ret = tty_cache_fill(e)) != SP_OK) {
+			tty_cache_clear();
+			break;
+		}
+		if (!e->port)
+			continue;
+		*list = list_append_copy(*list, e->port);
+		if (!*list)
+			SET_ERROR(ret, SP_ERR_MEM, "List append failed");
+	}
+
+	pthread_mutex_unlock(&tty_cache.lock);
+
+	return ret;
+}
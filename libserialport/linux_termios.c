@@ -38,59 +38,71 @@
 #include <linux/termios.h>
 #include "linux_termios.h"
 
-SP_PRIV unsigned long get_termios_get_ioctl(void)
-{
-#ifdef HAVE_STRUCT_TERMIOS2
-	return TCGETS2;
+/*
+ * The kernel termios layout is chosen from the kernel headers rather than
+ * from configure results, so that builds which do not run configure (such
+ * as node-gyp) still get arbitrary baud rates. Architectures without
+ * TCGETS2 carry c_ispeed/c_ospeed in struct termios itself.
+ */
+#if defined(TCGETS2) && defined(TCSETS2)
+#define KERNEL_TERMIOS termios2
+#define KERNEL_TCGETS TCGETS2
+#define KERNEL_TCSETS TCSETS2
 #else
-	return TCGETS;
+#define KERNEL_TERMIOS termios
+#define KERNEL_TCGETS TCGETS
+#define KERNEL_TCSETS TCSETS
 #endif
+
+SP_PRIV unsigned long get_termios_get_ioctl(void)
+{
+	return KERNEL_TCGETS;
 }
 
 SP_PRIV unsigned long get_termios_set_ioctl(void)
 {
-#ifdef HAVE_STRUCT_TERMIOS2
-	return TCSETS2;
-#else
-	return TCSETS;
-#endif
+	return KERNEL_TCSETS;
 }
 
 SP_PRIV size_t get_termios_size(void)
 {
-#ifdef HAVE_STRUCT_TERMIOS2
-	return sizeof(struct termios2);
-#else
-	return sizeof(struct termios);
-#endif
+	return sizeof(struct KERNEL_TERMIOS);
 }
 
-#if (defined(HAVE_TERMIOS_SPEED) || defined(HAVE_TERMIOS2_SPEED)) && HAVE_DECL_BOTHER
 SP_PRIV int get_termios_speed(void *data)
 {
-#ifdef HAVE_STRUCT_TERMIOS2
-	struct termios2 *term = (struct termios2 *) data;
-#else
-	struct termios *term = (struct termios *) data;
-#endif
+	struct KERNEL_TERMIOS *term = (struct KERNEL_TERMIOS *) data;
+
 	if (term->c_ispeed != term->c_ospeed)
 		return -1;
 	else
 		return term->c_ispeed;
 }
 
-SP_PRIV void set_termios_speed(void *data, int speed)
+SP_PRIV int get_termios_output_speed(void *data)
 {
-#ifdef HAVE_STRUCT_TERMIOS2
-	struct termios2 *term = (struct termios2 *) data;
-#else
-	struct termios *term = (struct termios *) data;
-#endif
+	struct KERNEL_TERMIOS *term = (struct KERNEL_TERMIOS *) data;
+
+	return term->c_ospeed;
+}
+
+SP_PRIV int set_termios_speed(void *data, int speed)
+{
+#ifdef BOTHER
+	struct KERNEL_TERMIOS *term = (struct KERNEL_TERMIOS *) data;
+
 	term->c_cflag &= ~CBAUD;
 	term->c_cflag |= BOTHER;
 	term->c_ispeed = term->c_ospeed = speed;
-}
+
+	return 0;
+#else
+	(void)data;
+	(void)speed;
+
+	return -1;
 #endif
+}
 
 #ifdef HAVE_STRUCT_TERMIOX
 SP_PRIV size_t get_termiox_size(void)
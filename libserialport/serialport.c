@@ -47,19 +47,64 @@ static const struct std_baudrate std_baudrates[] = {
 
 void (*sp_debug_handler)(const char *format, ...) = sp_default_debug_handler;
 
+static sp_ioctl_fn ioctl_function = NULL;
+
 static enum sp_return get_config(struct sp_port *port, struct port_data *data,
 	struct sp_port_config *config);
 
 static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 	const struct sp_port_config *config);
 
+/*
+ * Allocate a port structure for the given name, without looking up
+ * any of its details.
+ */
+SP_PRIV struct sp_port *alloc_port(const char *portname)
+{
+	struct sp_port *port;
+	size_t len;
+
+	if (!(port = malloc(sizeof(struct sp_port))))
+		return NULL;
+
+	len = strlen(portname) + 1;
+
+	if (!(port->name = malloc(len))) {
+		free(port);
+		return NULL;
+	}
+
+	memcpy(port->name, portname, len);
+
+#ifdef _WIN32
+	port->usb_path = NULL;
+	port->hdl = INVALID_HANDLE_VALUE;
+	port->write_buf = NULL;
+	port->write_buf_size = 0;
+#else
+	port->fd = -1;
+#endif
+
+	port->description = NULL;
+	port->transport = SP_TRANSPORT_NATIVE;
+	port->usb_bus = -1;
+	port->usb_address = -1;
+	port->usb_vid = -1;
+	port->usb_pid = -1;
+	port->usb_manufacturer = NULL;
+	port->usb_product = NULL;
+	port->usb_serial = NULL;
+	port->bluetooth_address = NULL;
+
+	return port;
+}
+
 SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port **port_ptr)
 {
 	struct sp_port *port;
 #ifndef NO_PORT_METADATA
 	enum sp_return ret;
 #endif
-	size_t len;
 
 	TRACE("%s, %p", portname, port_ptr);
 
@@ -87,38 +132,9 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 	portname = pathbuf;
 #endif
 
-	if (!(port = malloc(sizeof(struct sp_port))))
+	if (!(port = alloc_port(portname)))
 		RETURN_ERROR(SP_ERR_MEM, "Port structure malloc failed");
 
-	len = strlen(portname) + 1;
-
-	if (!(port->name = malloc(len))) {
-		free(port);
-		RETURN_ERROR(SP_ERR_MEM, "Port name malloc failed");
-	}
-
-	memcpy(port->name, portname, len);
-
-#ifdef _WIN32
-	port->usb_path = NULL;
-	port->hdl = INVALID_HANDLE_VALUE;
-	port->write_buf = NULL;
-	port->write_buf_size = 0;
-#else
-	port->fd = -1;
-#endif
-
-	port->description = NULL;
-	port->transport = SP_TRANSPORT_NATIVE;
-	port->usb_bus = -1;
-	port->usb_address = -1;
-	port->usb_vid = -1;
-	port->usb_pid = -1;
-	port->usb_manufacturer = NULL;
-	port->usb_product = NULL;
-	port->usb_serial = NULL;
-	port->bluetooth_address = NULL;
-
 #ifndef NO_PORT_METADATA
 	if ((ret = get_port_details(port)) != SP_OK) {
 		sp_free_port(port);
@@ -337,6 +353,98 @@ fail:
 	return NULL;
 }
 
+/*
+ * Duplicate a port structure without looking up its details again.
+ * The copy is not open, even if the original is.
+ */
+static struct sp_port *dup_port(const struct sp_port *port)
+{
+	struct sp_port *copy;
+
+	if (!(copy = calloc(1, sizeof(struct sp_port))))
+		return NULL;
+
+#define DUP_STRING(x) do { \
+	if (port->x && !(copy->x = strdup(port->x))) \
+		goto fail; \
+} while (0)
+	DUP_STRING(name);
+	DUP_STRING(description);
+	DUP_STRING(usb_manufacturer);
+	DUP_STRING(usb_product);
+	DUP_STRING(usb_serial);
+	DUP_STRING(bluetooth_address);
+#ifdef _WIN32
+	DUP_STRING(usb_path);
+#endif
+#undef DUP_STRING
+
+	copy->transport = port->transport;
+	copy->usb_bus = port->usb_bus;
+	copy->usb_address = port->usb_address;
+	copy->usb_vid = port->usb_vid;
+	copy->usb_pid = port->usb_pid;
+#ifdef _WIN32
+	copy->hdl = INVALID_HANDLE_VALUE;
+	copy->write_buf = NULL;
+	copy->write_buf_size = 0;
+#else
+	copy->fd = -1;
+#endif
+
+	return copy;
+
+fail:
+	sp_free_port(copy);
+	return NULL;
+}
+
+SP_PRIV struct sp_port **list_append_copy(struct sp_port **list,
+                                          const struct sp_port *port)
+{
+	void *tmp;
+	size_t count;
+
+	for (count = 0; list[count]; count++)
+		;
+	if (!(tmp = realloc(list, sizeof(struct sp_port *) * (count + 2))))
+		goto fail;
+	list = tmp;
+	if (!(list[count] = dup_port(port)))
+		goto fail;
+	list[count + 1] = NULL;
+	return list;
+
+fail:
+	sp_free_port_list(list);
+	return NULL;
+}
+
+#if !defined(NO_ENUMERATION) && !defined(__linux__)
+/* Remove the ports which match none of the filters from a list. */
+static void filter_port_list(struct sp_port **list,
+                             const struct sp_usb_filter *filters,
+                             size_t num_filters)
+{
+	size_t i, j, k;
+
+	for (i = 0, j = 0; list[i]; i++) {
+		for (k = 0; k < num_filters; k++) {
+			if (list[i]->usb_vid < 0 || filters[k].vid != list[i]->usb_vid)
+				continue;
+			if (filters[k].pid >= 0 && filters[k].pid != list[i]->usb_pid)
+				continue;
+			break;
+		}
+		if (k < num_filters)
+			list[j++] = list[i];
+		else
+			sp_free_port(list[i]);
+	}
+	list[j] = NULL;
+}
+#endif
+
 SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr)
 {
 #ifndef NO_ENUMERATION
@@ -374,6 +482,64 @@ SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr)
 #endif
 }
 
+SP_API enum sp_return sp_list_ports_cached(struct sp_port ***list_ptr,
+                                          int rescan)
+{
+	TRACE("%p, %d", list_ptr, rescan);
+
+	RETURN_INT(sp_list_ports_matching(list_ptr, NULL, 0, rescan));
+}
+
+SP_API enum sp_return sp_list_ports_matching(struct sp_port ***list_ptr,
+                                            const struct sp_usb_filter *filters,
+                                            size_t num_filters, int rescan)
+{
+#ifndef NO_ENUMERATION
+	struct sp_port **list;
+	int ret;
+#endif
+
+	TRACE("%p, %p, %zu, %d", list_ptr, filters, num_filters, rescan);
+
+	if (!list_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*list_ptr = NULL;
+
+	if (num_filters > 0 && !filters)
+		RETURN_ERROR(SP_ERR_ARG, "Null filters");
+
+#ifdef NO_ENUMERATION
+	RETURN_ERROR(SP_ERR_SUPP, "Enumeration not supported on this platform");
+#else
+	DEBUG("Enumerating ports");
+
+	if (!(list = malloc(sizeof(struct sp_port *))))
+		RETURN_ERROR(SP_ERR_MEM, "Port list malloc failed");
+
+	list[0] = NULL;
+
+#ifdef __linux__
+	ret = list_ports_cached(&list, filters, num_filters, rescan);
+#else
+	/* Other platforms do not cache enumeration results yet. */
+	ret = list_ports(&list);
+
+	if (ret == SP_OK && num_filters > 0)
+		filter_port_list(list, filters, num_filters);
+#endif
+
+	if (ret == SP_OK) {
+		*list_ptr = list;
+	} else {
+		sp_free_port_list(list);
+		*list_ptr = NULL;
+	}
+
+	RETURN_CODEVAL(ret);
+#endif
+}
+
 SP_API void sp_free_port_list(struct sp_port **list)
 {
 	unsigned int i;
@@ -453,14 +619,17 @@ static enum sp_return restart_wait(struct sp_port *port)
 }
 #endif
 
-SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
+/*
+ * Open a port and give it a raw configuration. If override is not NULL,
+ * its fields which are set take precedence over the current settings.
+ */
+static enum sp_return open_port(struct sp_port *port, enum sp_mode flags,
+	const struct sp_port_config *override)
 {
 	struct port_data data;
 	struct sp_port_config config;
 	enum sp_return ret;
 
-	TRACE("%p, 0x%x", port, flags);
-
 	CHECK_PORT();
 
 	if (flags > SP_MODE_READ_WRITE)
@@ -577,7 +746,7 @@ SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 	 * lead to EINVAL or ENOTTY.
 	 * These errors aren't fatal and can be ignored.
 	 */
-	if (ioctl(port->fd, TIOCEXCL) < 0 && errno != EINVAL && errno != ENOTTY)
+	if (port_ioctl(port->fd, TIOCEXCL, NULL) < 0 && errno != EINVAL && errno != ENOTTY)
 		RETURN_FAIL("ioctl() failed");
 #endif
 
@@ -651,6 +820,23 @@ SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 		RETURN_FAIL("ClearCommError() failed");
 #endif
 
+	if (override) {
+#define OVERRIDE(x) do { \
+	if (override->x >= 0) \
+		config.x = override->x; \
+} while (0)
+		OVERRIDE(baudrate);
+		OVERRIDE(bits);
+		OVERRIDE(parity);
+		OVERRIDE(stopbits);
+		OVERRIDE(rts);
+		OVERRIDE(cts);
+		OVERRIDE(dtr);
+		OVERRIDE(dsr);
+		OVERRIDE(xon_xoff);
+#undef OVERRIDE
+	}
+
 	ret = set_config(port, &data, &config);
 
 	if (ret < 0) {
@@ -661,6 +847,24 @@ SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 	RETURN_OK();
 }
 
+SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
+{
+	TRACE("%p, 0x%x", port, flags);
+
+	RETURN_INT(open_port(port, flags, NULL));
+}
+
+SP_API enum sp_return sp_open_with_config(struct sp_port *port,
+	enum sp_mode flags, const struct sp_port_config *config)
+{
+	TRACE("%p, 0x%x, %p", port, flags, config);
+
+	if (!config)
+		RETURN_ERROR(SP_ERR_ARG, "Null config");
+
+	RETURN_INT(open_port(port, flags, config));
+}
+
 SP_API enum sp_return sp_close(struct sp_port *port)
 {
 	TRACE("%p", port);
@@ -762,7 +966,7 @@ SP_API enum sp_return sp_drain(struct sp_port *port)
 		/* Android only has tcdrain from platform 21 onwards.
 		 * On previous API versions, use the ioctl directly. */
 		int arg = 1;
-		result = ioctl(port->fd, TCSBRK, &arg);
+		result = port_ioctl(port->fd, TCSBRK, &arg);
 #else
 		result = tcdrain(port->fd);
 #endif
@@ -1337,7 +1541,7 @@ SP_API enum sp_return sp_input_waiting(struct sp_port *port)
 	RETURN_INT(comstat.cbInQue);
 #else
 	int bytes_waiting;
-	if (ioctl(port->fd, TIOCINQ, &bytes_waiting) < 0)
+	if (port_ioctl(port->fd, TIOCINQ, &bytes_waiting) < 0)
 		RETURN_FAIL("TIOCINQ ioctl failed");
 	RETURN_INT(bytes_waiting);
 #endif
@@ -1365,7 +1569,7 @@ SP_API enum sp_return sp_output_waiting(struct sp_port *port)
 	RETURN_INT(comstat.cbOutQue);
 #else
 	int bytes_waiting;
-	if (ioctl(port->fd, TIOCOUTQ, &bytes_waiting) < 0)
+	if (port_ioctl(port->fd, TIOCOUTQ, &bytes_waiting) < 0)
 		RETURN_FAIL("TIOCOUTQ ioctl failed");
 	RETURN_INT(bytes_waiting);
 #endif
@@ -1562,7 +1766,7 @@ static enum sp_return get_baudrate(int fd, int *baudrate)
 	if (!(data = malloc(get_termios_size())))
 		RETURN_ERROR(SP_ERR_MEM, "termios malloc failed");
 
-	if (ioctl(fd, get_termios_get_ioctl(), data) < 0) {
+	if (port_ioctl(fd, get_termios_get_ioctl(), data) < 0) {
 		free(data);
 		RETURN_FAIL("Getting termios failed");
 	}
@@ -1585,17 +1789,26 @@ static enum sp_return set_baudrate(int fd, int baudrate)
 	if (!(data = malloc(get_termios_size())))
 		RETURN_ERROR(SP_ERR_MEM, "termios malloc failed");
 
-	if (ioctl(fd, get_termios_get_ioctl(), data) < 0) {
+	if (port_ioctl(fd, get_termios_get_ioctl(), data) < 0) {
 		free(data);
 		RETURN_FAIL("Getting termios failed");
 	}
 
 	DEBUG("Setting baud rate");
 
-	set_termios_speed(data, baudrate);
+	if (set_termios_speed(data, baudrate) < 0) {
+		free(data);
+		RETURN_ERROR(SP_ERR_SUPP, "Non-standard baudrate not supported");
+	}
+
+	if (port_ioctl(fd, get_termios_set_ioctl(), data) < 0) {
+		int err = errno;
 
-	if (ioctl(fd, get_termios_set_ioctl(), data) < 0) {
 		free(data);
+		/* Kernels and drivers without BOTHER refuse the request itself. */
+		if (err == ENOTTY || err == EINVAL)
+			RETURN_ERROR(SP_ERR_SUPP, "Non-standard baudrate not supported");
+		errno = err;
 		RETURN_FAIL("Setting termios failed");
 	}
 
@@ -1603,6 +1816,29 @@ static enum sp_return set_baudrate(int fd, int baudrate)
 
 	RETURN_OK();
 }
+
+static enum sp_return get_output_baudrate(int fd, int *baudrate)
+{
+	void *data;
+
+	TRACE("%d, %p", fd, baudrate);
+
+	DEBUG("Getting output baud rate");
+
+	if (!(data = malloc(get_termios_size())))
+		RETURN_ERROR(SP_ERR_MEM, "termios malloc failed");
+
+	if (port_ioctl(fd, get_termios_get_ioctl(), data) < 0) {
+		free(data);
+		RETURN_FAIL("Getting termios failed");
+	}
+
+	*baudrate = get_termios_output_speed(data);
+
+	free(data);
+
+	RETURN_OK();
+}
 #endif /* USE_TERMIOS_SPEED */
 
 #ifdef USE_TERMIOX
@@ -1617,7 +1853,7 @@ static enum sp_return get_flow(int fd, struct port_data *data)
 	if (!(termx = malloc(get_termiox_size())))
 		RETURN_ERROR(SP_ERR_MEM, "termiox malloc failed");
 
-	if (ioctl(fd, TCGETX, termx) < 0) {
+	if (port_ioctl(fd, TCGETX, termx) < 0) {
 		free(termx);
 		RETURN_FAIL("Getting termiox failed");
 	}
@@ -1641,7 +1877,7 @@ static enum sp_return set_flow(int fd, struct port_data *data)
 	if (!(termx = malloc(get_termiox_size())))
 		RETURN_ERROR(SP_ERR_MEM, "termiox malloc failed");
 
-	if (ioctl(fd, TCGETX, termx) < 0) {
+	if (port_ioctl(fd, TCGETX, termx) < 0) {
 		free(termx);
 		RETURN_FAIL("Getting termiox failed");
 	}
@@ -1651,7 +1887,7 @@ static enum sp_return set_flow(int fd, struct port_data *data)
 	set_termiox_flow(termx, data->rts_flow, data->cts_flow,
 			data->dtr_flow, data->dsr_flow);
 
-	if (ioctl(fd, TCSETX, termx) < 0) {
+	if (port_ioctl(fd, TCSETX, termx) < 0) {
 		free(termx);
 		RETURN_FAIL("Setting termiox failed");
 	}
@@ -1768,7 +2004,7 @@ static enum sp_return get_config(struct sp_port *port, struct port_data *data,
 	if (tcgetattr(port->fd, &data->term) < 0)
 		RETURN_FAIL("tcgetattr() failed");
 
-	if (ioctl(port->fd, TIOCMGET, &data->controlbits) < 0)
+	if (port_ioctl(port->fd, TIOCMGET, &data->controlbits) < 0)
 		RETURN_FAIL("TIOCMGET ioctl failed");
 
 #ifdef USE_TERMIOX
@@ -2139,7 +2375,7 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 			case SP_RTS_OFF:
 			case SP_RTS_ON:
 				controlbits = TIOCM_RTS;
-				if (ioctl(port->fd, config->rts == SP_RTS_ON ? TIOCMBIS : TIOCMBIC, &controlbits) < 0)
+				if (port_ioctl(port->fd, config->rts == SP_RTS_ON ? TIOCMBIS : TIOCMBIC, &controlbits) < 0)
 					RETURN_FAIL("Setting RTS signal level failed");
 				break;
 			case SP_RTS_FLOW_CONTROL:
@@ -2152,12 +2388,12 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 				data->cts_flow = 1;
 
 			if (data->rts_flow && data->cts_flow)
-				data->term.c_iflag |= CRTSCTS;
+				data->term.c_cflag |= CRTSCTS;
 			else
-				data->term.c_iflag &= ~CRTSCTS;
+				data->term.c_cflag &= ~CRTSCTS;
 		} else {
 			/* Asymmetric use of RTS/CTS not supported. */
-			if (data->term.c_iflag & CRTSCTS) {
+			if (data->term.c_cflag & CRTSCTS) {
 				/* Flow control can only be disabled for both RTS & CTS together. */
 				if (config->rts >= 0 && config->rts != SP_RTS_FLOW_CONTROL) {
 					if (config->cts != SP_CTS_IGNORE)
@@ -2176,10 +2412,11 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 
 			if (config->rts >= 0) {
 				if (config->rts == SP_RTS_FLOW_CONTROL) {
-					data->term.c_iflag |= CRTSCTS;
+					data->term.c_cflag |= CRTSCTS;
 				} else {
+					data->term.c_cflag &= ~CRTSCTS;
 					controlbits = TIOCM_RTS;
-					if (ioctl(port->fd, config->rts == SP_RTS_ON ? TIOCMBIS : TIOCMBIC,
+					if (port_ioctl(port->fd, config->rts == SP_RTS_ON ? TIOCMBIS : TIOCMBIC,
 							&controlbits) < 0)
 						RETURN_FAIL("Setting RTS signal level failed");
 				}
@@ -2194,7 +2431,7 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 			case SP_DTR_OFF:
 			case SP_DTR_ON:
 				controlbits = TIOCM_DTR;
-				if (ioctl(port->fd, config->dtr == SP_DTR_ON ? TIOCMBIS : TIOCMBIC, &controlbits) < 0)
+				if (port_ioctl(port->fd, config->dtr == SP_DTR_ON ? TIOCMBIS : TIOCMBIC, &controlbits) < 0)
 					RETURN_FAIL("Setting DTR signal level failed");
 				break;
 			case SP_DTR_FLOW_CONTROL:
@@ -2212,7 +2449,7 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 
 			if (config->dtr >= 0) {
 				controlbits = TIOCM_DTR;
-				if (ioctl(port->fd, config->dtr == SP_DTR_ON ? TIOCMBIS : TIOCMBIC,
+				if (port_ioctl(port->fd, config->dtr == SP_DTR_ON ? TIOCMBIS : TIOCMBIC,
 						&controlbits) < 0)
 					RETURN_FAIL("Setting DTR signal level failed");
 			}
@@ -2243,7 +2480,7 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 
 #ifdef __APPLE__
 	if (baud_nonstd != B0) {
-		if (ioctl(port->fd, IOSSIOSPEED, &baud_nonstd) == -1)
+		if (port_ioctl(port->fd, IOSSIOSPEED, &baud_nonstd) == -1)
 			RETURN_FAIL("IOSSIOSPEED ioctl failed");
 		/*
 		 * Set baud rates in data->term to correct, but incompatible
@@ -2290,6 +2527,7 @@ SP_API enum sp_return sp_new_config(struct sp_port_config **config_ptr)
 	config->cts = -1;
 	config->dtr = -1;
 	config->dsr = -1;
+	config->xon_xoff = -1;
 
 	*config_ptr = config;
 
@@ -2325,6 +2563,34 @@ SP_API enum sp_return sp_get_config(struct sp_port *port,
 	RETURN_OK();
 }
 
+SP_API enum sp_return sp_get_actual_baudrate(struct sp_port *port,
+                                             int *baudrate_ptr)
+{
+#ifndef USE_TERMIOS_SPEED
+	struct port_data data;
+	struct sp_port_config config;
+#endif
+
+	TRACE("%p, %p", port, baudrate_ptr);
+
+	CHECK_OPEN_PORT();
+
+	if (!baudrate_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*baudrate_ptr = -1;
+
+#ifdef USE_TERMIOS_SPEED
+	/* The driver writes back the rate it really programmed. */
+	TRY(get_output_baudrate(port->fd, baudrate_ptr));
+#else
+	TRY(get_config(port, &data, &config));
+	*baudrate_ptr = config.baudrate;
+#endif
+
+	RETURN_OK();
+}
+
 SP_API enum sp_return sp_set_config(struct sp_port *port,
                                     const struct sp_port_config *config)
 {
@@ -2344,6 +2610,42 @@ SP_API enum sp_return sp_set_config(struct sp_port *port,
 	RETURN_OK();
 }
 
+SP_API enum sp_return sp_update_config(struct sp_port *port,
+	sp_config_update_fn update, void *user_data)
+{
+	struct port_data data;
+	struct sp_port_config current;
+	struct sp_port_config changes;
+	int ret;
+
+	TRACE("%p, %p, %p", port, update, user_data);
+
+	CHECK_OPEN_PORT();
+
+	if (!update)
+		RETURN_ERROR(SP_ERR_ARG, "Null update function");
+
+	TRY(get_config(port, &data, &current));
+
+	changes.baudrate = -1;
+	changes.bits = -1;
+	changes.parity = -1;
+	changes.stopbits = -1;
+	changes.rts = -1;
+	changes.cts = -1;
+	changes.dtr = -1;
+	changes.dsr = -1;
+	changes.xon_xoff = -1;
+
+	ret = update(&current, &changes, user_data);
+	if (ret < 0)
+		RETURN_CODEVAL(ret);
+	if (ret > 0)
+		TRY(set_config(port, &data, &changes));
+
+	RETURN_OK();
+}
+
 #define CREATE_ACCESSORS(x, type) \
 SP_API enum sp_return sp_set_##x(struct sp_port *port, type x) { \
 	struct port_data data; \
@@ -2465,7 +2767,7 @@ SP_API enum sp_return sp_get_signals(struct sp_port *port,
 		*signals |= SP_SIG_RI;
 #else
 	int bits;
-	if (ioctl(port->fd, TIOCMGET, &bits) < 0)
+	if (port_ioctl(port->fd, TIOCMGET, &bits) < 0)
 		RETURN_FAIL("TIOCMGET ioctl failed");
 	if (bits & TIOCM_CTS)
 		*signals |= SP_SIG_CTS;
@@ -2488,7 +2790,7 @@ SP_API enum sp_return sp_start_break(struct sp_port *port)
 	if (SetCommBreak(port->hdl) == 0)
 		RETURN_FAIL("SetCommBreak() failed");
 #else
-	if (ioctl(port->fd, TIOCSBRK, 1) < 0)
+	if (port_ioctl(port->fd, TIOCSBRK, NULL) < 0)
 		RETURN_FAIL("TIOCSBRK ioctl failed");
 #endif
 
@@ -2504,7 +2806,7 @@ SP_API enum sp_return sp_end_break(struct sp_port *port)
 	if (ClearCommBreak(port->hdl) == 0)
 		RETURN_FAIL("ClearCommBreak() failed");
 #else
-	if (ioctl(port->fd, TIOCCBRK, 1) < 0)
+	if (port_ioctl(port->fd, TIOCCBRK, NULL) < 0)
 		RETURN_FAIL("TIOCCBRK ioctl failed");
 #endif
 
@@ -2570,6 +2872,41 @@ SP_API void sp_set_debug_handler(void (*handler)(const char *format, ...))
 	RETURN();
 }
 
+SP_API void sp_set_ioctl_function(sp_ioctl_fn function)
+{
+	TRACE("%p", function);
+
+	ioctl_function = function;
+
+	RETURN();
+}
+
+SP_API void sp_set_tty_class_dir(const char *path)
+{
+	TRACE("%p", path);
+
+#ifdef __linux__
+	set_tty_class_dir(path);
+#else
+	(void)path;
+#endif
+
+	RETURN();
+}
+
+#ifndef _WIN32
+/* Every ioctl() the library makes on a port goes through here. */
+SP_PRIV int port_ioctl(int fd, unsigned long request, void *arg)
+{
+	sp_ioctl_fn function = ioctl_function;
+
+	if (function)
+		return function(fd, request, arg);
+
+	return ioctl(fd, request, arg);
+}
+#endif
+
 SP_API void sp_default_debug_handler(const char *format, ...)
 {
 	va_list args;
@@ -0,0 +1,60 @@
+#include "addon-data.h"
+
+namespace webserial {
+
+static void FinalizeAddonData(napi_env env, void* data, void* hint) {
+  AddonData* addon_data = static_cast<AddonData*>(data);
+
+  napi_delete_reference(env, addon_data->handle_constructor);
+  delete addon_data;
+}
+
+// Cleanup hooks run in reverse order of registration, so this one runs
+// before the hook that finalizes the env's wrapped objects.
+static void CleanupThreads(void* arg) {
+  AddonData* addon_data = static_cast<AddonData*>(arg);
+
+  for (ThreadOwner* owner : addon_data->threads) {
+    owner->Join();
+  }
+
+  addon_data->threads.clear();
+}
+
+napi_status InitAddonData(napi_env env) {
+  AddonData* addon_data = new AddonData();
+  napi_status status;
+
+  addon_data->handle_constructor = nullptr;
+  status = napi_set_instance_data(env,
+                                  addon_data,
+                                  FinalizeAddonData,
+                                  nullptr);
+  if (status != napi_ok) {
+    delete addon_data;
+    return status;
+  }
+
+  return napi_add_env_cleanup_hook(env, CleanupThreads, addon_data);
+}
+
+AddonData* GetAddonData(napi_env env) {
+  void* data = nullptr;
+
+  napi_get_instance_data(env, &data);
+  return static_cast<AddonData*>(data);
+}
+
+void RegisterThread(napi_env env, ThreadOwner* owner) {
+  GetAddonData(env)->threads.insert(owner);
+}
+
+void UnregisterThread(napi_env env, ThreadOwner* owner) {
+  AddonData* addon_data = GetAddonData(env);
+
+  if (addon_data != nullptr) {
+    addon_data->threads.erase(owner);
+  }
+}
+
+}
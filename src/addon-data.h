@@ -0,0 +1,37 @@
+#ifndef WEBSERIAL_ADDON_DATA_H
+#define WEBSERIAL_ADDON_DATA_H
+
+#include <unordered_set>
+#include <node_api.h>
+
+namespace webserial {
+
+// Implemented by objects that run a native thread on behalf of an env.
+class ThreadOwner {
+  public:
+    virtual ~ThreadOwner() {}
+
+    // Stops and joins the thread without calling into JS. Safe to call more
+    // than once.
+    virtual void Join(void) = 0;
+};
+
+// State that belongs to one env. The addon can be loaded by the main thread
+// and any number of workers at once, so nothing env specific may be kept in
+// globals.
+struct AddonData {
+  napi_ref handle_constructor;
+  // Native threads that are still running. They are joined when the env
+  // shuts down, before any wrapped object is finalized, so that no thread
+  // outlives the handles it uses.
+  std::unordered_set<ThreadOwner*> threads;
+};
+
+napi_status InitAddonData(napi_env env);
+AddonData* GetAddonData(napi_env env);
+void RegisterThread(napi_env env, ThreadOwner* owner);
+void UnregisterThread(napi_env env, ThreadOwner* owner);
+
+}
+
+#endif
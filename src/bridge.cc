@@ -0,0 +1,404 @@
+#include <string.h>
+#include "bridge.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+
+static void InitDirection(BridgeDirection* dir,
+                          SerialHandle* from,
+                          SerialHandle* to,
+                          size_t buffer_size) {
+  dir->from = from;
+  dir->to = to;
+  dir->io_generation = from->io_generation();
+  dir->buf.resize(buffer_size);
+  dir->start = 0;
+  dir->end = 0;
+  dir->bytes = 0;
+}
+
+SerialBridge::SerialBridge() {
+  handle_refs_[0] = nullptr;
+  handle_refs_[1] = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+}
+
+SerialBridge::~SerialBridge() {}
+
+// The bridge is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void SerialBridge::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void SerialBridge::Destructor(napi_env env,
+                              void* native_object,
+                              void* finalize_hint) {
+  SerialBridge* bridge = static_cast<SerialBridge*>(native_object);
+
+  bridge->Stop(env);
+  napi_delete_reference(env, bridge->wrapper_ref_);
+  bridge->wrapper_ref_ = nullptr;
+  bridge->Release();
+}
+
+void SerialBridge::ThreadFinalize(napi_env env,
+                                  void* finalize_data,
+                                  void* finalize_hint) {
+  static_cast<SerialBridge*>(finalize_data)->Release();
+}
+
+// The thread only calls into JS when it stops on its own, because of an
+// error or because one of the ports was closed.
+void SerialBridge::CallJs(napi_env env,
+                          napi_value js_callback,
+                          void* context,
+                          void* data) {
+  if (env != nullptr) {
+    static_cast<SerialBridge*>(context)->Stop(env);
+  }
+}
+
+napi_value SerialBridge::CreateStats(napi_env env) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(a_to_b_.bytes), &field),
+    "could not create aToB"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "aToB", field),
+    "could not set 'aToB' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(b_to_a_.bytes), &field),
+    "could not create bToA"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "bToA", field),
+    "could not set 'bToA' property"
+  );
+
+  return ret;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void SerialBridge::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and settles the closed promise, with the final
+// byte counts or with the error that stopped the bridge. Called from
+// Close(), from the thread via CallJs(), and from the wrapper's finalizer.
+void SerialBridge::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create bridge stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_refs_[0]);
+  napi_delete_reference(env, handle_refs_[1]);
+  handle_refs_[0] = nullptr;
+  handle_refs_[1] = nullptr;
+}
+
+// Moves as many bytes as the ports allow without blocking. Bytes are only
+// read while there is room to hold them.
+sp_return SerialBridge::Pump(BridgeDirection* dir, bool readable) {
+  int r;
+
+  if (readable && dir->end < dir->buf.size()) {
+    r = dir->from->read_data(dir->buf.data() + dir->end,
+                             dir->buf.size() - dir->end);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    dir->end += r;
+  }
+
+  if (dir->start < dir->end) {
+    r = dir->to->write_data(dir->buf.data() + dir->start,
+                            dir->end - dir->start);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    dir->start += r;
+    dir->bytes += r;
+  }
+
+  if (dir->start == dir->end) {
+    dir->start = dir->end = 0;
+  } else if (dir->end == dir->buf.size() && dir->start > 0) {
+    memmove(dir->buf.data(), dir->buf.data() + dir->start,
+            dir->end - dir->start);
+    dir->end -= dir->start;
+    dir->start = 0;
+  }
+
+  return SP_OK;
+}
+
+// Marks a pass of the thread as I/O on both ports, so that neither can be
+// closed under it. Returns false once either port has been closed.
+bool SerialBridge::BeginIo(void) {
+  if (!a_to_b_.from->begin_io(a_to_b_.io_generation)) {
+    return false;
+  }
+
+  if (!b_to_a_.from->begin_io(b_to_a_.io_generation)) {
+    a_to_b_.from->end_io();
+    return false;
+  }
+
+  return true;
+}
+
+void SerialBridge::EndIo(void) {
+  b_to_a_.from->end_io();
+  a_to_b_.from->end_io();
+}
+
+// Waits briefly for either port and moves whatever it allows.
+sp_return SerialBridge::Step(void) {
+  BridgeDirection* ab = &a_to_b_;
+  BridgeDirection* ba = &b_to_a_;
+  SerialHandle* handles[2] = { ab->from, ba->from };
+  int events[2];
+  int ready[2];
+  int r;
+
+  // Each port is watched for input while its own buffer has room, and for
+  // output space while the other direction has bytes waiting for it.
+  events[0] = (ab->end < ab->buf.size() ? SP_EVENT_RX_READY : 0) |
+              (ba->start < ba->end ? SP_EVENT_TX_READY : 0);
+  events[1] = (ba->end < ba->buf.size() ? SP_EVENT_RX_READY : 0) |
+              (ab->start < ab->end ? SP_EVENT_TX_READY : 0);
+
+  r = SerialHandle::wait_any(handles, events, ready, 2, kMaxWaitNs);
+  if (r <= 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  if ((ready[0] | ready[1]) & SP_EVENT_ERROR) {
+    error_ = "Bridged port was disconnected";
+    return SP_OK;
+  }
+
+  r = Pump(ab, ready[0] & SP_EVENT_RX_READY);
+  if (r == SP_OK) {
+    r = Pump(ba, ready[1] & SP_EVENT_RX_READY);
+  }
+
+  return static_cast<sp_return>(r);
+}
+
+void SerialBridge::Run(void* arg) {
+  SerialBridge* bridge = static_cast<SerialBridge*>(arg);
+  sp_return r = SP_OK;
+
+  while (!bridge->stopping_ && bridge->error_.empty() && bridge->BeginIo()) {
+    r = bridge->Step();
+    bridge->EndIo();
+    if (r < 0) {
+      break;
+    }
+  }
+
+  if (r < 0) {
+    bridge->error_ = ErrorMessage(r);
+  }
+
+  if (!bridge->stopping_) {
+    napi_call_threadsafe_function(bridge->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Bridges two open ports. Arguments are the two handles and the size of the
+// buffer used for each direction. The returned object has a closed promise
+// that resolves with the final byte counts once the bridge is closed, or
+// rejects if either port fails.
+napi_value SerialBridge::Create(napi_env env, napi_callback_info info) {
+  SerialBridge* bridge;
+  SerialHandle* a;
+  SerialHandle* b;
+  napi_value argv[3];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 3;
+  uint32_t buffer_size;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&a)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[1], reinterpret_cast<void**>(&b)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &buffer_size),
+    "could not get bufferSize"
+  );
+
+  if (a == b || buffer_size == 0) {
+    napi_throw_range_error(env, nullptr, "invalid bridge arguments");
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:bridge",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create bridge");
+
+  bridge = new SerialBridge();
+  InitDirection(&bridge->a_to_b_, a, b, buffer_size);
+  InitDirection(&bridge->b_to_a_, b, a, buffer_size);
+
+  status = napi_create_threadsafe_function(env,
+                                           nullptr,
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           bridge,
+                                           ThreadFinalize,
+                                           bridge,
+                                           CallJs,
+                                           &bridge->tsfn_);
+  if (status != napi_ok) {
+    delete bridge;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the bridge. It
+  // stays referenced while the bridge runs, like a listening server.
+  status = napi_create_promise(env, &bridge->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &bridge->handle_refs_[0]);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[1], 1, &bridge->handle_refs_[1]);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, bridge, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    bridge->closed_ = true;
+    napi_delete_reference(env, bridge->handle_refs_[0]);
+    napi_delete_reference(env, bridge->handle_refs_[1]);
+    napi_release_threadsafe_function(bridge->tsfn_, napi_tsfn_release);
+    bridge->Release();
+    NAPI_CHECK(status, "could not wrap bridge");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &bridge->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&bridge->thread_, Run, bridge) != 0) {
+    bridge->error_ = "could not start bridge thread";
+    bridge->Stop(env);
+    napi_throw_error(env, nullptr, "could not start bridge thread");
+    return nullptr;
+  }
+
+  bridge->started_ = true;
+  RegisterThread(env, bridge);
+  return ret;
+}
+
+// Returns the number of bytes delivered in each direction so far.
+napi_value SerialBridge::Stats(napi_env env, napi_callback_info info) {
+  SerialBridge* bridge;
+  napi_value argv[1];
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&bridge)),
+    "could not unwrap bridge"
+  );
+
+  return bridge->CreateStats(env);
+}
+
+// Stops the bridge. Bytes still held in its buffers are dropped, and both
+// ports can be used normally again once this returns.
+napi_value SerialBridge::Close(napi_env env, napi_callback_info info) {
+  SerialBridge* bridge;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&bridge)),
+    "could not unwrap bridge"
+  );
+
+  bridge->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
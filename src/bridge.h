@@ -0,0 +1,79 @@
+#ifndef WEBSERIAL_BRIDGE_H
+#define WEBSERIAL_BRIDGE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// One direction of a bridge. Bytes read from the source wait in a fixed
+// buffer until the destination accepts them.
+struct BridgeDirection {
+  SerialHandle* from;
+  SerialHandle* to;
+  // The generation of from's I/O that the bridge belongs to. Once either
+  // port is closed the bridge stops.
+  uint32_t io_generation;
+  std::vector<uint8_t> buf;
+  size_t start;
+  size_t end;
+  std::atomic<uint64_t> bytes;
+};
+
+// Connects two open ports on a dedicated thread, so data flows between them
+// without entering JS. A direction stops reading its source while its buffer
+// is full, which leaves the bytes in the OS and lets hardware flow control
+// hold off the sender.
+class SerialBridge : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Stats(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    SerialBridge();
+    ~SerialBridge();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    bool BeginIo(void);
+    void EndIo(void);
+    sp_return Step(void);
+    sp_return Pump(BridgeDirection* dir, bool readable);
+    napi_value CreateStats(napi_env env);
+
+    BridgeDirection a_to_b_;
+    BridgeDirection b_to_a_;
+    napi_ref handle_refs_[2];
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+};
+
+}
+
+#endif
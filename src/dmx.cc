@@ -0,0 +1,431 @@
+#include <string.h>
+#include "dmx.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+// A frame of 513 slots takes about 23ms at 250000 baud.
+static const unsigned int kWriteTimeoutMs = 1000;
+static const size_t kMaxSlots = 512;
+
+DmxOutput::DmxOutput() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  buffer_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  universe_ = nullptr;
+  period_ns_ = 0;
+  break_ns_ = 0;
+  mab_ns_ = 0;
+  io_generation_ = 0;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  frames_ = 0;
+  overruns_ = 0;
+}
+
+DmxOutput::~DmxOutput() {}
+
+// The output is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void DmxOutput::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void DmxOutput::Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint) {
+  DmxOutput* dmx = static_cast<DmxOutput*>(native_object);
+
+  dmx->Stop(env);
+  napi_delete_reference(env, dmx->wrapper_ref_);
+  dmx->wrapper_ref_ = nullptr;
+  dmx->Release();
+}
+
+void DmxOutput::ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint) {
+  static_cast<DmxOutput*>(finalize_data)->Release();
+}
+
+// The thread calls in once if it stops by itself, because the port failed
+// or was closed.
+void DmxOutput::CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data) {
+  if (env != nullptr) {
+    static_cast<DmxOutput*>(context)->Stop(env);
+  }
+}
+
+napi_value DmxOutput::CreateStats(napi_env env) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(frames_), &field),
+    "could not create frames"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "frames", field),
+    "could not set 'frames' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(overruns_), &field),
+    "could not create overruns"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "overruns", field),
+    "could not set 'overruns' property"
+  );
+
+  return ret;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void DmxOutput::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and settles the closed promise, with the final
+// counts or with the error that stopped the output. Called from Close(),
+// from the thread via CallJs(), and from the wrapper's finalizer.
+void DmxOutput::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create DMX stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  napi_delete_reference(env, buffer_ref_);
+  handle_ref_ = nullptr;
+  buffer_ref_ = nullptr;
+}
+
+// Sleeps until the next frame is due. Returns false if the output should
+// stop instead.
+bool DmxOutput::WaitUntil(uint64_t deadline) {
+  uint64_t now;
+
+  while (!stopping_ && !handle_->io_cancelled(io_generation_)) {
+    now = NowNs();
+    if (now >= deadline) {
+      return true;
+    }
+
+    SleepUntilNs(deadline - now < kMaxWaitNs ? deadline : now + kMaxWaitNs);
+  }
+
+  return false;
+}
+
+// Sends one frame. The slots are copied out of the universe after the
+// break, so every frame carries the latest values. A frame may mix old and
+// new values of an update that JS is making at that moment, which receivers
+// simply show for one refresh.
+sp_return DmxOutput::SendFrame(void) {
+  DrainOutcome outcome;
+  sp_return r;
+  uint64_t t;
+
+  r = handle_->set_signals(-1, -1, 1);
+  if (r != SP_OK) {
+    return r;
+  }
+
+  t = NowNs();
+  PreciseSleepUntilNs(t + break_ns_);
+  r = handle_->set_signals(-1, -1, 0);
+  if (r != SP_OK) {
+    return r;
+  }
+
+  t = NowNs();
+  memcpy(frame_.data(), universe_, frame_.size());
+  PreciseSleepUntilNs(t + mab_ns_);
+
+  r = handle_->write_all(frame_.data(),
+                         frame_.size(),
+                         kWriteTimeoutMs,
+                         io_generation_);
+  if (r < 0) {
+    return r;
+  }
+
+  if (static_cast<size_t>(r) < frame_.size()) {
+    return handle_->io_cancelled(io_generation_) ? SP_OK : SP_ERR_FAIL;
+  }
+
+  // The next break must not start while the UART is still sending the last
+  // slots, or it would cut them off.
+  r = handle_->drain_output(kWriteTimeoutMs,
+                            io_generation_,
+                            handle_->drain_generation(),
+                            &stopping_,
+                            &outcome);
+  if (r != SP_OK || outcome != kDrainTimedOut) {
+    return r;
+  }
+
+  return SP_ERR_FAIL;
+}
+
+void DmxOutput::Run(void* arg) {
+  DmxOutput* dmx = static_cast<DmxOutput*>(arg);
+  uint64_t next = NowNs();
+  uint64_t now;
+  sp_return r = SP_OK;
+
+  while (dmx->WaitUntil(next)) {
+    if (!dmx->handle_->begin_io(dmx->io_generation_)) {
+      break;
+    }
+
+    // Frames are scheduled from when they were due rather than from when
+    // they started, so the refresh rate does not drift.
+    next += dmx->period_ns_;
+    r = dmx->SendFrame();
+    dmx->handle_->end_io();
+    if (r != SP_OK) {
+      break;
+    }
+
+    dmx->frames_++;
+    now = NowNs();
+    if (now > next) {
+      dmx->overruns_++;
+      next = now;
+    }
+  }
+
+  if (r != SP_OK) {
+    dmx->error_ = ErrorMessage(r);
+  }
+
+  if (!dmx->stopping_) {
+    napi_call_threadsafe_function(dmx->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Starts transmitting a universe. Arguments are the handle, a Uint8Array
+// over the universe (the start code followed by the channel slots), the
+// number of channel slots to send, the refresh rate in frames per second,
+// and the break and mark after break durations in microseconds. The
+// returned object has a closed promise that resolves with the final counts
+// once the output is closed or the port is closed, or rejects if the port
+// fails.
+napi_value DmxOutput::Create(napi_env env, napi_callback_info info) {
+  DmxOutput* dmx;
+  SerialHandle* handle;
+  napi_value argv[6];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_value arraybuffer;
+  napi_typedarray_type type;
+  napi_status status;
+  size_t argc = 6;
+  size_t length;
+  size_t byte_offset;
+  void* data;
+  uint32_t slots;
+  double rate;
+  uint32_t break_us;
+  uint32_t mab_us;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_typedarray_info(env,
+                             argv[1],
+                             &type,
+                             &length,
+                             &data,
+                             &arraybuffer,
+                             &byte_offset),
+    "could not get universe"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &slots),
+    "could not get slots"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[3], &rate),
+    "could not get refreshRate"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[4], &break_us),
+    "could not get breakMicros"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[5], &mab_us),
+    "could not get markAfterBreakMicros"
+  );
+
+  if (type != napi_uint8_array ||
+      slots == 0 ||
+      slots > kMaxSlots ||
+      length < slots + 1 ||
+      !(rate > 0)) {
+    napi_throw_range_error(env, nullptr, "invalid DMX universe");
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:dmx",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create DMX output");
+
+  dmx = new DmxOutput();
+  dmx->handle_ = handle;
+  dmx->universe_ = static_cast<const uint8_t*>(data);
+  dmx->frame_.resize(slots + 1);
+  dmx->period_ns_ = static_cast<uint64_t>(1e9 / rate);
+  dmx->break_ns_ = break_us * UINT64_C(1000);
+  dmx->mab_ns_ = mab_us * UINT64_C(1000);
+  dmx->io_generation_ = handle->io_generation();
+
+  status = napi_create_threadsafe_function(env,
+                                           nullptr,
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           dmx,
+                                           ThreadFinalize,
+                                           dmx,
+                                           CallJs,
+                                           &dmx->tsfn_);
+  if (status != napi_ok) {
+    delete dmx;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the output. It
+  // stays referenced while the output runs, like a listening server.
+  status = napi_create_promise(env, &dmx->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &dmx->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[1], 1, &dmx->buffer_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, dmx, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    dmx->closed_ = true;
+    napi_delete_reference(env, dmx->handle_ref_);
+    napi_delete_reference(env, dmx->buffer_ref_);
+    napi_release_threadsafe_function(dmx->tsfn_, napi_tsfn_release);
+    dmx->Release();
+    NAPI_CHECK(status, "could not wrap DMX output");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &dmx->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&dmx->thread_, Run, dmx) != 0) {
+    dmx->error_ = "could not start DMX thread";
+    dmx->Stop(env);
+    napi_throw_error(env, nullptr, "could not start DMX thread");
+    return nullptr;
+  }
+
+  dmx->started_ = true;
+  RegisterThread(env, dmx);
+  return ret;
+}
+
+napi_value DmxOutput::Stats(napi_env env, napi_callback_info info) {
+  DmxOutput* dmx;
+  napi_value argv[1];
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&dmx)),
+    "could not unwrap DMX output"
+  );
+
+  return dmx->CreateStats(env);
+}
+
+// Stops transmitting after the frame in progress. The port can be used
+// normally again once this returns.
+napi_value DmxOutput::Close(napi_env env, napi_callback_info info) {
+  DmxOutput* dmx;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&dmx)),
+    "could not unwrap DMX output"
+  );
+
+  dmx->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
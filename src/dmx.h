@@ -0,0 +1,71 @@
+#ifndef WEBSERIAL_DMX_H
+#define WEBSERIAL_DMX_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// Transmits a DMX512 universe continuously from a dedicated thread. Each
+// frame is a break, a mark after break, then the start code and the
+// channel slots, read from a buffer that JS updates in place. The port must
+// already be open at 250000 baud with 8 data bits and 2 stop bits.
+class DmxOutput : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Stats(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    DmxOutput();
+    ~DmxOutput();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    bool WaitUntil(uint64_t deadline);
+    sp_return SendFrame(void);
+    napi_value CreateStats(napi_env env);
+
+    SerialHandle* handle_;
+    napi_ref handle_ref_;
+    napi_ref buffer_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    const uint8_t* universe_;
+    std::vector<uint8_t> frame_;
+    uint64_t period_ns_;
+    uint64_t break_ns_;
+    uint64_t mab_ns_;
+    uint32_t io_generation_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+    std::atomic<uint64_t> frames_;
+    std::atomic<uint64_t> overruns_;
+};
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "echo-filter.h"
+#include "timing.h"
+
+namespace webserial {
+
+EchoFilter::EchoFilter() {
+  enabled_ = false;
+  char_ns_ = 0;
+  timeout_ns_ = 0;
+  due_ns_ = 0;
+  suppressed_ = 0;
+  mismatched_ = 0;
+  expired_ = 0;
+  uv_mutex_init(&mutex_);
+}
+
+EchoFilter::~EchoFilter() {
+  uv_mutex_destroy(&mutex_);
+}
+
+void EchoFilter::enable(uint64_t char_ns, uint64_t timeout_ns) {
+  uv_mutex_lock(&mutex_);
+  pending_.clear();
+  char_ns_ = char_ns;
+  timeout_ns_ = timeout_ns;
+  due_ns_ = 0;
+  suppressed_ = 0;
+  mismatched_ = 0;
+  expired_ = 0;
+  enabled_ = true;
+  uv_mutex_unlock(&mutex_);
+}
+
+void EchoFilter::disable(void) {
+  uv_mutex_lock(&mutex_);
+  enabled_ = false;
+  pending_.clear();
+  uv_mutex_unlock(&mutex_);
+}
+
+bool EchoFilter::enabled(void) const {
+  return enabled_;
+}
+
+void EchoFilter::sent(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t now = NowNs();
+
+  if (!enabled_ || size == 0) {
+    return;
+  }
+
+  uv_mutex_lock(&mutex_);
+  expire(now);
+  pending_.insert(pending_.end(), bytes, bytes + size);
+  if (pending_.size() > kMaxPending) {
+    expired_ += pending_.size() - kMaxPending;
+    pending_.erase(pending_.begin(),
+                   pending_.begin() + (pending_.size() - kMaxPending));
+  }
+
+  // The bytes queue up behind whatever is still being transmitted.
+  due_ns_ = (due_ns_ > now ? due_ns_ : now) + size * char_ns_;
+  uv_mutex_unlock(&mutex_);
+}
+
+size_t EchoFilter::filter(void* data, size_t size) {
+  uint8_t* bytes = static_cast<uint8_t*>(data);
+  size_t kept = 0;
+
+  if (!enabled_ || size == 0) {
+    return size;
+  }
+
+  uv_mutex_lock(&mutex_);
+  expire(NowNs());
+  for (size_t i = 0; i < size; i++) {
+    if (!pending_.empty()) {
+      if (bytes[i] == pending_.front()) {
+        pending_.pop_front();
+        suppressed_++;
+        continue;
+      }
+
+      // Whatever is left of our echo was lost along with this byte.
+      mismatched_++;
+      pending_.clear();
+    }
+
+    bytes[kept++] = bytes[i];
+  }
+  uv_mutex_unlock(&mutex_);
+
+  return kept;
+}
+
+void EchoFilter::stats(uint64_t* suppressed,
+                       uint64_t* mismatched,
+                       uint64_t* expired) {
+  uv_mutex_lock(&mutex_);
+  *suppressed = suppressed_;
+  *mismatched = mismatched_;
+  *expired = expired_;
+  uv_mutex_unlock(&mutex_);
+}
+
+// Must be called with mutex_ held.
+void EchoFilter::expire(uint64_t now) {
+  if (!pending_.empty() && now > due_ns_ + timeout_ns_) {
+    expired_ += pending_.size();
+    pending_.clear();
+  }
+}
+
+}
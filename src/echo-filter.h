@@ -0,0 +1,52 @@
+#ifndef WEBSERIAL_ECHO_FILTER_H
+#define WEBSERIAL_ECHO_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <uv.h>
+
+namespace webserial {
+
+// Removes the echo of our own transmissions from received data, for
+// half-duplex adapters that hear themselves on the bus. Every byte written
+// is remembered and the same bytes are dropped when they come back. If a
+// received byte differs, as in a collision, or the echo does not arrive in
+// time, the remembered bytes are forgotten and the data passes through.
+class EchoFilter {
+  public:
+    // Most bytes remembered. Older ones are forgotten first.
+    static const size_t kMaxPending = 65536;
+
+    EchoFilter();
+    ~EchoFilter();
+
+    // char_ns is how long one character takes on the wire. timeout_ns is how
+    // long after it should have been transmitted a byte may come back.
+    void enable(uint64_t char_ns, uint64_t timeout_ns);
+    void disable(void);
+    bool enabled(void) const;
+    void sent(const void* data, size_t size);
+    // Drops echoed bytes from data in place and returns how many are left.
+    size_t filter(void* data, size_t size);
+    void stats(uint64_t* suppressed, uint64_t* mismatched, uint64_t* expired);
+
+  private:
+    void expire(uint64_t now);
+
+    uv_mutex_t mutex_;
+    std::atomic<bool> enabled_;
+    std::deque<uint8_t> pending_;
+    uint64_t char_ns_;
+    uint64_t timeout_ns_;
+    // When the last remembered byte should be through the transmitter.
+    uint64_t due_ns_;
+    uint64_t suppressed_;
+    uint64_t mismatched_;
+    uint64_t expired_;
+};
+
+}
+
+#endif
@@ -0,0 +1,571 @@
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#endif
+#include "fd-pipe.h"
+#include "util.h"
+
+namespace webserial {
+
+static const size_t kBufferSize = 16384;
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const int kMaxWaitMs = 50;
+
+FdPipe::FdPipe() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  fd_ = -1;
+  to_fd_ = false;
+  limit_ = 0;
+  bytes_ = 0;
+  io_generation_ = 0;
+  start_ = 0;
+  end_ = 0;
+  max_write_ = 0;
+  zero_copy_ = false;
+  want_out_ = false;
+  eof_ = false;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+}
+
+FdPipe::~FdPipe() {}
+
+// The pipe is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void FdPipe::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void FdPipe::Destructor(napi_env env,
+                        void* native_object,
+                        void* finalize_hint) {
+  FdPipe* pipe = static_cast<FdPipe*>(native_object);
+
+  pipe->Stop(env);
+  napi_delete_reference(env, pipe->wrapper_ref_);
+  pipe->wrapper_ref_ = nullptr;
+  pipe->Release();
+}
+
+void FdPipe::ThreadFinalize(napi_env env,
+                            void* finalize_data,
+                            void* finalize_hint) {
+  static_cast<FdPipe*>(finalize_data)->Release();
+}
+
+// The thread calls into JS once, when it finishes on its own.
+void FdPipe::CallJs(napi_env env,
+                    napi_value js_callback,
+                    void* context,
+                    void* data) {
+  if (env != nullptr) {
+    static_cast<FdPipe*>(context)->Stop(env);
+  }
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void FdPipe::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and settles the done promise, with the number of
+// bytes moved or with the error that stopped the pipe. Called from Close(),
+// from the thread via CallJs(), and from the wrapper's finalizer.
+void FdPipe::Stop(napi_env env) {
+  napi_value bytes = nullptr;
+
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  if (error_.empty()) {
+    napi_create_double(env, static_cast<double>(bytes_), &bytes);
+  }
+
+  SettlePromise(env, deferred_, bytes, error_);
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+// Returns how many more bytes may be taken in, given the bytes already
+// buffered, so that a length limit is never overshot.
+size_t FdPipe::Chunk(size_t pending) {
+  uint64_t left;
+
+  if (limit_ == 0) {
+    return buf_.size();
+  }
+
+  left = limit_ - bytes_ - pending;
+  return left < buf_.size() ? static_cast<size_t>(left) : buf_.size();
+}
+
+void FdPipe::SetOsError(void) {
+  error_ = uv_strerror(uv_translate_sys_error(errno));
+}
+
+#ifndef _WIN32
+static void SetPoll(struct pollfd* pfd, int fd, short events) {
+  // Negative descriptors are ignored, so idle ones cannot wake the wait
+  // with a hangup nobody is going to act on yet.
+  pfd->fd = events != 0 ? fd : -1;
+  pfd->events = events;
+  pfd->revents = 0;
+}
+#endif
+
+// Checks what the descriptor is, to pick how bytes are moved. Returns false,
+// with error_ set, if it cannot be used.
+bool FdPipe::Prepare(void) {
+#ifndef _WIN32
+  struct stat st;
+
+  if (fstat(fd_, &st) < 0) {
+    SetOsError();
+    return false;
+  }
+
+#ifdef __linux__
+  zero_copy_ = to_fd_ ? S_ISFIFO(st.st_mode) : S_ISREG(st.st_mode);
+#endif
+  // Writes of up to PIPE_BUF bytes do not block once poll() reports a pipe
+  // or socket writable, whatever its blocking mode.
+  max_write_ = S_ISREG(st.st_mode) ? buf_.size() : PIPE_BUF;
+#endif
+  return true;
+}
+
+// One pass from the port to the file descriptor. Returns false once the
+// limit is reached or either side fails.
+bool FdPipe::PassToFd(int port_fd) {
+#ifndef _WIN32
+  struct pollfd pfds[2];
+  size_t room;
+  ssize_t n;
+  int r;
+
+  if (limit_ != 0 && bytes_ >= limit_) {
+    return false;
+  }
+
+  room = buf_.size() - end_;
+  if (room > Chunk(end_ - start_)) {
+    room = Chunk(end_ - start_);
+  }
+
+  SetPoll(&pfds[0],
+          port_fd,
+          (zero_copy_ ? !want_out_ : room > 0) ? POLLIN : 0);
+  SetPoll(&pfds[1],
+          fd_,
+          (zero_copy_ ? want_out_ : start_ < end_) ? POLLOUT : 0);
+
+  r = poll(pfds, 2, kMaxWaitMs);
+  if (r < 0 && errno != EINTR) {
+    SetOsError();
+    return false;
+  }
+
+  if (r <= 0) {
+    return true;
+  }
+
+  if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    error_ = "Port was disconnected";
+    return false;
+  }
+
+  if (pfds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    error_ = "File descriptor was closed";
+    return false;
+  }
+
+#ifdef __linux__
+  if (zero_copy_) {
+    n = splice(port_fd,
+               nullptr,
+               fd_,
+               nullptr,
+               Chunk(0),
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      bytes_ += n;
+      want_out_ = false;
+    } else if (n < 0 && errno == EAGAIN) {
+      // Input was waiting, so it is the pipe that is full.
+      want_out_ = (pfds[0].revents & POLLIN) != 0;
+    } else if (n < 0 && errno == EINVAL && bytes_ == 0) {
+      // Older kernels cannot splice from a tty.
+      zero_copy_ = false;
+    } else if (n < 0) {
+      SetOsError();
+      return false;
+    }
+
+    return true;
+  }
+#endif
+
+  if ((pfds[0].revents & POLLIN) && room > 0) {
+    r = handle_->read_data(buf_.data() + end_, room);
+    if (r < 0) {
+      error_ = ErrorMessage(static_cast<sp_return>(r));
+      return false;
+    }
+
+    end_ += r;
+  }
+
+  if ((pfds[1].revents & POLLOUT) && start_ < end_) {
+    n = write(fd_,
+              buf_.data() + start_,
+              end_ - start_ < max_write_ ? end_ - start_ : max_write_);
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      SetOsError();
+      return false;
+    }
+
+    if (n > 0) {
+      start_ += n;
+      bytes_ += n;
+    }
+  }
+
+  if (start_ == end_) {
+    start_ = end_ = 0;
+  } else if (end_ == buf_.size() && start_ > 0) {
+    memmove(buf_.data(), buf_.data() + start_, end_ - start_);
+    end_ -= start_;
+    start_ = 0;
+  }
+#endif
+  return true;
+}
+
+// One pass from the file descriptor to the port. Returns false at end of
+// file, once the limit is reached or when either side fails. Completion
+// means the bytes were handed to the driver, not that they have left the
+// wire.
+bool FdPipe::PassFromFd(int port_fd) {
+#ifndef _WIN32
+  struct pollfd pfds[2];
+  size_t room;
+  ssize_t n;
+  int r;
+
+  if ((limit_ != 0 && bytes_ >= limit_) || (eof_ && start_ == end_)) {
+    return false;
+  }
+
+  room = eof_ ? 0 : buf_.size() - end_;
+  if (room > Chunk(end_ - start_)) {
+    room = Chunk(end_ - start_);
+  }
+
+  SetPoll(&pfds[0],
+          port_fd,
+          (zero_copy_ || start_ < end_) ? POLLOUT : 0);
+  SetPoll(&pfds[1],
+          fd_,
+          (!zero_copy_ && room > 0) ? POLLIN : 0);
+
+  r = poll(pfds, 2, kMaxWaitMs);
+  if (r < 0 && errno != EINTR) {
+    SetOsError();
+    return false;
+  }
+
+  if (r <= 0) {
+    return true;
+  }
+
+  if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    error_ = "Port was disconnected";
+    return false;
+  }
+
+  if (pfds[1].revents & POLLNVAL) {
+    error_ = "File descriptor was closed";
+    return false;
+  }
+
+#ifdef __linux__
+  if (zero_copy_) {
+    if (!(pfds[0].revents & POLLOUT)) {
+      return true;
+    }
+
+    n = sendfile(port_fd, fd_, nullptr, Chunk(0));
+    if (n > 0) {
+      bytes_ += n;
+    } else if (n == 0) {
+      eof_ = true;
+    } else if ((errno == EINVAL || errno == ENOSYS) && bytes_ == 0) {
+      zero_copy_ = false;
+    } else if (errno != EAGAIN && errno != EINTR) {
+      SetOsError();
+      return false;
+    }
+
+    return true;
+  }
+#endif
+
+  // A hangup still leaves buffered data to read before end of file.
+  if ((pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) && room > 0) {
+    n = read(fd_, buf_.data() + end_, room);
+    if (n == 0) {
+      eof_ = true;
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      SetOsError();
+      return false;
+    } else if (n > 0) {
+      end_ += n;
+    }
+  }
+
+  if ((pfds[0].revents & POLLOUT) && start_ < end_) {
+    r = handle_->write_data(buf_.data() + start_, end_ - start_);
+    if (r < 0) {
+      error_ = ErrorMessage(static_cast<sp_return>(r));
+      return false;
+    }
+
+    start_ += r;
+    bytes_ += r;
+  }
+
+  if (start_ == end_) {
+    start_ = end_ = 0;
+  } else if (end_ == buf_.size() && start_ > 0) {
+    memmove(buf_.data(), buf_.data() + start_, end_ - start_);
+    end_ -= start_;
+    start_ = 0;
+  }
+#endif
+  return true;
+}
+
+void FdPipe::Run(void* arg) {
+  FdPipe* pipe = static_cast<FdPipe*>(arg);
+  bool more = pipe->Prepare();
+  int port_fd;
+  sp_return r;
+
+  // Each pass counts as I/O on the port, so the port cannot be closed while
+  // its descriptor is being polled. Closing it stops the pipe.
+  while (more && !pipe->stopping_ &&
+         pipe->handle_->begin_io(pipe->io_generation_)) {
+    r = pipe->handle_->get_os_handle(&port_fd);
+    if (r != SP_OK) {
+      pipe->error_ = ErrorMessage(r);
+      more = false;
+    } else if (pipe->to_fd_) {
+      more = pipe->PassToFd(port_fd);
+    } else {
+      more = pipe->PassFromFd(port_fd);
+    }
+
+    pipe->handle_->end_io();
+  }
+
+  if (!pipe->stopping_) {
+    napi_call_threadsafe_function(pipe->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Starts moving bytes between an open port and a file descriptor. Arguments
+// are the handle, the descriptor, true to copy from the port to the
+// descriptor or false for the other way, and the number of bytes to move,
+// where 0 means no limit. The returned object has a done promise that
+// resolves with the number of bytes moved.
+napi_value FdPipe::Create(napi_env env, napi_callback_info info) {
+#ifdef _WIN32
+  napi_throw_error(env, nullptr, "Not supported");
+  return nullptr;
+#else
+  FdPipe* pipe;
+  SerialHandle* handle;
+  napi_value argv[4];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 4;
+  int32_t fd;
+  bool to_fd;
+  double limit;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(napi_get_value_int32(env, argv[1], &fd), "could not get fd");
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[2], &to_fd),
+    "could not get direction"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[3], &limit),
+    "could not get length"
+  );
+
+  if (fd < 0 || !(limit >= 0)) {
+    napi_throw_range_error(env, nullptr, "invalid pipe arguments");
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:fdpipe",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create pipe");
+
+  pipe = new FdPipe();
+  pipe->handle_ = handle;
+  pipe->io_generation_ = handle->io_generation();
+  pipe->fd_ = fd;
+  pipe->to_fd_ = to_fd;
+  pipe->limit_ = static_cast<uint64_t>(limit);
+  pipe->buf_.resize(kBufferSize);
+
+  status = napi_create_threadsafe_function(env,
+                                           nullptr,
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           pipe,
+                                           ThreadFinalize,
+                                           pipe,
+                                           CallJs,
+                                           &pipe->tsfn_);
+  if (status != napi_ok) {
+    delete pipe;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the pipe. It stays
+  // referenced until the pipe is done, so pending work keeps the loop alive.
+  status = napi_create_promise(env, &pipe->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "done", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &pipe->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, pipe, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    pipe->closed_ = true;
+    napi_delete_reference(env, pipe->handle_ref_);
+    napi_release_threadsafe_function(pipe->tsfn_, napi_tsfn_release);
+    pipe->Release();
+    NAPI_CHECK(status, "could not wrap pipe");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &pipe->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&pipe->thread_, Run, pipe) != 0) {
+    pipe->error_ = "could not start pipe thread";
+    pipe->Stop(env);
+    napi_throw_error(env, nullptr, "could not start pipe thread");
+    return nullptr;
+  }
+
+  pipe->started_ = true;
+  RegisterThread(env, pipe);
+  return ret;
+#endif
+}
+
+// Returns the number of bytes moved so far.
+napi_value FdPipe::Stats(napi_env env, napi_callback_info info) {
+  FdPipe* pipe;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pipe)),
+    "could not unwrap pipe"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(pipe->bytes_), &ret),
+    "could not create byte count"
+  );
+
+  return ret;
+}
+
+// Stops the pipe early. The done promise resolves with the bytes moved so
+// far, and the port can be used normally again once this returns.
+napi_value FdPipe::Close(napi_env env, napi_callback_info info) {
+  FdPipe* pipe;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pipe)),
+    "could not unwrap pipe"
+  );
+
+  pipe->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef WEBSERIAL_FD_PIPE_H
+#define WEBSERIAL_FD_PIPE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// Moves bytes between an open port and an ordinary file descriptor on a
+// dedicated thread. On Linux, splice() feeds pipes and sendfile() reads
+// regular files without copying through user space. Everything else goes
+// through a buffer that is allocated once per pipe.
+class FdPipe : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Stats(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    FdPipe();
+    ~FdPipe();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    bool Prepare(void);
+    bool PassToFd(int port_fd);
+    bool PassFromFd(int port_fd);
+    size_t Chunk(size_t pending);
+    void SetOsError(void);
+
+    SerialHandle* handle_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    int fd_;
+    bool to_fd_;
+    uint64_t limit_;
+    std::atomic<uint64_t> bytes_;
+    uint32_t io_generation_;
+    // The thread's buffer and how it moves bytes; see Prepare().
+    std::vector<uint8_t> buf_;
+    size_t start_;
+    size_t end_;
+    size_t max_write_;
+    bool zero_copy_;
+    bool want_out_;
+    bool eof_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+};
+
+}
+
+#endif
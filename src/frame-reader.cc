@@ -0,0 +1,555 @@
+#include <string.h>
+#include "frame-reader.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+static const size_t kScratchSize = 4096;
+
+// Passed through the threadsafe function to say that frames are waiting, as
+// opposed to nullptr, which means that the thread has stopped.
+static int notify_tag;
+
+FrameReader::FrameReader() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  io_generation_ = 0;
+  gap_ns_ = 0;
+  max_length_ = 0;
+  max_queued_ = 0;
+  frame_.start_ns = 0;
+  frame_.end_ns = 0;
+  frame_.gap_ns = 0;
+  frame_.truncated = false;
+  last_ns_ = 0;
+  frames_ = 0;
+  bytes_ = 0;
+  dropped_ = 0;
+  truncated_ = 0;
+  notify_pending_ = false;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  uv_mutex_init(&mutex_);
+}
+
+FrameReader::~FrameReader() {
+  uv_mutex_destroy(&mutex_);
+}
+
+// The reader is shared by its JS wrapper and the threadsafe function, and
+// is deleted once both have been finalized.
+void FrameReader::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void FrameReader::Destructor(napi_env env,
+                             void* native_object,
+                             void* finalize_hint) {
+  FrameReader* reader = static_cast<FrameReader*>(native_object);
+
+  reader->Stop(env);
+  napi_delete_reference(env, reader->wrapper_ref_);
+  reader->wrapper_ref_ = nullptr;
+  reader->Release();
+}
+
+void FrameReader::ThreadFinalize(napi_env env,
+                                 void* finalize_data,
+                                 void* finalize_hint) {
+  static_cast<FrameReader*>(finalize_data)->Release();
+}
+
+// Tells JS that frames are waiting. The thread also calls in once when it
+// stops by itself, because the port was closed or failed.
+void FrameReader::CallJs(napi_env env,
+                         napi_value js_callback,
+                         void* context,
+                         void* data) {
+  FrameReader* reader = static_cast<FrameReader*>(context);
+  napi_value recv;
+
+  if (env == nullptr) {
+    return;
+  }
+
+  if (data == nullptr) {
+    reader->Stop(env);
+    return;
+  }
+
+  reader->notify_pending_ = false;
+  if (napi_get_undefined(env, &recv) == napi_ok) {
+    napi_call_function(env, recv, js_callback, 0, nullptr, nullptr);
+  }
+}
+
+napi_value FrameReader::CreateFrame(napi_env env, const Frame& frame) {
+  napi_value ret;
+  napi_value arraybuffer;
+  napi_value field;
+  void* data;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create frame");
+  NAPI_CHECK(
+    napi_create_arraybuffer(env, frame.data.size(), &data, &arraybuffer),
+    "could not create frame data"
+  );
+  if (!frame.data.empty()) {
+    memcpy(data, frame.data.data(), frame.data.size());
+  }
+  NAPI_CHECK(
+    napi_create_typedarray(env,
+                           napi_uint8_array,
+                           frame.data.size(),
+                           arraybuffer,
+                           0,
+                           &field),
+    "could not create frame data"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "data", field),
+    "could not set 'data' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, frame.start_ns / 1e3, &field),
+    "could not create timeMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "timeMicros", field),
+    "could not set 'timeMicros' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, (frame.end_ns - frame.start_ns) / 1e3, &field),
+    "could not create durationMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "durationMicros", field),
+    "could not set 'durationMicros' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, frame.gap_ns / 1e3, &field),
+    "could not create gapMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "gapMicros", field),
+    "could not set 'gapMicros' property"
+  );
+  NAPI_CHECK(
+    napi_get_boolean(env, frame.truncated, &field),
+    "could not create truncated"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "truncated", field),
+    "could not set 'truncated' property"
+  );
+
+  return ret;
+}
+
+napi_value FrameReader::CreateStats(napi_env env) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(frames_), &field),
+    "could not create frames"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "frames", field),
+    "could not set 'frames' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(bytes_), &field),
+    "could not create bytes"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "bytes", field),
+    "could not set 'bytes' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(dropped_), &field),
+    "could not create dropped"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "dropped", field),
+    "could not set 'dropped' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(truncated_), &field),
+    "could not create truncated"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "truncated", field),
+    "could not set 'truncated' property"
+  );
+
+  return ret;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void FrameReader::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and settles the closed promise, with the final
+// counts or with the error that stopped the reader. Frames still queued can
+// be read afterwards. Called from Close(), from the thread via CallJs(),
+// and from the wrapper's finalizer.
+void FrameReader::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create frame reader stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+// Queues the frame being received and starts a new one. When JS has fallen
+// max_queued_ frames behind, the oldest frame is dropped.
+void FrameReader::Finish(bool truncated) {
+  frame_.truncated = truncated;
+
+  uv_mutex_lock(&mutex_);
+  frames_++;
+  bytes_ += frame_.data.size();
+  if (truncated) {
+    truncated_++;
+  }
+  if (queue_.size() >= max_queued_) {
+    queue_.pop_front();
+    dropped_++;
+  }
+  queue_.push_back(std::move(frame_));
+  uv_mutex_unlock(&mutex_);
+
+  frame_.data.clear();
+  frame_.data.reserve(max_length_ < kScratchSize ? max_length_ : kScratchSize);
+
+  if (!notify_pending_.exchange(true)) {
+    napi_call_threadsafe_function(tsfn_, &notify_tag, napi_tsfn_nonblocking);
+  }
+}
+
+// Adds whatever the port has to the current frame. Everything from one read
+// shares the timestamp taken right after it, which is as precise as the
+// driver delivers the bytes.
+sp_return FrameReader::Fill(void) {
+  const uint8_t* data = scratch_.data();
+  size_t size;
+  size_t n;
+  uint64_t now;
+  int r;
+
+  r = handle_->read_data(scratch_.data(), scratch_.size());
+  now = NowNs();
+  if (r <= 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  size = static_cast<size_t>(r);
+  while (size > 0) {
+    if (frame_.data.empty()) {
+      frame_.start_ns = now;
+      frame_.gap_ns = now - last_ns_;
+    }
+
+    n = max_length_ - frame_.data.size();
+    if (n > size) {
+      n = size;
+    }
+
+    frame_.data.insert(frame_.data.end(), data, data + n);
+    frame_.end_ns = now;
+    last_ns_ = now;
+    data += n;
+    size -= n;
+
+    if (frame_.data.size() == max_length_) {
+      Finish(true);
+    }
+  }
+
+  return SP_OK;
+}
+
+// Waits for input, but no longer than the silence that would end the
+// current frame. Returns 1 if input is available, 0 if not, or an error.
+sp_return FrameReader::Poll(void) {
+  uint64_t wait = kMaxWaitNs;
+  uint64_t deadline;
+  uint64_t now;
+
+  if (!frame_.data.empty()) {
+    deadline = last_ns_ + gap_ns_;
+    now = NowNs();
+    if (now >= deadline) {
+      Finish(false);
+      return static_cast<sp_return>(0);
+    }
+
+    if (deadline - now < wait) {
+      wait = deadline - now;
+    }
+  }
+
+  return handle_->wait_input(wait);
+}
+
+void FrameReader::Run(void* arg) {
+  FrameReader* reader = static_cast<FrameReader*>(arg);
+  int r = SP_OK;
+
+  reader->last_ns_ = NowNs();
+
+  while (!reader->stopping_ &&
+         reader->handle_->begin_io(reader->io_generation_)) {
+    r = reader->Poll();
+    if (r > 0) {
+      r = reader->Fill();
+    }
+
+    reader->handle_->end_io();
+    if (r < 0) {
+      break;
+    }
+  }
+
+  // Whatever arrived last is a frame too, even if its gap never came.
+  if (!reader->frame_.data.empty()) {
+    reader->Finish(false);
+  }
+
+  if (r < 0) {
+    reader->error_ = ErrorMessage(static_cast<sp_return>(r));
+  }
+
+  if (!reader->stopping_) {
+    napi_call_threadsafe_function(reader->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Starts splitting a port's input into frames. Arguments are the handle,
+// the gap that ends a frame in microseconds, or 0 to use the next argument
+// instead, the gap in character times at the port's current settings, the
+// longest frame, the most frames to queue, and a function called whenever
+// frames are waiting to be read. The returned object has a closed promise
+// that resolves with the final counts once the reader is closed, or
+// rejects if the port fails. Closing the port closes the reader too.
+napi_value FrameReader::Create(napi_env env, napi_callback_info info) {
+  FrameReader* reader;
+  SerialHandle* handle;
+  napi_value argv[6];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 6;
+  double gap_us;
+  double gap_chars;
+  uint32_t max_length;
+  uint32_t max_queued;
+  uint64_t char_ns;
+  uint64_t gap_ns;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[1], &gap_us),
+    "could not get gapMicros"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[2], &gap_chars),
+    "could not get gapChars"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[3], &max_length),
+    "could not get maxFrameLength"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[4], &max_queued),
+    "could not get maxQueuedFrames"
+  );
+
+  if (gap_us > 0) {
+    gap_ns = static_cast<uint64_t>(gap_us * 1e3);
+  } else {
+    SP_CHECK(handle->get_char_time(&char_ns));
+    gap_ns = static_cast<uint64_t>(gap_chars * char_ns);
+  }
+
+  if (gap_ns == 0 || max_length == 0 || max_queued == 0) {
+    napi_throw_range_error(env, nullptr, "invalid frame reader options");
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:framereader",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create frame reader");
+
+  reader = new FrameReader();
+  reader->handle_ = handle;
+  reader->io_generation_ = handle->io_generation();
+  reader->gap_ns_ = gap_ns;
+  reader->max_length_ = max_length;
+  reader->max_queued_ = max_queued;
+  reader->scratch_.resize(kScratchSize);
+
+  status = napi_create_threadsafe_function(env,
+                                           argv[5],
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           reader,
+                                           ThreadFinalize,
+                                           reader,
+                                           CallJs,
+                                           &reader->tsfn_);
+  if (status != napi_ok) {
+    delete reader;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the reader. It
+  // stays referenced while the reader runs, like a listening server.
+  status = napi_create_promise(env, &reader->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &reader->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, reader, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    reader->closed_ = true;
+    napi_delete_reference(env, reader->handle_ref_);
+    napi_release_threadsafe_function(reader->tsfn_, napi_tsfn_release);
+    reader->Release();
+    NAPI_CHECK(status, "could not wrap frame reader");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &reader->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&reader->thread_, Run, reader) != 0) {
+    reader->error_ = "could not start frame reader thread";
+    reader->Stop(env);
+    napi_throw_error(env, nullptr, "could not start frame reader thread");
+    return nullptr;
+  }
+
+  reader->started_ = true;
+  RegisterThread(env, reader);
+  return ret;
+}
+
+// Takes the oldest finished frame, as { data, timeMicros, durationMicros,
+// gapMicros, truncated }, or returns null if there is none.
+napi_value FrameReader::Read(napi_env env, napi_callback_info info) {
+  FrameReader* reader;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+  Frame frame;
+  bool found = false;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&reader)),
+    "could not unwrap frame reader"
+  );
+
+  uv_mutex_lock(&reader->mutex_);
+  if (!reader->queue_.empty()) {
+    frame = std::move(reader->queue_.front());
+    reader->queue_.pop_front();
+    found = true;
+  }
+  uv_mutex_unlock(&reader->mutex_);
+
+  if (!found) {
+    NAPI_CHECK(napi_get_null(env, &ret), "could not get null");
+    return ret;
+  }
+
+  return reader->CreateFrame(env, frame);
+}
+
+// Stops reading. Queued frames can still be read, and the port can be read
+// normally again once this returns.
+napi_value FrameReader::Close(napi_env env, napi_callback_info info) {
+  FrameReader* reader;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&reader)),
+    "could not unwrap frame reader"
+  );
+
+  reader->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef WEBSERIAL_FRAME_READER_H
+#define WEBSERIAL_FRAME_READER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// Reads a port on a dedicated thread and splits the input into frames at
+// every silence longer than a set gap, as protocols like Modbus RTU
+// require. Bytes are timestamped as they are read, so the event loop's
+// scheduling has no effect on where frames end. Finished frames wait in a
+// bounded queue until JS takes them.
+class FrameReader : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Read(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    struct Frame {
+      std::vector<uint8_t> data;
+      uint64_t start_ns;
+      uint64_t end_ns;
+      uint64_t gap_ns;
+      bool truncated;
+    };
+
+    FrameReader();
+    ~FrameReader();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    sp_return Poll(void);
+    sp_return Fill(void);
+    void Finish(bool truncated);
+    napi_value CreateFrame(napi_env env, const Frame& frame);
+    napi_value CreateStats(napi_env env);
+
+    SerialHandle* handle_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    uv_mutex_t mutex_;
+    uint32_t io_generation_;
+    uint64_t gap_ns_;
+    size_t max_length_;
+    size_t max_queued_;
+    std::vector<uint8_t> scratch_;
+    // The frame being received, only touched by the thread.
+    Frame frame_;
+    uint64_t last_ns_;
+    // Finished frames, guarded by mutex_.
+    std::deque<Frame> queue_;
+    uint64_t frames_;
+    uint64_t bytes_;
+    uint64_t dropped_;
+    uint64_t truncated_;
+    std::atomic<bool> notify_pending_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+};
+
+}
+
+#endif
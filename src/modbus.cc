@@ -0,0 +1,881 @@
+#include <string.h>
+#include "modbus.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Largest RTU frame: address, 253 byte PDU and CRC.
+static const size_t kMaxAduSize = 256;
+static const size_t kMaxPduSize = 253;
+// The response length is unknown, so the frame ends after t3.5 of silence.
+static const size_t kFrameBySilence = SIZE_MAX;
+// Bytes after which ExpectedLength() can always tell the frame length.
+static const size_t kMinLengthKnown = 4;
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+
+struct CrcTable {
+  uint16_t entries[256];
+
+  constexpr CrcTable() : entries() {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = i;
+
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+      }
+
+      entries[i] = crc;
+    }
+  }
+};
+
+static constexpr CrcTable kCrcTable;
+
+static uint16_t Crc16(const uint8_t* data, size_t size) {
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < size; i++) {
+    crc = (crc >> 8) ^ kCrcTable.entries[(crc ^ data[i]) & 0xFF];
+  }
+
+  return crc;
+}
+
+static const char* ExceptionMessage(uint8_t code) {
+  switch (code) {
+    case 0x01:
+      return "Illegal function";
+    case 0x02:
+      return "Illegal data address";
+    case 0x03:
+      return "Illegal data value";
+    case 0x04:
+      return "Server device failure";
+    case 0x05:
+      return "Acknowledge";
+    case 0x06:
+      return "Server device busy";
+    case 0x08:
+      return "Memory parity error";
+    case 0x0A:
+      return "Gateway path unavailable";
+    case 0x0B:
+      return "Gateway target device failed to respond";
+    default:
+      return "Unknown exception";
+  }
+}
+
+static const char* StatusCode(ModbusStatus status) {
+  switch (status) {
+    case kModbusTimeout:
+      return "ETIMEDOUT";
+    case kModbusBadCrc:
+      return "EBADCRC";
+    case kModbusBadFrame:
+      return "EBADFRAME";
+    case kModbusException:
+      return "EMODBUS";
+    case kModbusCancelled:
+      return "ECANCELED";
+    default:
+      return "EIO";
+  }
+}
+
+// Returns the length of the response frame once enough of it has arrived to
+// tell, 0 if more bytes are needed first, or kFrameBySilence for function
+// codes whose length cannot be derived from the frame.
+static size_t ExpectedLength(const ModbusTransaction* t,
+                             const uint8_t* buf,
+                             size_t size) {
+  if (size < 2) {
+    return 0;
+  }
+
+  if (buf[1] & 0x80) {
+    return 5;
+  }
+
+  switch (buf[1]) {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x0C:
+    case 0x11:
+    case 0x14:
+    case 0x15:
+    case 0x17:
+      return size < 3 ? 0 : 5 + buf[2];
+    case 0x05:
+    case 0x06:
+    case 0x0B:
+    case 0x0F:
+    case 0x10:
+      return 8;
+    case 0x07:
+      return 5;
+    case 0x08:
+      return 3 + t->pdu.size();
+    case 0x16:
+      return 10;
+    case 0x18:
+      return size < 4 ? 0 : 6 + ((buf[2] << 8) | buf[3]);
+    default:
+      return kFrameBySilence;
+  }
+}
+
+ModbusMaster::ModbusMaster() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  tsfn_ = nullptr;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  pending_ = 0;
+  t35_ns_ = 0;
+  max_gap_ns_ = 0;
+  char_ns_ = 0;
+  response_timeout_ns_ = 0;
+  turnaround_ns_ = 0;
+  bus_idle_ns_ = 0;
+  io_generation_ = 0;
+  uv_mutex_init(&mutex_);
+  uv_cond_init(&cond_);
+}
+
+ModbusMaster::~ModbusMaster() {
+  uv_cond_destroy(&cond_);
+  uv_mutex_destroy(&mutex_);
+}
+
+// The master is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void ModbusMaster::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void ModbusMaster::Destructor(napi_env env,
+                              void* native_object,
+                              void* finalize_hint) {
+  ModbusMaster* master = static_cast<ModbusMaster*>(native_object);
+
+  master->Stop(env);
+  napi_delete_reference(env, master->wrapper_ref_);
+  master->wrapper_ref_ = nullptr;
+  master->Release();
+}
+
+void ModbusMaster::ThreadFinalize(napi_env env,
+                                  void* finalize_data,
+                                  void* finalize_hint) {
+  static_cast<ModbusMaster*>(finalize_data)->Release();
+}
+
+static napi_value CreateResult(napi_env env, ModbusTransaction* t) {
+  napi_value ret;
+  napi_value field;
+  napi_value message;
+  void* backing_store;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create result");
+  NAPI_CHECK(
+    napi_create_uint32(env, t->slave_id, &field),
+    "could not create slaveId"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "slaveId", field),
+    "could not set 'slaveId' property"
+  );
+  NAPI_CHECK(
+    napi_create_uint32(env, t->pdu[0], &field),
+    "could not create functionCode"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "functionCode", field),
+    "could not set 'functionCode' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, (t->done_ns - t->start_ns) / 1e6, &field),
+    "could not create totalTime"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "totalTime", field),
+    "could not set 'totalTime' property"
+  );
+
+  if (t->status != kModbusOk) {
+    NAPI_CHECK(
+      napi_create_string_utf8(env,
+                              t->error.c_str(),
+                              t->error.size(),
+                              &message),
+      "could not create error message"
+    );
+    NAPI_CHECK(
+      napi_create_error(env, nullptr, message, &field),
+      "could not create error"
+    );
+    NAPI_CHECK(
+      napi_create_string_utf8(env,
+                              StatusCode(t->status),
+                              NAPI_AUTO_LENGTH,
+                              &message),
+      "could not create error code"
+    );
+    NAPI_CHECK(
+      napi_set_named_property(env, field, "code", message),
+      "could not set 'code' property"
+    );
+
+    if (t->status == kModbusException) {
+      NAPI_CHECK(
+        napi_create_uint32(env, t->exception_code, &message),
+        "could not create exceptionCode"
+      );
+      NAPI_CHECK(
+        napi_set_named_property(env, field, "exceptionCode", message),
+        "could not set 'exceptionCode' property"
+      );
+    }
+
+    NAPI_CHECK(
+      napi_set_named_property(env, ret, "error", field),
+      "could not set 'error' property"
+    );
+    return ret;
+  }
+
+  // The data excludes the function code, which is reported separately.
+  NAPI_CHECK(
+    napi_create_arraybuffer(env,
+                            t->response.size() - 1,
+                            &backing_store,
+                            &field),
+    "could not create array buffer"
+  );
+  if (t->response.size() > 1) {
+    memcpy(backing_store, t->response.data() + 1, t->response.size() - 1);
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "data", field),
+    "could not set 'data' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, (t->done_ns - t->sent_ns) / 1e6, &field),
+    "could not create responseTime"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "responseTime", field),
+    "could not set 'responseTime' property"
+  );
+
+  return ret;
+}
+
+static void SettleJob(napi_env env, ModbusJob* job) {
+  napi_value results = nullptr;
+  napi_value result;
+  napi_status status;
+
+  status = napi_create_array_with_length(env,
+                                         job->transactions.size(),
+                                         &results);
+  for (size_t i = 0; status == napi_ok && i < job->transactions.size(); i++) {
+    result = CreateResult(env, &job->transactions[i]);
+    if (result == nullptr) {
+      status = napi_pending_exception;
+      break;
+    }
+
+    status = napi_set_element(env, results, i, result);
+  }
+
+  SettlePromise(env,
+                job->deferred,
+                status == napi_ok ? results : nullptr,
+                "could not create Modbus results");
+}
+
+void ModbusMaster::CallJs(napi_env env,
+                          napi_value js_callback,
+                          void* context,
+                          void* data) {
+  ModbusMaster* master = static_cast<ModbusMaster*>(context);
+  ModbusJob* job = static_cast<ModbusJob*>(data);
+
+  if (env != nullptr) {
+    SettleJob(env, job);
+
+    if (--master->pending_ == 0 && !master->closed_) {
+      napi_unref_threadsafe_function(env, master->tsfn_);
+      napi_reference_unref(env, master->wrapper_ref_, nullptr);
+    }
+  }
+
+  delete job;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void ModbusMaster::Join(void) {
+  uv_mutex_lock(&mutex_);
+  stopping_ = true;
+  uv_cond_signal(&cond_);
+  uv_mutex_unlock(&mutex_);
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and rejects whatever it had not started yet.
+// Called from Close() and from the wrapper's finalizer.
+void ModbusMaster::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  while (!queue_.empty()) {
+    ModbusJob* job = queue_.front();
+
+    queue_.pop_front();
+    for (ModbusTransaction& t : job->transactions) {
+      t.status = kModbusCancelled;
+      t.error = "Modbus master was closed";
+      t.start_ns = t.done_ns = NowNs();
+    }
+
+    SettleJob(env, job);
+    delete job;
+  }
+
+  if (pending_ > 0) {
+    napi_reference_unref(env, wrapper_ref_, nullptr);
+  }
+
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+void ModbusMaster::Run(void* arg) {
+  ModbusMaster* master = static_cast<ModbusMaster*>(arg);
+  ModbusJob* job;
+
+  for (;;) {
+    uv_mutex_lock(&master->mutex_);
+    while (master->queue_.empty() && !master->stopping_) {
+      uv_cond_wait(&master->cond_, &master->mutex_);
+    }
+
+    if (master->stopping_) {
+      uv_mutex_unlock(&master->mutex_);
+      break;
+    }
+
+    job = master->queue_.front();
+    master->queue_.pop_front();
+    uv_mutex_unlock(&master->mutex_);
+
+    for (ModbusTransaction& t : job->transactions) {
+      master->Execute(&t);
+    }
+
+    if (napi_call_threadsafe_function(master->tsfn_,
+                                      job,
+                                      napi_tsfn_blocking) != napi_ok) {
+      delete job;
+    }
+  }
+}
+
+void ModbusMaster::Execute(ModbusTransaction* t) {
+  uint8_t adu[kMaxAduSize];
+  size_t size = 0;
+  uint16_t crc;
+
+  adu[size++] = t->slave_id;
+  memcpy(adu + size, t->pdu.data(), t->pdu.size());
+  size += t->pdu.size();
+  crc = Crc16(adu, size);
+  adu[size++] = crc & 0xFF;
+  adu[size++] = crc >> 8;
+
+  // The bus must have been silent for t3.5 before a new frame starts.
+  SleepUntilNs(bus_idle_ns_ + t35_ns_);
+  t->start_ns = NowNs();
+  t->sent_ns = t->done_ns = t->start_ns;
+
+  if (stopping_) {
+    t->status = kModbusCancelled;
+    t->error = "Modbus master was closed";
+    return;
+  }
+
+  // The exchange counts as I/O on the port, so the port cannot be closed
+  // under it.
+  if (!handle_->begin_io(io_generation_)) {
+    t->status = kModbusCancelled;
+    t->error = "Port was closed";
+    return;
+  }
+
+  Exchange(t, adu, size);
+  handle_->end_io();
+}
+
+// Sends the request and reads the response, if one is expected.
+void ModbusMaster::Exchange(ModbusTransaction* t,
+                            const uint8_t* adu,
+                            size_t size) {
+  uint64_t wire_ns;
+  int r;
+
+  // Anything still in the input buffer belongs to an earlier exchange.
+  r = handle_->discard_rx_buffer();
+  if (r == SP_OK) {
+    r = handle_->write_all(adu,
+                           size,
+                           response_timeout_ns_ / 1000000,
+                           io_generation_);
+  }
+
+  if (r >= 0 && static_cast<size_t>(r) < size) {
+    t->status = kModbusTimeout;
+    t->error = "Timed out writing request";
+    t->done_ns = bus_idle_ns_ = NowNs();
+    return;
+  }
+
+  // The driver may report the write complete while the UART is still
+  // shifting out the last characters, so never assume the frame left the
+  // wire sooner than its transmission time. The wait is bounded: a UART
+  // held back by flow control must not hang the master.
+  if (r >= 0) {
+    DrainOutcome outcome;
+
+    r = handle_->drain_output(response_timeout_ns_ / 1000000,
+                              io_generation_,
+                              handle_->drain_generation(),
+                              &stopping_,
+                              &outcome);
+    if (r == SP_OK && outcome == kDrainTimedOut) {
+      t->status = kModbusTimeout;
+      t->error = "Timed out sending request";
+      t->done_ns = bus_idle_ns_ = NowNs();
+      return;
+    }
+
+    if (r == SP_OK && outcome == kDrainAborted) {
+      t->status = kModbusCancelled;
+      t->error = stopping_ ? "Modbus master was closed" : "Port was closed";
+      t->done_ns = bus_idle_ns_ = NowNs();
+      return;
+    }
+  }
+
+  if (r < 0) {
+    t->status = kModbusPortError;
+    t->error = ErrorMessage(static_cast<sp_return>(r));
+    t->done_ns = bus_idle_ns_ = NowNs();
+    return;
+  }
+
+  wire_ns = t->start_ns + size * char_ns_;
+  t->sent_ns = NowNs();
+  if (t->sent_ns < wire_ns) {
+    SleepUntilNs(wire_ns);
+    t->sent_ns = wire_ns;
+  }
+
+  if (t->slave_id == 0) {
+    // Broadcasts are not answered. Give the slaves time to act on them.
+    SleepUntilNs(t->sent_ns + turnaround_ns_);
+    t->status = kModbusOk;
+    t->response.assign(t->pdu.begin(), t->pdu.begin() + 1);
+    t->done_ns = bus_idle_ns_ = NowNs();
+    return;
+  }
+
+  t->status = ReadResponse(t, t->sent_ns + response_timeout_ns_);
+  t->done_ns = NowNs();
+}
+
+ModbusStatus ModbusMaster::ReadResponse(ModbusTransaction* t,
+                                        uint64_t deadline) {
+  uint8_t buf[kMaxAduSize];
+  size_t received = 0;
+  size_t expected = 0;
+  uint64_t last_rx = 0;
+  uint64_t now;
+  uint64_t until;
+  uint16_t crc;
+  bool broken = false;
+  int r;
+
+  for (;;) {
+    if (stopping_) {
+      t->error = "Modbus master was closed";
+      bus_idle_ns_ = NowNs();
+      return kModbusCancelled;
+    }
+
+    if (handle_->io_cancelled(io_generation_)) {
+      t->error = "Port was closed";
+      bus_idle_ns_ = NowNs();
+      return kModbusCancelled;
+    }
+
+    now = NowNs();
+    until = expected == kFrameBySilence ? last_rx + t35_ns_ : deadline;
+    if (now >= until) {
+      if (expected == kFrameBySilence) {
+        break;
+      }
+
+      t->error = received == 0 ? "No response" : "Incomplete response";
+      bus_idle_ns_ = received == 0 ? now : last_rx;
+      return kModbusTimeout;
+    }
+
+    r = handle_->wait_input(until - now < kMaxWaitNs ?
+                            until - now : kMaxWaitNs);
+    if (r == 0) {
+      continue;
+    }
+
+    if (r > 0) {
+      size_t limit;
+
+      // Every response is at least 5 bytes long and its length is known
+      // after 4, so reading up to 4 bytes first never consumes bytes of a
+      // following frame.
+      if (expected == 0) {
+        limit = kMinLengthKnown;
+      } else if (expected == kFrameBySilence) {
+        limit = kMaxAduSize;
+      } else {
+        limit = expected;
+      }
+
+      r = handle_->read_data(buf + received, limit - received);
+    }
+
+    if (r < 0) {
+      t->error = ErrorMessage(static_cast<sp_return>(r));
+      bus_idle_ns_ = NowNs();
+      return kModbusPortError;
+    }
+
+    now = NowNs();
+    // A frame must arrive as one burst. Once a silence longer than t1.5
+    // has split it, the rest is read until t3.5 of silence ends it, so
+    // that the bus timing stays right, and then thrown away.
+    if (received > 0 && now > last_rx + r * char_ns_ + max_gap_ns_) {
+      broken = true;
+      expected = kFrameBySilence;
+    }
+
+    received += r;
+    last_rx = now;
+
+    if (expected == 0) {
+      expected = ExpectedLength(t, buf, received);
+      if (expected != kFrameBySilence && expected > kMaxAduSize) {
+        t->error = "Response length exceeds maximum frame size";
+        bus_idle_ns_ = last_rx;
+        return kModbusBadFrame;
+      }
+    }
+
+    if (received == kMaxAduSize ||
+        (expected != 0 && expected != kFrameBySilence &&
+         received >= expected)) {
+      break;
+    }
+  }
+
+  bus_idle_ns_ = last_rx;
+
+  if (broken) {
+    t->error = "Silence within response";
+    return kModbusBadFrame;
+  }
+
+  if (received < 4) {
+    t->error = "Response too short";
+    return kModbusBadFrame;
+  }
+
+  crc = Crc16(buf, received - 2);
+  if (buf[received - 2] != (crc & 0xFF) || buf[received - 1] != (crc >> 8)) {
+    t->error = "CRC mismatch";
+    return kModbusBadCrc;
+  }
+
+  if (buf[0] != t->slave_id) {
+    t->error = "Response from unexpected slave";
+    return kModbusBadFrame;
+  }
+
+  if (buf[1] == (t->pdu[0] | 0x80)) {
+    t->exception_code = buf[2];
+    t->error = ExceptionMessage(buf[2]);
+    return kModbusException;
+  }
+
+  if (buf[1] != t->pdu[0]) {
+    t->error = "Unexpected function code in response";
+    return kModbusBadFrame;
+  }
+
+  t->response.assign(buf + 1, buf + received - 2);
+  return kModbusOk;
+}
+
+// Creates a master for an open port. Arguments are the handle, the baud rate
+// the port runs at (used for the silent intervals), the response timeout and
+// the broadcast turnaround delay, both in milliseconds, and the longest
+// silence allowed within a response in microseconds, or 0 for t1.5.
+napi_value ModbusMaster::Create(napi_env env, napi_callback_info info) {
+  ModbusMaster* master;
+  SerialHandle* handle;
+  napi_value argv[5];
+  napi_value resource_name;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 5;
+  uint32_t baud_rate;
+  uint32_t response_timeout_ms;
+  uint32_t turnaround_ms;
+  uint32_t max_gap_us;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[1], &baud_rate),
+    "could not get baudRate"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &response_timeout_ms),
+    "could not get responseTimeout"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[3], &turnaround_ms),
+    "could not get turnaroundDelay"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[4], &max_gap_us),
+    "could not get maxGapMicros"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:modbus",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create master");
+
+  master = new ModbusMaster();
+  master->handle_ = handle;
+  master->io_generation_ = handle->io_generation();
+  master->char_ns_ = CharTimeNs(baud_rate, 11);
+  // Above 19200 baud the specification fixes t1.5 at 750us and t3.5 at
+  // 1750us.
+  master->t35_ns_ = baud_rate > 19200 ? 1750000 : (master->char_ns_ * 7) / 2;
+  if (max_gap_us != 0) {
+    master->max_gap_ns_ = max_gap_us * UINT64_C(1000);
+  } else {
+    master->max_gap_ns_ = baud_rate > 19200 ? 750000 :
+                          (master->char_ns_ * 3) / 2;
+  }
+  master->response_timeout_ns_ = response_timeout_ms * UINT64_C(1000000);
+  master->turnaround_ns_ = turnaround_ms * UINT64_C(1000000);
+
+  status = napi_create_threadsafe_function(env,
+                                           nullptr,
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           master,
+                                           ThreadFinalize,
+                                           master,
+                                           CallJs,
+                                           &master->tsfn_);
+  if (status != napi_ok) {
+    delete master;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the master.
+  napi_unref_threadsafe_function(env, master->tsfn_);
+  status = napi_create_reference(env, argv[0], 1, &master->handle_ref_);
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, master, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    master->closed_ = true;
+    napi_delete_reference(env, master->handle_ref_);
+    napi_release_threadsafe_function(master->tsfn_, napi_tsfn_release);
+    master->Release();
+    NAPI_CHECK(status, "could not wrap master");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 0, &master->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&master->thread_, Run, master) != 0) {
+    master->Stop(env);
+    napi_throw_error(env, nullptr, "could not start Modbus thread");
+    return nullptr;
+  }
+
+  master->started_ = true;
+  RegisterThread(env, master);
+  return ret;
+}
+
+// Queues a batch of requests, each an object with a slaveId and a pdu
+// ArrayBuffer holding the function code and data. The batch runs back to
+// back without returning to JS, and the promise resolves with one result per
+// request. Failed requests carry an error instead of data.
+napi_value ModbusMaster::Submit(napi_env env, napi_callback_info info) {
+  ModbusMaster* master;
+  ModbusJob* job;
+  napi_value argv[2];
+  napi_value element;
+  napi_value field;
+  napi_value promise;
+  napi_status status;
+  size_t argc = 2;
+  uint32_t count;
+  uint32_t slave_id;
+  void* buf;
+  size_t len;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&master)),
+    "could not unwrap master"
+  );
+  NAPI_CHECK(
+    napi_get_array_length(env, argv[1], &count),
+    "could not get request count"
+  );
+
+  if (master->closed_) {
+    napi_throw_error(env, nullptr, "Modbus master is closed");
+    return nullptr;
+  }
+
+  job = new ModbusJob();
+  job->transactions.resize(count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    ModbusTransaction& t = job->transactions[i];
+
+    status = napi_get_element(env, argv[1], i, &element);
+    if (status == napi_ok) {
+      status = napi_get_named_property(env, element, "slaveId", &field);
+    }
+    if (status == napi_ok) {
+      status = napi_get_value_uint32(env, field, &slave_id);
+    }
+    if (status == napi_ok) {
+      status = napi_get_named_property(env, element, "pdu", &field);
+    }
+    if (status == napi_ok) {
+      status = napi_get_arraybuffer_info(env, field, &buf, &len);
+    }
+
+    if (status != napi_ok) {
+      delete job;
+      NAPI_CHECK(status, "could not get request");
+    }
+
+    if (slave_id > 247 || len == 0 || len > kMaxPduSize) {
+      delete job;
+      napi_throw_range_error(env, nullptr, "invalid Modbus request");
+      return nullptr;
+    }
+
+    t.slave_id = slave_id;
+    t.pdu.assign(static_cast<uint8_t*>(buf), static_cast<uint8_t*>(buf) + len);
+    t.status = kModbusOk;
+    t.exception_code = 0;
+    t.start_ns = t.sent_ns = t.done_ns = 0;
+  }
+
+  status = napi_create_promise(env, &job->deferred, &promise);
+  if (status != napi_ok) {
+    delete job;
+    NAPI_CHECK(status, "could not create promise");
+  }
+
+  if (master->pending_++ == 0) {
+    napi_ref_threadsafe_function(env, master->tsfn_);
+    napi_reference_ref(env, master->wrapper_ref_, nullptr);
+  }
+
+  uv_mutex_lock(&master->mutex_);
+  master->queue_.push_back(job);
+  uv_cond_signal(&master->cond_);
+  uv_mutex_unlock(&master->mutex_);
+
+  return promise;
+}
+
+// Stops the master. Requests that have not started are rejected, and the
+// port can be used normally again once this returns.
+napi_value ModbusMaster::Close(napi_env env, napi_callback_info info) {
+  ModbusMaster* master;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&master)),
+    "could not unwrap master"
+  );
+
+  master->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
@@ -0,0 +1,99 @@
+#ifndef WEBSERIAL_MODBUS_H
+#define WEBSERIAL_MODBUS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+enum ModbusStatus {
+  kModbusOk = 0,
+  kModbusTimeout,
+  kModbusBadCrc,
+  kModbusBadFrame,
+  kModbusException,
+  kModbusPortError,
+  kModbusCancelled
+};
+
+struct ModbusTransaction {
+  uint8_t slave_id;
+  std::vector<uint8_t> pdu;
+  std::vector<uint8_t> response;
+  ModbusStatus status;
+  uint8_t exception_code;
+  uint64_t start_ns;
+  uint64_t sent_ns;
+  uint64_t done_ns;
+  std::string error;
+};
+
+struct ModbusJob {
+  napi_deferred deferred;
+  std::vector<ModbusTransaction> transactions;
+};
+
+// A Modbus RTU master. Requests are queued from JS and run back to back on
+// a dedicated thread, which owns the port while the master is open and
+// keeps the inter-frame silence using the monotonic clock. Each submitted
+// batch is settled with one call back into JS.
+class ModbusMaster : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Submit(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    ModbusMaster();
+    ~ModbusMaster();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    void Execute(ModbusTransaction* t);
+    void Exchange(ModbusTransaction* t, const uint8_t* adu, size_t size);
+    ModbusStatus ReadResponse(ModbusTransaction* t, uint64_t deadline);
+
+    SerialHandle* handle_;
+    uint32_t io_generation_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    uv_mutex_t mutex_;
+    uv_cond_t cond_;
+    std::deque<ModbusJob*> queue_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    size_t pending_;
+    uint64_t t35_ns_;
+    uint64_t max_gap_ns_;
+    uint64_t char_ns_;
+    uint64_t response_timeout_ns_;
+    uint64_t turnaround_ns_;
+    uint64_t bus_idle_ns_;
+};
+
+}
+
+#endif
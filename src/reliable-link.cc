@@ -0,0 +1,1127 @@
+#ifdef __linux__
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#include <math.h>
+#include <string.h>
+#include "reliable-link.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Frame layout before stuffing: type, sequence number, acknowledgement,
+// payload, CRC-32 of all that, least significant byte first. The
+// acknowledgement is the sequence number the sender expects next.
+static const uint8_t kFlag = 0x7E;
+static const uint8_t kEscape = 0x7D;
+static const uint8_t kEscapeBit = 0x20;
+static const uint8_t kFrameData = 0;
+static const uint8_t kFrameAck = 1;
+static const uint8_t kFrameNak = 2;
+static const size_t kHeaderSize = 3;
+static const size_t kCrcSize = 4;
+// Largest payload accepted, whatever the local maxPayload is.
+static const size_t kMaxPayload = 4096;
+static const size_t kScratchSize = 4096;
+// Longest the thread sleeps when nothing is due. Writes, reads and close
+// wake it through wake_fd_ before then.
+static const uint64_t kMaxWaitNs = 50000000;
+#ifndef __linux__
+// Elsewhere there is no wakeup, so the thread looks for new writes and room
+// in the receive buffer this often.
+static const uint64_t kPollNs = 1000000;
+#endif
+// Leeway in the retransmit timeout for the peer to get round to answering.
+static const uint64_t kTurnaroundNs = 20000000;
+
+// Passed through the threadsafe function to say that data or settled
+// requests are waiting, as opposed to nullptr, which means that the thread
+// has stopped.
+static int notify_tag;
+
+struct CrcTable {
+  uint32_t entries[256];
+
+  constexpr CrcTable() : entries() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+      }
+
+      entries[i] = crc;
+    }
+  }
+};
+
+static constexpr CrcTable kCrcTable;
+
+static uint32_t UpdateCrc32(uint32_t crc, uint8_t byte) {
+  return (crc >> 8) ^ kCrcTable.entries[(crc ^ byte) & 0xFF];
+}
+
+ReliableLink::ReliableLink() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  io_generation_ = 0;
+  window_ = 0;
+  max_payload_ = 0;
+  char_ns_ = 0;
+  frame_ns_ = 0;
+  rto_ns_ = 0;
+  max_retransmits_ = 0;
+  receive_buffer_size_ = 0;
+  faults_ = LinkFaults();
+  for (int i = 0; i < 256; i++) {
+    tx_[i].deadline_ns = 0;
+    tx_[i].retries = 0;
+    tx_[i].resend = false;
+    rx_[i].nak_ns = 0;
+    rx_[i].present = false;
+  }
+  send_base_ = 0;
+  next_seq_ = 0;
+  recv_next_ = 0;
+  ack_owed_ = false;
+  queued_ns_ = 0;
+  escape_ = false;
+  discard_ = false;
+  rng_ = 0;
+  frames_sent_ = 0;
+  frames_received_ = 0;
+  retransmits_ = 0;
+  naks_sent_ = 0;
+  crc_errors_ = 0;
+  duplicates_ = 0;
+  bytes_sent_ = 0;
+  bytes_received_ = 0;
+  notify_pending_ = false;
+  wake_fd_ = -1;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  uv_mutex_init(&mutex_);
+}
+
+ReliableLink::~ReliableLink() {
+  for (LinkRequest* request : requests_) {
+    delete request;
+  }
+
+  for (LinkRequest* request : done_) {
+    delete request;
+  }
+
+  uv_mutex_destroy(&mutex_);
+#ifdef __linux__
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+#endif
+}
+
+// The link is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void ReliableLink::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void ReliableLink::Destructor(napi_env env,
+                              void* native_object,
+                              void* finalize_hint) {
+  ReliableLink* link = static_cast<ReliableLink*>(native_object);
+
+  link->Stop(env);
+  napi_delete_reference(env, link->wrapper_ref_);
+  link->wrapper_ref_ = nullptr;
+  link->Release();
+}
+
+void ReliableLink::ThreadFinalize(napi_env env,
+                                  void* finalize_data,
+                                  void* finalize_hint) {
+  static_cast<ReliableLink*>(finalize_data)->Release();
+}
+
+static void SettleRequest(napi_env env, LinkRequest* request) {
+  napi_value ret = nullptr;
+
+  if (request->error.empty() && napi_get_undefined(env, &ret) != napi_ok) {
+    request->error = "could not get undefined";
+  }
+
+  SettlePromise(env, request->deferred, ret, request->error);
+}
+
+// Settles the writes that have been framed and the flushes that have been
+// acknowledged.
+void ReliableLink::SettleDone(napi_env env) {
+  std::deque<LinkRequest*> done;
+
+  uv_mutex_lock(&mutex_);
+  done.swap(done_);
+  uv_mutex_unlock(&mutex_);
+
+  for (LinkRequest* request : done) {
+    SettleRequest(env, request);
+    delete request;
+  }
+}
+
+// Settles finished requests and tells JS that received data may be
+// waiting. The thread also calls in once when it stops by itself, because
+// the port was closed or failed.
+void ReliableLink::CallJs(napi_env env,
+                          napi_value js_callback,
+                          void* context,
+                          void* data) {
+  ReliableLink* link = static_cast<ReliableLink*>(context);
+  napi_value recv;
+
+  if (env == nullptr) {
+    return;
+  }
+
+  if (data == nullptr) {
+    link->Stop(env);
+    return;
+  }
+
+  link->notify_pending_ = false;
+  link->SettleDone(env);
+  if (napi_get_undefined(env, &recv) == napi_ok) {
+    napi_call_function(env, recv, js_callback, 0, nullptr, nullptr);
+  }
+}
+
+void ReliableLink::Notify(void) {
+  if (!notify_pending_.exchange(true)) {
+    napi_call_threadsafe_function(tsfn_, &notify_tag, napi_tsfn_nonblocking);
+  }
+}
+
+napi_value ReliableLink::CreateStats(napi_env env) {
+  const struct {
+    const char* name;
+    uint64_t value;
+  } fields[] = {
+    { "framesSent", frames_sent_ },
+    { "framesReceived", frames_received_ },
+    { "retransmits", retransmits_ },
+    { "naksSent", naks_sent_ },
+    { "crcErrors", crc_errors_ },
+    { "duplicates", duplicates_ },
+    { "bytesSent", bytes_sent_ },
+    { "bytesReceived", bytes_received_ }
+  };
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  for (const auto& f : fields) {
+    NAPI_CHECK(
+      napi_create_double(env, static_cast<double>(f.value), &field),
+      "could not create stat"
+    );
+    NAPI_CHECK(
+      napi_set_named_property(env, ret, f.name, field),
+      "could not set stat"
+    );
+  }
+
+  return ret;
+}
+
+// Cuts the thread's wait short, so that it sees new requests, room in the
+// receive buffer or stopping_ straight away.
+void ReliableLink::Wake(void) {
+#ifdef __linux__
+  uint64_t one = 1;
+  ssize_t r;
+
+  r = write(wake_fd_, &one, sizeof(one));
+  (void) r;
+#endif
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void ReliableLink::Join(void) {
+  stopping_ = true;
+  Wake();
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread, rejects the writes and flushes that were not
+// done yet, and settles the closed promise, with the final counts or with
+// the error that stopped the link. Received data can still be read
+// afterwards. Called from Close(), from the thread via CallJs(), and from
+// the wrapper's finalizer.
+void ReliableLink::Stop(napi_env env) {
+  std::deque<LinkRequest*> unfinished;
+
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+  SettleDone(env);
+
+  uv_mutex_lock(&mutex_);
+  unfinished.swap(requests_);
+  uv_mutex_unlock(&mutex_);
+
+  for (LinkRequest* request : unfinished) {
+    request->error = "reliable link was closed";
+    SettleRequest(env, request);
+    delete request;
+  }
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create link stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+// xorshift64*, which is plenty for choosing faults.
+double ReliableLink::NextRandom(void) {
+  rng_ ^= rng_ >> 12;
+  rng_ ^= rng_ << 25;
+  rng_ ^= rng_ >> 27;
+  return ((rng_ * UINT64_C(2685821657736338717)) >> 11) / 9007199254740992.0;
+}
+
+// Damages the encoded frame as configured. Returns true if the frame is to
+// be lost altogether.
+bool ReliableLink::InjectFaults(void) {
+  double byte_error_rate;
+
+  if (faults_.drop_rate > 0 && NextRandom() < faults_.drop_rate) {
+    return true;
+  }
+
+  if (faults_.bit_error_rate > 0) {
+    byte_error_rate = 1 - pow(1 - faults_.bit_error_rate, 8);
+    for (uint8_t& byte : encoded_) {
+      if (NextRandom() < byte_error_rate) {
+        byte ^= 1 << static_cast<int>(NextRandom() * 8);
+      }
+    }
+  }
+
+  return false;
+}
+
+// Frames, stuffs and writes one frame, carrying the current acknowledgement.
+sp_return ReliableLink::SendFrame(uint8_t type,
+                                  uint8_t seq,
+                                  const std::vector<uint8_t>* payload) {
+  uint32_t crc = 0xFFFFFFFF;
+  uint64_t now;
+  int r;
+  auto put = [this](uint8_t byte) {
+    if (byte == kFlag || byte == kEscape) {
+      encoded_.push_back(kEscape);
+      encoded_.push_back(byte ^ kEscapeBit);
+    } else {
+      encoded_.push_back(byte);
+    }
+  };
+
+  encoded_.clear();
+  encoded_.push_back(kFlag);
+  for (uint8_t byte : { type, seq, recv_next_ }) {
+    crc = UpdateCrc32(crc, byte);
+    put(byte);
+  }
+  if (payload != nullptr) {
+    for (uint8_t byte : *payload) {
+      crc = UpdateCrc32(crc, byte);
+      put(byte);
+    }
+  }
+  crc ^= 0xFFFFFFFF;
+  for (size_t i = 0; i < kCrcSize; i++) {
+    put(static_cast<uint8_t>(crc >> (8 * i)));
+  }
+  encoded_.push_back(kFlag);
+
+  ack_owed_ = false;
+  frames_sent_++;
+
+  // A lost frame still takes its time on the line.
+  now = NowNs();
+  queued_ns_ = (queued_ns_ > now ? queued_ns_ : now) +
+               encoded_.size() * char_ns_;
+  if (InjectFaults()) {
+    return SP_OK;
+  }
+
+  r = handle_->write_all(encoded_.data(), encoded_.size(), 0, io_generation_);
+  return r < 0 ? static_cast<sp_return>(r) : SP_OK;
+}
+
+// Fills payload with up to max_payload_ bytes of queued writes. Writes that
+// are used up are settled. A flush stops the filling until everything
+// before it has been acknowledged.
+bool ReliableLink::TakePayload(std::vector<uint8_t>* payload) {
+  LinkRequest* request;
+  bool finished = false;
+  size_t n;
+
+  payload->clear();
+
+  uv_mutex_lock(&mutex_);
+  while (payload->size() < max_payload_ && !requests_.empty()) {
+    request = requests_.front();
+    if (request->flush) {
+      break;
+    }
+
+    n = max_payload_ - payload->size();
+    if (n > request->data.size() - request->offset) {
+      n = request->data.size() - request->offset;
+    }
+
+    payload->insert(payload->end(),
+                    request->data.begin() + request->offset,
+                    request->data.begin() + request->offset + n);
+    request->offset += n;
+    if (request->offset == request->data.size()) {
+      requests_.pop_front();
+      done_.push_back(request);
+      finished = true;
+    }
+  }
+  uv_mutex_unlock(&mutex_);
+
+  if (finished) {
+    Notify();
+  }
+
+  return !payload->empty();
+}
+
+// Sends whatever is due: frames the peer asked for again, the oldest frame
+// if its acknowledgement is overdue, new frames while the window has room,
+// and a bare acknowledgement if nothing else carried it. New frames are
+// only queued a frame ahead of the line, so that requests for missing
+// frames and acknowledgements never wait behind a whole window.
+sp_return ReliableLink::Transmit(uint64_t now) {
+  uint8_t outstanding = next_seq_ - send_base_;
+  uint8_t seq;
+  bool flushed = false;
+  int r;
+
+  for (uint8_t i = 0; i < outstanding; i++) {
+    seq = send_base_ + i;
+    TxSlot& slot = tx_[seq];
+
+    // Frames after the oldest are recovered by the peer asking for them,
+    // which it does once it has the frames around the gap.
+    if (!slot.resend && (i > 0 || now < slot.deadline_ns)) {
+      continue;
+    }
+
+    if (max_retransmits_ > 0 && slot.retries >= max_retransmits_) {
+      error_ = "peer is not responding";
+      return SP_ERR_FAIL;
+    }
+
+    slot.retries++;
+    slot.resend = false;
+    retransmits_++;
+    r = SendFrame(kFrameData, seq, &slot.payload);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    slot.deadline_ns = queued_ns_ + rto_ns_;
+  }
+
+  while (static_cast<uint8_t>(next_seq_ - send_base_) < window_ &&
+         queued_ns_ <= now + frame_ns_) {
+    TxSlot& slot = tx_[next_seq_];
+
+    if (!TakePayload(&slot.payload)) {
+      break;
+    }
+
+    slot.retries = 0;
+    slot.resend = false;
+    r = SendFrame(kFrameData, next_seq_, &slot.payload);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    slot.deadline_ns = queued_ns_ + rto_ns_;
+    bytes_sent_ += slot.payload.size();
+    next_seq_++;
+  }
+
+  if (send_base_ == next_seq_) {
+    uv_mutex_lock(&mutex_);
+    if (!requests_.empty() && requests_.front()->flush) {
+      done_.push_back(requests_.front());
+      requests_.pop_front();
+      flushed = true;
+    }
+    uv_mutex_unlock(&mutex_);
+  }
+
+  if (flushed) {
+    Notify();
+  }
+
+  if (ack_owed_) {
+    return SendFrame(kFrameAck, 0, nullptr);
+  }
+
+  return SP_OK;
+}
+
+// Frees every frame the peer has acknowledged.
+void ReliableLink::HandleAck(uint8_t ack) {
+  uint8_t outstanding = next_seq_ - send_base_;
+  uint8_t acked = ack - send_base_;
+
+  if (acked == 0 || acked > outstanding) {
+    return;
+  }
+
+  while (send_base_ != ack) {
+    tx_[send_base_].payload.clear();
+    send_base_++;
+  }
+}
+
+// Hands received frames to JS in order, as long as the receive buffer has
+// room. Frames that do not fit stay unacknowledged, which holds the peer
+// back once its window fills.
+void ReliableLink::Deliver(void) {
+  bool delivered = false;
+  bool fits;
+
+  while (rx_[recv_next_].present) {
+    RxSlot& slot = rx_[recv_next_];
+
+    uv_mutex_lock(&mutex_);
+    fits = received_.empty() ||
+           received_.size() + slot.payload.size() <= receive_buffer_size_;
+    if (fits) {
+      received_.insert(received_.end(),
+                       slot.payload.begin(),
+                       slot.payload.end());
+    }
+    uv_mutex_unlock(&mutex_);
+
+    if (!fits) {
+      break;
+    }
+
+    bytes_received_ += slot.payload.size();
+    slot.payload.clear();
+    slot.present = false;
+    slot.nak_ns = 0;
+    recv_next_++;
+    ack_owed_ = true;
+    delivered = true;
+  }
+
+  if (delivered) {
+    Notify();
+  }
+}
+
+sp_return ReliableLink::HandleData(uint8_t seq,
+                                   const uint8_t* data,
+                                   size_t size) {
+  uint8_t offset = seq - recv_next_;
+  uint64_t now;
+  int r;
+
+  // Anything outside the window was delivered already. The peer sent it
+  // again because our acknowledgement was lost.
+  if (offset >= window_ || rx_[seq].present) {
+    duplicates_++;
+    ack_owed_ = true;
+    return SP_OK;
+  }
+
+  rx_[seq].payload.assign(data, data + size);
+  rx_[seq].present = true;
+
+  // Ask for every frame still missing before this one, but not again until
+  // the first request has had time to be answered.
+  now = NowNs();
+  for (uint8_t i = 0; i < offset; i++) {
+    RxSlot& hole = rx_[static_cast<uint8_t>(recv_next_ + i)];
+
+    if (hole.present || (hole.nak_ns != 0 && now - hole.nak_ns < rto_ns_)) {
+      continue;
+    }
+
+    r = SendFrame(kFrameNak, recv_next_ + i, nullptr);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    hole.nak_ns = now;
+    naks_sent_++;
+  }
+
+  Deliver();
+  return SP_OK;
+}
+
+// Checks and acts on the frame collected in frame_. Damaged frames are
+// dropped, and the gap they leave is noticed through the frames after them.
+sp_return ReliableLink::HandleFrame(void) {
+  uint32_t crc = 0xFFFFFFFF;
+  uint32_t expected = 0;
+  size_t size = frame_.size();
+  uint8_t type;
+  uint8_t seq;
+
+  if (size < kHeaderSize + kCrcSize) {
+    crc_errors_++;
+    return SP_OK;
+  }
+
+  for (size_t i = 0; i < size - kCrcSize; i++) {
+    crc = UpdateCrc32(crc, frame_[i]);
+  }
+  for (size_t i = 0; i < kCrcSize; i++) {
+    expected |= static_cast<uint32_t>(frame_[size - kCrcSize + i]) << (8 * i);
+  }
+  if ((crc ^ 0xFFFFFFFF) != expected) {
+    crc_errors_++;
+    return SP_OK;
+  }
+
+  frames_received_++;
+  type = frame_[0];
+  seq = frame_[1];
+  HandleAck(frame_[2]);
+
+  // Any intact frame shows the peer is still there, so only silence counts
+  // towards giving up. A peer whose receive buffer is full keeps answering
+  // our retransmits with acknowledgements, and is slow, not gone.
+  for (uint8_t i = send_base_; i != next_seq_; i++) {
+    tx_[i].retries = 0;
+  }
+
+  if (type == kFrameData) {
+    return HandleData(seq,
+                      frame_.data() + kHeaderSize,
+                      size - kHeaderSize - kCrcSize);
+  }
+
+  if (type == kFrameNak &&
+      static_cast<uint8_t>(seq - send_base_) <
+        static_cast<uint8_t>(next_seq_ - send_base_)) {
+    tx_[seq].resend = true;
+  }
+
+  return SP_OK;
+}
+
+// Unstuffs whatever the port has and handles each complete frame.
+sp_return ReliableLink::Receive(void) {
+  uint8_t byte;
+  int r;
+
+  r = handle_->read_data(scratch_.data(), scratch_.size());
+  if (r <= 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  for (int i = 0; i < r; i++) {
+    byte = scratch_[i];
+    if (byte == kFlag) {
+      if (!discard_ && !frame_.empty()) {
+        sp_return result = HandleFrame();
+
+        if (result < 0) {
+          return result;
+        }
+      }
+
+      frame_.clear();
+      escape_ = false;
+      discard_ = false;
+      continue;
+    }
+
+    if (discard_) {
+      continue;
+    }
+
+    if (byte == kEscape) {
+      escape_ = true;
+      continue;
+    }
+
+    if (escape_) {
+      byte ^= kEscapeBit;
+      escape_ = false;
+    }
+
+    // Too long to be a frame, most likely because a flag was damaged.
+    if (frame_.size() == kHeaderSize + kMaxPayload + kCrcSize) {
+      crc_errors_++;
+      discard_ = true;
+      continue;
+    }
+
+    frame_.push_back(byte);
+  }
+
+  return SP_OK;
+}
+
+sp_return ReliableLink::Step(void) {
+  uint64_t now;
+  uint64_t until;
+  int r;
+
+#ifdef __linux__
+  uint64_t count;
+
+  // Clear the wakeup before looking at requests, so that one queued after
+  // this ends the wait below.
+  if (read(wake_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    return SP_ERR_FAIL;
+  }
+#endif
+
+  now = NowNs();
+  r = Transmit(now);
+  if (r < 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  // JS may have made room for frames that did not fit before.
+  Deliver();
+
+  // Sleep until input arrives, JS wakes us, the oldest frame is due again,
+  // or the line has room for another frame.
+#ifdef __linux__
+  until = now + kMaxWaitNs;
+#else
+  until = now + kPollNs;
+#endif
+  if (send_base_ != next_seq_ && tx_[send_base_].deadline_ns < until) {
+    until = tx_[send_base_].deadline_ns;
+  }
+  if (queued_ns_ > now + frame_ns_ && queued_ns_ - frame_ns_ < until) {
+    until = queued_ns_ - frame_ns_;
+  }
+
+  now = NowNs();
+  r = handle_->wait_input(until > now ? until - now : 0, wake_fd_);
+  if (r > 0) {
+    r = Receive();
+  }
+
+  return static_cast<sp_return>(r);
+}
+
+void ReliableLink::Run(void* arg) {
+  ReliableLink* link = static_cast<ReliableLink*>(arg);
+  int r = SP_OK;
+
+  while (!link->stopping_ &&
+         link->handle_->begin_io(link->io_generation_)) {
+    r = link->Step();
+    link->handle_->end_io();
+    if (r < 0) {
+      break;
+    }
+  }
+
+  if (r < 0 && link->error_.empty()) {
+    link->error_ = ErrorMessage(static_cast<sp_return>(r));
+  }
+
+  if (!link->stopping_) {
+    napi_call_threadsafe_function(link->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Starts a reliable link over an open port. Arguments are the handle, the
+// window in frames (1 to 127), the largest payload per frame, the
+// retransmit timeout in milliseconds (0 to derive it from the frame time),
+// how many times in a row a frame may be sent again without hearing from
+// the peer before giving up (0 for no limit), the receive buffer size, the
+// chance of dropping a frame and of flipping a bit on the way out, the seed
+// for those faults, and a function called whenever received data may be
+// waiting. The returned object has a closed promise that resolves with the
+// final counts once the link is closed, or rejects if it fails.
+napi_value ReliableLink::Create(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  SerialHandle* handle;
+  napi_value argv[10];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 10;
+  uint32_t window;
+  uint32_t max_payload;
+  uint32_t rto_ms;
+  uint32_t max_retransmits;
+  uint32_t receive_buffer_size;
+  LinkFaults faults;
+  int64_t seed;
+  uint64_t char_ns;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[1], &window),
+    "could not get window"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &max_payload),
+    "could not get maxPayload"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[3], &rto_ms),
+    "could not get retransmitTimeout"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[4], &max_retransmits),
+    "could not get maxRetransmits"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[5], &receive_buffer_size),
+    "could not get receiveBufferSize"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[6], &faults.drop_rate),
+    "could not get dropRate"
+  );
+  NAPI_CHECK(
+    napi_get_value_double(env, argv[7], &faults.bit_error_rate),
+    "could not get bitErrorRate"
+  );
+  NAPI_CHECK(napi_get_value_int64(env, argv[8], &seed), "could not get seed");
+
+  // Sequence numbers are 8 bits, and selective repeat needs the window to
+  // be at most half of that.
+  if (window < 1 || window > 127 ||
+      max_payload < 1 || max_payload > kMaxPayload ||
+      receive_buffer_size < max_payload) {
+    napi_throw_range_error(env, nullptr, "invalid reliable link options");
+    return nullptr;
+  }
+
+  SP_CHECK(handle->get_char_time(&char_ns));
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:reliablelink",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create link");
+
+  link = new ReliableLink();
+  link->handle_ = handle;
+  link->io_generation_ = handle->io_generation();
+  link->window_ = static_cast<uint8_t>(window);
+  link->max_payload_ = max_payload;
+  link->char_ns_ = char_ns;
+  // Flags and header, ignoring stuffing.
+  link->frame_ns_ = (max_payload + kHeaderSize + kCrcSize + 2) * char_ns;
+  // By default, our frame, one queued ahead of the peer's answer and the
+  // answer itself, plus some leeway.
+  link->rto_ns_ = rto_ms > 0 ? rto_ms * UINT64_C(1000000)
+                             : 3 * link->frame_ns_ + kTurnaroundNs;
+  link->max_retransmits_ = max_retransmits;
+  link->receive_buffer_size_ = receive_buffer_size;
+  link->faults_ = faults;
+  link->faults_.seed = static_cast<uint64_t>(seed);
+  link->rng_ = seed != 0 ? static_cast<uint64_t>(seed) : NowNs() | 1;
+  link->scratch_.resize(kScratchSize);
+
+#ifdef __linux__
+  link->wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (link->wake_fd_ < 0) {
+    delete link;
+    napi_throw_error(env, nullptr, "could not create wakeup descriptor");
+    return nullptr;
+  }
+#endif
+
+  status = napi_create_threadsafe_function(env,
+                                           argv[9],
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           link,
+                                           ThreadFinalize,
+                                           link,
+                                           CallJs,
+                                           &link->tsfn_);
+  if (status != napi_ok) {
+    delete link;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the link. It
+  // stays referenced while the link runs, like a listening server.
+  status = napi_create_promise(env, &link->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &link->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, link, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    link->closed_ = true;
+    napi_delete_reference(env, link->handle_ref_);
+    napi_release_threadsafe_function(link->tsfn_, napi_tsfn_release);
+    link->Release();
+    NAPI_CHECK(status, "could not wrap link");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &link->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&link->thread_, Run, link) != 0) {
+    link->error_ = "could not start link thread";
+    link->Stop(env);
+    napi_throw_error(env, nullptr, "could not start link thread");
+    return nullptr;
+  }
+
+  link->started_ = true;
+  RegisterThread(env, link);
+  return ret;
+}
+
+static napi_value QueueRequest(napi_env env,
+                               LinkRequest* request,
+                               std::deque<LinkRequest*>* requests,
+                               uv_mutex_t* mutex) {
+  napi_value promise;
+  napi_status status;
+
+  status = napi_create_promise(env, &request->deferred, &promise);
+  if (status != napi_ok) {
+    delete request;
+    NAPI_CHECK(status, "could not create promise");
+  }
+
+  uv_mutex_lock(mutex);
+  requests->push_back(request);
+  uv_mutex_unlock(mutex);
+
+  return promise;
+}
+
+// Queues an ArrayBuffer for sending. The promise resolves once all of it
+// has gone out in frames, which is when the window had room for it.
+napi_value ReliableLink::Write(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  LinkRequest* request;
+  napi_value argv[2];
+  napi_value promise;
+  size_t argc = 2;
+  void* buf;
+  size_t len;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&link)),
+    "could not unwrap link"
+  );
+  NAPI_CHECK(
+    napi_get_arraybuffer_info(env, argv[1], &buf, &len),
+    "could not get buffer"
+  );
+
+  if (link->closed_) {
+    napi_throw_error(env, nullptr, "reliable link is closed");
+    return nullptr;
+  }
+
+  request = new LinkRequest();
+  request->data.assign(static_cast<uint8_t*>(buf),
+                       static_cast<uint8_t*>(buf) + len);
+  request->offset = 0;
+  request->flush = false;
+
+  promise = QueueRequest(env, request, &link->requests_, &link->mutex_);
+  link->Wake();
+  return promise;
+}
+
+// Resolves once everything written before it has been acknowledged.
+napi_value ReliableLink::Flush(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  LinkRequest* request;
+  napi_value argv[1];
+  napi_value promise;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&link)),
+    "could not unwrap link"
+  );
+
+  if (link->closed_) {
+    napi_throw_error(env, nullptr, "reliable link is closed");
+    return nullptr;
+  }
+
+  request = new LinkRequest();
+  request->offset = 0;
+  request->flush = true;
+
+  promise = QueueRequest(env, request, &link->requests_, &link->mutex_);
+  link->Wake();
+  return promise;
+}
+
+// Takes everything received so far as a Uint8Array, or returns null if
+// there is nothing.
+napi_value ReliableLink::Read(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  std::vector<uint8_t> received;
+  napi_value argv[1];
+  napi_value arraybuffer;
+  napi_value ret;
+  size_t argc = 1;
+  void* data;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&link)),
+    "could not unwrap link"
+  );
+
+  uv_mutex_lock(&link->mutex_);
+  received.swap(link->received_);
+  uv_mutex_unlock(&link->mutex_);
+
+  if (received.empty()) {
+    NAPI_CHECK(napi_get_null(env, &ret), "could not get null");
+    return ret;
+  }
+
+  // The thread may be holding frames back for want of room.
+  link->Wake();
+
+  NAPI_CHECK(
+    napi_create_arraybuffer(env, received.size(), &data, &arraybuffer),
+    "could not create buffer"
+  );
+  memcpy(data, received.data(), received.size());
+  NAPI_CHECK(
+    napi_create_typedarray(env,
+                           napi_uint8_array,
+                           received.size(),
+                           arraybuffer,
+                           0,
+                           &ret),
+    "could not create data"
+  );
+
+  return ret;
+}
+
+napi_value ReliableLink::Stats(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  napi_value argv[1];
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&link)),
+    "could not unwrap link"
+  );
+
+  return link->CreateStats(env);
+}
+
+// Stops the link. Pending writes and flushes are rejected, and the port can
+// be used directly again once this returns.
+napi_value ReliableLink::Close(napi_env env, napi_callback_info info) {
+  ReliableLink* link;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&link)),
+    "could not unwrap link"
+  );
+
+  link->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
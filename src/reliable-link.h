@@ -0,0 +1,153 @@
+#ifndef WEBSERIAL_RELIABLE_LINK_H
+#define WEBSERIAL_RELIABLE_LINK_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// Faults injected into transmitted frames, for testing the link over a
+// clean line such as a pty pair.
+struct LinkFaults {
+  double drop_rate;       // Chance of losing a whole frame.
+  double bit_error_rate;  // Chance of flipping each bit.
+  uint64_t seed;
+};
+
+struct LinkRequest {
+  napi_deferred deferred;
+  std::vector<uint8_t> data;
+  size_t offset;
+  bool flush;
+  std::string error;
+};
+
+// Turns a port into a loss-free byte stream with selective-repeat ARQ. Data
+// goes out in HDLC-style frames, delimited by flag bytes and byte stuffed,
+// each with a sequence number, the acknowledgement of what has been
+// received, and a CRC-32. A window of frames is kept in flight. The
+// receiver buffers frames that arrive out of order and asks for each
+// missing one by number, so only lost frames are sent again. A dedicated
+// thread runs both directions.
+class ReliableLink : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Write(napi_env env, napi_callback_info info);
+    static napi_value Flush(napi_env env, napi_callback_info info);
+    static napi_value Read(napi_env env, napi_callback_info info);
+    static napi_value Stats(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    struct TxSlot {
+      std::vector<uint8_t> payload;
+      uint64_t deadline_ns;
+      uint32_t retries;
+      bool resend;
+    };
+
+    struct RxSlot {
+      std::vector<uint8_t> payload;
+      uint64_t nak_ns;
+      bool present;
+    };
+
+    ReliableLink();
+    ~ReliableLink();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    void Notify(void);
+    void Wake(void);
+    void SettleDone(napi_env env);
+    sp_return Step(void);
+    sp_return Transmit(uint64_t now);
+    sp_return SendFrame(uint8_t type,
+                        uint8_t seq,
+                        const std::vector<uint8_t>* payload);
+    bool TakePayload(std::vector<uint8_t>* payload);
+    sp_return Receive(void);
+    sp_return HandleFrame(void);
+    void HandleAck(uint8_t ack);
+    sp_return HandleData(uint8_t seq, const uint8_t* data, size_t size);
+    void Deliver(void);
+    bool InjectFaults(void);
+    double NextRandom(void);
+    napi_value CreateStats(napi_env env);
+
+    SerialHandle* handle_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    uv_mutex_t mutex_;
+    uint32_t io_generation_;
+    uint8_t window_;
+    size_t max_payload_;
+    uint64_t char_ns_;
+    uint64_t frame_ns_;
+    uint64_t rto_ns_;
+    uint32_t max_retransmits_;
+    size_t receive_buffer_size_;
+    LinkFaults faults_;
+
+    // Guarded by mutex_.
+    std::deque<LinkRequest*> requests_;
+    std::deque<LinkRequest*> done_;
+    std::vector<uint8_t> received_;
+
+    // Only touched by the link thread.
+    TxSlot tx_[256];
+    RxSlot rx_[256];
+    uint8_t send_base_;
+    uint8_t next_seq_;
+    uint8_t recv_next_;
+    bool ack_owed_;
+    uint64_t queued_ns_;
+    std::vector<uint8_t> encoded_;
+    std::vector<uint8_t> frame_;
+    std::vector<uint8_t> scratch_;
+    bool escape_;
+    bool discard_;
+    uint64_t rng_;
+
+    std::atomic<uint64_t> frames_sent_;
+    std::atomic<uint64_t> frames_received_;
+    std::atomic<uint64_t> retransmits_;
+    std::atomic<uint64_t> naks_sent_;
+    std::atomic<uint64_t> crc_errors_;
+    std::atomic<uint64_t> duplicates_;
+    std::atomic<uint64_t> bytes_sent_;
+    std::atomic<uint64_t> bytes_received_;
+    std::atomic<bool> notify_pending_;
+    int wake_fd_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,1176 @@
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include "rfc2217.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+#ifndef _WIN32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const size_t kBufferSize = 4096;
+// Longest subnegotiation worth keeping. Every COM port command fits easily.
+static const size_t kMaxSubSize = 64;
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const int kMaxWaitMs = 50;
+// How often the modem lines are sampled while a client is connected.
+static const int kModemPollMs = 10;
+
+// Telnet commands and options (RFC 854, 856, 858).
+static const uint8_t kIac = 255;
+static const uint8_t kDont = 254;
+static const uint8_t kDo = 253;
+static const uint8_t kWont = 252;
+static const uint8_t kWill = 251;
+static const uint8_t kSb = 250;
+static const uint8_t kSe = 240;
+static const uint8_t kOptionBinary = 0;
+static const uint8_t kOptionSga = 3;
+static const uint8_t kOptionComPort = 44;
+
+// COM port commands (RFC 2217). Server replies add kServerOffset.
+static const uint8_t kSetBaudRate = 1;
+static const uint8_t kSetDataSize = 2;
+static const uint8_t kSetParity = 3;
+static const uint8_t kSetStopSize = 4;
+static const uint8_t kSetControl = 5;
+static const uint8_t kNotifyModemState = 7;
+static const uint8_t kFlowControlSuspend = 8;
+static const uint8_t kFlowControlResume = 9;
+static const uint8_t kSetLineStateMask = 10;
+static const uint8_t kSetModemStateMask = 11;
+static const uint8_t kPurgeData = 12;
+static const uint8_t kServerOffset = 100;
+// Passed as the threadsafe function's data to report a settings change.
+// Any other call means the thread stopped on its own.
+static int notify_tag;
+
+static void SetPoll(struct pollfd* pfd, int fd, short events) {
+  // Negative descriptors are ignored, so idle ones cannot wake the wait
+  // with a hangup nobody is going to act on yet.
+  pfd->fd = events != 0 ? fd : -1;
+  pfd->events = events;
+  pfd->revents = 0;
+}
+
+static bool IsSupportedOption(uint8_t option) {
+  return option == kOptionBinary ||
+         option == kOptionSga ||
+         option == kOptionComPort;
+}
+
+static uint8_t FlowControlCode(int flow_control) {
+  switch (flow_control) {
+    case SP_FLOWCONTROL_XONXOFF:
+      return 2;
+    case SP_FLOWCONTROL_RTSCTS:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
+static std::string OsErrorMessage(void) {
+  return uv_strerror(uv_translate_sys_error(errno));
+}
+
+#endif
+
+Rfc2217Server::Rfc2217Server() {
+  handle_ = nullptr;
+  io_generation_ = 0;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  listen_fd_ = -1;
+  client_fd_ = -1;
+  port_fd_ = -1;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  connected_ = false;
+  to_network_ = 0;
+  to_serial_ = 0;
+  connections_ = 0;
+  notify_pending_ = false;
+  net_in_start_ = 0;
+  net_in_end_ = 0;
+  net_out_start_ = 0;
+  serial_out_start_ = 0;
+  serial_out_end_ = 0;
+  telnet_state_ = kTelnetData;
+  telnet_verb_ = 0;
+  suspended_ = false;
+  dtr_ = true;
+  rts_ = true;
+  break_ = false;
+  modem_mask_ = 0xFF;
+  line_mask_ = 0;
+  modem_state_ = 0;
+  modem_query_ = false;
+  next_modem_poll_ns_ = 0;
+  memset(local_options_, 0, sizeof(local_options_));
+  memset(remote_options_, 0, sizeof(remote_options_));
+}
+
+Rfc2217Server::~Rfc2217Server() {}
+
+// The server is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void Rfc2217Server::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void Rfc2217Server::Destructor(napi_env env,
+                               void* native_object,
+                               void* finalize_hint) {
+  Rfc2217Server* server = static_cast<Rfc2217Server*>(native_object);
+
+  server->Stop(env);
+  napi_delete_reference(env, server->wrapper_ref_);
+  server->wrapper_ref_ = nullptr;
+  server->Release();
+}
+
+void Rfc2217Server::ThreadFinalize(napi_env env,
+                                   void* finalize_data,
+                                   void* finalize_hint) {
+  static_cast<Rfc2217Server*>(finalize_data)->Release();
+}
+
+// The thread calls into JS when the client has changed the line settings,
+// and when it stops on its own, because of an error or because the port was
+// closed.
+void Rfc2217Server::CallJs(napi_env env,
+                           napi_value js_callback,
+                           void* context,
+                           void* data) {
+  Rfc2217Server* server = static_cast<Rfc2217Server*>(context);
+
+  if (env == nullptr) {
+    return;
+  }
+
+  if (data == nullptr) {
+    server->Stop(env);
+    return;
+  }
+
+  server->notify_pending_ = false;
+  if (!server->closed_) {
+    server->CallConfigChanged(env, js_callback);
+  }
+}
+
+// Passes the port's current { baudRate, dataBits, stopBits, parity,
+// flowControl } to the callback, so that JS does not keep stale settings.
+void Rfc2217Server::CallConfigChanged(napi_env env, napi_value callback) {
+  const char* names[] = {
+    "baudRate", "dataBits", "stopBits", "parity", "flowControl"
+  };
+  int values[5];
+  napi_value config;
+  napi_value field;
+  napi_value recv;
+
+  if (handle_->get_config(&values[0],
+                          &values[1],
+                          &values[2],
+                          &values[3],
+                          &values[4]) != SP_OK ||
+      napi_create_object(env, &config) != napi_ok) {
+    return;
+  }
+
+  for (size_t i = 0; i < 5; i++) {
+    if (napi_create_int32(env, values[i], &field) != napi_ok ||
+        napi_set_named_property(env, config, names[i], field) != napi_ok) {
+      return;
+    }
+  }
+
+  if (napi_get_undefined(env, &recv) == napi_ok) {
+    napi_call_function(env, recv, callback, 1, &config, nullptr);
+  }
+}
+
+void Rfc2217Server::NotifyConfig(void) {
+  if (!notify_pending_.exchange(true)) {
+    napi_call_threadsafe_function(tsfn_, &notify_tag, napi_tsfn_nonblocking);
+  }
+}
+
+napi_value Rfc2217Server::CreateStats(napi_env env) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_get_boolean(env, connected_, &field),
+    "could not create connected"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "connected", field),
+    "could not set 'connected' property"
+  );
+  NAPI_CHECK(
+    napi_create_uint32(env, connections_, &field),
+    "could not create connections"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "connections", field),
+    "could not set 'connections' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(to_network_), &field),
+    "could not create toNetwork"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "toNetwork", field),
+    "could not set 'toNetwork' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(to_serial_), &field),
+    "could not create toSerial"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "toSerial", field),
+    "could not set 'toSerial' property"
+  );
+
+  return ret;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void Rfc2217Server::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the server thread, closes the sockets and settles the closed
+// promise, with the final stats or with the error that stopped the server.
+// Called from Close(), from the thread via CallJs(), and from the wrapper's
+// finalizer.
+void Rfc2217Server::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+#ifndef _WIN32
+  if (client_fd_ >= 0) {
+    close(client_fd_);
+    client_fd_ = -1;
+  }
+
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+#endif
+
+  connected_ = false;
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create server stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+#ifndef _WIN32
+
+void Rfc2217Server::SendCommand(uint8_t verb, uint8_t option) {
+  const uint8_t command[] = { kIac, verb, option };
+
+  net_out_.insert(net_out_.end(), command, command + sizeof(command));
+}
+
+void Rfc2217Server::SendSub(uint8_t command,
+                            const uint8_t* data,
+                            size_t size) {
+  const uint8_t head[] = {
+    kIac,
+    kSb,
+    kOptionComPort,
+    static_cast<uint8_t>(command + kServerOffset)
+  };
+
+  net_out_.insert(net_out_.end(), head, head + sizeof(head));
+  for (size_t i = 0; i < size; i++) {
+    net_out_.push_back(data[i]);
+    if (data[i] == kIac) {
+      net_out_.push_back(kIac);
+    }
+  }
+  net_out_.push_back(kIac);
+  net_out_.push_back(kSe);
+}
+
+// Takes a new client, or turns it away if one is already connected. The
+// server proposes binary mode in both directions and the COM port option,
+// and counts those as agreed unless the client objects.
+void Rfc2217Server::Accept(void) {
+  int fd;
+  int one = 1;
+
+  fd = accept(listen_fd_, nullptr, nullptr);
+  if (fd < 0) {
+    return;
+  }
+
+  if (client_fd_ >= 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+    close(fd);
+    return;
+  }
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+  client_fd_ = fd;
+  net_in_start_ = net_in_end_ = 0;
+  net_out_.clear();
+  net_out_start_ = 0;
+  serial_out_start_ = serial_out_end_ = 0;
+  telnet_state_ = kTelnetData;
+  sub_.clear();
+  memset(local_options_, 0, sizeof(local_options_));
+  memset(remote_options_, 0, sizeof(remote_options_));
+  suspended_ = false;
+  modem_mask_ = 0xFF;
+  line_mask_ = 0;
+  // Starting from all lines off makes the first sample report the current
+  // state to the client.
+  modem_state_ = 0;
+  modem_query_ = false;
+  next_modem_poll_ns_ = 0;
+
+  // Input that arrived while nobody was listening is stale.
+  handle_->discard_rx_buffer();
+
+  SendCommand(kWill, kOptionBinary);
+  SendCommand(kDo, kOptionBinary);
+  SendCommand(kWill, kOptionSga);
+  SendCommand(kDo, kOptionSga);
+  SendCommand(kDo, kOptionComPort);
+  local_options_[kOptionBinary] = true;
+  local_options_[kOptionSga] = true;
+  remote_options_[kOptionBinary] = true;
+  remote_options_[kOptionSga] = true;
+  remote_options_[kOptionComPort] = true;
+
+  connections_++;
+  connected_ = true;
+}
+
+void Rfc2217Server::Disconnect(void) {
+  close(client_fd_);
+  client_fd_ = -1;
+  connected_ = false;
+}
+
+bool Rfc2217Server::ReadNetwork(void) {
+  ssize_t n;
+
+  n = recv(client_fd_,
+           net_in_.data() + net_in_end_,
+           net_in_.size() - net_in_end_,
+           0);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+
+  net_in_end_ += n;
+  return n > 0;
+}
+
+// Answers option negotiation so that the two sides never loop: a request is
+// only acknowledged when it changes the state of the option.
+void Rfc2217Server::HandleOption(uint8_t verb, uint8_t option) {
+  switch (verb) {
+    case kDo:
+      if (!IsSupportedOption(option)) {
+        SendCommand(kWont, option);
+      } else if (!local_options_[option]) {
+        local_options_[option] = true;
+        SendCommand(kWill, option);
+      }
+      break;
+    case kDont:
+      if (local_options_[option]) {
+        local_options_[option] = false;
+        SendCommand(kWont, option);
+      }
+      break;
+    case kWill:
+      if (!IsSupportedOption(option)) {
+        SendCommand(kDont, option);
+      } else if (!remote_options_[option]) {
+        remote_options_[option] = true;
+        SendCommand(kDo, option);
+      }
+      break;
+    case kWont:
+      if (remote_options_[option]) {
+        remote_options_[option] = false;
+        SendCommand(kDont, option);
+      }
+      break;
+  }
+}
+
+// Applies a COM port command and replies with the resulting setting, which
+// tells the client whether its request took effect. Settings the port
+// cannot take are left alone rather than failing the connection.
+bool Rfc2217Server::HandleCommand(void) {
+  const uint8_t* data;
+  size_t size;
+  uint8_t value;
+  uint8_t reply[4];
+  int baud_rate;
+  int data_bits;
+  int stop_bits;
+  int parity;
+  int flow_control;
+  sp_return r;
+
+  if (sub_.size() < 2 || sub_[0] != kOptionComPort) {
+    return true;
+  }
+
+  data = sub_.data() + 2;
+  size = sub_.size() - 2;
+  if (size == 0 && sub_[1] != kNotifyModemState) {
+    return true;
+  }
+
+  value = size > 0 ? data[0] : 0;
+
+  switch (sub_[1]) {
+    case kSetBaudRate:
+      if (size < 4) {
+        return true;
+      }
+
+      baud_rate = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+      if (baud_rate > 0) {
+        handle_->reconfigure(baud_rate, 0, 0, -1, -1, nullptr);
+      }
+      break;
+    case kSetDataSize:
+      if (value >= 5 && value <= 8) {
+        handle_->reconfigure(0, value, 0, -1, -1, nullptr);
+      }
+      break;
+    case kSetParity:
+      // The RFC numbers none, odd, even, mark and space from 1, in the same
+      // order as enum sp_parity.
+      if (value >= 1 && value <= 5) {
+        handle_->reconfigure(0, 0, 0, value - 1, -1, nullptr);
+      }
+      break;
+    case kSetStopSize:
+      // 1.5 stop bits (3) is not supported.
+      if (value == 1 || value == 2) {
+        handle_->reconfigure(0, 0, value, -1, -1, nullptr);
+      }
+      break;
+    case kSetControl:
+      switch (value) {
+        case 1:
+        case 2:
+        case 3:
+          handle_->reconfigure(0,
+                               0,
+                               0,
+                               -1,
+                               value == 1 ? SP_FLOWCONTROL_NONE :
+                               value == 2 ? SP_FLOWCONTROL_XONXOFF :
+                                            SP_FLOWCONTROL_RTSCTS,
+                               nullptr);
+          break;
+        case 4:
+          value = break_ ? 5 : 6;
+          break;
+        case 5:
+        case 6:
+          if (handle_->set_signals(-1, -1, value == 5) == SP_OK) {
+            break_ = value == 5;
+          }
+          value = break_ ? 5 : 6;
+          break;
+        case 7:
+          value = dtr_ ? 8 : 9;
+          break;
+        case 8:
+        case 9:
+          if (handle_->set_signals(value == 8, -1, -1) == SP_OK) {
+            dtr_ = value == 8;
+          }
+          value = dtr_ ? 8 : 9;
+          break;
+        case 10:
+          value = rts_ ? 11 : 12;
+          break;
+        case 11:
+        case 12:
+          if (handle_->set_signals(-1, value == 11, -1) == SP_OK) {
+            rts_ = value == 11;
+          }
+          value = rts_ ? 11 : 12;
+          break;
+      }
+      break;
+    case kNotifyModemState:
+      // Some clients poll the modem lines this way.
+      next_modem_poll_ns_ = 0;
+      modem_query_ = true;
+      return true;
+    case kFlowControlSuspend:
+      suspended_ = true;
+      return true;
+    case kFlowControlResume:
+      suspended_ = false;
+      return true;
+    case kSetLineStateMask:
+      line_mask_ = value;
+      break;
+    case kSetModemStateMask:
+      modem_mask_ = value;
+      break;
+    case kPurgeData:
+      if (value & 1) {
+        handle_->discard_rx_buffer();
+      }
+      if (value & 2) {
+        handle_->discard_tx_buffer();
+        serial_out_start_ = serial_out_end_ = 0;
+      }
+      break;
+    default:
+      return true;
+  }
+
+  r = handle_->get_config(&baud_rate,
+                          &data_bits,
+                          &stop_bits,
+                          &parity,
+                          &flow_control);
+  if (r != SP_OK) {
+    error_ = ErrorMessage(r);
+    return false;
+  }
+
+  if (sub_[1] <= kSetStopSize || (sub_[1] == kSetControl && value <= 3)) {
+    NotifyConfig();
+  }
+
+  switch (sub_[1]) {
+    case kSetBaudRate:
+      reply[0] = baud_rate >> 24;
+      reply[1] = baud_rate >> 16;
+      reply[2] = baud_rate >> 8;
+      reply[3] = baud_rate;
+      SendSub(kSetBaudRate, reply, 4);
+      return true;
+    case kSetDataSize:
+      value = data_bits;
+      break;
+    case kSetParity:
+      value = parity + 1;
+      break;
+    case kSetStopSize:
+      value = stop_bits;
+      break;
+    case kSetControl:
+      if (value <= 3) {
+        value = FlowControlCode(flow_control);
+      }
+      break;
+  }
+
+  SendSub(sub_[1], &value, 1);
+  return true;
+}
+
+// Runs the Telnet state machine over the received bytes. Data bytes are
+// only consumed while there is room for them in the port's output buffer,
+// so a slow port holds back the client through TCP flow control.
+bool Rfc2217Server::ParseNetwork(void) {
+  uint8_t b;
+
+  while (net_in_start_ < net_in_end_) {
+    b = net_in_[net_in_start_];
+
+    if ((telnet_state_ == kTelnetData && b != kIac) ||
+        (telnet_state_ == kTelnetIac && b == kIac)) {
+      if (serial_out_end_ == serial_out_.size() && serial_out_start_ > 0) {
+        memmove(serial_out_.data(),
+                serial_out_.data() + serial_out_start_,
+                serial_out_end_ - serial_out_start_);
+        serial_out_end_ -= serial_out_start_;
+        serial_out_start_ = 0;
+      }
+
+      if (serial_out_end_ == serial_out_.size()) {
+        break;
+      }
+
+      serial_out_[serial_out_end_++] = b;
+      telnet_state_ = kTelnetData;
+      net_in_start_++;
+      continue;
+    }
+
+    net_in_start_++;
+
+    switch (telnet_state_) {
+      case kTelnetData:
+        telnet_state_ = kTelnetIac;
+        break;
+      case kTelnetIac:
+        if (b >= kWill && b <= kDont) {
+          telnet_verb_ = b;
+          telnet_state_ = kTelnetOption;
+        } else if (b == kSb) {
+          sub_.clear();
+          telnet_state_ = kTelnetSub;
+        } else {
+          // NOP, AYT and friends have no meaning for a serial port.
+          telnet_state_ = kTelnetData;
+        }
+        break;
+      case kTelnetOption:
+        HandleOption(telnet_verb_, b);
+        telnet_state_ = kTelnetData;
+        break;
+      case kTelnetSub:
+        if (b == kIac) {
+          telnet_state_ = kTelnetSubIac;
+        } else if (sub_.size() < kMaxSubSize) {
+          sub_.push_back(b);
+        }
+        break;
+      case kTelnetSubIac:
+        if (b == kSe) {
+          telnet_state_ = kTelnetData;
+          if (!HandleCommand()) {
+            return false;
+          }
+        } else if (b == kIac) {
+          if (sub_.size() < kMaxSubSize) {
+            sub_.push_back(kIac);
+          }
+          telnet_state_ = kTelnetSub;
+        } else {
+          telnet_state_ = kTelnetData;
+        }
+        break;
+    }
+  }
+
+  if (net_in_start_ == net_in_end_) {
+    net_in_start_ = net_in_end_ = 0;
+  } else if (net_in_end_ == net_in_.size() && net_in_start_ > 0) {
+    memmove(net_in_.data(),
+            net_in_.data() + net_in_start_,
+            net_in_end_ - net_in_start_);
+    net_in_end_ -= net_in_start_;
+    net_in_start_ = 0;
+  }
+
+  return true;
+}
+
+// Queues input from the port for the client, doubling any IAC bytes.
+bool Rfc2217Server::ReadSerial(void) {
+  uint8_t buf[kBufferSize];
+  int r;
+
+  r = handle_->read_data(buf, sizeof(buf));
+  if (r < 0) {
+    error_ = ErrorMessage(static_cast<sp_return>(r));
+    return false;
+  }
+
+  if (memchr(buf, kIac, r) == nullptr) {
+    net_out_.insert(net_out_.end(), buf, buf + r);
+  } else {
+    for (int i = 0; i < r; i++) {
+      net_out_.push_back(buf[i]);
+      if (buf[i] == kIac) {
+        net_out_.push_back(kIac);
+      }
+    }
+  }
+
+  to_network_ += r;
+  return true;
+}
+
+bool Rfc2217Server::WriteSerial(void) {
+  int r;
+
+  r = handle_->write_data(serial_out_.data() + serial_out_start_,
+                          serial_out_end_ - serial_out_start_);
+  if (r < 0) {
+    error_ = ErrorMessage(static_cast<sp_return>(r));
+    return false;
+  }
+
+  serial_out_start_ += r;
+  to_serial_ += r;
+
+  if (serial_out_start_ == serial_out_end_) {
+    serial_out_start_ = serial_out_end_ = 0;
+  }
+
+  return true;
+}
+
+bool Rfc2217Server::WriteNetwork(void) {
+  ssize_t n;
+
+  n = send(client_fd_,
+           net_out_.data() + net_out_start_,
+           net_out_.size() - net_out_start_,
+           MSG_NOSIGNAL);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+
+  net_out_start_ += n;
+  if (net_out_start_ == net_out_.size()) {
+    net_out_.clear();
+    net_out_start_ = 0;
+  } else if (net_out_start_ >= kBufferSize) {
+    net_out_.erase(net_out_.begin(), net_out_.begin() + net_out_start_);
+    net_out_start_ = 0;
+  }
+
+  return true;
+}
+
+// Samples the modem lines and tells the client about changes it asked for,
+// using the RFC 2217 NOTIFY-MODEMSTATE layout: CD, RI, DSR and CTS in the
+// high nibble, their delta bits in the low one.
+bool Rfc2217Server::NotifyModemState(void) {
+  uint64_t now = NowNs();
+  uint8_t state;
+  uint8_t changed;
+  uint8_t value;
+  int cts;
+  int dsr;
+  int dcd;
+  int ri;
+
+  if (now < next_modem_poll_ns_ || (modem_mask_ == 0 && !modem_query_)) {
+    return true;
+  }
+
+  next_modem_poll_ns_ = now + kModemPollMs * UINT64_C(1000000);
+
+  if (handle_->get_signals(&cts, &dsr, &dcd, &ri) != SP_OK) {
+    // Ports without modem lines simply never report them.
+    modem_mask_ = 0;
+    modem_query_ = false;
+    return true;
+  }
+
+  state = (cts ? 0x10 : 0) | (dsr ? 0x20 : 0) | (ri ? 0x40 : 0) |
+          (dcd ? 0x80 : 0);
+  changed = state ^ modem_state_;
+  value = state |
+          ((changed & 0x10) ? 0x01 : 0) |
+          ((changed & 0x20) ? 0x02 : 0) |
+          ((changed & 0x40) && !ri ? 0x04 : 0) |
+          ((changed & 0x80) ? 0x08 : 0);
+  modem_state_ = state;
+
+  if (modem_query_ || (changed != 0 && (value & modem_mask_) != 0)) {
+    value &= modem_mask_;
+    SendSub(kNotifyModemState, &value, 1);
+    modem_query_ = false;
+  }
+
+  return true;
+}
+
+// One pass of the server: waits briefly for the port, the listening socket
+// and the client, and serves whichever is ready. Returns false, with error_
+// set, if the server has to stop.
+bool Rfc2217Server::Step(void) {
+  struct pollfd pfds[3];
+  bool client;
+  short events;
+  int r;
+
+  client = client_fd_ >= 0;
+
+  events = 0;
+  if (client && !suspended_ &&
+      net_out_.size() - net_out_start_ < kBufferSize) {
+    events |= POLLIN;
+  }
+  if (serial_out_start_ < serial_out_end_) {
+    events |= POLLOUT;
+  }
+  SetPoll(&pfds[0], port_fd_, events);
+  SetPoll(&pfds[1], listen_fd_, POLLIN);
+
+  events = 0;
+  if (client && net_in_end_ < net_in_.size()) {
+    events |= POLLIN;
+  }
+  if (client && net_out_start_ < net_out_.size()) {
+    events |= POLLOUT;
+  }
+  SetPoll(&pfds[2], client_fd_, events);
+
+  r = poll(pfds,
+           3,
+           client && modem_mask_ != 0 ? kModemPollMs : kMaxWaitMs);
+  if (r < 0 && errno != EINTR) {
+    error_ = OsErrorMessage();
+    return false;
+  }
+
+  if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    error_ = "Port was disconnected";
+    return false;
+  }
+
+  if (pfds[1].revents & POLLIN) {
+    Accept();
+  }
+
+  if (!client) {
+    return true;
+  }
+
+  if (pfds[2].revents & (POLLIN | POLLHUP | POLLERR)) {
+    if (!ReadNetwork()) {
+      Disconnect();
+      return true;
+    }
+  }
+
+  if (net_in_start_ < net_in_end_ && !ParseNetwork()) {
+    return false;
+  }
+
+  if (pfds[0].revents & POLLIN) {
+    if (!ReadSerial()) {
+      return false;
+    }
+  }
+
+  if (serial_out_start_ < serial_out_end_ && !WriteSerial()) {
+    return false;
+  }
+
+  if (!NotifyModemState()) {
+    return false;
+  }
+
+  if (net_out_start_ < net_out_.size() && !WriteNetwork()) {
+    Disconnect();
+  }
+
+  return true;
+}
+
+void Rfc2217Server::Run(void* arg) {
+  Rfc2217Server* server = static_cast<Rfc2217Server*>(arg);
+  bool ok = true;
+
+  // Each pass counts as I/O on the port, so the port cannot be closed under
+  // it. Closing the port stops the server.
+  while (ok && !server->stopping_ &&
+         server->handle_->begin_io(server->io_generation_)) {
+    ok = server->Step();
+    server->handle_->end_io();
+  }
+
+  if (!server->stopping_) {
+    napi_call_threadsafe_function(server->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Binds the listening socket on the calling thread, so that address errors
+// are thrown to the caller.
+static int Listen(const char* host, uint32_t port, std::string* error) {
+  struct addrinfo hints;
+  struct addrinfo* info;
+  char service[8];
+  int one = 1;
+  int fd;
+  int r;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+  snprintf(service, sizeof(service), "%u", port);
+
+  r = getaddrinfo(host, service, &hints, &info);
+  if (r != 0) {
+    *error = gai_strerror(r);
+    return -1;
+  }
+
+  fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+  if (fd >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, info->ai_addr, info->ai_addrlen) < 0 ||
+        listen(fd, 4) < 0 ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+      *error = OsErrorMessage();
+      close(fd);
+      fd = -1;
+    }
+  } else {
+    *error = OsErrorMessage();
+  }
+
+  freeaddrinfo(info);
+  return fd;
+}
+
+static uint32_t LocalPort(int fd) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+
+  if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0) {
+    return 0;
+  }
+
+  if (addr.ss_family == AF_INET6) {
+    return ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+  }
+
+  return ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+}
+
+#endif
+
+// Starts serving an open port. Arguments are the handle, the numeric
+// address to listen on, the TCP port, where 0 picks a free one, and a
+// function called with the port's settings after the client changes them.
+// The returned object carries the port actually bound and a closed promise
+// that resolves with the final stats once the server is closed, or rejects
+// if the serial port fails.
+napi_value Rfc2217Server::Create(napi_env env, napi_callback_info info) {
+#ifdef _WIN32
+  napi_throw_error(env, nullptr, "Not supported");
+  return nullptr;
+#else
+  Rfc2217Server* server;
+  SerialHandle* handle;
+  napi_value argv[4];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value field;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 4;
+  char host[64];
+  size_t host_len;
+  uint32_t port;
+  std::string error;
+  int port_fd;
+  int fd;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[1], host, sizeof(host), &host_len),
+    "could not get host"
+  );
+  NAPI_CHECK(napi_get_value_uint32(env, argv[2], &port), "could not get port");
+
+  if (port > 65535) {
+    napi_throw_range_error(env, nullptr, "invalid TCP port");
+    return nullptr;
+  }
+
+  SP_CHECK(handle->get_os_handle(&port_fd));
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:rfc2217",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create server");
+
+  fd = Listen(host, port, &error);
+  if (fd < 0) {
+    napi_throw_error(env, nullptr, error.c_str());
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_uint32(env, LocalPort(fd), &field),
+    "could not create port"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "port", field),
+    "could not set 'port' property"
+  );
+
+  server = new Rfc2217Server();
+  server->handle_ = handle;
+  server->io_generation_ = handle->io_generation();
+  server->listen_fd_ = fd;
+  server->port_fd_ = port_fd;
+  server->net_in_.resize(kBufferSize);
+  server->serial_out_.resize(kBufferSize);
+
+  status = napi_create_threadsafe_function(env,
+                                           argv[3],
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           server,
+                                           ThreadFinalize,
+                                           server,
+                                           CallJs,
+                                           &server->tsfn_);
+  if (status != napi_ok) {
+    close(fd);
+    delete server;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the server. It
+  // stays referenced while the server runs, like any listening socket.
+  status = napi_create_promise(env, &server->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &server->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, server, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    server->closed_ = true;
+    close(server->listen_fd_);
+    napi_delete_reference(env, server->handle_ref_);
+    napi_release_threadsafe_function(server->tsfn_, napi_tsfn_release);
+    server->Release();
+    NAPI_CHECK(status, "could not wrap server");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &server->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&server->thread_, Run, server) != 0) {
+    server->error_ = "could not start server thread";
+    server->Stop(env);
+    napi_throw_error(env, nullptr, "could not start server thread");
+    return nullptr;
+  }
+
+  server->started_ = true;
+  RegisterThread(env, server);
+  return ret;
+#endif
+}
+
+// Returns whether a client is connected, how many have connected, and the
+// number of bytes passed each way so far.
+napi_value Rfc2217Server::Stats(napi_env env, napi_callback_info info) {
+  Rfc2217Server* server;
+  napi_value argv[1];
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&server)),
+    "could not unwrap server"
+  );
+
+  return server->CreateStats(env);
+}
+
+// Stops the server and drops any connected client. The port can be used
+// normally again once this returns.
+napi_value Rfc2217Server::Close(napi_env env, napi_callback_info info) {
+  Rfc2217Server* server;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&server)),
+    "could not unwrap server"
+  );
+
+  server->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef WEBSERIAL_RFC2217_H
+#define WEBSERIAL_RFC2217_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// A Telnet COM Port Control (RFC 2217) server for one open port. A single
+// client at a time gets the port's data stream and can change the line
+// settings and modem signals. Sockets and the port are served from one
+// dedicated thread, so no data passes through JS.
+class Rfc2217Server : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Stats(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    enum TelnetState {
+      kTelnetData,
+      kTelnetIac,
+      kTelnetOption,
+      kTelnetSub,
+      kTelnetSubIac
+    };
+
+    Rfc2217Server();
+    ~Rfc2217Server();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    napi_value CreateStats(napi_env env);
+    void CallConfigChanged(napi_env env, napi_value callback);
+    void NotifyConfig(void);
+    bool Step(void);
+    void Accept(void);
+    void Disconnect(void);
+    bool ReadNetwork(void);
+    bool ParseNetwork(void);
+    void HandleOption(uint8_t verb, uint8_t option);
+    bool HandleCommand(void);
+    bool ReadSerial(void);
+    bool WriteSerial(void);
+    bool WriteNetwork(void);
+    bool NotifyModemState(void);
+    void SendCommand(uint8_t verb, uint8_t option);
+    void SendSub(uint8_t command, const uint8_t* data, size_t size);
+
+    SerialHandle* handle_;
+    uint32_t io_generation_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    int listen_fd_;
+    int client_fd_;
+    int port_fd_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+    std::atomic<bool> connected_;
+    std::atomic<uint64_t> to_network_;
+    std::atomic<uint64_t> to_serial_;
+    std::atomic<uint32_t> connections_;
+    std::atomic<bool> notify_pending_;
+
+    // Per-connection state, only touched by the server thread.
+    std::vector<uint8_t> net_in_;
+    size_t net_in_start_;
+    size_t net_in_end_;
+    std::vector<uint8_t> net_out_;
+    size_t net_out_start_;
+    std::vector<uint8_t> serial_out_;
+    size_t serial_out_start_;
+    size_t serial_out_end_;
+    TelnetState telnet_state_;
+    uint8_t telnet_verb_;
+    std::vector<uint8_t> sub_;
+    bool local_options_[256];
+    bool remote_options_[256];
+    bool suspended_;
+    bool dtr_;
+    bool rts_;
+    bool break_;
+    uint8_t modem_mask_;
+    uint8_t line_mask_;
+    uint8_t modem_state_;
+    bool modem_query_;
+    uint64_t next_modem_poll_ns_;
+};
+
+}
+
+#endif
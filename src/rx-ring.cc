@@ -0,0 +1,418 @@
+#include "rx-ring.h"
+#include "util.h"
+
+namespace webserial {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "ring slots must be plain 32-bit words");
+
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+// Bytes that arrive while the ring is full are read into this much scratch
+// space at a time and counted as dropped.
+static const size_t kScratchSize = 4096;
+static const uint32_t kMinCapacity = 16;
+static const uint32_t kMaxCapacity = 1u << 30;
+
+// Passed through the threadsafe function to ask for a wakeup, as opposed to
+// nullptr, which means that the thread has stopped.
+static int notify_tag;
+
+RxRing::RxRing() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  buffer_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  deferred_ = nullptr;
+  tsfn_ = nullptr;
+  header_ = nullptr;
+  data_ = nullptr;
+  capacity_ = 0;
+  received_ = 0;
+  io_generation_ = 0;
+  dropped_ = 0;
+  notify_pending_ = false;
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+}
+
+RxRing::~RxRing() {}
+
+// The ring is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void RxRing::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void RxRing::Destructor(napi_env env,
+                        void* native_object,
+                        void* finalize_hint) {
+  RxRing* ring = static_cast<RxRing*>(native_object);
+
+  ring->Stop(env);
+  napi_delete_reference(env, ring->wrapper_ref_);
+  ring->wrapper_ref_ = nullptr;
+  ring->Release();
+}
+
+void RxRing::ThreadFinalize(napi_env env,
+                            void* finalize_data,
+                            void* finalize_hint) {
+  static_cast<RxRing*>(finalize_data)->Release();
+}
+
+// Atomics.notify() only exists in JS, so wakeups go through the owning
+// thread's event loop. The thread also calls in once if it stops on its
+// own, because the port failed or was closed.
+void RxRing::CallJs(napi_env env,
+                    napi_value js_callback,
+                    void* context,
+                    void* data) {
+  RxRing* ring = static_cast<RxRing*>(context);
+  napi_value recv;
+
+  if (env == nullptr) {
+    return;
+  }
+
+  if (data == nullptr) {
+    ring->Stop(env);
+    return;
+  }
+
+  ring->notify_pending_ = false;
+  if (napi_get_undefined(env, &recv) == napi_ok) {
+    napi_call_function(env, recv, js_callback, 0, nullptr, nullptr);
+  }
+}
+
+napi_value RxRing::CreateStats(napi_env env) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(received_), &field),
+    "could not create received"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "received", field),
+    "could not set 'received' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(dropped_), &field),
+    "could not create dropped"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "dropped", field),
+    "could not set 'dropped' property"
+  );
+
+  return ret;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void RxRing::Join(void) {
+  stopping_ = true;
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and settles the closed promise, with the final
+// byte counts or with the error that stopped the ring. Called from Close(),
+// from the thread via CallJs(), and from the wrapper's finalizer.
+void RxRing::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  if (error_.empty()) {
+    SettlePromise(env,
+                  deferred_,
+                  CreateStats(env),
+                  "could not create ring stats");
+  } else {
+    SettlePromise(env, deferred_, nullptr, error_);
+  }
+
+  deferred_ = nullptr;
+  napi_reference_unref(env, wrapper_ref_, nullptr);
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  napi_delete_reference(env, buffer_ref_);
+  handle_ref_ = nullptr;
+  buffer_ref_ = nullptr;
+}
+
+// Asks the owning thread to wake blocked consumers, unless nobody is
+// waiting or a wakeup is already on its way. Consumers only sleep while the
+// signal slot still holds the value they read before registering, so a
+// change that races with a wakeup cannot be missed.
+void RxRing::Notify(void) {
+  if (header_[kRingWaiters].load() == 0 || notify_pending_.exchange(true)) {
+    return;
+  }
+
+  napi_call_threadsafe_function(tsfn_, &notify_tag, napi_tsfn_nonblocking);
+}
+
+// Moves whatever the port has into the free part of the ring. When the
+// consumer has fallen a whole ring behind, new bytes are dropped and
+// counted rather than left in the OS, where an overrun would go unnoticed.
+sp_return RxRing::Fill(void) {
+  uint32_t write = header_[kRingWrite].load(std::memory_order_relaxed);
+  uint32_t read = header_[kRingRead].load(std::memory_order_acquire);
+  uint32_t used = write - read;
+  uint32_t offset;
+  uint32_t room;
+  int r;
+
+  if (used >= capacity_) {
+    r = handle_->read_data(scratch_.data(), scratch_.size());
+    if (r > 0) {
+      header_[kRingDropped].fetch_add(r);
+      dropped_ += r;
+    }
+
+    return r < 0 ? static_cast<sp_return>(r) : SP_OK;
+  }
+
+  offset = write & (capacity_ - 1);
+  room = capacity_ - used;
+  if (room > capacity_ - offset) {
+    room = capacity_ - offset;
+  }
+
+  r = handle_->read_data(data_ + offset, room);
+  if (r <= 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  header_[kRingWrite].store(write + r);
+  header_[kRingSignal].fetch_add(1);
+  received_ += r;
+  Notify();
+  return SP_OK;
+}
+
+// Waits briefly for input and moves whatever arrived into the ring.
+sp_return RxRing::Poll(void) {
+  SerialHandle* handles[1] = { handle_ };
+  int events[1] = { SP_EVENT_RX_READY };
+  int ready[1];
+  int r;
+
+  r = SerialHandle::wait_any(handles, events, ready, 1, kMaxWaitNs);
+  if (r <= 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  if (ready[0] & SP_EVENT_ERROR) {
+    error_ = "Port was disconnected";
+    return SP_OK;
+  }
+
+  return Fill();
+}
+
+void RxRing::Run(void* arg) {
+  RxRing* ring = static_cast<RxRing*>(arg);
+  sp_return r = SP_OK;
+
+  // Each pass counts as I/O on the port, so the port cannot be closed under
+  // it. Closing the port stops the ring.
+  while (!ring->stopping_ && ring->error_.empty() &&
+         ring->handle_->begin_io(ring->io_generation_)) {
+    r = ring->Poll();
+    ring->handle_->end_io();
+    if (r < 0) {
+      break;
+    }
+  }
+
+  if (r < 0) {
+    ring->error_ = ErrorMessage(r);
+  }
+
+  // The state is published from here, while the buffer is certainly still
+  // alive, rather than from Stop(), which may run during env teardown.
+  ring->header_[kRingState].store(
+    ring->error_.empty() ? kRingClosed : kRingFailed
+  );
+  ring->header_[kRingSignal].fetch_add(1);
+
+  if (!ring->stopping_) {
+    napi_call_threadsafe_function(ring->tsfn_, nullptr, napi_tsfn_blocking);
+  }
+}
+
+// Starts reading a port into a shared ring. Arguments are the handle, a
+// Uint8Array covering the whole SharedArrayBuffer, and a function that wakes
+// blocked consumers. The returned object has a closed promise that resolves
+// with the final byte counts once the ring is closed, or rejects if the
+// port fails.
+napi_value RxRing::Create(napi_env env, napi_callback_info info) {
+  RxRing* ring;
+  SerialHandle* handle;
+  napi_value argv[3];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value ret;
+  napi_value arraybuffer;
+  napi_typedarray_type type;
+  napi_status status;
+  size_t argc = 3;
+  size_t length;
+  size_t byte_offset;
+  size_t capacity;
+  void* data;
+  uint32_t i;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_typedarray_info(env,
+                             argv[1],
+                             &type,
+                             &length,
+                             &data,
+                             &arraybuffer,
+                             &byte_offset),
+    "could not get ring buffer"
+  );
+
+  capacity = length > kRingHeaderSize ? length - kRingHeaderSize : 0;
+  if (type != napi_uint8_array ||
+      reinterpret_cast<uintptr_t>(data) % sizeof(uint32_t) != 0 ||
+      capacity < kMinCapacity ||
+      capacity > kMaxCapacity ||
+      (capacity & (capacity - 1)) != 0) {
+    napi_throw_range_error(env, nullptr, "invalid ring buffer");
+    return nullptr;
+  }
+
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:rxring",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create ring");
+
+  ring = new RxRing();
+  ring->handle_ = handle;
+  ring->io_generation_ = handle->io_generation();
+  ring->header_ = static_cast<std::atomic<uint32_t>*>(data);
+  ring->data_ = static_cast<uint8_t*>(data) + kRingHeaderSize;
+  ring->capacity_ = static_cast<uint32_t>(capacity);
+  ring->scratch_.resize(kScratchSize);
+
+  for (i = 0; i < kRingHeaderSize / sizeof(uint32_t); i++) {
+    ring->header_[i].store(0);
+  }
+
+  ring->header_[kRingCapacity].store(ring->capacity_);
+
+  status = napi_create_threadsafe_function(env,
+                                           argv[2],
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           ring,
+                                           ThreadFinalize,
+                                           ring,
+                                           CallJs,
+                                           &ring->tsfn_);
+  if (status != napi_ok) {
+    delete ring;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the ring. It stays
+  // referenced while the ring runs, like a listening server.
+  status = napi_create_promise(env, &ring->deferred_, &promise);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "closed", promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &ring->handle_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[1], 1, &ring->buffer_ref_);
+  }
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, ring, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    ring->closed_ = true;
+    napi_delete_reference(env, ring->handle_ref_);
+    napi_delete_reference(env, ring->buffer_ref_);
+    napi_release_threadsafe_function(ring->tsfn_, napi_tsfn_release);
+    ring->Release();
+    NAPI_CHECK(status, "could not wrap ring");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 1, &ring->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&ring->thread_, Run, ring) != 0) {
+    ring->error_ = "could not start ring thread";
+    ring->Stop(env);
+    napi_throw_error(env, nullptr, "could not start ring thread");
+    return nullptr;
+  }
+
+  ring->started_ = true;
+  RegisterThread(env, ring);
+  return ret;
+}
+
+// Stops the ring. Consumers can still drain what is left in it, and the
+// port can be read normally again once this returns.
+napi_value RxRing::Close(napi_env env, napi_callback_info info) {
+  RxRing* ring;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&ring)),
+    "could not unwrap ring"
+  );
+
+  ring->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
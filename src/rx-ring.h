@@ -0,0 +1,92 @@
+#ifndef WEBSERIAL_RX_RING_H
+#define WEBSERIAL_RX_RING_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+// Reads a port on a dedicated thread straight into a ring that lives in a
+// SharedArrayBuffer, so any thread holding the buffer can consume the data
+// with Atomics and no per chunk allocation. The layout is shared with
+// lib/rx-ring.js: a header of kRingHeaderSize bytes holding the 32-bit slots
+// below, followed by the data area, whose size is a power of two. Positions
+// are byte counts that wrap at 2^32.
+enum RingSlot {
+  kRingWrite = 0,     // Bytes written, only advanced by the reader thread.
+  kRingRead = 1,      // Bytes consumed, only advanced by the consumer.
+  kRingDropped = 2,   // Bytes dropped because the ring was full.
+  kRingState = 3,     // One of RingState.
+  kRingWaiters = 4,   // Threads blocked waiting for kRingSignal to move.
+  kRingCapacity = 5,  // Size of the data area.
+  kRingConsumer = 6,  // 1 while a consumer has claimed kRingRead.
+  kRingSignal = 7     // Bumped after every write and state change.
+};
+
+enum RingState {
+  kRingOpen = 0,
+  kRingClosed = 1,
+  kRingFailed = 2
+};
+
+static const size_t kRingHeaderSize = 64;
+
+class RxRing : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    RxRing();
+    ~RxRing();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    sp_return Poll(void);
+    sp_return Fill(void);
+    void Notify(void);
+    napi_value CreateStats(napi_env env);
+
+    SerialHandle* handle_;
+    uint32_t io_generation_;
+    napi_ref handle_ref_;
+    napi_ref buffer_ref_;
+    napi_ref wrapper_ref_;
+    napi_deferred deferred_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    std::atomic<uint32_t>* header_;
+    uint8_t* data_;
+    uint32_t capacity_;
+    std::vector<uint8_t> scratch_;
+    uint64_t received_;
+    uint64_t dropped_;
+    std::atomic<bool> notify_pending_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    std::string error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,618 @@
+#include <stdint.h>
+#include <string.h>
+#include <regex>
+#include <string>
+#include <vector>
+#include "script.h"
+#include "serial-handle.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single wait for input, so the deadline is rechecked.
+static const uint64_t kMaxWaitNs = 50000000;
+static const size_t kReadChunkSize = 256;
+// Input kept for matching. Beyond this, the oldest bytes are dropped.
+static const size_t kMaxPendingSize = 65536;
+// Longest match a pattern is expected to make. Input is searched again only
+// from this far before the newest bytes, so that each read costs the same
+// however much has been received.
+static const size_t kMaxMatchSize = 4096;
+
+enum ScriptStatus {
+  kScriptOk = 0,
+  kScriptError,
+  kScriptTimeout,
+  kScriptSkipped
+};
+
+struct ScriptStep {
+  std::vector<uint8_t> send;
+  std::vector<std::regex> expect;
+  std::vector<std::regex> errors;
+  uint32_t timeout_ms;
+  uint32_t retries;
+  uint32_t delay_ms;
+  ScriptStatus status;
+  int match;
+  std::vector<std::string> groups;
+  std::string output;
+  uint32_t attempts;
+  uint64_t elapsed_ns;
+};
+
+struct ScriptWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref;
+  SerialHandle* handle;
+  uint32_t generation;
+  std::vector<ScriptStep> steps;
+  int failed_step;
+  sp_return result;
+  std::string error;
+};
+
+static const char* StatusName(ScriptStatus status) {
+  switch (status) {
+    case kScriptOk:
+      return "ok";
+    case kScriptError:
+      return "error";
+    case kScriptTimeout:
+      return "timeout";
+    default:
+      return "skipped";
+  }
+}
+
+// Finds the earliest match of any expect or error pattern in input that
+// starts at or after from. Expect patterns win ties. On success the step's
+// match, groups and status are set, and end is set to the offset just past
+// the match. Throws std::regex_error if a pattern is too complex to run
+// against the input.
+static bool MatchStep(ScriptStep* step,
+                      const std::string& input,
+                      size_t from,
+                      size_t* end) {
+  std::string::const_iterator begin = input.begin() + from;
+  // Anchors and word boundaries still see the byte before from.
+  std::regex_constants::match_flag_type flags =
+    from > 0 ? std::regex_constants::match_prev_avail :
+               std::regex_constants::match_default;
+  std::smatch best;
+  bool found = false;
+  bool is_error = false;
+  int index = -1;
+
+  for (size_t i = 0; i < step->expect.size() + step->errors.size(); i++) {
+    bool error = i >= step->expect.size();
+    const std::regex& re = error ? step->errors[i - step->expect.size()] :
+                                   step->expect[i];
+    std::smatch m;
+
+    if (std::regex_search(begin, input.end(), m, re, flags) &&
+        (!found || m.position(0) < best.position(0))) {
+      best = m;
+      found = true;
+      is_error = error;
+      index = error ? i - step->expect.size() : i;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  step->status = is_error ? kScriptError : kScriptOk;
+  step->match = index;
+  step->groups.clear();
+  for (size_t i = 0; i < best.size(); i++) {
+    step->groups.push_back(best[i].str());
+  }
+
+  *end = from + best.position(0) + best.length(0);
+  return true;
+}
+
+// Runs one attempt of a step. Input left over after the match is kept in
+// pending for the next step, since devices often send unsolicited lines
+// right after a final result code. Stops early, with the step unfinished,
+// if the port is closed. A pattern that is too complex to run fails the
+// step with status error and match -1.
+static sp_return RunAttempt(SerialHandle* handle,
+                            uint32_t generation,
+                            ScriptStep* step,
+                            std::string* pending) {
+  char buf[kReadChunkSize];
+  uint64_t deadline;
+  uint64_t now;
+  size_t from = 0;
+  size_t end;
+  bool received = true;
+  bool matched;
+  int r;
+
+  step->status = kScriptOk;
+  step->match = -1;
+  step->groups.clear();
+  step->output.clear();
+
+  if (!step->send.empty()) {
+    r = handle->write_all(step->send.data(),
+                          step->send.size(),
+                          step->timeout_ms,
+                          generation);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    if (static_cast<size_t>(r) < step->send.size()) {
+      step->status = kScriptTimeout;
+      return SP_OK;
+    }
+  }
+
+  if (step->expect.empty() && step->errors.empty()) {
+    return SP_OK;
+  }
+
+  deadline = NowNs() + step->timeout_ms * UINT64_C(1000000);
+  for (;;) {
+    if (received) {
+      try {
+        matched = MatchStep(step, *pending, from, &end);
+      } catch (const std::regex_error&) {
+        step->status = kScriptError;
+        step->match = -1;
+        step->groups.clear();
+        step->output.swap(*pending);
+        pending->clear();
+        return SP_OK;
+      }
+
+      if (matched) {
+        step->output.assign(*pending, 0, end);
+        pending->erase(0, end);
+        return SP_OK;
+      }
+    }
+
+    now = NowNs();
+    if (now >= deadline || handle->io_cancelled(generation)) {
+      step->status = kScriptTimeout;
+      step->output.swap(*pending);
+      pending->clear();
+      return SP_OK;
+    }
+
+    r = handle->wait_input(deadline - now < kMaxWaitNs ?
+                           deadline - now : kMaxWaitNs);
+    if (r > 0) {
+      r = handle->read_data(buf, sizeof(buf));
+    }
+
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    received = r > 0;
+    if (!received) {
+      continue;
+    }
+
+    // A new match has to end in the new bytes, since anything before them
+    // has been searched already.
+    from = pending->size() > kMaxMatchSize ?
+           pending->size() - kMaxMatchSize : 0;
+    pending->append(buf, r);
+    if (pending->size() > kMaxPendingSize) {
+      size_t excess = pending->size() - kMaxPendingSize;
+
+      pending->erase(0, excess);
+      from = from > excess ? from - excess : 0;
+    }
+  }
+}
+
+static void RunSteps(ScriptWork* w) {
+  std::string pending;
+  uint64_t start;
+
+  for (size_t i = 0; i < w->steps.size(); i++) {
+    ScriptStep& step = w->steps[i];
+
+    if (w->failed_step >= 0) {
+      step.status = kScriptSkipped;
+      continue;
+    }
+
+    start = NowNs();
+    do {
+      step.attempts++;
+      w->result = RunAttempt(w->handle, w->generation, &step, &pending);
+      if (w->result != SP_OK) {
+        w->error = ErrorMessage(w->result);
+        return;
+      }
+    } while (step.status != kScriptOk && step.attempts <= step.retries &&
+             !w->handle->io_cancelled(w->generation));
+
+    if (step.status != kScriptOk) {
+      w->failed_step = i;
+    } else if (step.delay_ms > 0) {
+      SleepUntilNs(NowNs() + step.delay_ms * UINT64_C(1000000));
+    }
+
+    step.elapsed_ns = NowNs() - start;
+  }
+}
+
+static void RunScriptExecute(napi_env env, void* data) {
+  ScriptWork* w = static_cast<ScriptWork*>(data);
+
+  if (w->handle->begin_io(w->generation)) {
+    RunSteps(w);
+    w->handle->end_io();
+  }
+
+  if (w->result == SP_OK && w->handle->io_cancelled(w->generation)) {
+    w->result = SP_ERR_FAIL;
+    w->error = "script was cancelled";
+  }
+}
+
+static napi_value CreateStepResult(napi_env env, ScriptStep* step) {
+  napi_value ret;
+  napi_value field;
+  napi_value group;
+  void* backing_store;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create step result");
+  NAPI_CHECK(
+    napi_create_string_utf8(env,
+                            StatusName(step->status),
+                            NAPI_AUTO_LENGTH,
+                            &field),
+    "could not create status"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "status", field),
+    "could not set 'status' property"
+  );
+  NAPI_CHECK(
+    napi_create_int32(env, step->match, &field),
+    "could not create match"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "match", field),
+    "could not set 'match' property"
+  );
+  NAPI_CHECK(
+    napi_create_array_with_length(env, step->groups.size(), &field),
+    "could not create groups"
+  );
+  for (size_t i = 0; i < step->groups.size(); i++) {
+    NAPI_CHECK(
+      napi_create_string_utf8(env,
+                              step->groups[i].c_str(),
+                              step->groups[i].size(),
+                              &group),
+      "could not create group"
+    );
+    NAPI_CHECK(
+      napi_set_element(env, field, i, group),
+      "could not set group"
+    );
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "groups", field),
+    "could not set 'groups' property"
+  );
+  NAPI_CHECK(
+    napi_create_arraybuffer(env, step->output.size(), &backing_store, &field),
+    "could not create array buffer"
+  );
+  if (!step->output.empty()) {
+    memcpy(backing_store, step->output.data(), step->output.size());
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "output", field),
+    "could not set 'output' property"
+  );
+  NAPI_CHECK(
+    napi_create_uint32(env, step->attempts, &field),
+    "could not create attempts"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "attempts", field),
+    "could not set 'attempts' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, step->elapsed_ns / 1e6, &field),
+    "could not create time"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "time", field),
+    "could not set 'time' property"
+  );
+
+  return ret;
+}
+
+static napi_value CreateScriptResult(napi_env env, ScriptWork* w) {
+  napi_value ret;
+  napi_value steps;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create result");
+  NAPI_CHECK(
+    napi_get_boolean(env, w->failed_step < 0, &field),
+    "could not create ok"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "ok", field),
+    "could not set 'ok' property"
+  );
+  NAPI_CHECK(
+    napi_create_int32(env, w->failed_step, &field),
+    "could not create failedStep"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "failedStep", field),
+    "could not set 'failedStep' property"
+  );
+  NAPI_CHECK(
+    napi_create_array_with_length(env, w->steps.size(), &steps),
+    "could not create steps"
+  );
+  for (size_t i = 0; i < w->steps.size(); i++) {
+    field = CreateStepResult(env, &w->steps[i]);
+    if (field == nullptr) {
+      return nullptr;
+    }
+
+    NAPI_CHECK(
+      napi_set_element(env, steps, i, field),
+      "could not set step result"
+    );
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "steps", steps),
+    "could not set 'steps' property"
+  );
+
+  return ret;
+}
+
+static void RunScriptComplete(napi_env env, napi_status status, void* data) {
+  ScriptWork* w = static_cast<ScriptWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    ret = CreateScriptResult(env, w);
+  } else if (status != napi_ok) {
+    w->error = "script was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_reference(env, w->handle_ref);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+static std::regex CompilePattern(const std::string& source,
+                                 bool ignore_case) {
+  std::regex::flag_type flags = ignore_case ? std::regex::ECMAScript |
+                                              std::regex::icase :
+                                              std::regex::ECMAScript;
+
+#ifdef __GLIBCXX__
+  // libstdc++ normally matches by backtracking, which takes exponential
+  // time and stack on patterns such as /(a|a)*c/. Its polynomial mode runs
+  // in time linear in the input, but cannot handle back-references, so
+  // only those patterns fall back to backtracking.
+  try {
+    return std::regex(source, flags | std::regex_constants::__polynomial);
+  } catch (const std::regex_error&) {
+  }
+#endif
+
+  return std::regex(source, flags);
+}
+
+// Compiles an array of { source, ignoreCase } objects. Patterns use the
+// ECMAScript grammar, which covers what AT and chat scripts need.
+static napi_status GetPatterns(napi_env env,
+                               napi_value value,
+                               std::vector<std::regex>* patterns) {
+  napi_value element;
+  napi_value field;
+  napi_status status;
+  uint32_t count;
+  size_t len;
+  bool ignore_case;
+
+  status = napi_get_array_length(env, value, &count);
+  for (uint32_t i = 0; status == napi_ok && i < count; i++) {
+    std::string source;
+
+    status = napi_get_element(env, value, i, &element);
+    if (status == napi_ok) {
+      status = napi_get_named_property(env, element, "source", &field);
+    }
+    if (status == napi_ok) {
+      status = napi_get_value_string_utf8(env, field, nullptr, 0, &len);
+    }
+    if (status == napi_ok) {
+      source.resize(len);
+      status = napi_get_value_string_utf8(env,
+                                          field,
+                                          &source[0],
+                                          len + 1,
+                                          &len);
+    }
+    if (status == napi_ok) {
+      status = napi_get_named_property(env, element, "ignoreCase", &field);
+    }
+    if (status == napi_ok) {
+      status = napi_get_value_bool(env, field, &ignore_case);
+    }
+    if (status != napi_ok) {
+      break;
+    }
+
+    try {
+      patterns->push_back(CompilePattern(source, ignore_case));
+    } catch (const std::regex_error&) {
+      std::string message = "invalid pattern /" + source + "/";
+
+      napi_throw_error(env, nullptr, message.c_str());
+      return napi_pending_exception;
+    }
+  }
+
+  return status;
+}
+
+static napi_status GetStep(napi_env env, napi_value value, ScriptStep* step) {
+  napi_value field;
+  napi_valuetype type;
+  napi_status status;
+  void* buf;
+  size_t len;
+
+  step->timeout_ms = 0;
+  step->retries = 0;
+  step->delay_ms = 0;
+  step->status = kScriptSkipped;
+  step->match = -1;
+  step->attempts = 0;
+  step->elapsed_ns = 0;
+
+  status = napi_get_named_property(env, value, "send", &field);
+  if (status == napi_ok) {
+    status = napi_typeof(env, field, &type);
+  }
+  if (status == napi_ok && type != napi_undefined) {
+    status = napi_get_arraybuffer_info(env, field, &buf, &len);
+    if (status == napi_ok) {
+      step->send.assign(static_cast<uint8_t*>(buf),
+                        static_cast<uint8_t*>(buf) + len);
+    }
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "expect", &field);
+  }
+  if (status == napi_ok) {
+    status = GetPatterns(env, field, &step->expect);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "error", &field);
+  }
+  if (status == napi_ok) {
+    status = GetPatterns(env, field, &step->errors);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "timeout", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_uint32(env, field, &step->timeout_ms);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "retries", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_uint32(env, field, &step->retries);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "delay", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_uint32(env, field, &step->delay_ms);
+  }
+
+  return status;
+}
+
+// Runs a send/expect script on the threadpool. Each step optionally sends
+// bytes, then waits until one of its expect or error patterns matches or its
+// timeout expires, retrying the whole step up to retries more times. The
+// first failing step ends the script. Resolves with per-step results and
+// timings once the script is done.
+napi_value RunScript(napi_env env, napi_callback_info info) {
+  ScriptWork* w;
+  napi_value argv[2];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value element;
+  napi_status status;
+  size_t argc = 2;
+  uint32_t count;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_array_length(env, argv[1], &count),
+    "could not get step count"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:runScript",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  w = new ScriptWork();
+  w->handle_ref = nullptr;
+  w->failed_step = -1;
+  w->result = SP_OK;
+  w->steps.resize(count);
+
+  status = napi_unwrap(env, argv[0], reinterpret_cast<void**>(&w->handle));
+  if (status == napi_ok) {
+    w->generation = w->handle->io_generation();
+  }
+  for (uint32_t i = 0; status == napi_ok && i < count; i++) {
+    status = napi_get_element(env, argv[1], i, &element);
+    if (status == napi_ok) {
+      status = GetStep(env, element, &w->steps[i]);
+    }
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &w->handle_ref);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    RunScriptExecute,
+                                    RunScriptComplete,
+                                    w,
+                                    &w->work);
+  }
+
+  if (status != napi_ok) {
+    if (w->handle_ref != nullptr) {
+      napi_delete_reference(env, w->handle_ref);
+    }
+    delete w;
+    NAPI_CHECK(status, "could not create async work");
+  }
+
+  NAPI_CHECK(
+    napi_create_promise(env, &w->deferred, &promise),
+    "could not create promise"
+  );
+  NAPI_CHECK(napi_queue_async_work(env, w->work), "could not queue work");
+
+  return promise;
+}
+
+}
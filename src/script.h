@@ -0,0 +1,12 @@
+#ifndef WEBSERIAL_SCRIPT_H
+#define WEBSERIAL_SCRIPT_H
+
+#include <node_api.h>
+
+namespace webserial {
+
+napi_value RunScript(napi_env env, napi_callback_info info);
+
+}
+
+#endif
@@ -1,6 +1,16 @@
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/serial.h>
+#endif
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#endif
+#include <string.h>
+#include "addon-data.h"
 #include "serial-handle.h"
-
-napi_ref SerialHandle::constructor;
+#include "timing.h"
 
 #define RETURN_ON_ERROR(result)                                               \
   do {                                                                        \
@@ -9,10 +19,43 @@ napi_ref SerialHandle::constructor;
     }                                                                         \
   } while(0)
 
+static std::atomic<IoctlFunction> ioctl_function(nullptr);
+
+#ifndef _WIN32
+static int PortIoctl(int fd, unsigned long request, void* arg) {
+  IoctlFunction function = ioctl_function;
+
+  if (function != nullptr) {
+    return function(fd, request, arg);
+  }
+
+  return ioctl(fd, request, arg);
+}
+#endif
+
+// For native test harnesses, which can look this up in the loaded addon to
+// run it against a fake driver. See SerialHandle::set_ioctl_function().
+extern "C"
+#ifdef _WIN32
+__declspec(dllexport)
+#else
+__attribute__((visibility("default")))
+#endif
+void webserial_set_ioctl(IoctlFunction function) {
+  SerialHandle::set_ioctl_function(function);
+}
+
 SerialHandle::SerialHandle() {
   env_ = nullptr;
   wrapper_ = nullptr;
   port_ = nullptr;
+  io_pending_ = 0;
+  io_generation_ = 0;
+  drain_generation_ = 0;
+  uv_mutex_init(&io_mutex_);
+  uv_cond_init(&io_idle_);
+  uv_mutex_init(&config_mutex_);
+  uv_mutex_init(&unread_mutex_);
 }
 
 SerialHandle::~SerialHandle() {
@@ -22,10 +65,15 @@ SerialHandle::~SerialHandle() {
     port_ = nullptr;
   }
 
+  uv_mutex_destroy(&unread_mutex_);
+  uv_mutex_destroy(&config_mutex_);
+  uv_cond_destroy(&io_idle_);
+  uv_mutex_destroy(&io_mutex_);
   napi_delete_reference(env_, wrapper_);
 }
 
 napi_status SerialHandle::Init(napi_env env) {
+  webserial::AddonData* data = webserial::GetAddonData(env);
   napi_status status;
   napi_value cons;
 
@@ -41,7 +89,9 @@ napi_status SerialHandle::Init(napi_env env) {
     return status;
   }
 
-  status = napi_create_reference(env, cons, 1, &constructor);
+  // The constructor belongs to this env, so each env that loads the addon
+  // (the main thread and every worker) keeps its own reference.
+  status = napi_create_reference(env, cons, 1, &data->handle_constructor);
   if (status != napi_ok) {
     return status;
   }
@@ -85,11 +135,12 @@ void SerialHandle::Destructor(napi_env env,
 napi_status SerialHandle::NewInstance(napi_env env,
                                       struct sp_port* port,
                                       napi_value* instance) {
+  webserial::AddonData* data = webserial::GetAddonData(env);
   const int argc = 0;
   napi_value cons;
   napi_status status;
 
-  status = napi_get_reference_value(env, constructor, &cons);
+  status = napi_get_reference_value(env, data->handle_constructor, &cons);
   if (status != napi_ok) {
     return status;
   }
@@ -110,13 +161,22 @@ napi_status SerialHandle::NewInstance(napi_env env,
   return napi_ok;
 }
 
-sp_return SerialHandle::close_port(void) {
-  sp_return r;
+// Hands the open port over to the caller, leaving this handle closed. Used
+// to move a port to a handle in another env.
+struct sp_port* SerialHandle::detach_port(void) {
+  struct sp_port* port = port_;
 
-  r = sp_close(port_);
+  echo_.disable();
+  take_unread(nullptr, SIZE_MAX);
   port_ = nullptr;
+  return port;
+}
 
-  return r;
+// The port itself is kept, so that the handle can be opened again.
+sp_return SerialHandle::close_port(void) {
+  echo_.disable();
+  take_unread(nullptr, SIZE_MAX);
+  return sp_close(port_);
 }
 
 sp_return SerialHandle::open_port(int baud_rate,
@@ -127,14 +187,9 @@ sp_return SerialHandle::open_port(int baud_rate,
   struct sp_port_config* config;
   sp_return r;
 
-  r = sp_open(port_, SP_MODE_READ_WRITE);
-  if (r != SP_OK) {
-    return r;
-  }
-
   r = sp_new_config(&config);
   if (r != SP_OK) {
-    goto close_port;
+    return r;
   }
 
   r = sp_set_config_baudrate(config, baud_rate);
@@ -162,19 +217,227 @@ sp_return SerialHandle::open_port(int baud_rate,
     goto free_config;
   }
 
-  r = sp_set_config(port_, config);
+  // Opening and configuring in one step reads and writes the port settings
+  // once, instead of once for sp_open() and again for sp_set_config().
+  r = sp_open_with_config(port_, SP_MODE_READ_WRITE, config);
 
 free_config:
   sp_free_config(config);
 
-close_port:
-  if (r != SP_OK) {
-    sp_close(port_);
+  return r;
+}
+
+struct ConfigUpdate {
+  SerialHandle* handle;
+  int baud_rate;
+  int data_bits;
+  int stop_bits;
+  int parity;
+  int flow_control;
+  ReconfigureDrain* drain;
+};
+
+// Returns the flow control mode that the settings amount to, or -1 if they
+// mix modes, so that they get rewritten whatever mode is asked for.
+static int FlowControlMode(enum sp_rts rts,
+                           enum sp_cts cts,
+                           enum sp_xonxoff xon_xoff) {
+  bool hardware = rts == SP_RTS_FLOW_CONTROL && cts == SP_CTS_FLOW_CONTROL;
+  bool software = xon_xoff == SP_XONXOFF_INOUT;
+
+  if (hardware && xon_xoff == SP_XONXOFF_DISABLED) {
+    return SP_FLOWCONTROL_RTSCTS;
+  }
+
+  if (software && rts != SP_RTS_FLOW_CONTROL && cts != SP_CTS_FLOW_CONTROL) {
+    return SP_FLOWCONTROL_XONXOFF;
+  }
+
+  if (xon_xoff == SP_XONXOFF_DISABLED && rts != SP_RTS_FLOW_CONTROL &&
+      cts != SP_CTS_FLOW_CONTROL) {
+    return SP_FLOWCONTROL_NONE;
+  }
+
+  return -1;
+}
+
+// Called by sp_update_config() with the current settings. Fills in only the
+// ones that differ, and drains first if anything is about to change.
+static int DiffConfig(const struct sp_port_config* current,
+                      struct sp_port_config* changes,
+                      void* user_data) {
+  ConfigUpdate* update = static_cast<ConfigUpdate*>(user_data);
+  bool changed = false;
+  enum sp_parity cur_parity;
+  enum sp_rts cur_rts;
+  enum sp_cts cur_cts;
+  enum sp_xonxoff cur_xon_xoff;
+  int cur_baud_rate;
+  int cur_data_bits;
+  int cur_stop_bits;
+  sp_return r;
+
+  sp_get_config_baudrate(current, &cur_baud_rate);
+  sp_get_config_bits(current, &cur_data_bits);
+  sp_get_config_stopbits(current, &cur_stop_bits);
+  sp_get_config_parity(current, &cur_parity);
+  sp_get_config_rts(current, &cur_rts);
+  sp_get_config_cts(current, &cur_cts);
+  sp_get_config_xon_xoff(current, &cur_xon_xoff);
+
+  if (update->baud_rate > 0 && update->baud_rate != cur_baud_rate) {
+    sp_set_config_baudrate(changes, update->baud_rate);
+    changed = true;
+  }
+
+  if (update->data_bits > 0 && update->data_bits != cur_data_bits) {
+    sp_set_config_bits(changes, update->data_bits);
+    changed = true;
+  }
+
+  if (update->stop_bits > 0 && update->stop_bits != cur_stop_bits) {
+    sp_set_config_stopbits(changes, update->stop_bits);
+    changed = true;
+  }
+
+  if (update->parity >= 0 && update->parity != cur_parity) {
+    sp_set_config_parity(changes, (enum sp_parity)update->parity);
+    changed = true;
+  }
+
+  if (update->flow_control >= 0 &&
+      update->flow_control !=
+        FlowControlMode(cur_rts, cur_cts, cur_xon_xoff)) {
+    // Start from the current RTS setting, so that turning flow control off
+    // leaves RTS asserted rather than unspecified.
+    sp_set_config_rts(changes, cur_rts);
+    r = sp_set_config_flowcontrol(changes,
+                                  (enum sp_flowcontrol)update->flow_control);
+    if (r != SP_OK) {
+      return r;
+    }
+    changed = true;
+  }
+
+  if (!changed) {
+    return 0;
+  }
+
+  if (update->drain != nullptr) {
+    ReconfigureDrain* drain = update->drain;
+
+    r = update->handle->drain_output(drain->stall_timeout_ms,
+                                     drain->io_generation,
+                                     drain->drain_generation,
+                                     nullptr,
+                                     &drain->outcome);
+    if (r != SP_OK) {
+      return r;
+    }
+    if (drain->outcome != kDrainCompleted) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Applies only the settings which differ from the current configuration.
+// Negative values leave a setting unchanged. If drain is given, pending
+// output is transmitted with the old settings before switching, and nothing
+// changes unless that drain completes. Blocks while it drains, so it runs
+// off the JS thread.
+sp_return SerialHandle::reconfigure(int baud_rate,
+                                    int data_bits,
+                                    int stop_bits,
+                                    int parity,
+                                    int flow_control,
+                                    ReconfigureDrain* drain) {
+  ConfigUpdate update;
+  sp_return r;
+
+  update.handle = this;
+  update.baud_rate = baud_rate;
+  update.data_bits = data_bits;
+  update.stop_bits = stop_bits;
+  update.parity = parity;
+  update.flow_control = flow_control;
+  update.drain = drain;
+  if (drain != nullptr) {
+    // Nothing needed changing, unless DiffConfig() says otherwise.
+    drain->outcome = kDrainCompleted;
   }
 
+  uv_mutex_lock(&config_mutex_);
+  r = sp_update_config(port_, DiffConfig, &update);
+  uv_mutex_unlock(&config_mutex_);
+
+  return r;
+}
+
+// Reads back the current line settings, using the same encoding as
+// reconfigure(). The baud rate is the one the hardware actually runs at,
+// and the flow control is -1 if the settings mix modes.
+sp_return SerialHandle::get_config(int* baud_rate,
+                                   int* data_bits,
+                                   int* stop_bits,
+                                   int* parity,
+                                   int* flow_control) {
+  struct sp_port_config* config;
+  enum sp_parity cur_parity;
+  enum sp_rts cur_rts;
+  enum sp_cts cur_cts;
+  enum sp_xonxoff cur_xon_xoff;
+  sp_return r;
+
+  RETURN_ON_ERROR(sp_new_config(&config));
+  r = sp_get_config(port_, config);
+  if (r == SP_OK) {
+    sp_get_config_bits(config, data_bits);
+    sp_get_config_stopbits(config, stop_bits);
+    sp_get_config_parity(config, &cur_parity);
+    sp_get_config_rts(config, &cur_rts);
+    sp_get_config_cts(config, &cur_cts);
+    sp_get_config_xon_xoff(config, &cur_xon_xoff);
+    *parity = cur_parity;
+    *flow_control = FlowControlMode(cur_rts, cur_cts, cur_xon_xoff);
+
+    r = sp_get_actual_baudrate(port_, baud_rate);
+  }
+  sp_free_config(config);
+
   return r;
 }
 
+// Nanoseconds one character takes on the wire at the current settings,
+// counting the start, parity and stop bits.
+sp_return SerialHandle::get_char_time(uint64_t* char_ns) {
+  int baud_rate;
+  int data_bits;
+  int stop_bits;
+  int parity;
+  int flow_control;
+  int bits;
+
+  RETURN_ON_ERROR(
+    get_config(&baud_rate, &data_bits, &stop_bits, &parity, &flow_control)
+  );
+  bits = 1 + data_bits + stop_bits + (parity == SP_PARITY_NONE ? 0 : 1);
+  *char_ns = webserial::CharTimeNs(baud_rate, bits);
+
+  return SP_OK;
+}
+
+sp_return SerialHandle::get_baud_rate(int* baud_rate) {
+  return sp_get_actual_baudrate(port_, baud_rate);
+}
+
+// Returns the OS handle of the open port: a file descriptor on POSIX, a
+// HANDLE on Windows.
+sp_return SerialHandle::get_os_handle(void* result) {
+  return sp_get_port_handle(port_, result);
+}
+
 sp_return SerialHandle::get_signals(int* cts, int* dsr, int* dcd, int* ri) {
   sp_signal mask;
   sp_return r;
@@ -188,7 +451,31 @@ sp_return SerialHandle::get_signals(int* cts, int* dsr, int* dcd, int* ri) {
   return r;
 }
 
+// Each signal is 0 to clear it, 1 to set it or anything else to leave it.
 sp_return SerialHandle::set_signals(int dtr, int rts, int brk) {
+#ifndef _WIN32
+  // Changing DTR and RTS in one ioctl keeps auto-reset circuits, such as
+  // those on ESP32 boards, from ever seeing the lines half way through.
+  if ((dtr == 0 || dtr == 1) && (rts == 0 || rts == 1)) {
+    int fd;
+    int bits;
+
+    RETURN_ON_ERROR(sp_get_port_handle(port_, &fd));
+    if (PortIoctl(fd, TIOCMGET, &bits) < 0) {
+      return SP_ERR_FAIL;
+    }
+
+    bits = dtr ? bits | TIOCM_DTR : bits & ~TIOCM_DTR;
+    bits = rts ? bits | TIOCM_RTS : bits & ~TIOCM_RTS;
+    if (PortIoctl(fd, TIOCMSET, &bits) < 0) {
+      return SP_ERR_FAIL;
+    }
+
+    dtr = -1;
+    rts = -1;
+  }
+#endif
+
   if (dtr == 0) {
     RETURN_ON_ERROR(sp_set_dtr(port_, SP_DTR_OFF));
   } else if (dtr == 1) {
@@ -210,15 +497,390 @@ sp_return SerialHandle::set_signals(int dtr, int rts, int brk) {
   return SP_OK;
 }
 
+// Turns kernel RS-485 mode on or off. Only Linux has it; elsewhere turning
+// it off is the only thing that succeeds.
+sp_return SerialHandle::set_rs485(const Rs485Config& config) {
+#ifdef __linux__
+  struct serial_rs485 rs485 = {};
+  int fd;
+
+  RETURN_ON_ERROR(sp_get_port_handle(port_, &fd));
+  if (config.enabled) {
+    rs485.flags = SER_RS485_ENABLED;
+    if (config.rts_on_send) {
+      rs485.flags |= SER_RS485_RTS_ON_SEND;
+    }
+    if (config.rts_after_send) {
+      rs485.flags |= SER_RS485_RTS_AFTER_SEND;
+    }
+    if (config.rx_during_tx) {
+      rs485.flags |= SER_RS485_RX_DURING_TX;
+    }
+    rs485.delay_rts_before_send = config.delay_before_send;
+    rs485.delay_rts_after_send = config.delay_after_send;
+  }
+
+  if (PortIoctl(fd, TIOCSRS485, &rs485) < 0) {
+    // Drivers without RS-485 support have nothing to turn off.
+    if (!config.enabled && (errno == ENOTTY || errno == EINVAL)) {
+      return SP_OK;
+    }
+
+    return SP_ERR_FAIL;
+  }
+
+  return SP_OK;
+#else
+  return config.enabled ? SP_ERR_SUPP : SP_OK;
+#endif
+}
+
+// Starts dropping the echo of what is written from what is read. An echo
+// is expected within timeout_ns of the bytes having been transmitted at the
+// current settings.
+sp_return SerialHandle::enable_echo_filter(uint64_t timeout_ns) {
+  uint64_t char_ns;
+
+  RETURN_ON_ERROR(get_char_time(&char_ns));
+  echo_.enable(char_ns, timeout_ns);
+
+  return SP_OK;
+}
+
+void SerialHandle::disable_echo_filter(void) {
+  echo_.disable();
+}
+
+webserial::EchoFilter& SerialHandle::echo_filter(void) {
+  return echo_;
+}
+
+// Hands bytes that were read but not consumed back to the port, so that the
+// next read returns them first. Used by readers that take whatever is
+// available and find they went past the end of what they wanted.
+void SerialHandle::unread(const void* buf, size_t size) {
+  const uint8_t* data = static_cast<const uint8_t*>(buf);
+
+  uv_mutex_lock(&unread_mutex_);
+  unread_.insert(unread_.begin(), data, data + size);
+  uv_mutex_unlock(&unread_mutex_);
+}
+
+// Moves up to size bytes handed back with unread() into buf, or drops them
+// if buf is nullptr. Returns how many were taken.
+size_t SerialHandle::take_unread(void* buf, size_t size) {
+  size_t taken;
+
+  uv_mutex_lock(&unread_mutex_);
+  taken = unread_.size() < size ? unread_.size() : size;
+  if (taken > 0) {
+    if (buf != nullptr) {
+      memcpy(buf, unread_.data(), taken);
+    }
+    unread_.erase(unread_.begin(), unread_.begin() + taken);
+  }
+  uv_mutex_unlock(&unread_mutex_);
+
+  return taken;
+}
+
+bool SerialHandle::has_unread(void) {
+  bool pending;
+
+  uv_mutex_lock(&unread_mutex_);
+  pending = !unread_.empty();
+  uv_mutex_unlock(&unread_mutex_);
+
+  return pending;
+}
+
+// Input that turns out to be nothing but echo is skipped, so that a caller
+// polling for data is not told there is none while more is waiting.
 sp_return SerialHandle::read_data(void* buf, size_t size) {
-  return sp_nonblocking_read(port_, buf, size);
+  int r;
+  size_t kept;
+
+  kept = take_unread(buf, size);
+  if (kept > 0) {
+    return static_cast<sp_return>(kept);
+  }
+
+  do {
+    r = sp_nonblocking_read(port_, buf, size);
+    if (r <= 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    kept = echo_.filter(buf, r);
+  } while (kept == 0);
+
+  return static_cast<sp_return>(kept);
 }
 
 sp_return SerialHandle::write_data(void* buf, size_t size) {
-  return sp_nonblocking_write(port_, buf, size);
+  int r = sp_nonblocking_write(port_, buf, size);
+
+  if (r > 0) {
+    echo_.sent(buf, r);
+  }
+
+  return static_cast<sp_return>(r);
+}
+
+// With echo suppression on, fewer bytes than were received may be returned,
+// possibly none at all before the timeout.
+sp_return SerialHandle::blocking_read(void* buf,
+                                      size_t size,
+                                      unsigned int timeout_ms) {
+  size_t taken = take_unread(buf, size);
+  int r;
+
+  if (taken == size) {
+    return static_cast<sp_return>(taken);
+  }
+
+  r = sp_blocking_read(port_,
+                       static_cast<uint8_t*>(buf) + taken,
+                       size - taken,
+                       timeout_ms);
+  if (r < 0) {
+    return static_cast<sp_return>(r);
+  }
+
+  return static_cast<sp_return>(
+    taken + echo_.filter(static_cast<uint8_t*>(buf) + taken, r)
+  );
+}
+
+sp_return SerialHandle::blocking_read_next(void* buf,
+                                           size_t size,
+                                           unsigned int timeout_ms) {
+  size_t taken = take_unread(buf, size);
+  int r;
+
+  if (taken > 0) {
+    return static_cast<sp_return>(taken);
+  }
+
+  r = sp_blocking_read_next(port_, buf, size, timeout_ms);
+
+  return r > 0 ? static_cast<sp_return>(echo_.filter(buf, r))
+               : static_cast<sp_return>(r);
+}
+
+sp_return SerialHandle::blocking_write(const void* buf,
+                                       size_t size,
+                                       unsigned int timeout_ms) {
+  int r = sp_blocking_write(port_, buf, size, timeout_ms);
+
+  if (r > 0) {
+    echo_.sent(buf, r);
+  }
+
+  return static_cast<sp_return>(r);
+}
+
+// Writes all of buf unless timeout_ms (0 for none) runs out or the I/O
+// generation moves on. The write is split into short waits so that a
+// cancellation is noticed promptly. Returns the number of bytes written.
+sp_return SerialHandle::write_all(const void* buf,
+                                  size_t size,
+                                  unsigned int timeout_ms,
+                                  uint32_t generation) {
+  const uint8_t* data = static_cast<const uint8_t*>(buf);
+  uint64_t deadline = uv_hrtime() + timeout_ms * UINT64_C(1000000);
+  uint64_t now;
+  unsigned int wait;
+  size_t written = 0;
+  int r;
+
+  while (written < size && !io_cancelled(generation)) {
+    wait = kIoSliceMs;
+    if (timeout_ms > 0) {
+      now = uv_hrtime();
+      if (now >= deadline) {
+        break;
+      }
+
+      if (deadline - now < wait * UINT64_C(1000000)) {
+        wait = static_cast<unsigned int>((deadline - now + 999999) / 1000000);
+      }
+    }
+
+    r = sp_blocking_write(port_, data + written, size - written, wait);
+    if (r < 0) {
+      return static_cast<sp_return>(r);
+    }
+
+    echo_.sent(data + written, r);
+    written += r;
+  }
+
+  return static_cast<sp_return>(written);
+}
+
+// Waits for input with nanosecond resolution where the OS allows it. On
+// Linux, the wait also ends early once wake_fd, if not negative, becomes
+// readable; the caller drains it. Returns 1 if input is available, 0 on
+// timeout or wakeup, or an error code.
+sp_return SerialHandle::wait_input(uint64_t timeout_ns, int wake_fd) {
+#ifdef __linux__
+  struct pollfd pfds[2];
+  struct timespec ts;
+  int r;
+
+  if (has_unread()) {
+    return static_cast<sp_return>(1);
+  }
+
+  RETURN_ON_ERROR(sp_get_port_handle(port_, &pfds[0].fd));
+  pfds[0].events = POLLIN;
+  // Negative descriptors are ignored, so without one this is a plain wait.
+  pfds[1].fd = wake_fd;
+  pfds[1].events = POLLIN;
+  ts.tv_sec = timeout_ns / 1000000000;
+  ts.tv_nsec = timeout_ns % 1000000000;
+
+  do {
+    r = ppoll(pfds, 2, &ts, nullptr);
+  } while (r < 0 && errno == EINTR);
+
+  if (r < 0) {
+    return SP_ERR_FAIL;
+  }
+
+  // A hung up tty polls readable forever while reads return nothing, so
+  // treat it as an error like wait_any() does, rather than let callers spin.
+  if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    errno = EIO;
+    return SP_ERR_FAIL;
+  }
+
+  return static_cast<sp_return>((pfds[0].revents & POLLIN) ? 1 : 0);
+#else
+  struct sp_event_set* events;
+  sp_return r;
+
+  if (has_unread()) {
+    return static_cast<sp_return>(1);
+  }
+
+  RETURN_ON_ERROR(sp_new_event_set(&events));
+  r = sp_add_port_events(events, port_, SP_EVENT_RX_READY);
+  if (r == SP_OK) {
+    // sp_wait() treats 0 as "forever", so always wait at least 1ms.
+    r = sp_wait(events, static_cast<unsigned int>(timeout_ns / 1000000) + 1);
+  }
+  sp_free_event_set(events);
+  RETURN_ON_ERROR(r);
+
+  return static_cast<sp_return>(sp_input_waiting(port_) > 0 ? 1 : 0);
+#endif
+}
+
+// Waits until any of several ports is ready for the sp_event flags in
+// events. On return, ready holds the flags each port is ready for. Where
+// the OS cannot report which port woke the wait, every requested flag is
+// reported and the caller's nonblocking calls sort it out. Returns the
+// number of ready ports, 0 on timeout, or an error code.
+sp_return SerialHandle::wait_any(SerialHandle* const* handles,
+                                 const int* events,
+                                 int* ready,
+                                 size_t count,
+                                 uint64_t timeout_ns) {
+  bool unread[kMaxWaitPorts];
+  bool any_unread = false;
+
+  if (count > kMaxWaitPorts) {
+    return SP_ERR_ARG;
+  }
+
+  // Input handed back with unread() is ready without waiting.
+  for (size_t i = 0; i < count; i++) {
+    unread[i] = (events[i] & SP_EVENT_RX_READY) && handles[i]->has_unread();
+    any_unread = any_unread || unread[i];
+  }
+
+  if (any_unread) {
+    timeout_ns = 0;
+  }
+
+#ifdef __linux__
+  struct pollfd pfds[kMaxWaitPorts];
+  struct timespec ts;
+  int r;
+
+  for (size_t i = 0; i < count; i++) {
+    RETURN_ON_ERROR(sp_get_port_handle(handles[i]->port_, &pfds[i].fd));
+    pfds[i].events = 0;
+    if (events[i] & SP_EVENT_RX_READY) {
+      pfds[i].events |= POLLIN;
+    }
+    if (events[i] & SP_EVENT_TX_READY) {
+      pfds[i].events |= POLLOUT;
+    }
+    // Ports with nothing to wait for still report errors and hangups.
+  }
+
+  ts.tv_sec = timeout_ns / 1000000000;
+  ts.tv_nsec = timeout_ns % 1000000000;
+
+  do {
+    r = ppoll(pfds, count, &ts, nullptr);
+  } while (r < 0 && errno == EINTR);
+
+  if (r < 0) {
+    return SP_ERR_FAIL;
+  }
+
+  r = 0;
+  for (size_t i = 0; i < count; i++) {
+    ready[i] = 0;
+    if ((pfds[i].revents & POLLIN) || unread[i]) {
+      ready[i] |= SP_EVENT_RX_READY;
+    }
+    if (pfds[i].revents & POLLOUT) {
+      ready[i] |= SP_EVENT_TX_READY;
+    }
+    if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      ready[i] |= SP_EVENT_ERROR;
+    }
+    if (ready[i] != 0) {
+      r++;
+    }
+  }
+
+  return static_cast<sp_return>(r);
+#else
+  struct sp_event_set* event_set;
+  sp_return r = SP_OK;
+
+  RETURN_ON_ERROR(sp_new_event_set(&event_set));
+  for (size_t i = 0; r == SP_OK && i < count; i++) {
+    if (events[i] != 0) {
+      r = sp_add_port_events(event_set,
+                             handles[i]->port_,
+                             static_cast<enum sp_event>(events[i]));
+    }
+  }
+  if (r == SP_OK && !any_unread) {
+    // sp_wait() treats 0 as "forever", so always wait at least 1ms.
+    r = sp_wait(event_set,
+                static_cast<unsigned int>(timeout_ns / 1000000) + 1);
+  }
+  sp_free_event_set(event_set);
+  RETURN_ON_ERROR(r);
+
+  for (size_t i = 0; i < count; i++) {
+    ready[i] = events[i];
+  }
+
+  return static_cast<sp_return>(count);
+#endif
 }
 
 sp_return SerialHandle::discard_rx_buffer(void) {
+  take_unread(nullptr, SIZE_MAX);
   return sp_flush(port_, SP_BUF_INPUT);
 }
 
@@ -230,6 +892,144 @@ sp_return SerialHandle::flush_tx_buffer(void) {
   return sp_drain(port_);
 }
 
+// Returns the number of bytes still queued for transmission by the OS.
+sp_return SerialHandle::output_waiting(void) {
+  return sp_output_waiting(port_);
+}
+
+// Bounds on how long a drain sleeps between checks of the output queue.
+static const uint64_t kDrainMinPollMs = 1;
+static const uint64_t kDrainMaxPollMs = 20;
+
+// Waits until everything written has been transmitted. Polls the OS output
+// queue rather than blocking in tcdrain(), so that the wait ends when the
+// queue has not moved for stall_timeout_ms (0 for never), when io_generation
+// or drain_generation moves on, or when stop is set. Whatever is left is
+// discarded in those cases, so that closing the port afterwards cannot
+// block on it either.
+sp_return SerialHandle::drain_output(unsigned int stall_timeout_ms,
+                                     uint32_t io_generation,
+                                     uint32_t drain_generation,
+                                     const std::atomic<bool>* stop,
+                                     DrainOutcome* outcome) {
+  uint64_t last_progress = uv_hrtime();
+  int last_waiting = -1;
+  int baud_rate = 0;
+  int waiting;
+  uint64_t interval_ms;
+
+  get_baud_rate(&baud_rate);
+
+  for (;;) {
+    if (drain_generation_ != drain_generation ||
+        io_cancelled(io_generation) ||
+        (stop != nullptr && *stop)) {
+      *outcome = kDrainAborted;
+      break;
+    }
+
+    waiting = output_waiting();
+    if (waiting < 0) {
+      return static_cast<sp_return>(waiting);
+    }
+
+    if (waiting == 0) {
+      // The queue is empty, but the last bytes may still be in the UART.
+      // Waiting for those is bounded by the size of its FIFO.
+      *outcome = kDrainCompleted;
+      return flush_tx_buffer();
+    }
+
+    if (waiting < last_waiting) {
+      last_progress = uv_hrtime();
+    }
+
+    last_waiting = waiting;
+    if (stall_timeout_ms > 0 &&
+        uv_hrtime() - last_progress >= stall_timeout_ms * 1000000ull) {
+      *outcome = kDrainTimedOut;
+      break;
+    }
+
+    // Sleep for about as long as the queue takes to send, assuming ten bits
+    // per byte, but check back often enough to notice a cancellation.
+    interval_ms = baud_rate > 0 ? waiting * 10000ull / baud_rate : 0;
+    if (interval_ms < kDrainMinPollMs) {
+      interval_ms = kDrainMinPollMs;
+    } else if (interval_ms > kDrainMaxPollMs) {
+      interval_ms = kDrainMaxPollMs;
+    }
+
+    uv_sleep(static_cast<unsigned int>(interval_ms));
+  }
+
+  return discard_tx_buffer();
+}
+
+// Makes every drain that is currently polling this port give up. A drain
+// remembers the generation it started in and stops once it changes.
+void SerialHandle::cancel_drains(void) {
+  drain_generation_++;
+}
+
+uint32_t SerialHandle::drain_generation(void) {
+  return drain_generation_;
+}
+
+// Threadpool work that uses the port takes the I/O generation when it is
+// queued, and gives up as soon as the generation moves on. Closing the port
+// moves it on, then waits for the work still using the port to finish.
+uint32_t SerialHandle::io_generation(void) {
+  return io_generation_;
+}
+
+bool SerialHandle::io_cancelled(uint32_t generation) {
+  return io_generation_ != generation;
+}
+
+// Marks the start of work queued in generation. Returns false, without
+// marking anything, if the work was cancelled before it got to run.
+bool SerialHandle::begin_io(uint32_t generation) {
+  bool ok;
+
+  uv_mutex_lock(&io_mutex_);
+  ok = io_generation_ == generation;
+  if (ok) {
+    io_pending_++;
+  }
+  uv_mutex_unlock(&io_mutex_);
+
+  return ok;
+}
+
+void SerialHandle::end_io(void) {
+  uv_mutex_lock(&io_mutex_);
+  if (--io_pending_ == 0) {
+    uv_cond_broadcast(&io_idle_);
+  }
+  uv_mutex_unlock(&io_mutex_);
+}
+
+void SerialHandle::cancel_io(void) {
+  uv_mutex_lock(&io_mutex_);
+  io_generation_++;
+  uv_mutex_unlock(&io_mutex_);
+}
+
+// Blocks until no work started by begin_io() is still running.
+void SerialHandle::wait_io_idle(void) {
+  uv_mutex_lock(&io_mutex_);
+  while (io_pending_ > 0) {
+    uv_cond_wait(&io_idle_, &io_mutex_);
+  }
+  uv_mutex_unlock(&io_mutex_);
+}
+
 void SerialHandle::set_port(struct sp_port* port) {
   port_ = port;
 }
+
+void SerialHandle::set_ioctl_function(IoctlFunction function) {
+  ioctl_function = function;
+  sp_set_ioctl_function(function);
+}
@@ -1,8 +1,52 @@
+#ifndef WEBSERIAL_SERIAL_HANDLE_H
+#define WEBSERIAL_SERIAL_HANDLE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
 #include <node_api.h>
+#include <uv.h>
 #include <libserialport.h>
+#include "echo-filter.h"
+
+// Matches ioctl(2), so that tests can stand in for the kernel.
+typedef int (*IoctlFunction)(int fd, unsigned long request, void* arg);
+
+// Kernel RS-485 mode, as set with TIOCSRS485 on Linux. The driver turns the
+// transmitter on with RTS around each transmission. Delays are in
+// milliseconds.
+struct Rs485Config {
+  bool enabled;
+  bool rts_on_send;
+  bool rts_after_send;
+  bool rx_during_tx;
+  uint32_t delay_before_send;
+  uint32_t delay_after_send;
+};
+
+// How a bounded drain ended. Output that was still queued is discarded
+// unless the drain completed.
+enum DrainOutcome {
+  kDrainCompleted,
+  kDrainTimedOut,
+  kDrainAborted
+};
+
+// Asks reconfigure() to drain pending output, using drain_output(), before
+// it changes anything. The settings are only changed if the drain
+// completes.
+struct ReconfigureDrain {
+  unsigned int stall_timeout_ms;
+  uint32_t io_generation;
+  uint32_t drain_generation;
+  DrainOutcome outcome;
+};
 
 class SerialHandle {
   public:
+    static const size_t kMaxWaitPorts = 8;
+    // Longest single wait in cancellable I/O.
+    static const unsigned int kIoSliceMs = 50;
     static napi_status Init(napi_env env);
     static void Destructor(napi_env env,
                            void* native_object,
@@ -11,27 +55,98 @@ class SerialHandle {
                                    struct sp_port* port,
                                    napi_value* instance);
     sp_return close_port(void);
+    struct sp_port* detach_port(void);
     sp_return open_port(int baud_rate,
                         int data_bits,
                         int stop_bits,
                         int parity,
                         int flow_control);
+    sp_return reconfigure(int baud_rate,
+                          int data_bits,
+                          int stop_bits,
+                          int parity,
+                          int flow_control,
+                          ReconfigureDrain* drain);
+    sp_return get_config(int* baud_rate,
+                         int* data_bits,
+                         int* stop_bits,
+                         int* parity,
+                         int* flow_control);
+    sp_return get_baud_rate(int* baud_rate);
+    sp_return get_char_time(uint64_t* char_ns);
+    sp_return get_os_handle(void* result);
     sp_return get_signals(int* cts, int* dsr, int* dcd, int* ri);
     sp_return set_signals(int dtr, int rts, int brk);
+    sp_return set_rs485(const Rs485Config& config);
+    sp_return enable_echo_filter(uint64_t timeout_ns);
+    void disable_echo_filter(void);
+    webserial::EchoFilter& echo_filter(void);
+    void unread(const void* buf, size_t size);
     sp_return read_data(void* buf, size_t size);
     sp_return write_data(void* buf, size_t size);
+    sp_return blocking_read(void* buf, size_t size, unsigned int timeout_ms);
+    sp_return blocking_read_next(void* buf,
+                                 size_t size,
+                                 unsigned int timeout_ms);
+    sp_return blocking_write(const void* buf,
+                             size_t size,
+                             unsigned int timeout_ms);
+    sp_return write_all(const void* buf,
+                        size_t size,
+                        unsigned int timeout_ms,
+                        uint32_t generation);
+    sp_return wait_input(uint64_t timeout_ns, int wake_fd = -1);
+    static sp_return wait_any(SerialHandle* const* handles,
+                              const int* events,
+                              int* ready,
+                              size_t count,
+                              uint64_t timeout_ns);
     sp_return discard_rx_buffer(void);
     sp_return discard_tx_buffer(void);
     sp_return flush_tx_buffer(void);
+    sp_return output_waiting(void);
+    sp_return drain_output(unsigned int stall_timeout_ms,
+                           uint32_t io_generation,
+                           uint32_t drain_generation,
+                           const std::atomic<bool>* stop,
+                           DrainOutcome* outcome);
+    void cancel_drains(void);
+    uint32_t drain_generation(void);
+    uint32_t io_generation(void);
+    bool io_cancelled(uint32_t generation);
+    bool begin_io(uint32_t generation);
+    void end_io(void);
+    void cancel_io(void);
+    void wait_io_idle(void);
     void set_port(struct sp_port* port);
+    // Replaces the ioctl() used on ports' file descriptors, here and inside
+    // libserialport, for every port in the process. nullptr puts back the
+    // real one. Termios calls such as tcsetattr() are not covered.
+    static void set_ioctl_function(IoctlFunction function);
 
   private:
     SerialHandle();
     ~SerialHandle();
 
     static napi_value New(napi_env env, napi_callback_info info);
-    static napi_ref constructor;
+    size_t take_unread(void* buf, size_t size);
+    bool has_unread(void);
     napi_env env_;
     napi_ref wrapper_;
     struct sp_port* port_;
+    uv_mutex_t io_mutex_;
+    uv_cond_t io_idle_;
+    // Serializes reconfigure(), which runs on the threadpool and on native
+    // helper threads.
+    uv_mutex_t config_mutex_;
+    int io_pending_;
+    std::atomic<uint32_t> io_generation_;
+    std::atomic<uint32_t> drain_generation_;
+    webserial::EchoFilter echo_;
+    // Input that was read from the port but handed back with unread(). Reads
+    // return it before anything new.
+    uv_mutex_t unread_mutex_;
+    std::vector<uint8_t> unread_;
 };
+
+#endif
@@ -0,0 +1,320 @@
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "serial-handle.h"
+#include "signal-sequence.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single sleep, so that closing the port is noticed.
+static const uint64_t kMaxWaitNs = 50000000;
+
+struct SignalStep {
+  int dtr;
+  int rts;
+  int brk;
+  uint64_t hold_ns;
+  uint64_t start_ns;
+  uint64_t set_ns;
+  uint64_t held_ns;
+};
+
+struct SequenceWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref;
+  SerialHandle* handle;
+  uint32_t generation;
+  std::vector<SignalStep> steps;
+  size_t completed;
+  uint64_t total_ns;
+  sp_return result;
+  std::string error;
+};
+
+// Waits until deadline. Returns false if the port was closed meanwhile.
+static bool HoldUntil(SequenceWork* w, uint64_t deadline) {
+  uint64_t now;
+
+  while ((now = NowNs()) < deadline) {
+    if (w->handle->io_cancelled(w->generation)) {
+      return false;
+    }
+
+    if (deadline - now > kMaxWaitNs) {
+      SleepUntilNs(now + kMaxWaitNs);
+    } else {
+      PreciseSleepUntilNs(deadline);
+    }
+  }
+
+  return true;
+}
+
+// Each hold is timed from the moment the step's changes have been made, so
+// that a slow ioctl delays the rest of the sequence rather than eating into
+// the hold.
+static void RunSteps(SequenceWork* w) {
+  uint64_t start = NowNs();
+  uint64_t applied;
+
+  for (SignalStep& step : w->steps) {
+    step.start_ns = NowNs() - start;
+    w->result = w->handle->set_signals(step.dtr, step.rts, step.brk);
+    applied = NowNs();
+    step.set_ns = applied - start - step.start_ns;
+    if (w->result != SP_OK) {
+      w->error = ErrorMessage(w->result);
+      break;
+    }
+
+    if (!HoldUntil(w, applied + step.hold_ns)) {
+      w->result = SP_ERR_FAIL;
+      w->error = "signal sequence was cancelled";
+      break;
+    }
+
+    step.held_ns = NowNs() - applied;
+    w->completed++;
+  }
+
+  w->total_ns = NowNs() - start;
+}
+
+static void RunSignalSequenceExecute(napi_env env, void* data) {
+  SequenceWork* w = static_cast<SequenceWork*>(data);
+#ifdef __linux__
+  // The default timer slack lets the kernel wake a sleeper up to 50us late.
+  // This is a threadpool thread, so the old value is put back afterwards.
+  int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+
+  prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+#endif
+
+  if (w->handle->begin_io(w->generation)) {
+    RunSteps(w);
+    w->handle->end_io();
+  } else {
+    w->result = SP_ERR_FAIL;
+    w->error = "signal sequence was cancelled";
+  }
+
+#ifdef __linux__
+  if (slack > 0) {
+    prctl(PR_SET_TIMERSLACK, slack, 0, 0, 0);
+  }
+#endif
+}
+
+static napi_value CreateStepResult(napi_env env, SignalStep* step) {
+  napi_value ret;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create step result");
+  NAPI_CHECK(
+    napi_create_double(env, step->start_ns / 1e3, &field),
+    "could not create startMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "startMicros", field),
+    "could not set 'startMicros' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, step->set_ns / 1e3, &field),
+    "could not create setMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "setMicros", field),
+    "could not set 'setMicros' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, step->held_ns / 1e3, &field),
+    "could not create holdMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "holdMicros", field),
+    "could not set 'holdMicros' property"
+  );
+
+  return ret;
+}
+
+static napi_value CreateSequenceResult(napi_env env, SequenceWork* w) {
+  napi_value ret;
+  napi_value steps;
+  napi_value field;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create result");
+  NAPI_CHECK(
+    napi_create_array_with_length(env, w->completed, &steps),
+    "could not create steps"
+  );
+  for (size_t i = 0; i < w->completed; i++) {
+    field = CreateStepResult(env, &w->steps[i]);
+    if (field == nullptr) {
+      return nullptr;
+    }
+
+    NAPI_CHECK(
+      napi_set_element(env, steps, i, field),
+      "could not set step result"
+    );
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "steps", steps),
+    "could not set 'steps' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, w->total_ns / 1e3, &field),
+    "could not create totalMicros"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "totalMicros", field),
+    "could not set 'totalMicros' property"
+  );
+
+  return ret;
+}
+
+static void RunSignalSequenceComplete(napi_env env,
+                                      napi_status status,
+                                      void* data) {
+  SequenceWork* w = static_cast<SequenceWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    ret = CreateSequenceResult(env, w);
+  } else if (status != napi_ok) {
+    w->error = "signal sequence was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_reference(env, w->handle_ref);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+static napi_status GetStep(napi_env env, napi_value value, SignalStep* step) {
+  napi_value field;
+  napi_status status;
+  uint32_t hold_us = 0;
+
+  step->start_ns = 0;
+  step->set_ns = 0;
+  step->held_ns = 0;
+
+  status = napi_get_named_property(env, value, "dtr", &field);
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, field, &step->dtr);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "rts", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, field, &step->rts);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "brk", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, field, &step->brk);
+  }
+  if (status == napi_ok) {
+    status = napi_get_named_property(env, value, "holdMicros", &field);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_uint32(env, field, &hold_us);
+  }
+
+  step->hold_ns = hold_us * UINT64_C(1000);
+
+  return status;
+}
+
+// Runs a sequence of modem signal changes on the threadpool. Each step is
+// { dtr, rts, brk, holdMicros }, where a signal is 0 to clear it, 1 to set
+// it or -1 to leave it, and holdMicros is how long to keep the result before
+// the next step. Resolves with { steps, totalMicros }, where each step
+// reports when it started, how long setting the signals took and how long
+// they were actually held, all in microseconds.
+napi_value RunSignalSequence(napi_env env, napi_callback_info info) {
+  SequenceWork* w;
+  napi_value argv[2];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value element;
+  napi_status status;
+  size_t argc = 2;
+  uint32_t count;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_array_length(env, argv[1], &count),
+    "could not get step count"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:runSignalSequence",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  w = new SequenceWork();
+  w->handle_ref = nullptr;
+  w->completed = 0;
+  w->total_ns = 0;
+  w->result = SP_OK;
+  w->steps.resize(count);
+
+  status = napi_unwrap(env, argv[0], reinterpret_cast<void**>(&w->handle));
+  if (status == napi_ok) {
+    w->generation = w->handle->io_generation();
+  }
+  for (uint32_t i = 0; status == napi_ok && i < count; i++) {
+    status = napi_get_element(env, argv[1], i, &element);
+    if (status == napi_ok) {
+      status = GetStep(env, element, &w->steps[i]);
+    }
+  }
+  if (status == napi_ok) {
+    status = napi_create_reference(env, argv[0], 1, &w->handle_ref);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    RunSignalSequenceExecute,
+                                    RunSignalSequenceComplete,
+                                    w,
+                                    &w->work);
+  }
+
+  if (status != napi_ok) {
+    if (w->handle_ref != nullptr) {
+      napi_delete_reference(env, w->handle_ref);
+    }
+    delete w;
+    NAPI_CHECK(status, "could not create async work");
+  }
+
+  NAPI_CHECK(
+    napi_create_promise(env, &w->deferred, &promise),
+    "could not create promise"
+  );
+  NAPI_CHECK(napi_queue_async_work(env, w->work), "could not queue work");
+
+  return promise;
+}
+
+}
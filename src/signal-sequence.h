@@ -0,0 +1,12 @@
+#ifndef WEBSERIAL_SIGNAL_SEQUENCE_H
+#define WEBSERIAL_SIGNAL_SEQUENCE_H
+
+#include <node_api.h>
+
+namespace webserial {
+
+napi_value RunSignalSequence(napi_env env, napi_callback_info info);
+
+}
+
+#endif
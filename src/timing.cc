@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <time.h>
+#include <uv.h>
+#include "timing.h"
+
+namespace webserial {
+
+// How long PreciseSleepUntilNs() spins rather than sleeps.
+static const uint64_t kSpinNs = 100000;
+
+uint64_t NowNs(void) {
+  return uv_hrtime();
+}
+
+void SleepUntilNs(uint64_t deadline) {
+#ifdef __linux__
+  // uv_hrtime() reads CLOCK_MONOTONIC on Linux, so the deadline can be used
+  // as an absolute timeout and the kernel does not add rounding of its own.
+  struct timespec ts;
+
+  ts.tv_sec = deadline / 1000000000;
+  ts.tv_nsec = deadline % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+#else
+  uint64_t now;
+
+  // Sleep for whole milliseconds, then spin for the remainder.
+  while ((now = uv_hrtime()) < deadline) {
+    if (deadline - now > 2000000) {
+      uv_sleep(static_cast<unsigned int>((deadline - now) / 1000000 - 1));
+    }
+  }
+#endif
+}
+
+void PreciseSleepUntilNs(uint64_t deadline) {
+  uint64_t now = uv_hrtime();
+
+  if (now < deadline && deadline - now > kSpinNs) {
+    SleepUntilNs(deadline - kSpinNs);
+  }
+
+  while (uv_hrtime() < deadline) {
+  }
+}
+
+uint64_t CharTimeNs(int baud_rate, int bits_per_char) {
+  if (baud_rate <= 0) {
+    return 0;
+  }
+
+  return (UINT64_C(1000000000) * bits_per_char + baud_rate - 1) / baud_rate;
+}
+
+}
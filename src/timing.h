@@ -0,0 +1,27 @@
+#ifndef WEBSERIAL_TIMING_H
+#define WEBSERIAL_TIMING_H
+
+#include <stdint.h>
+
+namespace webserial {
+
+// Monotonic time in nanoseconds. This is the clock used by uv_hrtime(), so
+// values can be compared with timestamps taken by libuv.
+uint64_t NowNs(void);
+
+// Sleeps until the monotonic clock reaches deadline. Returns immediately if
+// the deadline has already passed.
+void SleepUntilNs(uint64_t deadline);
+
+// Like SleepUntilNs(), but spins for the last stretch, since waking up from
+// a sleep can take a while on a loaded system. Meant for short waits whose
+// end matters to the microsecond.
+void PreciseSleepUntilNs(uint64_t deadline);
+
+// Nanoseconds needed to transmit one character of bits_per_char bits,
+// including start, parity and stop bits, at baud_rate.
+uint64_t CharTimeNs(int baud_rate, int bits_per_char);
+
+}
+
+#endif
@@ -0,0 +1,593 @@
+#include <math.h>
+#include "tx-pacer.h"
+#include "timing.h"
+#include "util.h"
+
+namespace webserial {
+
+// Upper bound on a single wait, so that Close() never blocks for long.
+static const uint64_t kMaxWaitNs = 50000000;
+static const unsigned int kMaxWriteMs = 50;
+
+TxPacer::TxPacer() {
+  handle_ = nullptr;
+  handle_ref_ = nullptr;
+  wrapper_ref_ = nullptr;
+  tsfn_ = nullptr;
+  pacing_ = TxPacing();
+  started_ = false;
+  stopping_ = false;
+  closed_ = false;
+  owners_ = 2;
+  pending_ = 0;
+  io_generation_ = 0;
+  drain_timeout_ms_ = 0;
+  generation_ = 0;
+  tokens_ = 0;
+  refill_ns_ = 0;
+  line_idle_ns_ = 0;
+  uv_mutex_init(&mutex_);
+  uv_cond_init(&cond_);
+}
+
+TxPacer::~TxPacer() {
+  for (TxChunk* chunk : queue_) {
+    delete chunk;
+  }
+
+  uv_cond_destroy(&cond_);
+  uv_mutex_destroy(&mutex_);
+}
+
+// The pacer is shared by its JS wrapper and the threadsafe function, and is
+// deleted once both have been finalized.
+void TxPacer::Release(void) {
+  if (--owners_ == 0) {
+    delete this;
+  }
+}
+
+void TxPacer::Destructor(napi_env env,
+                         void* native_object,
+                         void* finalize_hint) {
+  TxPacer* pacer = static_cast<TxPacer*>(native_object);
+
+  pacer->Stop(env);
+  napi_delete_reference(env, pacer->wrapper_ref_);
+  pacer->wrapper_ref_ = nullptr;
+  pacer->Release();
+}
+
+void TxPacer::ThreadFinalize(napi_env env,
+                             void* finalize_data,
+                             void* finalize_hint) {
+  static_cast<TxPacer*>(finalize_data)->Release();
+}
+
+static void SettleChunk(napi_env env, TxChunk* chunk) {
+  napi_value ret = nullptr;
+
+  if (chunk->error.empty() && napi_get_undefined(env, &ret) != napi_ok) {
+    chunk->error = "could not get undefined";
+  }
+
+  SettlePromise(env, chunk->deferred, ret, chunk->error);
+}
+
+void TxPacer::CallJs(napi_env env,
+                     napi_value js_callback,
+                     void* context,
+                     void* data) {
+  TxPacer* pacer = static_cast<TxPacer*>(context);
+  TxChunk* chunk = static_cast<TxChunk*>(data);
+
+  if (env != nullptr) {
+    SettleChunk(env, chunk);
+
+    if (--pacer->pending_ == 0 && !pacer->closed_) {
+      napi_unref_threadsafe_function(env, pacer->tsfn_);
+      napi_reference_unref(env, pacer->wrapper_ref_, nullptr);
+    }
+  }
+
+  delete chunk;
+}
+
+// Stops the worker thread without touching JS, so it can also run from the
+// env cleanup hook.
+void TxPacer::Join(void) {
+  uv_mutex_lock(&mutex_);
+  stopping_ = true;
+  uv_cond_signal(&cond_);
+  uv_mutex_unlock(&mutex_);
+
+  if (started_) {
+    uv_thread_join(&thread_);
+    started_ = false;
+  }
+}
+
+// Stops the worker thread and rejects the chunks it had not started yet.
+// Called from Close() and from the wrapper's finalizer.
+void TxPacer::Stop(napi_env env) {
+  if (closed_) {
+    return;
+  }
+
+  closed_ = true;
+  Join();
+  UnregisterThread(env, this);
+
+  while (!queue_.empty()) {
+    TxChunk* chunk = queue_.front();
+
+    queue_.pop_front();
+    chunk->error = "transmit pacer was closed";
+    SettleChunk(env, chunk);
+    delete chunk;
+  }
+
+  if (pending_ > 0) {
+    napi_reference_unref(env, wrapper_ref_, nullptr);
+  }
+
+  napi_release_threadsafe_function(tsfn_, napi_tsfn_release);
+  napi_delete_reference(env, handle_ref_);
+  handle_ref_ = nullptr;
+}
+
+// Records why a chunk cannot be finished, if it cannot.
+bool TxPacer::Cancelled(TxChunk* chunk) {
+  if (stopping_) {
+    chunk->error = "transmit pacer was closed";
+  } else if (generation_ != chunk->generation) {
+    chunk->error = "write was aborted";
+  } else if (handle_->io_cancelled(io_generation_)) {
+    chunk->error = "port was closed";
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// Sleeps until deadline, in short steps so that closing the pacer or
+// aborting the write is noticed. Returns false in that case.
+bool TxPacer::WaitUntil(uint64_t deadline, TxChunk* chunk) {
+  uint64_t now;
+
+  while ((now = NowNs()) < deadline) {
+    if (Cancelled(chunk)) {
+      return false;
+    }
+
+    SleepUntilNs(deadline - now < kMaxWaitNs ? deadline : now + kMaxWaitNs);
+  }
+
+  return !Cancelled(chunk);
+}
+
+void TxPacer::Refill(const TxPacing& pacing, uint64_t now) {
+  tokens_ += (now - refill_ns_) * pacing.rate / 1e9;
+  if (tokens_ > pacing.burst) {
+    tokens_ = pacing.burst;
+  }
+
+  refill_ns_ = now;
+}
+
+// Waits until the bytes handed to the driver have left the UART, with the
+// same stall timeout as drain(). Returns false, with the chunk's error set,
+// if they did not, in which case whatever was left has been discarded.
+bool TxPacer::Drain(TxChunk* chunk, uint32_t drain_generation) {
+  DrainOutcome outcome;
+  sp_return r;
+
+  r = handle_->drain_output(drain_timeout_ms_,
+                            io_generation_,
+                            drain_generation,
+                            &stopping_,
+                            &outcome);
+  if (r != SP_OK) {
+    chunk->error = ErrorMessage(r);
+    return false;
+  }
+
+  if (outcome == kDrainTimedOut) {
+    chunk->error = "drain timed out";
+    return false;
+  }
+
+  if (outcome == kDrainAborted) {
+    if (!Cancelled(chunk)) {
+      chunk->error = "write was aborted";
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+// Hands a chunk to the driver as fast as the pacing allows. The settings
+// are read again before every write, so changes apply straight away.
+void TxPacer::Send(TxChunk* chunk) {
+  const uint8_t* data = chunk->data.data();
+  size_t size = chunk->data.size();
+  size_t written = 0;
+  uint32_t drain_generation = handle_->drain_generation();
+  TxPacing pacing;
+  double wanted;
+  uint64_t now;
+  size_t n;
+  int r;
+
+  if (!handle_->begin_io(io_generation_)) {
+    chunk->error = "port was closed";
+    return;
+  }
+
+  while (written < size) {
+    uv_mutex_lock(&mutex_);
+    pacing = pacing_;
+    uv_mutex_unlock(&mutex_);
+
+    // The line stays idle for the gap that followed the last byte or chunk.
+    if (!WaitUntil(line_idle_ns_, chunk)) {
+      break;
+    }
+
+    n = pacing.byte_gap_ns > 0 ? 1 : size - written;
+    if (pacing.rate > 0) {
+      now = NowNs();
+      Refill(pacing, now);
+
+      // Wait until the whole write, or a full burst, is allowed, rather
+      // than trickling out a byte at a time.
+      wanted = n < pacing.burst ? static_cast<double>(n) : pacing.burst;
+      if (tokens_ < wanted) {
+        if (!WaitUntil(now + static_cast<uint64_t>(
+                         ceil((wanted - tokens_) * 1e9 / pacing.rate)),
+                       chunk)) {
+          break;
+        }
+
+        continue;
+      }
+
+      if (n > tokens_) {
+        n = static_cast<size_t>(tokens_);
+      }
+    }
+
+    r = handle_->write_all(data + written, n, kMaxWriteMs, io_generation_);
+    if (r < 0) {
+      chunk->error = ErrorMessage(static_cast<sp_return>(r));
+      break;
+    }
+
+    written += r;
+    if (pacing.rate > 0) {
+      tokens_ -= r;
+    }
+
+    // A gap is only kept on the line once the bytes before it have left the
+    // UART, not merely the driver's buffer.
+    if (r > 0 && pacing.byte_gap_ns > 0) {
+      if (!Drain(chunk, drain_generation)) {
+        break;
+      }
+
+      line_idle_ns_ = NowNs() + pacing.byte_gap_ns;
+    }
+  }
+
+  if (written == size && size > 0 && pacing.chunk_gap_ns > 0) {
+    if (Drain(chunk, drain_generation)) {
+      line_idle_ns_ = NowNs() + pacing.chunk_gap_ns;
+    }
+  } else if (written < size && chunk->error.empty()) {
+    Cancelled(chunk);
+  }
+
+  handle_->end_io();
+}
+
+void TxPacer::Run(void* arg) {
+  TxPacer* pacer = static_cast<TxPacer*>(arg);
+  TxChunk* chunk;
+
+  for (;;) {
+    uv_mutex_lock(&pacer->mutex_);
+    while (pacer->queue_.empty() && !pacer->stopping_) {
+      uv_cond_wait(&pacer->cond_, &pacer->mutex_);
+    }
+
+    if (pacer->stopping_) {
+      uv_mutex_unlock(&pacer->mutex_);
+      break;
+    }
+
+    chunk = pacer->queue_.front();
+    pacer->queue_.pop_front();
+    uv_mutex_unlock(&pacer->mutex_);
+
+    pacer->Send(chunk);
+
+    if (napi_call_threadsafe_function(pacer->tsfn_,
+                                      chunk,
+                                      napi_tsfn_blocking) != napi_ok) {
+      delete chunk;
+    }
+  }
+}
+
+// Reads the rate in bytes per second, the burst size in bytes and the byte
+// and chunk gaps in milliseconds from argv.
+static napi_status GetPacing(napi_env env,
+                             napi_value* argv,
+                             TxPacing* pacing) {
+  double byte_gap_ms;
+  double chunk_gap_ms;
+  napi_status status;
+
+  status = napi_get_value_double(env, argv[0], &pacing->rate);
+  if (status == napi_ok) {
+    status = napi_get_value_double(env, argv[1], &pacing->burst);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_double(env, argv[2], &byte_gap_ms);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_double(env, argv[3], &chunk_gap_ms);
+  }
+
+  if (status == napi_ok) {
+    if (pacing->burst < 1) {
+      pacing->burst = 1;
+    }
+
+    pacing->byte_gap_ns = static_cast<uint64_t>(byte_gap_ms * 1e6);
+    pacing->chunk_gap_ns = static_cast<uint64_t>(chunk_gap_ms * 1e6);
+  }
+
+  return status;
+}
+
+// Creates a pacer for an open port. Arguments are the handle, the rate in
+// bytes per second (0 for no limit), the burst size in bytes, the gaps to
+// keep after each byte and each chunk, in milliseconds, and how long, in
+// milliseconds, output may stall while waiting for a gap (0 for no limit).
+napi_value TxPacer::Create(napi_env env, napi_callback_info info) {
+  TxPacer* pacer;
+  SerialHandle* handle;
+  TxPacing pacing;
+  napi_value argv[6];
+  napi_value resource_name;
+  napi_value ret;
+  napi_status status;
+  size_t argc = 6;
+  uint32_t drain_timeout_ms;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(GetPacing(env, argv + 1, &pacing), "could not get pacing");
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[5], &drain_timeout_ms),
+    "could not get drain timeout"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:txpacer",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create pacer");
+
+  pacer = new TxPacer();
+  pacer->handle_ = handle;
+  pacer->pacing_ = pacing;
+  pacer->io_generation_ = handle->io_generation();
+  pacer->drain_timeout_ms_ = drain_timeout_ms;
+
+  status = napi_create_threadsafe_function(env,
+                                           nullptr,
+                                           nullptr,
+                                           resource_name,
+                                           0,
+                                           1,
+                                           pacer,
+                                           ThreadFinalize,
+                                           pacer,
+                                           CallJs,
+                                           &pacer->tsfn_);
+  if (status != napi_ok) {
+    delete pacer;
+    NAPI_CHECK(status, "could not create threadsafe function");
+  }
+
+  // From here on the threadsafe function owns a share of the pacer.
+  napi_unref_threadsafe_function(env, pacer->tsfn_);
+  status = napi_create_reference(env, argv[0], 1, &pacer->handle_ref_);
+  if (status == napi_ok) {
+    status = napi_wrap(env, ret, pacer, Destructor, nullptr, nullptr);
+  }
+
+  if (status != napi_ok) {
+    pacer->closed_ = true;
+    napi_delete_reference(env, pacer->handle_ref_);
+    napi_release_threadsafe_function(pacer->tsfn_, napi_tsfn_release);
+    pacer->Release();
+    NAPI_CHECK(status, "could not wrap pacer");
+  }
+
+  NAPI_CHECK(
+    napi_create_reference(env, ret, 0, &pacer->wrapper_ref_),
+    "could not create reference"
+  );
+
+  if (uv_thread_create(&pacer->thread_, Run, pacer) != 0) {
+    pacer->Stop(env);
+    napi_throw_error(env, nullptr, "could not start pacer thread");
+    return nullptr;
+  }
+
+  pacer->started_ = true;
+  RegisterThread(env, pacer);
+  return ret;
+}
+
+// Changes the pacing, with the same arguments as Create() after the handle.
+// A chunk that is being written continues with the new settings.
+napi_value TxPacer::Configure(napi_env env, napi_callback_info info) {
+  TxPacer* pacer;
+  TxPacing pacing;
+  napi_value argv[5];
+  napi_value ret;
+  size_t argc = 5;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pacer)),
+    "could not unwrap pacer"
+  );
+  NAPI_CHECK(GetPacing(env, argv + 1, &pacing), "could not get pacing");
+
+  uv_mutex_lock(&pacer->mutex_);
+  pacer->pacing_ = pacing;
+  uv_mutex_unlock(&pacer->mutex_);
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Queues an ArrayBuffer for writing. The promise resolves once all of it has
+// been handed to the driver.
+napi_value TxPacer::Write(napi_env env, napi_callback_info info) {
+  TxPacer* pacer;
+  TxChunk* chunk;
+  napi_value argv[2];
+  napi_value promise;
+  napi_status status;
+  size_t argc = 2;
+  void* buf;
+  size_t len;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pacer)),
+    "could not unwrap pacer"
+  );
+  NAPI_CHECK(
+    napi_get_arraybuffer_info(env, argv[1], &buf, &len),
+    "could not get buffer"
+  );
+
+  if (pacer->closed_) {
+    napi_throw_error(env, nullptr, "transmit pacer is closed");
+    return nullptr;
+  }
+
+  chunk = new TxChunk();
+  chunk->data.assign(static_cast<uint8_t*>(buf),
+                     static_cast<uint8_t*>(buf) + len);
+  chunk->generation = pacer->generation_;
+
+  status = napi_create_promise(env, &chunk->deferred, &promise);
+  if (status != napi_ok) {
+    delete chunk;
+    NAPI_CHECK(status, "could not create promise");
+  }
+
+  if (pacer->pending_++ == 0) {
+    napi_ref_threadsafe_function(env, pacer->tsfn_);
+    napi_reference_ref(env, pacer->wrapper_ref_, nullptr);
+  }
+
+  uv_mutex_lock(&pacer->mutex_);
+  pacer->queue_.push_back(chunk);
+  uv_cond_signal(&pacer->cond_);
+  uv_mutex_unlock(&pacer->mutex_);
+
+  return promise;
+}
+
+// Rejects every queued chunk and stops the one being written. Bytes already
+// handed to the driver are not affected.
+napi_value TxPacer::Discard(napi_env env, napi_callback_info info) {
+  TxPacer* pacer;
+  std::deque<TxChunk*> discarded;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pacer)),
+    "could not unwrap pacer"
+  );
+
+  uv_mutex_lock(&pacer->mutex_);
+  pacer->generation_++;
+  discarded.swap(pacer->queue_);
+  uv_mutex_unlock(&pacer->mutex_);
+
+  for (TxChunk* chunk : discarded) {
+    chunk->error = "write was aborted";
+    SettleChunk(env, chunk);
+    delete chunk;
+
+    if (--pacer->pending_ == 0 && !pacer->closed_) {
+      napi_unref_threadsafe_function(env, pacer->tsfn_);
+      napi_reference_unref(env, pacer->wrapper_ref_, nullptr);
+    }
+  }
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Stops the pacer. Chunks that have not started are rejected, and the port
+// can be written to directly again once this returns.
+napi_value TxPacer::Close(napi_env env, napi_callback_info info) {
+  TxPacer* pacer;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&pacer)),
+    "could not unwrap pacer"
+  );
+
+  pacer->Stop(env);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef WEBSERIAL_TX_PACER_H
+#define WEBSERIAL_TX_PACER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <node_api.h>
+#include <uv.h>
+#include "addon-data.h"
+#include "serial-handle.h"
+
+namespace webserial {
+
+struct TxPacing {
+  double rate;            // Bytes per second, 0 for no limit.
+  double burst;           // Bytes that may be sent back to back.
+  uint64_t byte_gap_ns;   // Idle time on the line after each byte.
+  uint64_t chunk_gap_ns;  // Idle time on the line after each chunk.
+};
+
+struct TxChunk {
+  napi_deferred deferred;
+  std::vector<uint8_t> data;
+  uint32_t generation;
+  std::string error;
+};
+
+// Writes to a port at a limited rate, for devices that lose data when sent
+// to faster than they can take it and have no flow control to say so. A
+// token bucket limits the average rate and the size of bursts, and fixed
+// gaps can be kept after every byte or chunk. Chunks are queued from JS and
+// written in order by a dedicated thread, which times the writes with the
+// monotonic clock.
+class TxPacer : public ThreadOwner {
+  public:
+    static napi_value Create(napi_env env, napi_callback_info info);
+    static napi_value Configure(napi_env env, napi_callback_info info);
+    static napi_value Write(napi_env env, napi_callback_info info);
+    static napi_value Discard(napi_env env, napi_callback_info info);
+    static napi_value Close(napi_env env, napi_callback_info info);
+
+  private:
+    TxPacer();
+    ~TxPacer();
+
+    static void Destructor(napi_env env,
+                           void* native_object,
+                           void* finalize_hint);
+    static void ThreadFinalize(napi_env env,
+                               void* finalize_data,
+                               void* finalize_hint);
+    static void CallJs(napi_env env,
+                       napi_value js_callback,
+                       void* context,
+                       void* data);
+    static void Run(void* arg);
+    void Join(void) override;
+    void Stop(napi_env env);
+    void Release(void);
+    void Send(TxChunk* chunk);
+    bool WaitUntil(uint64_t deadline, TxChunk* chunk);
+    bool Cancelled(TxChunk* chunk);
+    bool Drain(TxChunk* chunk, uint32_t drain_generation);
+    void Refill(const TxPacing& pacing, uint64_t now);
+
+    SerialHandle* handle_;
+    napi_ref handle_ref_;
+    napi_ref wrapper_ref_;
+    napi_threadsafe_function tsfn_;
+    uv_thread_t thread_;
+    uv_mutex_t mutex_;
+    uv_cond_t cond_;
+    std::deque<TxChunk*> queue_;
+    TxPacing pacing_;
+    bool started_;
+    std::atomic<bool> stopping_;
+    bool closed_;
+    int owners_;
+    size_t pending_;
+    uint32_t io_generation_;
+    unsigned int drain_timeout_ms_;
+    std::atomic<uint32_t> generation_;
+
+    // Only touched by the pacer thread.
+    double tokens_;
+    uint64_t refill_ns_;
+    uint64_t line_idle_ns_;
+};
+
+}
+
+#endif
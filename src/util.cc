@@ -0,0 +1,49 @@
+#include "util.h"
+
+namespace webserial {
+
+std::string ErrorMessage(sp_return result) {
+  switch (result) {
+    case SP_ERR_ARG:
+      return "Invalid argument";
+    case SP_ERR_FAIL: {
+      char* message = sp_last_error_message();
+      std::string ret(message);
+
+      sp_free_error_message(message);
+      return ret;
+    }
+    case SP_ERR_SUPP:
+      return "Not supported";
+    case SP_ERR_MEM:
+      return "Out of memory";
+    default:
+      return "Unknown serial port error";
+  }
+}
+
+void SettlePromise(napi_env env,
+                   napi_deferred deferred,
+                   napi_value value,
+                   const std::string& message) {
+  napi_value err;
+  napi_value msg;
+  bool is_pending;
+
+  if (value != nullptr) {
+    napi_resolve_deferred(env, deferred, value);
+    return;
+  }
+
+  napi_is_exception_pending(env, &is_pending);
+  if (is_pending) {
+    napi_get_and_clear_last_exception(env, &err);
+  } else {
+    napi_create_string_utf8(env, message.c_str(), message.size(), &msg);
+    napi_create_error(env, nullptr, msg, &err);
+  }
+
+  napi_reject_deferred(env, deferred, err);
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef WEBSERIAL_UTIL_H
+#define WEBSERIAL_UTIL_H
+
+#include <string>
+#include <node_api.h>
+#include <libserialport.h>
+
+#define NAPI_CHECK(status, msg)                                               \
+  do {                                                                        \
+    if ((status) != napi_ok) {                                                \
+      const napi_extended_error_info* error_info = NULL;                      \
+      napi_get_last_error_info((env), &error_info);                           \
+      bool is_pending;                                                        \
+      napi_is_exception_pending((env), &is_pending);                          \
+      if (!is_pending) {                                                      \
+        const char* message = (error_info->error_message == NULL)             \
+            ? (msg)                                                           \
+            : error_info->error_message;                                      \
+        napi_throw_error((env), NULL, message);                               \
+      }                                                                       \
+      return NULL;                                                            \
+    }                                                                         \
+  } while(0)
+
+#define SP_CHECK(result)                                                      \
+  do {                                                                        \
+    if ((result) != SP_OK) {                                                  \
+      napi_throw_error(                                                       \
+        (env),                                                                \
+        NULL,                                                                 \
+        ErrorMessage(static_cast<sp_return>((result))).c_str()                \
+      );                                                                      \
+      return NULL;                                                            \
+    }                                                                         \
+  } while(0)
+
+namespace webserial {
+
+// Must be called on the thread that produced the error, because
+// SP_ERR_FAIL messages are derived from errno.
+std::string ErrorMessage(sp_return result);
+
+// Settles a promise from an async work complete callback. If value is
+// nullptr, the pending exception is used as the rejection reason, or an
+// error is created from message if there is no pending exception.
+void SettlePromise(napi_env env,
+                   napi_deferred deferred,
+                   napi_value value,
+                   const std::string& message);
+
+}
+
+#endif
@@ -1,57 +1,25 @@
+#include <stdint.h>
 #include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <node_api.h>
+#include <uv.h>
 #include <libserialport.h>
+#include "addon-data.h"
+#include "bridge.h"
+#include "dmx.h"
+#include "fd-pipe.h"
+#include "frame-reader.h"
+#include "modbus.h"
+#include "reliable-link.h"
+#include "rfc2217.h"
+#include "rx-ring.h"
+#include "script.h"
 #include "serial-handle.h"
-
-#define NAPI_CHECK(status, msg)                                               \
-  do {                                                                        \
-    if ((status) != napi_ok) {                                                \
-      const napi_extended_error_info* error_info = NULL;                      \
-      napi_get_last_error_info((env), &error_info);                           \
-      bool is_pending;                                                        \
-      napi_is_exception_pending((env), &is_pending);                          \
-      if (!is_pending) {                                                      \
-        const char* message = (error_info->error_message == NULL)             \
-            ? (msg)                                                           \
-            : error_info->error_message;                                      \
-        napi_throw_error((env), NULL, message);                               \
-        return NULL;                                                          \
-      }                                                                       \
-    }                                                                         \
-  } while(0)
-
-#define SP_CHECK(result)                                                      \
-  do {                                                                        \
-    if ((result) != SP_OK) {                                                  \
-      char const* message;                                                    \
-                                                                              \
-      switch ((result)) {                                                     \
-        case SP_ERR_ARG:                                                      \
-          message = "Invalid argument";                                       \
-          break;                                                              \
-        case SP_ERR_FAIL:                                                     \
-          message = sp_last_error_message();                                  \
-          break;                                                              \
-        case SP_ERR_SUPP:                                                     \
-          message = "Not supported";                                          \
-          break;                                                              \
-        case SP_ERR_MEM:                                                      \
-          message = "Out of memory";                                          \
-          break;                                                              \
-        default:                                                              \
-          message = "Unknown serial port error";                              \
-          break;                                                              \
-      }                                                                       \
-                                                                              \
-      napi_throw_error((env), NULL, message);                                 \
-                                                                              \
-      if ((result) == SP_ERR_FAIL) {                                          \
-        sp_free_error_message((char*)message);                                \
-      }                                                                       \
-                                                                              \
-      return NULL;                                                            \
-    }                                                                         \
-  } while(0)
+#include "signal-sequence.h"
+#include "tx-pacer.h"
+#include "util.h"
 
 #define EXPORT_FUNCTION_OR_RETURN(env, exports, func, name)                   \
   do {                                                                        \
@@ -123,73 +91,479 @@ napi_value CreateHandle(napi_env env, napi_callback_info args) {
   return ret;
 }
 
-napi_value ClosePort(napi_env env, napi_callback_info args) {
-  SerialHandle* handle;
+// Ports in transit between envs, keyed by transfer ID. The table is shared
+// by every env in the process, so it is guarded by a mutex.
+static uv_once_t transfer_once = UV_ONCE_INIT;
+static uv_mutex_t transfer_mutex;
+static std::unordered_map<uint32_t, struct sp_port*>* transfers;
+static uint32_t next_transfer_id = 1;
+
+static void InitTransfers(void) {
+  uv_mutex_init(&transfer_mutex);
+  transfers = new std::unordered_map<uint32_t, struct sp_port*>();
+}
+
+// Wraps a port parked by DetachHandle() in a new handle owned by the calling
+// env. The open descriptor and its settings carry over unchanged. Each
+// transfer ID can be adopted once.
+napi_value AdoptHandle(napi_env env, napi_callback_info args) {
+  struct sp_port* port = nullptr;
   napi_value argv[1];
   napi_value ret;
+  napi_status status;
   size_t argc = 1;
+  uint32_t id;
 
   NAPI_CHECK(
     napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
     "could not get arguments"
   );
   NAPI_CHECK(
-    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
-    "could not unwrap handle"
+    napi_get_value_uint32(env, argv[0], &id),
+    "could not get transfer ID"
   );
-  SP_CHECK(handle->close_port());
-  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  uv_once(&transfer_once, InitTransfers);
+  uv_mutex_lock(&transfer_mutex);
+  auto it = transfers->find(id);
+  if (it != transfers->end()) {
+    port = it->second;
+    transfers->erase(it);
+  }
+  uv_mutex_unlock(&transfer_mutex);
+
+  if (port == nullptr) {
+    napi_throw_error(env, nullptr, "unknown or already adopted transfer");
+    return nullptr;
+  }
+
+  status = SerialHandle::NewInstance(env, port, &ret);
+  if (status != napi_ok) {
+    sp_close(port);
+    sp_free_port(port);
+    NAPI_CHECK(status, "could not create handle");
+  }
 
   return ret;
 }
 
-napi_value OpenPort(napi_env env, napi_callback_info args) {
+static const char* DrainOutcomeName(DrainOutcome outcome) {
+  switch (outcome) {
+    case kDrainCompleted:
+      return "drained";
+    case kDrainTimedOut:
+      return "timeout";
+    default:
+      return "aborted";
+  }
+}
+
+// Opening, closing, detaching and reconfiguring run on the threadpool, since
+// any of them can block for a long time on a misbehaving device or driver.
+struct PortWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref;
   SerialHandle* handle;
-  napi_value argv[6];
-  napi_value ret;
-  size_t argc = 6;
   int baud_rate;
   int data_bits;
   int stop_bits;
   int parity;
   int flow_control;
+  bool drain;
+  ReconfigureDrain drain_state;
+  uint32_t io_generation;
+  uint32_t transfer_id;
+  sp_return result;
+  std::string error;
+};
+
+static PortWork* NewPortWork(napi_env env,
+                             napi_value handle,
+                             const char* name,
+                             napi_async_execute_callback execute,
+                             napi_async_complete_callback complete) {
+  PortWork* w;
+  napi_value resource_name;
+  napi_status status;
+
+  status = napi_create_string_utf8(env,
+                                   name,
+                                   NAPI_AUTO_LENGTH,
+                                   &resource_name);
+  if (status != napi_ok) {
+    napi_throw_error(env, nullptr, "could not create resource name");
+    return nullptr;
+  }
+
+  w = new PortWork();
+  w->handle_ref = nullptr;
+  w->result = SP_OK;
+
+  status = napi_unwrap(env, handle, reinterpret_cast<void**>(&w->handle));
+  if (status == napi_ok) {
+    status = napi_create_reference(env, handle, 1, &w->handle_ref);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    execute,
+                                    complete,
+                                    w,
+                                    &w->work);
+  }
+
+  if (status != napi_ok) {
+    if (w->handle_ref != nullptr) {
+      napi_delete_reference(env, w->handle_ref);
+    }
+    delete w;
+    napi_throw_error(env, nullptr, "could not create async work");
+    return nullptr;
+  }
+
+  return w;
+}
+
+static napi_value QueuePortWork(napi_env env, PortWork* w) {
+  napi_value promise;
+  napi_status status;
+
+  status = napi_create_promise(env, &w->deferred, &promise);
+  if (status == napi_ok) {
+    status = napi_queue_async_work(env, w->work);
+  }
+
+  if (status != napi_ok) {
+    napi_delete_async_work(env, w->work);
+    napi_delete_reference(env, w->handle_ref);
+    delete w;
+    NAPI_CHECK(status, "could not queue work");
+  }
+
+  return promise;
+}
+
+static void FinishPortWork(napi_env env,
+                           napi_status status,
+                           PortWork* w,
+                           napi_value ret) {
+  if (status != napi_ok) {
+    w->error = "operation was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_reference(env, w->handle_ref);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+static void OpenPortExecute(napi_env env, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+
+  w->result = w->handle->open_port(w->baud_rate,
+                                   w->data_bits,
+                                   w->stop_bits,
+                                   w->parity,
+                                   w->flow_control);
+  if (w->result == SP_OK) {
+    w->result = w->handle->get_baud_rate(&w->baud_rate);
+    if (w->result != SP_OK) {
+      w->handle->close_port();
+    }
+  }
+
+  if (w->result != SP_OK) {
+    w->error = ErrorMessage(w->result);
+  }
+}
+
+static void OpenPortComplete(napi_env env, napi_status status, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK &&
+      napi_create_int32(env, w->baud_rate, &ret) != napi_ok) {
+    ret = nullptr;
+    w->error = "could not create baudRate";
+  }
+
+  FinishPortWork(env, status, w, ret);
+}
+
+// Opens and configures the port. Resolves with the baud rate that was
+// actually set.
+napi_value OpenPort(napi_env env, napi_callback_info args) {
+  PortWork* w;
+  napi_value argv[6];
+  napi_status status;
+  size_t argc = 6;
 
   NAPI_CHECK(
     napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
     "could not get arguments"
   );
+
+  w = NewPortWork(env,
+                  argv[0],
+                  "webserial:openPort",
+                  OpenPortExecute,
+                  OpenPortComplete);
+  if (w == nullptr) {
+    return nullptr;
+  }
+
+  status = napi_get_value_int32(env, argv[1], &w->baud_rate);
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[2], &w->data_bits);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[3], &w->stop_bits);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[4], &w->parity);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[5], &w->flow_control);
+  }
+
+  if (status != napi_ok) {
+    napi_delete_reference(env, w->handle_ref);
+    napi_delete_async_work(env, w->work);
+    delete w;
+    NAPI_CHECK(status, "could not get port options");
+  }
+
+  return QueuePortWork(env, w);
+}
+
+static void ClosePortExecute(napi_env env, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+
+  w->handle->wait_io_idle();
+  w->result = w->handle->close_port();
+  if (w->result != SP_OK) {
+    w->error = ErrorMessage(w->result);
+  }
+}
+
+static void ClosePortComplete(napi_env env, napi_status status, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK &&
+      napi_get_undefined(env, &ret) != napi_ok) {
+    ret = nullptr;
+    w->error = "could not get undefined";
+  }
+
+  FinishPortWork(env, status, w, ret);
+}
+
+// Closes the port. Transactions, scripts and drains still running on the
+// threadpool are cancelled first, and the port is closed once they have
+// let go of it, which takes at most SerialHandle::kIoSliceMs.
+napi_value ClosePort(napi_env env, napi_callback_info args) {
+  PortWork* w;
+  napi_value argv[1];
+  size_t argc = 1;
+
   NAPI_CHECK(
-    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
-    "could not unwrap handle"
-  );
-  NAPI_CHECK(
-    napi_get_value_int32(env, argv[1], &baud_rate),
-    "could not get baudRate"
-  );
-  NAPI_CHECK(
-    napi_get_value_int32(env, argv[2], &data_bits),
-    "could not get dataBits"
-  );
-  NAPI_CHECK(
-    napi_get_value_int32(env, argv[3], &stop_bits),
-    "could not get stopBits"
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
   );
+
+  w = NewPortWork(env,
+                  argv[0],
+                  "webserial:closePort",
+                  ClosePortExecute,
+                  ClosePortComplete);
+  if (w == nullptr) {
+    return nullptr;
+  }
+
+  w->handle->cancel_io();
+  w->handle->cancel_drains();
+
+  return QueuePortWork(env, w);
+}
+
+static void DetachHandleExecute(napi_env env, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+  struct sp_port* port;
+
+  w->handle->wait_io_idle();
+  port = w->handle->detach_port();
+  if (port == nullptr) {
+    w->error = "port is not open";
+    return;
+  }
+
+  uv_once(&transfer_once, InitTransfers);
+  uv_mutex_lock(&transfer_mutex);
+  w->transfer_id = next_transfer_id++;
+  (*transfers)[w->transfer_id] = port;
+  uv_mutex_unlock(&transfer_mutex);
+}
+
+static void DetachHandleComplete(napi_env env,
+                                 napi_status status,
+                                 void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->error.empty() &&
+      napi_create_uint32(env, w->transfer_id, &ret) != napi_ok) {
+    ret = nullptr;
+    w->error = "could not create transfer ID";
+  }
+
+  FinishPortWork(env, status, w, ret);
+}
+
+// Takes the open port away from a handle and parks it under a new transfer
+// ID, which can be posted to a worker and adopted there. Like ClosePort(),
+// native work still running on the port is cancelled and waited for first,
+// so nothing on this side touches the port once the promise resolves with
+// the ID.
+napi_value DetachHandle(napi_env env, napi_callback_info args) {
+  PortWork* w;
+  napi_value argv[1];
+  size_t argc = 1;
+
   NAPI_CHECK(
-    napi_get_value_int32(env, argv[4], &parity),
-    "could not get parity"
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
   );
+
+  w = NewPortWork(env,
+                  argv[0],
+                  "webserial:detachHandle",
+                  DetachHandleExecute,
+                  DetachHandleComplete);
+  if (w == nullptr) {
+    return nullptr;
+  }
+
+  w->handle->cancel_io();
+  w->handle->cancel_drains();
+
+  return QueuePortWork(env, w);
+}
+
+static void ReconfigurePortExecute(napi_env env, void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+
+  if (!w->handle->begin_io(w->io_generation)) {
+    w->drain_state.outcome = kDrainAborted;
+    return;
+  }
+
+  w->result = w->handle->reconfigure(w->baud_rate,
+                                     w->data_bits,
+                                     w->stop_bits,
+                                     w->parity,
+                                     w->flow_control,
+                                     w->drain ? &w->drain_state : nullptr);
+  if (w->result == SP_OK) {
+    w->result = w->handle->get_baud_rate(&w->baud_rate);
+  }
+  w->handle->end_io();
+
+  if (w->result != SP_OK) {
+    w->error = ErrorMessage(w->result);
+  }
+}
+
+static void ReconfigurePortComplete(napi_env env,
+                                    napi_status status,
+                                    void* data) {
+  PortWork* w = static_cast<PortWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    napi_status create_status;
+
+    if (w->drain_state.outcome == kDrainCompleted) {
+      create_status = napi_create_int32(env, w->baud_rate, &ret);
+    } else {
+      create_status = napi_create_string_utf8(
+        env,
+        DrainOutcomeName(w->drain_state.outcome),
+        NAPI_AUTO_LENGTH,
+        &ret
+      );
+    }
+    if (create_status != napi_ok) {
+      ret = nullptr;
+      w->error = "could not create reconfigure result";
+    }
+  }
+
+  FinishPortWork(env, status, w, ret);
+}
+
+// Changes the settings of an open port. Resolves with the baud rate the port
+// now runs at, or, if drain is set and the drain gave up before anything
+// changed, with 'timeout' or 'aborted' like Drain().
+napi_value ReconfigurePort(napi_env env, napi_callback_info args) {
+  PortWork* w;
+  napi_value argv[8];
+  napi_status status;
+  size_t argc = 8;
+
   NAPI_CHECK(
-    napi_get_value_int32(env, argv[5], &flow_control),
-    "could not get flowControl"
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
   );
-  SP_CHECK(handle->open_port(baud_rate,
-                             data_bits,
-                             stop_bits,
-                             parity,
-                             flow_control));
-  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
 
-  return ret;
+  w = NewPortWork(env,
+                  argv[0],
+                  "webserial:reconfigurePort",
+                  ReconfigurePortExecute,
+                  ReconfigurePortComplete);
+  if (w == nullptr) {
+    return nullptr;
+  }
+
+  // Taken here rather than on the threadpool, so that closing the port or
+  // cancelling drains before the work starts still applies to it.
+  w->io_generation = w->handle->io_generation();
+  w->drain_state.io_generation = w->io_generation;
+  w->drain_state.drain_generation = w->handle->drain_generation();
+  w->drain_state.outcome = kDrainCompleted;
+
+  status = napi_get_value_int32(env, argv[1], &w->baud_rate);
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[2], &w->data_bits);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[3], &w->stop_bits);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[4], &w->parity);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_int32(env, argv[5], &w->flow_control);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_bool(env, argv[6], &w->drain);
+  }
+  if (status == napi_ok) {
+    status = napi_get_value_uint32(env,
+                                   argv[7],
+                                   &w->drain_state.stall_timeout_ms);
+  }
+
+  if (status != napi_ok) {
+    napi_delete_reference(env, w->handle_ref);
+    napi_delete_async_work(env, w->work);
+    delete w;
+    NAPI_CHECK(status, "could not get port options");
+  }
+
+  return QueuePortWork(env, w);
 }
 
 napi_value GetSignals(napi_env env, napi_callback_info args) {
@@ -276,6 +650,145 @@ napi_value SetSignals(napi_env env, napi_callback_info args) {
   return ret;
 }
 
+// Arguments are the handle, whether RS-485 mode is on, the RTS level while
+// sending, the RTS level after sending, whether to keep receiving while
+// sending, and the RTS delays before and after sending in milliseconds.
+napi_value SetRs485(napi_env env, napi_callback_info args) {
+  SerialHandle* handle;
+  Rs485Config config;
+  napi_value argv[7];
+  napi_value ret;
+  size_t argc = 7;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[1], &config.enabled),
+    "could not get enabled"
+  );
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[2], &config.rts_on_send),
+    "could not get rtsOnSend"
+  );
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[3], &config.rts_after_send),
+    "could not get rtsAfterSend"
+  );
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[4], &config.rx_during_tx),
+    "could not get rxDuringTx"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[5], &config.delay_before_send),
+    "could not get delayRtsBeforeSend"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[6], &config.delay_after_send),
+    "could not get delayRtsAfterSend"
+  );
+  SP_CHECK(handle->set_rs485(config));
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Arguments are the handle, whether to suppress the echo of written data,
+// and how long, in milliseconds, an echo may take to come back.
+napi_value SetEchoSuppression(napi_env env, napi_callback_info args) {
+  SerialHandle* handle;
+  napi_value argv[3];
+  napi_value ret;
+  size_t argc = 3;
+  bool enabled;
+  uint32_t timeout_ms;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  NAPI_CHECK(
+    napi_get_value_bool(env, argv[1], &enabled),
+    "could not get enabled"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &timeout_ms),
+    "could not get timeout"
+  );
+
+  if (enabled) {
+    SP_CHECK(handle->enable_echo_filter(timeout_ms * UINT64_C(1000000)));
+  } else {
+    handle->disable_echo_filter();
+  }
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Returns { suppressed, mismatched, expired }: echoed bytes dropped, echoes
+// cut short by a different byte, and bytes whose echo never came.
+napi_value GetEchoStats(napi_env env, napi_callback_info args) {
+  SerialHandle* handle;
+  napi_value argv[1];
+  napi_value ret;
+  napi_value field;
+  size_t argc = 1;
+  uint64_t suppressed;
+  uint64_t mismatched;
+  uint64_t expired;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+
+  handle->echo_filter().stats(&suppressed, &mismatched, &expired);
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create stats");
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(suppressed), &field),
+    "could not create suppressed"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "suppressed", field),
+    "could not set 'suppressed' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(mismatched), &field),
+    "could not create mismatched"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "mismatched", field),
+    "could not set 'mismatched' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, static_cast<double>(expired), &field),
+    "could not create expired"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "expired", field),
+    "could not set 'expired' property"
+  );
+
+  return ret;
+}
+
 napi_value ReadData(napi_env env, napi_callback_info args) {
   SerialHandle* handle;
   napi_value argv[2];
@@ -370,7 +883,7 @@ napi_value DiscardRxBuffer(napi_env env, napi_callback_info args) {
   return ret;
 }
 
-napi_value FlushTxBuffer(napi_env env, napi_callback_info args) {
+napi_value DiscardTxBuffer(napi_env env, napi_callback_info args) {
   SerialHandle* handle;
   napi_value argv[1];
   napi_value ret;
@@ -384,39 +897,61 @@ napi_value FlushTxBuffer(napi_env env, napi_callback_info args) {
     napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
     "could not unwrap handle"
   );
-  SP_CHECK(handle->flush_tx_buffer());
+  SP_CHECK(handle->discard_tx_buffer());
   NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
 
   return ret;
 }
 
-napi_value DiscardTxBuffer(napi_env env, napi_callback_info args) {
-  SerialHandle* handle;
-  napi_value argv[1];
-  napi_value ret;
-  size_t argc = 1;
+// Reads an Int32Array of [vendorId, productId] pairs, where a productId of -1
+// matches any product. undefined means that no filtering is done.
+static napi_status GetFilters(napi_env env,
+                              napi_value value,
+                              std::vector<struct sp_usb_filter>* filters) {
+  napi_typedarray_type type;
+  napi_valuetype value_type;
+  napi_status status;
+  size_t length;
+  void* data;
+
+  status = napi_typeof(env, value, &value_type);
+  if (status != napi_ok || value_type == napi_undefined) {
+    return status;
+  }
 
-  NAPI_CHECK(
-    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
-    "could not get arguments"
-  );
-  NAPI_CHECK(
-    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
-    "could not unwrap handle"
+  status = napi_get_typedarray_info(
+    env,
+    value,
+    &type,
+    &length,
+    &data,
+    nullptr,
+    nullptr
   );
-  SP_CHECK(handle->discard_tx_buffer());
-  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+  if (status != napi_ok) {
+    return status;
+  }
 
-  return ret;
+  if (type != napi_int32_array) {
+    return napi_invalid_arg;
+  }
+
+  int32_t* pairs = static_cast<int32_t*>(data);
+
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    filters->push_back({ pairs[i], pairs[i + 1] });
+  }
+
+  return napi_ok;
 }
 
-napi_value ListAllPorts(napi_env env, napi_callback_info args) {
-  struct sp_port** port_list;
+// Converts a port list into an array of port objects. Returns nullptr with
+// an exception pending on failure. The list is not freed.
+static napi_value CreatePortArray(napi_env env, struct sp_port** port_list) {
   napi_value ret;
   sp_return r;
 
   NAPI_CHECK(napi_create_array(env, &ret), "could not create array");
-  SP_CHECK(sp_list_ports(&port_list));
 
   for (uint32_t i = 0; port_list[i] != NULL; ++i) {
     struct sp_port* port = port_list[i];
@@ -429,89 +964,1083 @@ napi_value ListAllPorts(napi_env env, napi_callback_info args) {
     }
 
     size_t name_len = strlen(port_name);
-    napi_status status;
     napi_value object;
     napi_value name;
 
-    status = napi_create_object(env, &object);
-    if (status != napi_ok) {
-      sp_free_port_list(port_list);
-      NAPI_CHECK(status, "could not create object");
+    NAPI_CHECK(napi_create_object(env, &object), "could not create object");
+    NAPI_CHECK(
+      napi_create_string_utf8(env, port_name, name_len, &name),
+      "could not create string"
+    );
+    NAPI_CHECK(
+      napi_set_named_property(env, object, "name", name),
+      "could not set 'name' property"
+    );
+    NAPI_CHECK(
+      napi_set_element(env, ret, i, object),
+      "could not set array element"
+    );
+
+    r = sp_get_port_usb_vid_pid(port, &vendor_id, &product_id);
+    if (r != SP_OK && r != SP_ERR_ARG) {
+      SP_CHECK(r);
     }
 
-    status = napi_create_string_utf8(env, port_name, name_len, &name);
-    if (status != napi_ok) {
-      sp_free_port_list(port_list);
-      NAPI_CHECK(status, "could not create string");
+    if (r == SP_OK) {
+      napi_value vendor;
+      napi_value product;
+
+      NAPI_CHECK(
+        napi_create_int32(env, vendor_id, &vendor),
+        "could not create vendor value"
+      );
+      NAPI_CHECK(
+        napi_create_int32(env, product_id, &product),
+        "could not create product value"
+      );
+      NAPI_CHECK(
+        napi_set_named_property(env, object, "vendorId", vendor),
+        "could not set 'vendorId' property"
+      );
+      NAPI_CHECK(
+        napi_set_named_property(env, object, "productId", product),
+        "could not set 'productId' property"
+      );
     }
+  }
+
+  return ret;
+}
 
-    status = napi_set_named_property(env, object, "name", name);
+// The compact port table is made of two ArrayBuffers. 'fields' holds one
+// row of int32 values per port: vendorId, productId, usbBus, usbAddress and
+// transport (-1 when not available), followed by an [offset, length] pair
+// into 'strings' for each of name, manufacturer, product and serialNumber
+// (length -1 when not available). 'strings' holds the UTF-8 bytes. This
+// layout is decoded by lib/port-table.js.
+static const size_t kPortTableStrings = 4;
+static const size_t kPortTableRowSize = 5 + 2 * kPortTableStrings;
+
+// Converts a port list into a compact port table using a fixed number of
+// N-API calls, regardless of the number of ports. Returns nullptr with an
+// exception pending on failure. The list is not freed.
+static napi_value CreatePortTable(napi_env env, struct sp_port** port_list) {
+  napi_value fields;
+  napi_value strings;
+  napi_value ret;
+  size_t count = 0;
+  size_t strings_len = 0;
+  void* fields_data;
+  void* strings_data;
+
+  for (size_t i = 0; port_list[i] != NULL; ++i) {
+    struct sp_port* port = port_list[i];
+    const char* values[] = {
+      sp_get_port_name(port),
+      sp_get_port_usb_manufacturer(port),
+      sp_get_port_usb_product(port),
+      sp_get_port_usb_serial(port)
+    };
+
+    if (values[0] == NULL) {
+      continue;
+    }
+
+    for (size_t j = 0; j < kPortTableStrings; ++j) {
+      strings_len += values[j] == NULL ? 0 : strlen(values[j]);
+    }
+
+    count++;
+  }
+
+  NAPI_CHECK(
+    napi_create_arraybuffer(
+      env,
+      count * kPortTableRowSize * sizeof(int32_t),
+      &fields_data,
+      &fields
+    ),
+    "could not create fields buffer"
+  );
+  NAPI_CHECK(
+    napi_create_arraybuffer(env, strings_len, &strings_data, &strings),
+    "could not create strings buffer"
+  );
+
+  int32_t* row = static_cast<int32_t*>(fields_data);
+  char* str = static_cast<char*>(strings_data);
+  size_t offset = 0;
+
+  for (size_t i = 0; port_list[i] != NULL; ++i) {
+    struct sp_port* port = port_list[i];
+    const char* values[] = {
+      sp_get_port_name(port),
+      sp_get_port_usb_manufacturer(port),
+      sp_get_port_usb_product(port),
+      sp_get_port_usb_serial(port)
+    };
+    int vendor_id = -1;
+    int product_id = -1;
+    int bus = -1;
+    int address = -1;
+
+    if (values[0] == NULL) {
+      continue;
+    }
+
+    if (sp_get_port_usb_vid_pid(port, &vendor_id, &product_id) != SP_OK) {
+      vendor_id = product_id = -1;
+    }
+
+    if (sp_get_port_usb_bus_address(port, &bus, &address) != SP_OK) {
+      bus = address = -1;
+    }
+
+    row[0] = vendor_id;
+    row[1] = product_id;
+    row[2] = bus;
+    row[3] = address;
+    row[4] = sp_get_port_transport(port);
+
+    for (size_t j = 0; j < kPortTableStrings; ++j) {
+      int32_t* entry = &row[5 + 2 * j];
+
+      if (values[j] == NULL) {
+        entry[0] = offset;
+        entry[1] = -1;
+        continue;
+      }
+
+      size_t len = strlen(values[j]);
+
+      memcpy(str + offset, values[j], len);
+      entry[0] = offset;
+      entry[1] = len;
+      offset += len;
+    }
+
+    row += kPortTableRowSize;
+  }
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create object");
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "fields", fields),
+    "could not set 'fields' property"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "strings", strings),
+    "could not set 'strings' property"
+  );
+
+  return ret;
+}
+
+// For native test harnesses, which can look this up in the loaded addon to
+// enumerate a fake sysfs tree. See sp_set_tty_class_dir().
+extern "C"
+#ifdef _WIN32
+__declspec(dllexport)
+#else
+__attribute__((visibility("default")))
+#endif
+void webserial_set_tty_class_dir(const char* path) {
+  sp_set_tty_class_dir(path);
+}
+
+napi_value ListAllPorts(napi_env env, napi_callback_info args) {
+  std::vector<struct sp_usb_filter> filters;
+  struct sp_port** port_list;
+  napi_value argv[3];
+  napi_value ret;
+  size_t argc = 3;
+  bool rescan;
+  bool compact;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(napi_coerce_to_bool(env, argv[0], &ret), "could not get rescan");
+  NAPI_CHECK(napi_get_value_bool(env, ret, &rescan), "could not get rescan");
+  NAPI_CHECK(GetFilters(env, argv[1], &filters), "could not get filters");
+  NAPI_CHECK(napi_coerce_to_bool(env, argv[2], &ret), "could not get compact");
+  NAPI_CHECK(napi_get_value_bool(env, ret, &compact), "could not get compact");
+  SP_CHECK(sp_list_ports_matching(&port_list,
+                                  filters.data(),
+                                  filters.size(),
+                                  rescan));
+  ret = compact ? CreatePortTable(env, port_list) :
+                  CreatePortArray(env, port_list);
+  sp_free_port_list(port_list);
+
+  return ret;
+}
+
+struct ListAllPortsWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  bool rescan;
+  bool compact;
+  std::vector<struct sp_usb_filter> filters;
+  struct sp_port** port_list;
+  sp_return result;
+  std::string error;
+};
+
+static void ListAllPortsExecute(napi_env env, void* data) {
+  ListAllPortsWork* w = static_cast<ListAllPortsWork*>(data);
+
+  w->result = sp_list_ports_matching(&w->port_list,
+                                     w->filters.data(),
+                                     w->filters.size(),
+                                     w->rescan);
+  if (w->result != SP_OK) {
+    w->error = ErrorMessage(w->result);
+  }
+}
+
+static void ListAllPortsComplete(napi_env env,
+                                 napi_status status,
+                                 void* data) {
+  ListAllPortsWork* w = static_cast<ListAllPortsWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    ret = w->compact ? CreatePortTable(env, w->port_list) :
+                       CreatePortArray(env, w->port_list);
+  } else if (status != napi_ok) {
+    w->error = "port enumeration was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  sp_free_port_list(w->port_list);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+// Enumerates ports on the threadpool. Resolves with the same value that
+// listAllPorts() returns for the same arguments.
+napi_value ListAllPortsAsync(napi_env env, napi_callback_info args) {
+  ListAllPortsWork* w;
+  napi_value argv[3];
+  napi_value resource_name;
+  napi_value promise;
+  napi_value value;
+  napi_status status;
+  size_t argc = 3;
+  bool rescan;
+  bool compact;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(napi_coerce_to_bool(env, argv[0], &value), "could not get rescan");
+  NAPI_CHECK(napi_get_value_bool(env, value, &rescan), "could not get rescan");
+  NAPI_CHECK(
+    napi_coerce_to_bool(env, argv[2], &value),
+    "could not get compact"
+  );
+  NAPI_CHECK(
+    napi_get_value_bool(env, value, &compact),
+    "could not get compact"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:listAllPorts",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  w = new ListAllPortsWork();
+  w->rescan = rescan;
+  w->compact = compact;
+  w->port_list = nullptr;
+  w->result = SP_OK;
+
+  status = GetFilters(env, argv[1], &w->filters);
+  if (status == napi_ok) {
+    status = napi_create_promise(env, &w->deferred, &promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    ListAllPortsExecute,
+                                    ListAllPortsComplete,
+                                    w,
+                                    &w->work);
+  }
+  if (status == napi_ok) {
+    status = napi_queue_async_work(env, w->work);
     if (status != napi_ok) {
-      sp_free_port_list(port_list);
-      NAPI_CHECK(status, "could not set 'name' property");
+      napi_delete_async_work(env, w->work);
     }
+  }
+
+  if (status != napi_ok) {
+    delete w;
+    NAPI_CHECK(status, "could not queue work");
+  }
+
+  return promise;
+}
+
+struct CreateHandleWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  std::string port_name;
+  struct sp_port* port;
+  sp_return result;
+  std::string error;
+};
+
+static void CreateHandleExecute(napi_env env, void* data) {
+  CreateHandleWork* w = static_cast<CreateHandleWork*>(data);
+
+  w->result = sp_get_port_by_name(w->port_name.c_str(), &w->port);
+  if (w->result != SP_OK) {
+    w->error = ErrorMessage(w->result);
+  }
+}
+
+static void CreateHandleComplete(napi_env env,
+                                 napi_status status,
+                                 void* data) {
+  CreateHandleWork* w = static_cast<CreateHandleWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    if (SerialHandle::NewInstance(env, w->port, &ret) != napi_ok) {
+      sp_free_port(w->port);
+      ret = nullptr;
+      w->error = "could not create handle";
+    }
+  } else if (status != napi_ok) {
+    sp_free_port(w->port);
+    w->error = "handle creation was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+// Looks up the named port on the threadpool. Resolves with a SerialHandle.
+napi_value CreateHandleAsync(napi_env env, napi_callback_info args) {
+  CreateHandleWork* w;
+  std::vector<char> port_name;
+  napi_value argv[1];
+  napi_value resource_name;
+  napi_value promise;
+  napi_status status;
+  size_t argc = 1;
+  size_t len;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], nullptr, 0, &len),
+    "could not get port name length"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:createHandle",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  port_name.resize(len + 1);
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env,
+                               argv[0],
+                               port_name.data(),
+                               port_name.size(),
+                               &len),
+    "could not get port name"
+  );
 
-    status = napi_set_element(env, ret, i, object);
+  w = new CreateHandleWork();
+  w->port_name.assign(port_name.data(), len);
+  w->port = nullptr;
+  w->result = SP_OK;
+
+  status = napi_create_promise(env, &w->deferred, &promise);
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    CreateHandleExecute,
+                                    CreateHandleComplete,
+                                    w,
+                                    &w->work);
+  }
+  if (status == napi_ok) {
+    status = napi_queue_async_work(env, w->work);
     if (status != napi_ok) {
-      sp_free_port_list(port_list);
-      NAPI_CHECK(status, "could not set array element");
+      napi_delete_async_work(env, w->work);
     }
+  }
 
-    r = sp_get_port_usb_vid_pid(port, &vendor_id, &product_id);
-    if (r != SP_OK && r != SP_ERR_ARG) {
-      sp_free_port_list(port_list);
-      SP_CHECK(r);
+  if (status != napi_ok) {
+    delete w;
+    NAPI_CHECK(status, "could not queue work");
+  }
+
+  return promise;
+}
+
+struct TransactWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref;
+  SerialHandle* handle;
+  std::vector<uint8_t> request;
+  std::vector<uint8_t> delimiter;
+  std::vector<uint8_t> response;
+  size_t expect_length;
+  unsigned int timeout_ms;
+  uint32_t generation;
+  bool timed_out;
+  uint64_t write_ns;
+  uint64_t total_ns;
+  sp_return result;
+  std::string error;
+};
+
+// Returns how long a blocking call may wait before the deadline, in the
+// form libserialport expects: 0 waits forever, so an expired deadline is
+// reported separately through expired.
+static unsigned int RemainingMs(const TransactWork* w,
+                                uint64_t deadline,
+                                bool* expired) {
+  uint64_t now;
+
+  *expired = false;
+  if (w->timeout_ms == 0) {
+    return 0;
+  }
+
+  now = uv_hrtime();
+  if (now >= deadline) {
+    *expired = true;
+    return 0;
+  }
+
+  // Round up so that a partial millisecond is not turned into "forever".
+  return static_cast<unsigned int>((deadline - now + 999999) / 1000000);
+}
+
+// Returns the offset just past the first delimiter in data[0..size), or 0
+// if there is none. Only delimiters ending at or after from are looked for,
+// since anything earlier has already been searched.
+static size_t FindDelimiter(const std::vector<uint8_t>& delimiter,
+                            const uint8_t* data,
+                            size_t size,
+                            size_t from) {
+  size_t n = delimiter.size();
+  size_t end = from > n ? from : n;
+
+  for (; end <= size; end++) {
+    if (memcmp(data + end - n, delimiter.data(), n) == 0) {
+      return end;
     }
+  }
 
-    if (r == SP_OK) {
-      napi_value vendor;
-      napi_value product;
+  return 0;
+}
 
-      status = napi_create_int32(env, vendor_id, &vendor);
-      if (status != napi_ok) {
-        sp_free_port_list(port_list);
-        NAPI_CHECK(status, "could not create vendor value");
-      }
+static void RunTransaction(TransactWork* w) {
+  uint64_t start = uv_hrtime();
+  uint64_t deadline = start + w->timeout_ms * UINT64_C(1000000);
+  size_t received = 0;
+  unsigned int wait;
+  bool expired;
+  int r;
+
+  r = w->handle->write_all(w->request.data(),
+                           w->request.size(),
+                           w->timeout_ms,
+                           w->generation);
+  w->write_ns = uv_hrtime() - start;
+  if (r < 0) {
+    w->result = static_cast<sp_return>(r);
+    w->error = ErrorMessage(w->result);
+    return;
+  }
 
-      status = napi_create_int32(env, product_id, &product);
-      if (status != napi_ok) {
-        sp_free_port_list(port_list);
-        NAPI_CHECK(status, "could not create product value");
-      }
+  if (static_cast<size_t>(r) < w->request.size()) {
+    w->timed_out = true;
+    w->response.clear();
+    w->total_ns = w->write_ns;
+    return;
+  }
 
-      status = napi_set_named_property(env, object, "vendorId", vendor);
-      if (status != napi_ok) {
-        sp_free_port_list(port_list);
-        NAPI_CHECK(status, "could not set 'vendorId' property");
-      }
+  while (received < w->response.size()) {
+    uint8_t* buf = w->response.data() + received;
+    size_t want = w->response.size() - received;
+
+    if (w->handle->io_cancelled(w->generation)) {
+      break;
+    }
+
+    wait = RemainingMs(w, deadline, &expired);
+    if (expired) {
+      w->timed_out = true;
+      break;
+    }
+
+    // Short waits, so that closing the port is noticed promptly.
+    if (wait == 0 || wait > SerialHandle::kIoSliceMs) {
+      wait = SerialHandle::kIoSliceMs;
+    }
+
+    if (w->expect_length > 0) {
+      r = w->handle->blocking_read(buf, want, wait);
+    } else {
+      // Take whatever has arrived, and hand back anything past the
+      // delimiter for the next reader, rather than reading a byte at a time
+      // to avoid overshooting it.
+      r = w->handle->blocking_read_next(buf, want, wait);
+    }
+
+    if (r < 0) {
+      w->result = static_cast<sp_return>(r);
+      w->error = ErrorMessage(w->result);
+      return;
+    }
 
-      status = napi_set_named_property(env, object, "productId", product);
-      if (status != napi_ok) {
-        sp_free_port_list(port_list);
-        NAPI_CHECK(status, "could not set 'productId' property");
+    received += r;
+    if (w->expect_length == 0 && r > 0) {
+      size_t end = FindDelimiter(w->delimiter,
+                                 w->response.data(),
+                                 received,
+                                 received - r + 1);
+
+      if (end > 0) {
+        w->handle->unread(w->response.data() + end, received - end);
+        received = end;
+        break;
       }
     }
   }
 
-  sp_free_port_list(port_list);
+  w->response.resize(received);
+  w->total_ns = uv_hrtime() - start;
+}
+
+static void TransactExecute(napi_env env, void* data) {
+  TransactWork* w = static_cast<TransactWork*>(data);
+
+  if (w->handle->begin_io(w->generation)) {
+    RunTransaction(w);
+    w->handle->end_io();
+  }
+
+  if (w->result == SP_OK && w->handle->io_cancelled(w->generation)) {
+    w->result = SP_ERR_FAIL;
+    w->error = "transaction was cancelled";
+  }
+}
+
+static napi_value CreateTransactResult(napi_env env, TransactWork* w) {
+  napi_value ret;
+  napi_value field;
+  void* backing_store;
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create result");
+  NAPI_CHECK(
+    napi_create_arraybuffer(env, w->response.size(), &backing_store, &field),
+    "could not create array buffer"
+  );
+  if (!w->response.empty()) {
+    memcpy(backing_store, w->response.data(), w->response.size());
+  }
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "data", field),
+    "could not set 'data' property"
+  );
+  NAPI_CHECK(
+    napi_get_boolean(env, w->timed_out, &field),
+    "could not create timedOut"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "timedOut", field),
+    "could not set 'timedOut' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, w->write_ns / 1e6, &field),
+    "could not create writeTime"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "writeTime", field),
+    "could not set 'writeTime' property"
+  );
+  NAPI_CHECK(
+    napi_create_double(env, w->total_ns / 1e6, &field),
+    "could not create totalTime"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "totalTime", field),
+    "could not set 'totalTime' property"
+  );
+
+  return ret;
+}
+
+static void TransactComplete(napi_env env, napi_status status, void* data) {
+  TransactWork* w = static_cast<TransactWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    ret = CreateTransactResult(env, w);
+  } else if (status != napi_ok) {
+    w->error = "transaction was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_reference(env, w->handle_ref);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+static napi_status CopyArrayBuffer(napi_env env,
+                                   napi_value value,
+                                   std::vector<uint8_t>* out) {
+  napi_status status;
+  void* buf;
+  size_t len;
+
+  status = napi_get_arraybuffer_info(env, value, &buf, &len);
+  if (status == napi_ok) {
+    out->assign(static_cast<uint8_t*>(buf), static_cast<uint8_t*>(buf) + len);
+  }
+
+  return status;
+}
+
+// Writes a request and waits for the response on the threadpool, so that a
+// whole request/response exchange costs a single crossing into JS. The
+// response ends after expectLength bytes or, if expectLength is zero, after
+// the delimiter (or maxLength bytes). Resolves with the response and the
+// time spent writing and in total, in milliseconds. Running out of time is
+// not an error: the partial response is returned with timedOut set.
+napi_value Transact(napi_env env, napi_callback_info args) {
+  TransactWork* w;
+  napi_value argv[6];
+  napi_value resource_name;
+  napi_value promise;
+  napi_status status;
+  size_t argc = 6;
+  uint32_t expect_length;
+  uint32_t max_length;
+  uint32_t timeout_ms;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[2], &expect_length),
+    "could not get expectLength"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[4], &max_length),
+    "could not get maxLength"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[5], &timeout_ms),
+    "could not get timeout"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:transact",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  w = new TransactWork();
+  w->handle_ref = nullptr;
+  w->expect_length = expect_length;
+  w->timeout_ms = timeout_ms;
+  w->timed_out = false;
+  w->write_ns = 0;
+  w->total_ns = 0;
+  w->result = SP_OK;
+
+  status = napi_unwrap(env, argv[0], reinterpret_cast<void**>(&w->handle));
+  if (status == napi_ok) {
+    w->generation = w->handle->io_generation();
+    status = CopyArrayBuffer(env, argv[1], &w->request);
+  }
+  if (status == napi_ok && expect_length == 0) {
+    status = CopyArrayBuffer(env, argv[3], &w->delimiter);
+    if (status == napi_ok && w->delimiter.empty()) {
+      delete w;
+      napi_throw_range_error(env, nullptr, "delimiter must not be empty");
+      return nullptr;
+    }
+  }
+  if (status == napi_ok) {
+    w->response.resize(expect_length > 0 ? expect_length : max_length);
+    status = napi_create_reference(env, argv[0], 1, &w->handle_ref);
+  }
+  if (status == napi_ok) {
+    status = napi_create_promise(env, &w->deferred, &promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    TransactExecute,
+                                    TransactComplete,
+                                    w,
+                                    &w->work);
+  }
+  if (status == napi_ok) {
+    status = napi_queue_async_work(env, w->work);
+    if (status != napi_ok) {
+      napi_delete_async_work(env, w->work);
+    }
+  }
+
+  if (status != napi_ok) {
+    if (w->handle_ref != nullptr) {
+      napi_delete_reference(env, w->handle_ref);
+    }
+    delete w;
+    NAPI_CHECK(status, "could not queue work");
+  }
+
+  return promise;
+}
+
+struct DrainWork {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref;
+  SerialHandle* handle;
+  unsigned int timeout_ms;
+  uint32_t generation;
+  uint32_t io_generation;
+  DrainOutcome outcome;
+  sp_return result;
+  std::string error;
+};
+
+static void DrainExecute(napi_env env, void* data) {
+  DrainWork* w = static_cast<DrainWork*>(data);
+
+  if (w->handle->begin_io(w->io_generation)) {
+    w->result = w->handle->drain_output(w->timeout_ms,
+                                        w->io_generation,
+                                        w->generation,
+                                        nullptr,
+                                        &w->outcome);
+    if (w->result != SP_OK) {
+      w->error = ErrorMessage(w->result);
+    }
+    w->handle->end_io();
+  } else {
+    w->outcome = kDrainAborted;
+  }
+}
+
+static void DrainComplete(napi_env env, napi_status status, void* data) {
+  DrainWork* w = static_cast<DrainWork*>(data);
+  napi_value ret = nullptr;
+
+  if (status == napi_ok && w->result == SP_OK) {
+    if (napi_create_string_utf8(env,
+                                DrainOutcomeName(w->outcome),
+                                NAPI_AUTO_LENGTH,
+                                &ret) != napi_ok) {
+      ret = nullptr;
+      w->error = "could not create drain result";
+    }
+  } else if (status != napi_ok) {
+    w->error = "drain was cancelled";
+  }
+
+  SettlePromise(env, w->deferred, ret, w->error);
+  napi_delete_reference(env, w->handle_ref);
+  napi_delete_async_work(env, w->work);
+  delete w;
+}
+
+// Waits on the threadpool until everything written to the port has been
+// transmitted. Gives up once the output queue has not moved for timeoutMs
+// (0 for never), or when CancelDrains() is called or the port is closed,
+// discarding what is left.
+// Resolves with 'drained', 'timeout' or 'aborted'.
+napi_value Drain(napi_env env, napi_callback_info args) {
+  DrainWork* w;
+  napi_value argv[2];
+  napi_value resource_name;
+  napi_value promise;
+  napi_status status;
+  size_t argc = 2;
+  uint32_t timeout_ms;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[1], &timeout_ms),
+    "could not get timeout"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(
+      env,
+      "webserial:drain",
+      NAPI_AUTO_LENGTH,
+      &resource_name
+    ),
+    "could not create resource name"
+  );
+
+  w = new DrainWork();
+  w->handle_ref = nullptr;
+  w->timeout_ms = timeout_ms;
+  w->outcome = kDrainAborted;
+  w->result = SP_OK;
+
+  status = napi_unwrap(env, argv[0], reinterpret_cast<void**>(&w->handle));
+  if (status == napi_ok) {
+    // Taken here rather than on the threadpool, so that a cancellation
+    // requested before the work starts still applies to it.
+    w->generation = w->handle->drain_generation();
+    w->io_generation = w->handle->io_generation();
+    status = napi_create_reference(env, argv[0], 1, &w->handle_ref);
+  }
+  if (status == napi_ok) {
+    status = napi_create_promise(env, &w->deferred, &promise);
+  }
+  if (status == napi_ok) {
+    status = napi_create_async_work(env,
+                                    nullptr,
+                                    resource_name,
+                                    DrainExecute,
+                                    DrainComplete,
+                                    w,
+                                    &w->work);
+  }
+  if (status == napi_ok) {
+    status = napi_queue_async_work(env, w->work);
+    if (status != napi_ok) {
+      napi_delete_async_work(env, w->work);
+    }
+  }
+
+  if (status != napi_ok) {
+    if (w->handle_ref != nullptr) {
+      napi_delete_reference(env, w->handle_ref);
+    }
+    delete w;
+    NAPI_CHECK(status, "could not queue work");
+  }
+
+  return promise;
+}
+
+// Makes every drain pending on the port give up.
+napi_value CancelDrains(napi_env env, napi_callback_info args) {
+  SerialHandle* handle;
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, args, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_unwrap(env, argv[0], reinterpret_cast<void**>(&handle)),
+    "could not unwrap handle"
+  );
+  handle->cancel_drains();
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
 
   return ret;
 }
 
 napi_value init(napi_env env, napi_value exports) {
-  SerialHandle::Init(env);
+  if (InitAddonData(env) != napi_ok || SerialHandle::Init(env) != napi_ok) {
+    napi_throw_error(env, nullptr, "could not initialize addon");
+    return nullptr;
+  }
 
   EXPORT_FUNCTION_OR_RETURN(env, exports, CreateHandle, "createHandle");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    CreateHandleAsync,
+    "createHandleAsync"
+  );
   EXPORT_FUNCTION_OR_RETURN(env, exports, ListAllPorts, "listAllPorts");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ListAllPortsAsync,
+    "listAllPortsAsync"
+  );
   EXPORT_FUNCTION_OR_RETURN(env, exports, OpenPort, "openPort");
   EXPORT_FUNCTION_OR_RETURN(env, exports, ClosePort, "closePort");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, DetachHandle, "detachHandle");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, AdoptHandle, "adoptHandle");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, ReconfigurePort, "reconfigurePort");
   EXPORT_FUNCTION_OR_RETURN(env, exports, GetSignals, "getSignals");
   EXPORT_FUNCTION_OR_RETURN(env, exports, SetSignals, "setSignals");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SetRs485, "setRs485");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    SetEchoSuppression,
+    "setEchoSuppression"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, GetEchoStats, "getEchoStats");
   EXPORT_FUNCTION_OR_RETURN(env, exports, ReadData, "readData");
   EXPORT_FUNCTION_OR_RETURN(env, exports, WriteData, "writeData");
   EXPORT_FUNCTION_OR_RETURN(env, exports, DiscardRxBuffer, "discardRxBuffer");
-  EXPORT_FUNCTION_OR_RETURN(env, exports, FlushTxBuffer, "flushTxBuffer");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Drain, "drain");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, CancelDrains, "cancelDrains");
   EXPORT_FUNCTION_OR_RETURN(env, exports, DiscardTxBuffer, "discardTxBuffer");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Transact, "transact");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, RunScript, "runScript");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    RunSignalSequence,
+    "runSignalSequence"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ModbusMaster::Create,
+    "modbusCreate"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ModbusMaster::Submit,
+    "modbusSubmit"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, ModbusMaster::Close, "modbusClose");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    SerialBridge::Create,
+    "bridgeCreate"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SerialBridge::Stats, "bridgeStats");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SerialBridge::Close, "bridgeClose");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, FdPipe::Create, "fdPipeCreate");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, FdPipe::Stats, "fdPipeStats");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, FdPipe::Close, "fdPipeClose");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    Rfc2217Server::Create,
+    "rfc2217Create"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    Rfc2217Server::Stats,
+    "rfc2217Stats"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    Rfc2217Server::Close,
+    "rfc2217Close"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    FrameReader::Create,
+    "frameReaderCreate"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    FrameReader::Read,
+    "frameReaderRead"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    FrameReader::Close,
+    "frameReaderClose"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Create,
+    "reliableLinkCreate"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Write,
+    "reliableLinkWrite"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Flush,
+    "reliableLinkFlush"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Read,
+    "reliableLinkRead"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Stats,
+    "reliableLinkStats"
+  );
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    ReliableLink::Close,
+    "reliableLinkClose"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, RxRing::Create, "rxRingCreate");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, RxRing::Close, "rxRingClose");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, TxPacer::Create, "txPacerCreate");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    TxPacer::Configure,
+    "txPacerConfigure"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, TxPacer::Write, "txPacerWrite");
+  EXPORT_FUNCTION_OR_RETURN(
+    env,
+    exports,
+    TxPacer::Discard,
+    "txPacerDiscard"
+  );
+  EXPORT_FUNCTION_OR_RETURN(env, exports, TxPacer::Close, "txPacerClose");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, DmxOutput::Create, "dmxCreate");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, DmxOutput::Stats, "dmxStats");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, DmxOutput::Close, "dmxClose");
 
   EXPORT_INT_OR_RETURN(env, exports, SP_PARITY_NONE, "kParityNone");
   EXPORT_INT_OR_RETURN(env, exports, SP_PARITY_ODD, "kParityOdd");
@@ -0,0 +1,93 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const {
+  Binding,
+  FakeDriver,
+  kAddonPath,
+  openSerialPort,
+  readDevice
+} = require('./fixtures');
+
+
+describe('baud rate', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('opens at non-standard and multi-megabaud rates', async () => {
+    for (const baudRate of [250000, 3000000, 12000000]) {
+      const pty = FakeDriver.openPty();
+
+      FakeDriver.install(kAddonPath);
+
+      const handle = await Binding.createHandleAsync(pty.path);
+
+      try {
+        const actual = await Binding.openPort(handle, baudRate, 8, 1,
+          Binding.kParityNone, Binding.kFlowControlNone);
+
+        assert.strictEqual(actual, baudRate);
+        // A reconfigure that changes nothing reads the rate back again.
+        assert.strictEqual(await Binding.reconfigurePort(handle, -1, -1, -1,
+          -1, -1, false, 0), baudRate);
+      } finally {
+        await Binding.closePort(handle);
+        Fs.closeSync(pty.fd);
+      }
+    }
+  });
+
+  it('reports the rate the driver programmed', async () => {
+    device = await openSerialPort({ baudRate: 250000 });
+
+    const { port, fd } = device;
+    const writer = port.writable.getWriter();
+
+    assert.strictEqual(port.baudRate, 250000);
+    await writer.write(new Uint8Array([1, 2, 3]));
+    writer.releaseLock();
+    assert.deepStrictEqual(readDevice(fd, 3), Buffer.from([1, 2, 3]));
+    await port.reconfigure({ baudRate: 3000000 });
+    assert.strictEqual(port.baudRate, 3000000);
+    await port.reconfigure({ baudRate: 115200 });
+    assert.strictEqual(port.baudRate, 115200);
+  });
+
+  it('refuses non-standard rates without BOTHER', async () => {
+    const pty = FakeDriver.openPty();
+
+    FakeDriver.install(kAddonPath);
+    FakeDriver.configure(0, -1, true);
+
+    try {
+      const handle = await Binding.createHandleAsync(pty.path);
+
+      await assert.rejects(Binding.openPort(handle, 250000, 8, 1,
+        Binding.kParityNone, Binding.kFlowControlNone), /Not supported/);
+
+      // Standard rates do not need it.
+      assert.strictEqual(await Binding.openPort(handle, 115200, 8, 1,
+        Binding.kParityNone, Binding.kFlowControlNone), 115200);
+      await assert.rejects(Binding.reconfigurePort(handle, 250000, -1, -1,
+        -1, -1, false, 0), /Not supported/);
+      await Binding.closePort(handle);
+    } finally {
+      Fs.closeSync(pty.fd);
+    }
+
+    await assert.rejects(openSerialPort({ baudRate: 3000000 }), {
+      name: 'NetworkError',
+      message: /Not supported/
+    });
+  });
+});
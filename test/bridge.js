@@ -0,0 +1,114 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { SerialBridge } = require('../lib');
+const { FakeDriver, openSerialPort, readDevice } = require('./fixtures');
+
+
+describe('bridges', { skip: FakeDriver === null }, () => {
+  let devices = [];
+
+  async function start() {
+    devices = [
+      await openSerialPort({ baudRate: 115200 }),
+      await openSerialPort({ baudRate: 115200 })
+    ];
+    return devices;
+  }
+
+  afterEach(async () => {
+    for (const { port, fd } of devices) {
+      await port.close();
+      Fs.closeSync(fd);
+    }
+
+    devices = [];
+    FakeDriver.uninstall();
+  });
+
+  it('forwards data both ways until closed', async () => {
+    const [a, b] = await start();
+    const bridge = a.port.bridgeTo(b.port, { bufferSize: 16 });
+
+    assert(bridge instanceof SerialBridge);
+    assert.throws(() => {
+      new SerialBridge(); // eslint-disable-line no-new
+    }, { name: 'TypeError', message: 'illegal constructor' });
+
+    // More than the buffer holds goes through in pieces.
+    const payload = Buffer.alloc(100, 'x');
+
+    Fs.writeSync(a.fd, payload);
+    assert.deepStrictEqual(readDevice(b.fd, 100), payload);
+    Fs.writeSync(b.fd, 'back');
+    assert.deepStrictEqual(readDevice(a.fd, 4), Buffer.from('back'));
+    assert.deepStrictEqual(bridge.getStats(), { aToB: 100, bToA: 4 });
+
+    // Both ports belong to the bridge meanwhile.
+    for (const { port } of [a, b]) {
+      assert.throws(() => {
+        return port.readable;
+      }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+      assert.throws(() => {
+        return port.writable;
+      }, { name: 'InvalidStateError' });
+      await assert.rejects(port.close(), { name: 'InvalidStateError' });
+    }
+
+    assert.deepStrictEqual(await bridge.close(), { aToB: 100, bToA: 4 });
+    assert.strictEqual(await bridge.closed, await bridge.close());
+
+    // The ports can be used normally again.
+    const writer = b.port.writable.getWriter();
+
+    await writer.write(Buffer.from('free'));
+    writer.releaseLock();
+    assert.deepStrictEqual(readDevice(b.fd, 4), Buffer.from('free'));
+    assert.strictEqual(readDevice(a.fd, 1, 20).length, 0);
+  });
+
+  it('rejects closed when a port fails', async () => {
+    const [a, b] = await start();
+    const bridge = a.port.bridgeTo(b.port);
+
+    // Hanging up the device side makes reads on the port fail. The
+    // placeholder keeps the cleanup the same for every test.
+    Fs.closeSync(a.fd);
+    a.fd = Fs.openSync('/dev/null', 'r');
+    await assert.rejects(bridge.closed,
+      { message: 'Bridged port was disconnected' });
+
+    // Both ports are released.
+    assert(b.port.writable instanceof WritableStream);
+  });
+
+  it('checks its arguments and the ports', async () => {
+    const [a, b] = await start();
+
+    assert.throws(() => {
+      a.port.bridgeTo(a.port);
+    }, { name: 'TypeError', message: 'port must be another SerialPort' });
+    assert.throws(() => {
+      a.port.bridgeTo({});
+    }, { name: 'TypeError', message: 'port must be another SerialPort' });
+    assert.throws(() => {
+      a.port.bridgeTo(b.port, { bufferSize: 0 });
+    }, {
+      name: 'TypeError',
+      message: 'bufferSize must be a non-zero unsigned integer'
+    });
+
+    const reader = b.port.readable.getReader();
+
+    assert.throws(() => {
+      a.port.bridgeTo(b.port);
+    }, { name: 'InvalidStateError', message: 'readable stream is locked' });
+    reader.releaseLock();
+    await b.port.close();
+    assert.throws(() => {
+      a.port.bridgeTo(b.port);
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+    await b.port.open({ baudRate: 115200 });
+  });
+});
@@ -0,0 +1,153 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { DmxOutput } = require('../lib');
+const { FakeDriver, openSerialPort, readDevice, sleep } = require('./fixtures');
+// From termios.h on Linux.
+const CSTOPB = 0o100;
+
+
+describe('DMX512 output', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  function start() {
+    return openSerialPort({ baudRate: 250000, stopBits: 2 });
+  }
+
+  // Skips what the output has sent so far and returns the next frame. Each
+  // frame is written in one go, so what is skipped ends on a frame boundary.
+  async function nextFrame(fd, size) {
+    await sleep(30);
+    readDevice(fd, 65536, 0);
+    return readDevice(fd, size);
+  }
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('sends the universe continuously', async () => {
+    device = await start();
+
+    const { port, fd } = device;
+
+    assert.strictEqual(port.baudRate, 250000);
+    assert.strictEqual(FakeDriver.getTermios(fd).cflag & CSTOPB, CSTOPB);
+
+    const output = port.createDmxOutput({ slots: 4, refreshRate: 100 });
+
+    assert(output instanceof DmxOutput);
+    assert.strictEqual(output.universe.length, 5);
+    assert.strictEqual(output.universe.buffer, output.buffer);
+    output.universe.set([10, 20, 30, 40], 1);
+    assert.deepStrictEqual(await nextFrame(fd, 5),
+      Buffer.from([0, 10, 20, 30, 40]));
+
+    // Changes go out with the next frame.
+    output.universe[2] = 0xff;
+    assert.deepStrictEqual(await nextFrame(fd, 5),
+      Buffer.from([0, 10, 0xff, 30, 40]));
+
+    const { frames } = output.stats();
+
+    assert(frames >= 2);
+    assert(FakeDriver.getState().breaks >= frames);
+
+    // The port's input stays free, while its output belongs to the output.
+    assert(port.readable instanceof ReadableStream);
+    assert.throws(() => {
+      return port.writable;
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+
+    const final = await output.close();
+
+    assert(final.frames >= frames);
+    assert.strictEqual(typeof final.overruns, 'number');
+    assert.strictEqual(FakeDriver.getState().breakOn, false);
+    assert(port.writable instanceof WritableStream);
+  });
+
+  it('sends a start code and fewer slots', async () => {
+    device = await start();
+
+    const { port, fd } = device;
+    const output = port.createDmxOutput({
+      slots: 1,
+      startCode: 0xcc,
+      breakMicros: 88,
+      markAfterBreakMicros: 8
+    });
+
+    output.universe[1] = 7;
+    assert.deepStrictEqual(await nextFrame(fd, 2), Buffer.from([0xcc, 7]));
+    await output.close();
+  });
+
+  it('rejects closed when the port fails', async () => {
+    device = await start();
+
+    const output = device.port.createDmxOutput({ slots: 1 });
+
+    // Hanging up the device side makes the port fail. The placeholder keeps
+    // the cleanup the same for every test.
+    Fs.closeSync(device.fd);
+    device.fd = Fs.openSync('/dev/null', 'r');
+    await assert.rejects(output.closed);
+    assert(device.port.writable instanceof WritableStream);
+  });
+
+  it('checks its options and the port', async () => {
+    device = await start();
+
+    const { port } = device;
+    const invalid = [
+      [{ slots: 0 }, /^slots must be an integer from 1 to 512$/],
+      [{ slots: 513 }, /^slots must be an integer from 1 to 512$/],
+      [{ refreshRate: 0 }, /^refreshRate must be a number above 0/],
+      [{ refreshRate: NaN }, /^refreshRate must be a number above 0/],
+      [{ refreshRate: 1001 }, /^refreshRate must be a number above 0/],
+      [{ breakMicros: 87 }, /^breakMicros must be an integer from 88 to/],
+      [{ markAfterBreakMicros: 7 }, /^markAfterBreakMicros must be an/],
+      [{ markAfterBreakMicros: 1e6 + 1 }, /^markAfterBreakMicros must be/],
+      [{ startCode: 256 }, /^startCode must be an integer from 0 to 255$/]
+    ];
+
+    assert.throws(() => {
+      new DmxOutput(); // eslint-disable-line no-new
+    }, { name: 'TypeError', message: 'illegal constructor' });
+
+    for (const [options, message] of invalid) {
+      assert.throws(() => {
+        port.createDmxOutput(options);
+      }, { name: 'TypeError', message });
+    }
+
+    const writer = port.writable.getWriter();
+
+    assert.throws(() => {
+      port.createDmxOutput();
+    }, { name: 'InvalidStateError', message: 'writable stream is locked' });
+    writer.releaseLock();
+
+    const output = port.createDmxOutput(null);
+
+    assert.strictEqual(output.universe.length, 513);
+    assert.throws(() => {
+      port.createDmxOutput();
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+    await output.close();
+    await port.close();
+    assert.throws(() => {
+      port.createDmxOutput();
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+    await port.open({ baudRate: 250000, stopBits: 2 });
+  });
+});
@@ -0,0 +1,124 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, readDevice, sleep } = require('./fixtures');
+
+
+describe('draining', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('waits for the output queue to empty', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port, fd } = device;
+    const writer = port.writable.getWriter();
+
+    await writer.write(Buffer.from('data'));
+    writer.releaseLock();
+    assert.deepStrictEqual(readDevice(fd, 4), Buffer.from('data'));
+    await port.drain();
+
+    // A queue that keeps moving does not time out, however long it takes.
+    const start = Date.now();
+
+    FakeDriver.configure(0, 100);
+
+    const draining = port.drain({ timeout: 100 });
+
+    for (const queued of [75, 50, 25, 0]) {
+      await sleep(40);
+      FakeDriver.configure(0, queued);
+    }
+
+    await draining;
+    assert(Date.now() - start >= 150);
+  });
+
+  it('gives up on a stalled queue', async () => {
+    device = await openSerialPort({ baudRate: 9600, drainTimeout: 50 });
+
+    const { port } = device;
+
+    FakeDriver.configure(0, 100);
+    await assert.rejects(port.drain(), {
+      name: 'TimeoutError',
+      message: 'drain timed out'
+    });
+    await assert.rejects(port.drain({ timeout: 10 }), { name: 'TimeoutError' });
+
+    // Closing the writable does not hang on it either.
+    await port.writable.close();
+    FakeDriver.configure(0, -1);
+  });
+
+  it('stops when aborted or when the port closes', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port } = device;
+    let controller = new AbortController();
+
+    FakeDriver.configure(0, 100);
+    controller.abort();
+    await assert.rejects(port.drain({ signal: controller.signal }), {
+      name: 'AbortError',
+      message: 'drain was aborted'
+    });
+
+    // Aborting cancels every drain pending on the port.
+    controller = new AbortController();
+
+    const drains = [
+      port.drain({ signal: controller.signal, timeout: 0 }),
+      port.drain({ timeout: 0 })
+    ];
+
+    await sleep(20);
+    controller.abort();
+
+    await Promise.all(drains.map((drain) => {
+      return assert.rejects(drain, { name: 'AbortError' });
+    }));
+
+    const draining = port.drain({ timeout: 0 });
+
+    await Promise.all([
+      assert.rejects(draining, { name: 'AbortError' }),
+      port.close()
+    ]);
+    FakeDriver.configure(0, -1);
+    await port.open({ baudRate: 9600 });
+  });
+
+  it('checks its options and the port', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port } = device;
+
+    await assert.rejects(port.drain({ timeout: -1 }), {
+      name: 'TypeError',
+      message: 'timeout must be an unsigned integer'
+    });
+    await assert.rejects(port.drain({ signal: {} }), {
+      name: 'TypeError',
+      message: 'signal must be an AbortSignal'
+    });
+    await port.drain(null);
+    await port.close();
+    await assert.rejects(port.drain(), {
+      name: 'InvalidStateError',
+      message: 'port is not open'
+    });
+    await port.open({ baudRate: 9600 });
+  });
+});
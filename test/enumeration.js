@@ -0,0 +1,302 @@
+'use strict';
+const assert = require('node:assert');
+const { describe, it, beforeEach, afterEach } =
+  exports.lab = require('@hapi/lab').script();
+const { Serial } = require('../lib');
+const { decodePortTable } = require('../lib/port-table');
+const { Binding, FakeDriver, kAddonPath } = require('./fixtures');
+const { FakeSysfs } = require('./fixtures/fake-sysfs');
+// From enum sp_transport in libserialport.h.
+const kTransportNative = 0;
+const kTransportUsb = 1;
+const kFtdi = {
+  idVendor: '0403',
+  idProduct: '6001',
+  busnum: 1,
+  devnum: 5,
+  manufacturer: 'FTDI',
+  product: 'FT232R USB UART',
+  serial: 'A50285BI'
+};
+
+
+// Lists the ports in the compact format, as plain objects sorted by name.
+function listDetails() {
+  const ports = decodePortTable(Binding.listAllPorts(true, undefined, true));
+
+  return ports.map((port) => {
+    return { ...port };
+  }).sort((a, b) => {
+    return a.name < b.name ? -1 : 1;
+  });
+}
+
+
+function names(ports) {
+  return ports.map((port) => {
+    return port.name;
+  }).sort();
+}
+
+
+describe('port enumeration', {
+  skip: FakeDriver === null || process.platform !== 'linux'
+}, () => {
+  let sysfs = null;
+
+  beforeEach(() => {
+    sysfs = new FakeSysfs();
+    FakeDriver.install(kAddonPath);
+    FakeDriver.setTtyClassDir(sysfs.classDir);
+  });
+
+  afterEach(() => {
+    FakeDriver.uninstall();
+    sysfs.destroy();
+    sysfs = null;
+  });
+
+  it('reuses cached details until asked to rescan', () => {
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    sysfs.addVirtual('tty1');
+    assert.deepStrictEqual(Binding.listAllPorts(false), [
+      { name: '/dev/ttyUSB0', vendorId: 0x0403, productId: 0x6001 }
+    ]);
+
+    // Attributes changing under an unchanged entry are not noticed, as the
+    // entry is not probed again...
+    sysfs.setAttributes('ttyUSB0', { idProduct: '6015' });
+    assert.strictEqual(Binding.listAllPorts(false)[0].productId, 0x6001);
+
+    // ...unless the cache is discarded.
+    assert.strictEqual(Binding.listAllPorts(true)[0].productId, 0x6015);
+  });
+
+  it('notices ports that come and go', () => {
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    assert.deepStrictEqual(names(Binding.listAllPorts(false)),
+      ['/dev/ttyUSB0']);
+    sysfs.addUsb('ttyACM0', { ...kFtdi, idVendor: '2341' });
+    assert.deepStrictEqual(names(Binding.listAllPorts(false)),
+      ['/dev/ttyACM0', '/dev/ttyUSB0']);
+    sysfs.remove('ttyUSB0');
+    assert.deepStrictEqual(Binding.listAllPorts(false), [
+      { name: '/dev/ttyACM0', vendorId: 0x2341, productId: 0x6001 }
+    ]);
+  });
+
+  it('reads the USB device attributes', () => {
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    sysfs.addUsb('ttyUSB1', { idVendor: '10c4', idProduct: 'ea60' });
+    // A USB device without its bus number is listed without USB details.
+    sysfs.addUsb('ttyUSB2', { idVendor: '067b', idProduct: '2303' });
+    sysfs.setAttributes('ttyUSB1', { busnum: 3, devnum: 17 });
+    sysfs.addNative('tty');
+    assert.deepStrictEqual(listDetails(), [
+      {
+        vendorId: undefined,
+        productId: undefined,
+        usbBus: undefined,
+        usbAddress: undefined,
+        transport: kTransportNative,
+        name: '/dev/tty',
+        manufacturer: undefined,
+        product: undefined,
+        serialNumber: undefined
+      },
+      {
+        vendorId: 0x0403,
+        productId: 0x6001,
+        usbBus: 1,
+        usbAddress: 5,
+        transport: kTransportUsb,
+        name: '/dev/ttyUSB0',
+        manufacturer: 'FTDI',
+        product: 'FT232R USB UART',
+        serialNumber: 'A50285BI'
+      },
+      {
+        vendorId: 0x10c4,
+        productId: 0xea60,
+        usbBus: 3,
+        usbAddress: 17,
+        transport: kTransportUsb,
+        name: '/dev/ttyUSB1',
+        manufacturer: undefined,
+        product: undefined,
+        serialNumber: undefined
+      },
+      {
+        vendorId: undefined,
+        productId: undefined,
+        usbBus: undefined,
+        usbAddress: undefined,
+        transport: kTransportUsb,
+        name: '/dev/ttyUSB2',
+        manufacturer: undefined,
+        product: undefined,
+        serialNumber: undefined
+      }
+    ]);
+  });
+
+  it('lists ports and creates handles off the event loop', async () => {
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    sysfs.addNative('tty');
+
+    const listing = Binding.listAllPortsAsync(true, undefined, false);
+
+    assert(listing instanceof Promise);
+    assert.deepStrictEqual(names(await listing), ['/dev/tty', '/dev/ttyUSB0']);
+    assert.deepStrictEqual(await Binding.listAllPortsAsync(false),
+      Binding.listAllPorts(false));
+
+    const handle = await Binding.createHandleAsync('/dev/tty');
+
+    assert.strictEqual(typeof handle, 'object');
+    // USB ports are listed from sysfs alone, but a handle needs the node.
+    await assert.rejects(Binding.createHandleAsync('/dev/ttyUSB0'),
+      { message: 'Invalid argument' });
+    assert.throws(() => {
+      Binding.createHandleAsync(1);
+    }, { message: 'could not get port name length' });
+    assert.throws(() => {
+      Binding.listAllPortsAsync(false, [0x0403, 0x6001], false);
+    }, { message: 'could not queue work' });
+  });
+
+  it('reports failures from the threadpool', async () => {
+    FakeDriver.setTtyClassDir(`${sysfs.classDir}-missing`);
+    // The message depends on errno, so it must be built where the failure
+    // happened.
+    await assert.rejects(Binding.listAllPortsAsync(true, undefined, true),
+      { message: 'No such file or directory' });
+  });
+
+  it('rejects requestPort() when a port cannot be reached', async () => {
+    const serial = new Serial({
+      requestPortHook(ports) {
+        return ports[0];
+      }
+    });
+
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    await assert.rejects(serial.requestPort(), { message: 'Invalid argument' });
+    sysfs.remove('ttyUSB0');
+    await assert.rejects(serial.requestPort(), { name: 'NotFoundError' });
+    FakeDriver.setTtyClassDir(`${sysfs.classDir}-missing`);
+    await assert.rejects(serial.requestPort(),
+      { message: 'No such file or directory' });
+  });
+
+  it('filters by vendor and product natively', () => {
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    sysfs.addUsb('ttyUSB1', { ...kFtdi, idProduct: '6015' });
+    sysfs.addUsb('ttyACM0', { ...kFtdi, idVendor: '2341', idProduct: '0043' });
+    sysfs.addNative('tty');
+
+    function list(...pairs) {
+      return names(Binding.listAllPorts(false, new Int32Array(pairs)));
+    }
+
+    assert.deepStrictEqual(list(), ['/dev/tty', '/dev/ttyACM0',
+      '/dev/ttyUSB0', '/dev/ttyUSB1']);
+    assert.deepStrictEqual(list(0x0403, -1), ['/dev/ttyUSB0', '/dev/ttyUSB1']);
+    assert.deepStrictEqual(list(0x0403, 0x6015), ['/dev/ttyUSB1']);
+    // A port matches if any filter does, even one for the same vendor.
+    assert.deepStrictEqual(list(0x0403, 0x6001, 0x0403, 0x6015),
+      ['/dev/ttyUSB0', '/dev/ttyUSB1']);
+    assert.deepStrictEqual(list(0x2341, 0x0043, 0x0403, 0x6015),
+      ['/dev/ttyACM0', '/dev/ttyUSB1']);
+    assert.deepStrictEqual(list(0x1234, -1), []);
+  });
+
+  it('passes requestPort() filters to the enumeration', async () => {
+    let offered = null;
+    const serial = new Serial({
+      requestPortHook(ports) {
+        offered = names(ports);
+        return undefined;
+      }
+    });
+
+    sysfs.addUsb('ttyUSB0', kFtdi);
+    sysfs.addUsb('ttyACM0', { ...kFtdi, idVendor: '2341', idProduct: '0043' });
+    sysfs.addNative('tty');
+    await assert.rejects(serial.requestPort({
+      filters: [{ usbVendorId: 0x2341 }, { usbVendorId: 0x0403 }]
+    }), { name: 'NotFoundError' });
+    assert.deepStrictEqual(offered, ['/dev/ttyACM0', '/dev/ttyUSB0']);
+    await assert.rejects(serial.requestPort({
+      filters: [{ usbVendorId: 0x0403, usbProductId: 0x6015 }]
+    }), { name: 'NotFoundError' });
+    assert.deepStrictEqual(offered, []);
+    await assert.rejects(serial.requestPort({ filters: [] }),
+      { name: 'NotFoundError' });
+    assert.deepStrictEqual(offered, ['/dev/tty', '/dev/ttyACM0',
+      '/dev/ttyUSB0']);
+
+    const invalid = [
+      [1, /cannot be converted to a sequence/],
+      [{}, /callable @@iterator property/],
+      [[null], /cannot convert signals to dictionary/],
+      [[{ usbProductId: 1 }], /provide a property to filter by/]
+    ];
+
+    for (const [filters, message] of invalid) {
+      await assert.rejects(serial.requestPort({ filters }),
+        { name: 'TypeError', message });
+    }
+  });
+
+  it('lists ports in a compact table', () => {
+    sysfs.addUsb('ttyUSB0', {
+      ...kFtdi,
+      manufacturer: 'Prolific™ Ünïcode'
+    });
+    sysfs.addUsb('ttyACM0', { ...kFtdi, idVendor: '2341', idProduct: '0043' });
+    sysfs.addNative('tty');
+
+    const table = Binding.listAllPorts(false, undefined, true);
+
+    assert(table.fields instanceof ArrayBuffer);
+    assert(table.strings instanceof ArrayBuffer);
+
+    const ports = decodePortTable(table);
+
+    // The same ports, in the same order, as the object format.
+    assert.deepStrictEqual(ports.map((port) => {
+      return port.name;
+    }), Binding.listAllPorts(false).map((port) => {
+      return port.name;
+    }));
+
+    const port = ports.find((entry) => {
+      return entry.name === '/dev/ttyUSB0';
+    });
+
+    // Multi-byte UTF-8 survives the packing, strings are decoded once, and
+    // the entries serialize like plain objects.
+    assert.strictEqual(port.manufacturer, 'Prolific™ Ünïcode');
+    assert.strictEqual(port.manufacturer, 'Prolific™ Ünïcode');
+    assert.deepStrictEqual(JSON.parse(JSON.stringify(port)), {
+      vendorId: 0x0403,
+      productId: 0x6001,
+      usbBus: 1,
+      usbAddress: 5,
+      transport: kTransportUsb,
+      name: '/dev/ttyUSB0',
+      manufacturer: 'Prolific™ Ünïcode',
+      product: 'FT232R USB UART',
+      serialNumber: 'A50285BI'
+    });
+  });
+
+  it('lists no ports as an empty table', () => {
+    const table = Binding.listAllPorts(false, undefined, true);
+
+    assert.strictEqual(table.fields.byteLength, 0);
+    assert.strictEqual(table.strings.byteLength, 0);
+    assert.deepStrictEqual(decodePortTable(table), []);
+  });
+});
@@ -0,0 +1,217 @@
+'use strict';
+const assert = require('node:assert');
+const ChildProcess = require('node:child_process');
+const Fs = require('node:fs');
+const Os = require('node:os');
+const Path = require('node:path');
+const { describe, it, beforeEach, afterEach } =
+  exports.lab = require('@hapi/lab').script();
+const { SerialFdPipe } = require('../lib');
+const {
+  FakeDriver,
+  openSerialPort,
+  readDevice,
+  sleep
+} = require('./fixtures');
+
+
+describe('file descriptor pipes', { skip: FakeDriver === null }, () => {
+  let device = null;
+  let dir = null;
+  let fds = [];
+
+  // Opens a file in the scratch directory, closed after the test.
+  function open(name, flags) {
+    const fd = Fs.openSync(Path.join(dir, name), flags);
+
+    fds.push(fd);
+    return fd;
+  }
+
+  function mkfifo(name) {
+    ChildProcess.execFileSync('mkfifo', [Path.join(dir, name)]);
+  }
+
+  async function waitForBytes(pipe, bytes) {
+    for (let i = 0; i < 1000 && pipe.bytesTransferred < bytes; i++) {
+      await sleep(1);
+    }
+
+    assert.strictEqual(pipe.bytesTransferred, bytes);
+  }
+
+  beforeEach(async () => {
+    dir = Fs.mkdtempSync(Path.join(Os.tmpdir(), 'webserial-'));
+    device = await openSerialPort({ baudRate: 115200 });
+  });
+
+  afterEach(async () => {
+    await device.port.close();
+    Fs.closeSync(device.fd);
+    device = null;
+
+    for (const fd of fds) {
+      Fs.closeSync(fd);
+    }
+
+    fds = [];
+    Fs.rmSync(dir, { recursive: true });
+    FakeDriver.uninstall();
+  });
+
+  it('copies input to a file, up to a length', async () => {
+    const { port, fd } = device;
+    const file = open('out', 'w+');
+    const pipe = port.pipeToFd(file, { length: 10 });
+
+    assert(pipe instanceof SerialFdPipe);
+    Fs.writeSync(fd, '0123456789abcde');
+    assert.strictEqual(await pipe.done, 10);
+    assert.strictEqual(Fs.readFileSync(Path.join(dir, 'out'), 'latin1'),
+      '0123456789');
+
+    // The limit is never overshot: the rest is left for the port.
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'abcde');
+  });
+
+  it('copies input into a pipe until closed', async () => {
+    const { port, fd } = device;
+
+    mkfifo('fifo');
+
+    const fifo = open('fifo', 'r+');
+    const pipe = port.pipeToFd(fifo);
+
+    Fs.writeSync(fd, 'abc');
+    await waitForBytes(pipe, 3);
+    assert.strictEqual(await pipe.close(), 3);
+
+    const received = Buffer.alloc(3);
+
+    assert.strictEqual(Fs.readSync(fifo, received), 3);
+    assert.strictEqual(received.toString(), 'abc');
+
+    // The port can be read normally again.
+    Fs.writeSync(fd, 'd');
+    await sleep(10);
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'd');
+  });
+
+  it('writes a file to the port', async () => {
+    const { port, fd } = device;
+    const data = Buffer.alloc(5000);
+
+    for (let i = 0; i < data.length; i++) {
+      data[i] = i & 0xff;
+    }
+
+    Fs.writeFileSync(Path.join(dir, 'in'), data);
+
+    let pipe = port.pipeFromFd(open('in', 'r'));
+
+    assert.deepStrictEqual(readDevice(fd, data.length), data);
+    assert.strictEqual(await pipe.done, data.length);
+
+    pipe = port.pipeFromFd(open('in', 'r'), { length: 100 });
+    assert.strictEqual(await pipe.done, 100);
+    assert.deepStrictEqual(readDevice(fd, data.length), data.subarray(0, 100));
+  });
+
+  it('writes what comes through a pipe until end of file', async () => {
+    const { port, fd } = device;
+
+    mkfifo('fifo');
+
+    const { O_RDONLY, O_NONBLOCK } = Fs.constants;
+    const source = open('fifo', O_RDONLY | O_NONBLOCK);
+    const sink = Fs.openSync(Path.join(dir, 'fifo'), 'w');
+
+    Fs.writeSync(sink, 'hello');
+    Fs.closeSync(sink);
+
+    const pipe = port.pipeFromFd(source);
+
+    assert.strictEqual(await pipe.done, 5);
+    assert.deepStrictEqual(readDevice(fd, 5), Buffer.from('hello'));
+  });
+
+  it('rejects done when the file descriptor fails', async () => {
+    const { port, fd } = device;
+
+    Fs.writeFileSync(Path.join(dir, 'file'), 'data');
+
+    const toFd = port.pipeToFd(open('file', 'r'));
+
+    Fs.writeSync(fd, 'x');
+    await assert.rejects(toFd.done, { message: 'bad file descriptor' });
+
+    const fromFd = port.pipeFromFd(open('file', 'a'));
+
+    await assert.rejects(fromFd.done, { message: 'bad file descriptor' });
+    // Both sides of the port are released.
+    assert(port.writable instanceof WritableStream);
+    Fs.writeSync(fd, 'y');
+    await sleep(10);
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'y');
+  });
+
+  it('checks its arguments and the port', async () => {
+    const { port } = device;
+    const file = open('out', 'w');
+
+    assert.throws(() => {
+      new SerialFdPipe(); // eslint-disable-line no-new
+    }, { name: 'TypeError', message: 'illegal constructor' });
+
+    for (const fd of [-1, 1.5, '1', 2 ** 31]) {
+      assert.throws(() => {
+        port.pipeToFd(fd);
+      }, { name: 'TypeError', message: 'fd must be a file descriptor' });
+    }
+
+    assert.throws(() => {
+      port.pipeFromFd(file, { length: -1 });
+    }, {
+      name: 'TypeError',
+      message: 'length must be a non-negative integer'
+    });
+
+    // A pipe takes one side of the port, and leaves the other.
+    const pipe = port.pipeToFd(file);
+
+    assert.throws(() => {
+      return port.readable;
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+    assert.throws(() => {
+      port.pipeToFd(file);
+    }, { name: 'InvalidStateError' });
+
+    const writer = port.writable.getWriter();
+
+    assert.throws(() => {
+      port.pipeFromFd(file);
+    }, { name: 'InvalidStateError', message: 'writable stream is locked' });
+    writer.releaseLock();
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+    await pipe.close();
+    await port.close();
+    assert.throws(() => {
+      port.pipeToFd(file);
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+    await port.open({ baudRate: 115200 });
+  });
+});
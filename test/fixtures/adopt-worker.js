@@ -0,0 +1,42 @@
+'use strict';
+// Runs in a worker thread: adopts the port transferred in workerData,
+// checks that the same transfer cannot be adopted twice, sends 'ping' and
+// reads the 'pong' already waiting before closing the port.
+const { parentPort, workerData } = require('node:worker_threads');
+const { SerialPort } = require('../../lib');
+
+
+async function main() {
+  const port = SerialPort.adopt(workerData);
+  let secondAdopt = null;
+
+  try {
+    SerialPort.adopt(workerData);
+  } catch (err) {
+    secondAdopt = err.name;
+  }
+
+  const writer = port.writable.getWriter();
+
+  await writer.write(Buffer.from('ping'));
+  writer.releaseLock();
+  parentPort.postMessage({ baudRate: port.baudRate, secondAdopt });
+
+  const reader = port.readable.getReader();
+  const chunks = [];
+  let received = 0;
+
+  while (received < 4) {
+    const { value } = await reader.read();
+
+    chunks.push(value);
+    received += value.length;
+  }
+
+  reader.releaseLock();
+  await port.close();
+  parentPort.postMessage(Buffer.concat(chunks).toString());
+}
+
+
+main();
@@ -0,0 +1,684 @@
+// A fake serial driver for tests. Ports are pseudo-terminals, which carry
+// data and termios settings like a real tty, and the ioctls a pty does not
+// support (modem signals, breaks and RS-485) are answered here through the
+// addon's webserial_set_ioctl() hook. Enumeration can be pointed at a fake
+// sysfs tree through webserial_set_tty_class_dir(). Only built where ptys
+// exist.
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#include <map>
+#include <string>
+#include <uv.h>
+#include "util.h"
+
+typedef int (*IoctlFunction)(int fd, unsigned long request, void* arg);
+typedef void (*SetIoctlFunction)(IoctlFunction function);
+typedef void (*SetTtyClassDirFunction)(const char* path);
+
+struct FakeDriver {
+  uv_mutex_t mutex;
+  SetIoctlFunction set_ioctl;
+  SetTtyClassDirFunction set_tty_class_dir;
+  // Output lines as last set, and input lines as the test wants them seen.
+  int output_signals;
+  int input_signals;
+  bool break_on;
+  int breaks;
+  // -1 reports the pty's real output queue. Anything else is reported as
+  // the number of bytes still to be sent, as by a stalled UART.
+  int output_queue;
+  // Refuses arbitrary baud rates as a driver without BOTHER does.
+  bool refuse_termios2;
+#ifdef __linux__
+  struct serial_rs485 rs485;
+#endif
+  std::map<std::string, uint32_t> calls;
+  // Milliseconds each ioctl, by name, takes before it is answered, as on an
+  // adapter that hangs.
+  std::map<std::string, uint32_t> delays;
+  // The errno each ioctl, by name, fails with, as on a driver that does not
+  // support it.
+  std::map<std::string, int> failures;
+};
+
+static uv_once_t driver_once = UV_ONCE_INIT;
+static FakeDriver* driver;
+
+static void InitDriver(void) {
+  driver = new FakeDriver();
+  uv_mutex_init(&driver->mutex);
+  driver->set_ioctl = nullptr;
+  driver->set_tty_class_dir = nullptr;
+  driver->output_signals = 0;
+  driver->input_signals = 0;
+  driver->break_on = false;
+  driver->breaks = 0;
+  driver->output_queue = -1;
+  driver->refuse_termios2 = false;
+#ifdef __linux__
+  memset(&driver->rs485, 0, sizeof(driver->rs485));
+#endif
+}
+
+// TCSETS2 and its TCSETSW2/TCSETSF2 variants, numbers 0x2B to 0x2D. The
+// kernel's struct termios2 cannot be declared next to glibc's termios.h, and
+// the request macros need its size, so match the numbers alone.
+static bool IsTermios2Set(unsigned long request) {
+#ifdef __linux__
+  return _IOC_TYPE(request) == 'T' && _IOC_NR(request) >= 0x2B &&
+         _IOC_NR(request) <= 0x2D;
+#else
+  return false;
+#endif
+}
+
+static const char* RequestName(unsigned long request) {
+  switch (request) {
+    case TIOCMGET:
+      return "TIOCMGET";
+    case TIOCMSET:
+      return "TIOCMSET";
+    case TIOCMBIS:
+      return "TIOCMBIS";
+    case TIOCMBIC:
+      return "TIOCMBIC";
+    case TIOCSBRK:
+      return "TIOCSBRK";
+    case TIOCCBRK:
+      return "TIOCCBRK";
+    case TIOCOUTQ:
+      return "TIOCOUTQ";
+#ifdef TIOCINQ
+    case TIOCINQ:
+      return "TIOCINQ";
+#endif
+    case TIOCEXCL:
+      return "TIOCEXCL";
+#ifdef __linux__
+    case TIOCSRS485:
+      return "TIOCSRS485";
+    case TIOCGRS485:
+      return "TIOCGRS485";
+#endif
+    default:
+      return "other";
+  }
+}
+
+// Stands in for ioctl() on every port of the addon.
+static int FakeIoctl(int fd, unsigned long request, void* arg) {
+  int* bits = static_cast<int*>(arg);
+  const char* name = RequestName(request);
+  uint32_t delay = 0;
+  int ret = 0;
+
+  uv_mutex_lock(&driver->mutex);
+  driver->calls[name]++;
+
+  auto it = driver->delays.find(name);
+
+  if (it != driver->delays.end()) {
+    delay = it->second;
+  }
+
+  if (delay > 0) {
+    // Sleep unlocked, so that the test can still look at the driver.
+    uv_mutex_unlock(&driver->mutex);
+    uv_sleep(delay);
+    uv_mutex_lock(&driver->mutex);
+  }
+
+  auto failure = driver->failures.find(name);
+
+  if (failure != driver->failures.end()) {
+    uv_mutex_unlock(&driver->mutex);
+    errno = failure->second;
+    return -1;
+  }
+
+  if (driver->refuse_termios2 && IsTermios2Set(request)) {
+    uv_mutex_unlock(&driver->mutex);
+    errno = ENOTTY;
+    return -1;
+  }
+
+  switch (request) {
+    case TIOCMGET:
+      *bits = driver->output_signals | driver->input_signals;
+      break;
+    case TIOCMSET:
+      driver->output_signals = *bits & (TIOCM_DTR | TIOCM_RTS);
+      break;
+    case TIOCMBIS:
+      driver->output_signals |= *bits & (TIOCM_DTR | TIOCM_RTS);
+      break;
+    case TIOCMBIC:
+      driver->output_signals &= ~*bits;
+      break;
+    case TIOCSBRK:
+      driver->break_on = true;
+      driver->breaks++;
+      break;
+    case TIOCCBRK:
+      driver->break_on = false;
+      break;
+    case TIOCOUTQ:
+      if (driver->output_queue >= 0) {
+        *bits = driver->output_queue;
+      } else {
+        ret = ioctl(fd, request, arg);
+      }
+      break;
+#ifdef __linux__
+    case TIOCSRS485:
+      memcpy(&driver->rs485, arg, sizeof(driver->rs485));
+      break;
+    case TIOCGRS485:
+      memcpy(arg, &driver->rs485, sizeof(driver->rs485));
+      break;
+#endif
+    default:
+      ret = ioctl(fd, request, arg);
+      break;
+  }
+
+  uv_mutex_unlock(&driver->mutex);
+  return ret;
+}
+
+// Points the addon at the fake driver. The argument is the path of the
+// addon, which must already be loaded.
+static napi_value Install(napi_env env, napi_callback_info info) {
+  napi_value argv[1];
+  napi_value ret;
+  size_t argc = 1;
+  size_t len;
+  void* addon;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], nullptr, 0, &len),
+    "could not get path length"
+  );
+
+  std::string path(len, '\0');
+
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], &path[0], len + 1, &len),
+    "could not get path"
+  );
+
+  uv_once(&driver_once, InitDriver);
+  addon = dlopen(path.c_str(), RTLD_NOW | RTLD_NOLOAD);
+  if (addon == nullptr) {
+    napi_throw_error(env, nullptr, "addon is not loaded");
+    return nullptr;
+  }
+
+  driver->set_ioctl = reinterpret_cast<SetIoctlFunction>(
+    dlsym(addon, "webserial_set_ioctl")
+  );
+  driver->set_tty_class_dir = reinterpret_cast<SetTtyClassDirFunction>(
+    dlsym(addon, "webserial_set_tty_class_dir")
+  );
+  dlclose(addon);
+  if (driver->set_ioctl == nullptr || driver->set_tty_class_dir == nullptr) {
+    napi_throw_error(env, nullptr, "addon has no test hooks");
+    return nullptr;
+  }
+
+  driver->set_ioctl(FakeIoctl);
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Puts the real ioctl() and sysfs back and forgets everything the driver
+// saw.
+static napi_value Uninstall(napi_env env, napi_callback_info info) {
+  napi_value ret;
+
+  uv_once(&driver_once, InitDriver);
+  if (driver->set_ioctl != nullptr) {
+    driver->set_ioctl(nullptr);
+  }
+  if (driver->set_tty_class_dir != nullptr) {
+    driver->set_tty_class_dir(nullptr);
+  }
+
+  uv_mutex_lock(&driver->mutex);
+  driver->output_signals = 0;
+  driver->input_signals = 0;
+  driver->break_on = false;
+  driver->breaks = 0;
+  driver->output_queue = -1;
+  driver->refuse_termios2 = false;
+#ifdef __linux__
+  memset(&driver->rs485, 0, sizeof(driver->rs485));
+#endif
+  driver->calls.clear();
+  driver->delays.clear();
+  driver->failures.clear();
+  uv_mutex_unlock(&driver->mutex);
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+static napi_status SetInt(napi_env env,
+                          napi_value object,
+                          const char* name,
+                          int64_t value) {
+  napi_value field;
+  napi_status status;
+
+  status = napi_create_int64(env, value, &field);
+  if (status != napi_ok) {
+    return status;
+  }
+
+  return napi_set_named_property(env, object, name, field);
+}
+
+// Returns what the driver has been told: { signals, breakOn, breaks, rs485,
+// calls }, where calls counts the ioctls by name.
+static napi_value GetState(napi_env env, napi_callback_info info) {
+  napi_value ret;
+  napi_value calls;
+  napi_value rs485;
+  napi_value flag;
+  napi_status status;
+
+  uv_once(&driver_once, InitDriver);
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create state");
+  NAPI_CHECK(napi_create_object(env, &calls), "could not create calls");
+  NAPI_CHECK(napi_create_object(env, &rs485), "could not create rs485");
+
+  uv_mutex_lock(&driver->mutex);
+  status = SetInt(env, ret, "signals", driver->output_signals);
+  if (status == napi_ok) {
+    status = SetInt(env, ret, "breaks", driver->breaks);
+  }
+  if (status == napi_ok) {
+    status = napi_get_boolean(env, driver->break_on, &flag);
+  }
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, ret, "breakOn", flag);
+  }
+#ifdef __linux__
+  if (status == napi_ok) {
+    status = SetInt(env, rs485, "flags", driver->rs485.flags);
+  }
+  if (status == napi_ok) {
+    status = SetInt(env,
+                    rs485,
+                    "delayRtsBeforeSend",
+                    driver->rs485.delay_rts_before_send);
+  }
+  if (status == napi_ok) {
+    status = SetInt(env,
+                    rs485,
+                    "delayRtsAfterSend",
+                    driver->rs485.delay_rts_after_send);
+  }
+#endif
+  for (const auto& entry : driver->calls) {
+    if (status == napi_ok) {
+      status = SetInt(env, calls, entry.first.c_str(), entry.second);
+    }
+  }
+  uv_mutex_unlock(&driver->mutex);
+
+  NAPI_CHECK(status, "could not fill in state");
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "rs485", rs485),
+    "could not set 'rs485' property"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "calls", calls),
+    "could not set 'calls' property"
+  );
+
+  return ret;
+}
+
+// Sets the input lines the port sees, as TIOCM_* bits, the output queue it
+// reports (-1 for the real one) and, if a third argument is given, whether
+// to refuse arbitrary baud rates.
+static napi_value Configure(napi_env env, napi_callback_info info) {
+  napi_value argv[3];
+  napi_value ret;
+  size_t argc = 3;
+  int32_t input_signals;
+  int32_t output_queue;
+  bool refuse_termios2 = false;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_int32(env, argv[0], &input_signals),
+    "could not get input signals"
+  );
+  NAPI_CHECK(
+    napi_get_value_int32(env, argv[1], &output_queue),
+    "could not get output queue"
+  );
+  if (argc > 2) {
+    NAPI_CHECK(
+      napi_get_value_bool(env, argv[2], &refuse_termios2),
+      "could not get termios2 refusal"
+    );
+  }
+
+  uv_once(&driver_once, InitDriver);
+  uv_mutex_lock(&driver->mutex);
+  driver->input_signals = input_signals &
+                          (TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RI);
+  driver->output_queue = output_queue;
+  driver->refuse_termios2 = refuse_termios2;
+  uv_mutex_unlock(&driver->mutex);
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Makes every ioctl with the given name, as counted in getState().calls,
+// take the given number of milliseconds. 0 answers it at once again.
+static napi_value SetDelay(napi_env env, napi_callback_info info) {
+  napi_value argv[2];
+  napi_value ret;
+  size_t argc = 2;
+  size_t len;
+  uint32_t delay;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], nullptr, 0, &len),
+    "could not get name length"
+  );
+
+  std::string name(len, '\0');
+
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], &name[0], len + 1, &len),
+    "could not get name"
+  );
+  NAPI_CHECK(
+    napi_get_value_uint32(env, argv[1], &delay),
+    "could not get delay"
+  );
+
+  uv_once(&driver_once, InitDriver);
+  uv_mutex_lock(&driver->mutex);
+  if (delay == 0) {
+    driver->delays.erase(name);
+  } else {
+    driver->delays[name] = delay;
+  }
+  uv_mutex_unlock(&driver->mutex);
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Makes every ioctl with the given name fail with the given errno. 0 lets it
+// through again.
+static napi_value SetFailure(napi_env env, napi_callback_info info) {
+  napi_value argv[2];
+  napi_value ret;
+  size_t argc = 2;
+  size_t len;
+  int32_t error;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], nullptr, 0, &len),
+    "could not get name length"
+  );
+
+  std::string name(len, '\0');
+
+  NAPI_CHECK(
+    napi_get_value_string_utf8(env, argv[0], &name[0], len + 1, &len),
+    "could not get name"
+  );
+  NAPI_CHECK(
+    napi_get_value_int32(env, argv[1], &error),
+    "could not get errno"
+  );
+
+  uv_once(&driver_once, InitDriver);
+  uv_mutex_lock(&driver->mutex);
+  if (error == 0) {
+    driver->failures.erase(name);
+  } else {
+    driver->failures[name] = error;
+  }
+  uv_mutex_unlock(&driver->mutex);
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Makes the addon enumerate the given directory in place of /sys/class/tty,
+// or the real one again if the argument is null. Needs install() first.
+static napi_value SetTtyClassDir(napi_env env, napi_callback_info info) {
+  napi_value argv[1];
+  napi_value ret;
+  napi_valuetype type;
+  size_t argc = 1;
+  size_t len;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(napi_typeof(env, argv[0], &type), "could not get path type");
+
+  uv_once(&driver_once, InitDriver);
+  if (driver->set_tty_class_dir == nullptr) {
+    napi_throw_error(env, nullptr, "driver is not installed");
+    return nullptr;
+  }
+
+  if (type == napi_null) {
+    driver->set_tty_class_dir(nullptr);
+  } else {
+    NAPI_CHECK(
+      napi_get_value_string_utf8(env, argv[0], nullptr, 0, &len),
+      "could not get path length"
+    );
+
+    std::string path(len, '\0');
+
+    NAPI_CHECK(
+      napi_get_value_string_utf8(env, argv[0], &path[0], len + 1, &len),
+      "could not get path"
+    );
+    driver->set_tty_class_dir(path.c_str());
+  }
+
+  NAPI_CHECK(napi_get_undefined(env, &ret), "could not get undefined");
+
+  return ret;
+}
+
+// Opens a new pty in raw mode. Returns { fd, path }: the controller side,
+// which plays the device, and the path of the port to open.
+static napi_value OpenPty(napi_env env, napi_callback_info info) {
+  struct termios term;
+  napi_value ret;
+  napi_value field;
+  const char* path;
+  int fd;
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+      grantpt(fd) < 0 || unlockpt(fd) < 0 ||
+      (path = ptsname(fd)) == nullptr) {
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    napi_throw_error(env, nullptr, strerror(errno));
+    return nullptr;
+  }
+
+  // The device side must not echo or translate what it is sent.
+  if (tcgetattr(fd, &term) == 0) {
+    cfmakeraw(&term);
+    tcsetattr(fd, TCSANOW, &term);
+  }
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create pty");
+  NAPI_CHECK(napi_create_int32(env, fd, &field), "could not create fd");
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "fd", field),
+    "could not set 'fd' property"
+  );
+  NAPI_CHECK(
+    napi_create_string_utf8(env, path, NAPI_AUTO_LENGTH, &field),
+    "could not create path"
+  );
+  NAPI_CHECK(
+    napi_set_named_property(env, ret, "path", field),
+    "could not set 'path' property"
+  );
+
+  return ret;
+}
+
+// Reads from a descriptor, waiting up to timeout milliseconds for the first
+// byte. Returns a Buffer, which is empty if nothing came.
+static napi_value Read(napi_env env, napi_callback_info info) {
+  struct pollfd pfd;
+  napi_value argv[3];
+  napi_value ret;
+  size_t argc = 3;
+  int32_t fd;
+  uint32_t size;
+  int32_t timeout;
+  void* data;
+  ssize_t n = 0;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(napi_get_value_int32(env, argv[0], &fd), "could not get fd");
+  NAPI_CHECK(napi_get_value_uint32(env, argv[1], &size), "could not get size");
+  NAPI_CHECK(
+    napi_get_value_int32(env, argv[2], &timeout),
+    "could not get timeout"
+  );
+
+  std::string buf(size, '\0');
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+    n = read(fd, &buf[0], size);
+    if (n < 0) {
+      n = 0;
+    }
+  }
+
+  NAPI_CHECK(
+    napi_create_buffer_copy(env, n, buf.data(), &data, &ret),
+    "could not create buffer"
+  );
+
+  return ret;
+}
+
+// Returns the termios flags of a pty, { iflag, oflag, cflag, lflag }. On the
+// controller side these are the settings the port was given.
+static napi_value GetTermios(napi_env env, napi_callback_info info) {
+  struct termios term;
+  napi_value argv[1];
+  napi_value ret;
+  napi_status status;
+  size_t argc = 1;
+  int32_t fd;
+
+  NAPI_CHECK(
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr),
+    "could not get arguments"
+  );
+  NAPI_CHECK(napi_get_value_int32(env, argv[0], &fd), "could not get fd");
+  if (tcgetattr(fd, &term) < 0) {
+    napi_throw_error(env, nullptr, strerror(errno));
+    return nullptr;
+  }
+
+  NAPI_CHECK(napi_create_object(env, &ret), "could not create termios");
+  status = SetInt(env, ret, "iflag", term.c_iflag);
+  if (status == napi_ok) {
+    status = SetInt(env, ret, "oflag", term.c_oflag);
+  }
+  if (status == napi_ok) {
+    status = SetInt(env, ret, "cflag", term.c_cflag);
+  }
+  if (status == napi_ok) {
+    status = SetInt(env, ret, "lflag", term.c_lflag);
+  }
+  NAPI_CHECK(status, "could not fill in termios");
+
+  return ret;
+}
+
+#define EXPORT_FUNCTION_OR_RETURN(env, exports, func, name)                   \
+  do {                                                                        \
+    napi_value fn;                                                            \
+                                                                              \
+    NAPI_CHECK(                                                               \
+      napi_create_function((env), nullptr, 0, (func), nullptr, &fn),          \
+      "could not create function"                                             \
+    );                                                                        \
+    NAPI_CHECK(                                                               \
+      napi_set_named_property((env), (exports), (name), fn),                  \
+      "could not export function"                                             \
+    );                                                                        \
+  } while(0)
+
+static napi_value Init(napi_env env, napi_value exports) {
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Install, "install");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Uninstall, "uninstall");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, GetState, "getState");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Configure, "configure");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SetDelay, "setDelay");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SetFailure, "setFailure");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, SetTtyClassDir, "setTtyClassDir");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, GetTermios, "getTermios");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, OpenPty, "openPty");
+  EXPORT_FUNCTION_OR_RETURN(env, exports, Read, "read");
+
+  return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)
@@ -0,0 +1,67 @@
+'use strict';
+// A fake /sys/class/tty tree in a temporary directory, for enumeration tests
+// through FakeDriver.setTtyClassDir(). Entries are laid out as the kernel
+// does: a class link to the tty's directory, whose device link points at
+// the port, with the USB device attributes two levels above that.
+const Fs = require('node:fs');
+const Os = require('node:os');
+const Path = require('node:path');
+
+
+class FakeSysfs {
+  constructor() {
+    this.root = Fs.mkdtempSync(Path.join(Os.tmpdir(), 'webserial-sysfs-'));
+    this.classDir = Path.join(this.root, 'class', 'tty');
+    Fs.mkdirSync(this.classDir, { recursive: true });
+  }
+
+  // Adds a USB serial port. attributes are written as sysfs files, each
+  // ending in a newline as the kernel's do.
+  addUsb(entry, attributes) {
+    const device = Path.join(this.root, 'devices', 'usb1', `1-${entry}`);
+
+    this.#add(entry, Path.join(device, `1-${entry}:1.0`, entry));
+    this.setAttributes(entry, attributes);
+    return device;
+  }
+
+  // Adds a port on a platform bus. Its name must exist in /dev, which is
+  // still where the library looks for port nodes.
+  addNative(entry) {
+    this.#add(entry, Path.join(this.root, 'devices', 'platform', 'uart.0',
+      entry));
+  }
+
+  // Adds a tty that is not a serial port, such as a virtual console.
+  addVirtual(entry) {
+    this.#add(entry, Path.join(this.root, 'devices', 'virtual', entry));
+  }
+
+  setAttributes(entry, attributes) {
+    const device = Path.join(this.root, 'devices', 'usb1', `1-${entry}`);
+
+    for (const [name, value] of Object.entries(attributes)) {
+      Fs.writeFileSync(Path.join(device, name), `${value}\n`);
+    }
+  }
+
+  remove(entry) {
+    Fs.unlinkSync(Path.join(this.classDir, entry));
+  }
+
+  destroy() {
+    Fs.rmSync(this.root, { recursive: true, force: true });
+  }
+
+  #add(entry, port) {
+    const tty = Path.join(port, 'tty', entry);
+
+    Fs.mkdirSync(tty, { recursive: true });
+    Fs.symlinkSync(Path.relative(tty, port), Path.join(tty, 'device'));
+    Fs.symlinkSync(Path.relative(this.classDir, tty),
+      Path.join(this.classDir, entry));
+  }
+}
+
+
+module.exports = { FakeSysfs };
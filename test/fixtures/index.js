@@ -0,0 +1,101 @@
+'use strict';
+const Fs = require('node:fs');
+const Path = require('node:path');
+const kBuildPath = Path.join(__dirname, '..', '..', 'build', 'Release');
+const kAddonPath = Path.join(kBuildPath, 'webserial.node');
+const Binding = require(kAddonPath);
+const { Serial } = require('../../lib');
+let FakeDriver = null;
+
+try {
+  FakeDriver = require(Path.join(kBuildPath, 'fake-driver.node'));
+} catch {
+  // Not built on this platform. Tests that need it are skipped.
+}
+
+
+// Opens a port on a fresh pty, with the fake driver answering the ioctls a
+// pty cannot. Returns { handle, fd, path }, where fd is the device side.
+async function openFakePort(baudRate = 9600) {
+  const pty = FakeDriver.openPty();
+
+  FakeDriver.install(kAddonPath);
+
+  const handle = await Binding.createHandleAsync(pty.path);
+
+  await Binding.openPort(handle, baudRate, 8, 1, Binding.kParityNone,
+    Binding.kFlowControlNone);
+  return { handle, fd: pty.fd, path: pty.path };
+}
+
+
+// Like openFakePort(), but goes through Serial.requestPort() and
+// SerialPort.open() with the given options. Returns { port, fd, path }.
+async function openSerialPort(options = { baudRate: 9600 }) {
+  const pty = FakeDriver.openPty();
+  const serial = new Serial({
+    requestPortHook() {
+      return { name: pty.path };
+    }
+  });
+
+  FakeDriver.install(kAddonPath);
+
+  const port = await serial.requestPort();
+
+  try {
+    await port.open(options);
+  } catch (err) {
+    Fs.closeSync(pty.fd);
+    throw err;
+  }
+
+  return { port, fd: pty.fd, path: pty.path };
+}
+
+
+// Reads what the port sent to the device until size bytes have come or the
+// line has been quiet for timeout milliseconds.
+function readDevice(fd, size, timeout = 200) {
+  const chunks = [];
+  let received = 0;
+
+  while (received < size) {
+    const chunk = FakeDriver.read(fd, size - received, timeout);
+
+    if (chunk.length === 0) {
+      break;
+    }
+
+    chunks.push(chunk);
+    received += chunk.length;
+  }
+
+  return Buffer.concat(chunks);
+}
+
+
+function readPort(handle, size) {
+  const buffer = Binding.readData(handle, size);
+
+  return Buffer.from(buffer, 0, buffer.bytesRead);
+}
+
+
+function sleep(ms) {
+  return new Promise((resolve) => {
+    setTimeout(resolve, ms);
+  });
+}
+
+
+module.exports = {
+  Binding,
+  FakeDriver,
+  kAddonPath,
+  openFakePort,
+  openSerialPort,
+  readDevice,
+  readPort,
+  sleep
+};
@@ -0,0 +1,159 @@
+'use strict';
+// A Modbus RTU slave on the device side of a fake port. It keeps 65536
+// coils and 65536 registers, which it serves as both holding and input
+// registers, and answers the read functions, Write Single Coil, Write
+// Single Register and Write Multiple Registers. Anything else gets an
+// Illegal function exception. With a baud rate set, it answers no sooner than a
+// real slave could: a pty moves bytes instantly.
+const Fs = require('node:fs');
+const { readDevice } = require('.');
+
+
+function crc16(bytes) {
+  let crc = 0xFFFF;
+
+  for (const byte of bytes) {
+    crc ^= byte;
+
+    for (let bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >>> 1) ^ 0xA001 : crc >>> 1;
+    }
+  }
+
+  return crc;
+}
+
+
+// Appends the CRC to an address and PDU.
+function frame(bytes) {
+  const crc = crc16(bytes);
+
+  return Buffer.from([...bytes, crc & 0xFF, crc >>> 8]);
+}
+
+
+function sleepSync(ms) {
+  Atomics.wait(new Int32Array(new SharedArrayBuffer(4)), 0, 0, ms);
+}
+
+
+class ModbusSlave {
+  constructor(fd, slaveId, baudRate = 0) {
+    this.fd = fd;
+    this.slaveId = slaveId;
+    this.baudRate = baudRate;
+    this.coils = new Uint8Array(65536);
+    this.registers = new Uint16Array(65536);
+  }
+
+  // Reads one request, or returns null if none came within timeout ms.
+  receive(timeout = 200) {
+    const head = readDevice(this.fd, 7, timeout);
+
+    if (head.length === 0) {
+      return null;
+    }
+
+    // Everything but Write Multiple Registers is 8 bytes long here.
+    const size = head[1] === 0x10 ? 9 + head[6] : 8;
+    const request = Buffer.concat([
+      head,
+      readDevice(this.fd, size - head.length, timeout)
+    ]);
+    const crc = crc16(request.subarray(0, size - 2));
+
+    if (request.readUInt16LE(size - 2) !== crc) {
+      throw new Error('request has a bad CRC');
+    }
+
+    return request;
+  }
+
+  // Builds the response frame for a request.
+  respond(request) {
+    const functionCode = request[1];
+    const address = request.readUInt16BE(2);
+
+    if (functionCode === 0x01 || functionCode === 0x02) {
+      const quantity = request.readUInt16BE(4);
+      const data = Buffer.alloc(Math.ceil(quantity / 8));
+
+      for (let i = 0; i < quantity; i++) {
+        if (this.coils[(address + i) & 0xFFFF]) {
+          data[i >> 3] |= 1 << (i & 7);
+        }
+      }
+
+      return frame([this.slaveId, functionCode, data.length, ...data]);
+    }
+
+    if (functionCode === 0x03 || functionCode === 0x04) {
+      const quantity = request.readUInt16BE(4);
+      const data = Buffer.alloc(quantity * 2);
+
+      for (let i = 0; i < quantity; i++) {
+        data.writeUInt16BE(this.registers[(address + i) & 0xFFFF], i * 2);
+      }
+
+      return frame([this.slaveId, functionCode, data.length, ...data]);
+    }
+
+    if (functionCode === 0x05) {
+      this.coils[address] = request.readUInt16BE(4) === 0xFF00 ? 1 : 0;
+      return frame(request.subarray(0, 6));
+    }
+
+    if (functionCode === 0x06) {
+      this.registers[address] = request.readUInt16BE(4);
+      return frame(request.subarray(0, 6));
+    }
+
+    if (functionCode === 0x10) {
+      const quantity = request.readUInt16BE(4);
+
+      for (let i = 0; i < quantity; i++) {
+        this.registers[(address + i) & 0xFFFF] =
+          request.readUInt16BE(7 + i * 2);
+      }
+
+      return frame(request.subarray(0, 6));
+    }
+
+    return frame([this.slaveId, functionCode | 0x80, 0x01]);
+  }
+
+  // Answers up to count requests addressed to this slave. Returns how many
+  // were answered before the line went quiet.
+  serve(count = 1) {
+    let answered = 0;
+
+    while (answered < count) {
+      const request = this.receive();
+
+      if (request === null) {
+        break;
+      }
+
+      if (request[0] === this.slaveId) {
+        const response = this.respond(request);
+
+        if (this.baudRate > 0) {
+          // The request's time on the wire, the silence after it, then
+          // the response's time on the wire, at 11 bits per character.
+          const charMs = 11000 / this.baudRate;
+          const t35 = this.baudRate > 19200 ? 1.75 : charMs * 3.5;
+
+          sleepSync((request.length + response.length) * charMs + t35);
+        }
+
+        Fs.writeSync(this.fd, response);
+        answered++;
+      }
+    }
+
+    return answered;
+  }
+}
+
+
+module.exports = { ModbusSlave, crc16, frame };
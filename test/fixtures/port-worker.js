@@ -0,0 +1,69 @@
+'use strict';
+// Runs in a worker thread: opens a port on a fresh pty through the full
+// SerialPort API, echoes data both ways and closes it, over and over.
+// workerData.iterations of 0 means keep going until terminated.
+const { parentPort, workerData } = require('node:worker_threads');
+const Fs = require('node:fs');
+const { Serial } = require('../../lib');
+const { FakeDriver, kAddonPath, readDevice } = require('.');
+
+
+async function cycle(index) {
+  const pty = FakeDriver.openPty();
+  const serial = new Serial({
+    requestPortHook() {
+      return { name: pty.path };
+    }
+  });
+
+  try {
+    const port = await serial.requestPort();
+
+    await port.open({ baudRate: 115200 });
+
+    const writer = port.writable.getWriter();
+    const message = Buffer.from(`worker ${workerData.id} pass ${index}`);
+
+    await writer.write(message);
+    writer.releaseLock();
+
+    if (!readDevice(pty.fd, message.length).equals(message)) {
+      throw new Error('the device got the wrong data');
+    }
+
+    Fs.writeSync(pty.fd, message);
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+
+    if (!Buffer.from(value).equals(message.subarray(0, value.length))) {
+      throw new Error('the port got the wrong data');
+    }
+
+    const ring = port.createRxRing();
+
+    await ring.close();
+    await port.close();
+  } finally {
+    Fs.closeSync(pty.fd);
+  }
+}
+
+
+async function main() {
+  const { iterations } = workerData;
+
+  FakeDriver.install(kAddonPath);
+
+  for (let i = 0; iterations === 0 || i < iterations; i++) {
+    await cycle(i);
+    parentPort.postMessage(i);
+  }
+}
+
+
+main().then(() => {
+  parentPort.postMessage('done');
+});
@@ -0,0 +1,173 @@
+'use strict';
+// A minimal RFC 2217 client: splits what the server sends into serial data
+// and COM port replies, and builds the commands.
+const Net = require('node:net');
+const kIac = 255;
+const kSb = 250;
+const kSe = 240;
+const kComPort = 44;
+
+
+class TelnetClient {
+  constructor(socket) {
+    this.socket = socket;
+    this.data = Buffer.alloc(0);
+    this.replies = [];
+    this.waiters = [];
+    this.pending = Buffer.alloc(0);
+    socket.on('data', (chunk) => {
+      this.pending = Buffer.concat([this.pending, chunk]);
+      this.parse();
+    });
+  }
+
+  static connect(port) {
+    return new Promise((resolve, reject) => {
+      const socket = Net.connect(port, '127.0.0.1', () => {
+        resolve(new TelnetClient(socket));
+      });
+
+      socket.once('error', reject);
+    });
+  }
+
+  parse() {
+    const input = this.pending;
+    const data = [];
+    let i = 0;
+
+    while (i < input.length) {
+      if (input[i] !== kIac) {
+        data.push(input[i++]);
+        continue;
+      }
+
+      if (i + 1 >= input.length) {
+        break;
+      }
+
+      const verb = input[i + 1];
+
+      if (verb === kIac) {
+        data.push(kIac);
+        i += 2;
+      } else if (verb === kSb) {
+        const end = input.indexOf(Buffer.from([kIac, kSe]), i + 2);
+
+        if (end < 0) {
+          break;
+        }
+
+        const sub = input.subarray(i + 2, end);
+
+        if (sub[0] === kComPort) {
+          this.replies.push({ command: sub[1], value: sub.subarray(2) });
+        }
+
+        i = end + 2;
+      } else if (verb >= 251 && verb <= 254) {
+        if (i + 2 >= input.length) {
+          break;
+        }
+
+        i += 3;
+      } else {
+        i += 2;
+      }
+    }
+
+    this.pending = input.subarray(i);
+    this.data = Buffer.concat([this.data, Buffer.from(data)]);
+    this.wake();
+  }
+
+  wake() {
+    const waiters = this.waiters;
+
+    this.waiters = [];
+
+    for (const waiter of waiters) {
+      waiter();
+    }
+  }
+
+  // Resolves once test() holds, checking after every chunk received.
+  until(test, timeout = 1000) {
+    return new Promise((resolve, reject) => {
+      const timer = setTimeout(() => {
+        reject(new Error('timed out waiting for the server'));
+      }, timeout);
+      const check = () => {
+        const result = test();
+
+        if (result !== undefined) {
+          clearTimeout(timer);
+          resolve(result);
+        } else {
+          this.waiters.push(check);
+        }
+      };
+
+      check();
+    });
+  }
+
+  // Resolves with the server's reply to command, which carries the
+  // setting now in effect.
+  async command(command, value) {
+    this.replies = this.replies.filter((reply) => {
+      return reply.command !== command + 100;
+    });
+    this.socket.write(Buffer.from([
+      kIac, kSb, kComPort, command, ...escape(value), kIac, kSe
+    ]));
+    return this.until(() => {
+      return this.replies.find((reply) => {
+        return reply.command === command + 100;
+      })?.value;
+    });
+  }
+
+  async read(size) {
+    const data = await this.until(() => {
+      return this.data.length >= size ? this.data : undefined;
+    });
+
+    this.data = data.subarray(size);
+    return data.subarray(0, size);
+  }
+
+  write(data) {
+    this.socket.write(escape(data));
+  }
+
+  close() {
+    this.socket.destroy();
+  }
+}
+
+
+function escape(bytes) {
+  const out = [];
+
+  for (const byte of bytes) {
+    out.push(byte);
+
+    if (byte === kIac) {
+      out.push(kIac);
+    }
+  }
+
+  return Buffer.from(out);
+}
+
+
+function baudRateBytes(baudRate) {
+  const bytes = Buffer.alloc(4);
+
+  bytes.writeUInt32BE(baudRate);
+  return bytes;
+}
+
+
+module.exports = { TelnetClient, baudRateBytes };
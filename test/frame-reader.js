@@ -0,0 +1,202 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { SerialFrameReader } = require('../lib');
+const { FakeDriver, openSerialPort, sleep } = require('./fixtures');
+
+
+describe('frame readers', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  async function start(options) {
+    device = await openSerialPort({ baudRate: 115200 });
+    return device.port.createFrameReader(options);
+  }
+
+  // Sends each chunk from the device side, pausing for gap milliseconds
+  // after each of them.
+  async function send(chunks, gap) {
+    for (const chunk of chunks) {
+      Fs.writeSync(device.fd, chunk);
+      await sleep(gap);
+    }
+  }
+
+  async function readFrames(frames, count) {
+    const reader = frames.readable.getReader();
+    const result = [];
+
+    try {
+      while (result.length < count) {
+        const { value, done } = await reader.read();
+
+        if (done) {
+          break;
+        }
+
+        result.push(value);
+      }
+    } finally {
+      reader.releaseLock();
+    }
+
+    return result;
+  }
+
+  function text(frame) {
+    return Buffer.from(frame.data).toString();
+  }
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('splits the input at silences', async () => {
+    const frames = await start({ gapMicros: 20000 });
+
+    assert(frames instanceof SerialFrameReader);
+    await send(['ab', 'c'], 2);
+    await sleep(60);
+    await send(['defg'], 40);
+
+    const [first, second] = await readFrames(frames, 2);
+
+    assert.strictEqual(text(first), 'abc');
+    assert.strictEqual(first.truncated, false);
+    assert(first.durationMicros >= 1000);
+    assert.strictEqual(text(second), 'defg');
+    assert(second.gapMicros >= 50000);
+    assert(second.timeMicros - first.timeMicros >= 60000);
+    assert.deepStrictEqual(await frames.close(), {
+      frames: 2,
+      bytes: 7,
+      dropped: 0,
+      truncated: 0
+    });
+  });
+
+  it('times the gap from the line settings', async () => {
+    // 1000 characters take about 87ms at 115200 baud.
+    const frames = await start({ gapChars: 1000 });
+
+    await send(['ab', 'cd'], 20);
+
+    // The frame in progress is ended by closing the reader.
+    await frames.close();
+
+    const result = await readFrames(frames, 2);
+
+    assert.strictEqual(result.length, 1);
+    assert.strictEqual(text(result[0]), 'abcd');
+  });
+
+  it('cuts long frames and drops old ones', async () => {
+    let frames = await start({ gapMicros: 10000, maxFrameLength: 3 });
+
+    await send(['abcdefg'], 30);
+
+    let result = await readFrames(frames, 3);
+
+    assert.deepStrictEqual(result.map(text), ['abc', 'def', 'g']);
+    assert.deepStrictEqual(result.map((frame) => {
+      return frame.truncated;
+    }), [true, true, false]);
+    assert.strictEqual((await frames.close()).truncated, 2);
+
+    // Once the stream's own queue of 16 is full, only the newest of the
+    // frames nobody reads is kept.
+    const letters = 'abcdefghijklmnopqrst'.split('');
+
+    frames = device.port.createFrameReader({
+      gapMicros: 5000,
+      maxQueuedFrames: 1
+    });
+    await send(letters, 15);
+    result = await readFrames(frames, 17);
+    assert.deepStrictEqual(result.map(text),
+      [...letters.slice(0, 16), letters[19]]);
+    assert.strictEqual((await frames.close()).dropped, 3);
+  });
+
+  it('gives the input back when the stream is cancelled', async () => {
+    const frames = await start({ gapMicros: 10000 });
+
+    assert.throws(() => {
+      return device.port.readable;
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+    await frames.readable.cancel();
+    await frames.closed;
+
+    const reader = device.port.readable.getReader();
+
+    Fs.writeSync(device.fd, 'raw');
+    await sleep(10);
+
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'raw');
+  });
+
+  it('errors the stream when the port fails', async () => {
+    const frames = await start({ gapMicros: 10000 });
+    const reader = frames.readable.getReader();
+
+    // Hanging up the device side makes the port fail. The placeholder keeps
+    // the cleanup the same for every test.
+    Fs.closeSync(device.fd);
+    device.fd = Fs.openSync('/dev/null', 'r');
+
+    const failure = await frames.closed.catch((err) => {
+      return err;
+    });
+
+    assert(failure instanceof Error);
+    await assert.rejects(reader.read(), { message: failure.message });
+  });
+
+  it('checks its options and the port', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const invalid = [
+      [{ gapMicros: -1 }, /^gapMicros must be a non-negative number$/],
+      [{ gapMicros: Infinity }, /^gapMicros must be a non-negative number$/],
+      [{ gapChars: 0 }, /^gapChars must be a positive number$/],
+      [{ gapChars: '1' }, /^gapChars must be a positive number$/],
+      [{ maxFrameLength: 0 }, /^maxFrameLength must be an integer from 1/],
+      [{ maxFrameLength: 2 ** 24 + 1 }, /^maxFrameLength must be/],
+      [{ maxQueuedFrames: 0.5 }, /^maxQueuedFrames must be an integer/]
+    ];
+
+    assert.throws(() => {
+      new SerialFrameReader(); // eslint-disable-line no-new
+    }, { name: 'TypeError', message: 'illegal constructor' });
+
+    for (const [options, message] of invalid) {
+      assert.throws(() => {
+        port.createFrameReader(options);
+      }, { name: 'TypeError', message });
+    }
+
+    const frames = port.createFrameReader(null);
+
+    assert.throws(() => {
+      port.createFrameReader();
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+    assert(port.writable instanceof WritableStream);
+    await frames.close();
+    await port.close();
+    assert.throws(() => {
+      port.createFrameReader();
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+    await port.open({ baudRate: 115200 });
+  });
+});
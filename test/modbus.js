@@ -0,0 +1,307 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { ModbusMaster } = require('../lib');
+const {
+  Binding,
+  FakeDriver,
+  openFakePort,
+  openSerialPort,
+  sleep
+} = require('./fixtures');
+const { ModbusSlave, frame } = require('./fixtures/modbus-slave');
+
+
+function readRegisters(address, quantity) {
+  const pdu = Buffer.alloc(5);
+
+  pdu[0] = 0x03;
+  pdu.writeUInt16BE(address, 1);
+  pdu.writeUInt16BE(quantity, 3);
+  return new Uint8Array(pdu).buffer;
+}
+
+
+describe('Modbus master', { skip: FakeDriver === null }, () => {
+  let port = null;
+  let master = null;
+
+  async function start(baudRate, options = {}) {
+    const {
+      responseTimeout = 200,
+      maxGapMicros = 0
+    } = options;
+
+    port = await openFakePort(baudRate);
+    master = Binding.modbusCreate(port.handle, baudRate, responseTimeout, 0,
+      maxGapMicros);
+    return new ModbusSlave(port.fd, 1);
+  }
+
+  afterEach(async () => {
+    if (master !== null) {
+      Binding.modbusClose(master);
+      master = null;
+    }
+
+    if (port !== null) {
+      await Binding.closePort(port.handle);
+      Fs.closeSync(port.fd);
+      port = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('talks to a slave', async () => {
+    const slave = await start(115200);
+
+    slave.registers.set([10, 20, 30], 5);
+
+    const results = Binding.modbusSubmit(master, [
+      { slaveId: 1, pdu: readRegisters(5, 3) },
+      { slaveId: 1, pdu: new Uint8Array([0x41, 0, 0, 0, 1]).buffer }
+    ]);
+
+    assert.strictEqual(slave.serve(2), 2);
+
+    const [read, unsupported] = await results;
+
+    assert.strictEqual(read.error, undefined);
+    assert.deepStrictEqual(Buffer.from(read.data),
+      Buffer.from([6, 0, 10, 0, 20, 0, 30]));
+    assert.strictEqual(unsupported.error.code, 'EMODBUS');
+    assert.strictEqual(unsupported.error.exceptionCode, 1);
+  });
+
+  it('times out a slave that does not answer', async () => {
+    const slave = await start(115200, { responseTimeout: 50 });
+    const results = Binding.modbusSubmit(master, [
+      { slaveId: 2, pdu: readRegisters(0, 1) },
+      { slaveId: 1, pdu: readRegisters(0, 1) }
+    ]);
+
+    assert.strictEqual(slave.serve(1), 1);
+
+    const [missing, present] = await results;
+
+    assert.strictEqual(missing.error.code, 'ETIMEDOUT');
+    assert.strictEqual(present.error, undefined);
+  });
+
+  it('rejects a response with a silence longer than t1.5', async () => {
+    // At 9600 baud t1.5 is about 1.7ms.
+    const slave = await start(9600);
+    const results = Binding.modbusSubmit(master, [
+      { slaveId: 1, pdu: readRegisters(0, 2) }
+    ]);
+    const response = slave.respond(slave.receive());
+
+    Fs.writeSync(port.fd, response.subarray(0, 4));
+    await sleep(20);
+    Fs.writeSync(port.fd, response.subarray(4));
+
+    const [result] = await results;
+
+    assert.strictEqual(result.error.code, 'EBADFRAME');
+    assert.strictEqual(result.error.message, 'Silence within response');
+  });
+
+  it('allows longer silences when asked to', async () => {
+    const slave = await start(9600, { maxGapMicros: 100000 });
+    const results = Binding.modbusSubmit(master, [
+      { slaveId: 1, pdu: readRegisters(0, 2) }
+    ]);
+    const response = slave.respond(slave.receive());
+
+    Fs.writeSync(port.fd, response.subarray(0, 4));
+    await sleep(20);
+    Fs.writeSync(port.fd, response.subarray(4));
+
+    const [result] = await results;
+
+    assert.strictEqual(result.error, undefined);
+  });
+
+  it('rejects a response with a bad CRC', async () => {
+    const slave = await start(115200);
+    const results = Binding.modbusSubmit(master, [
+      { slaveId: 1, pdu: readRegisters(0, 1) }
+    ]);
+    const response = frame([1, 0x03, 2, 0, 0]);
+
+    slave.receive();
+    response[response.length - 1] ^= 0xFF;
+    Fs.writeSync(port.fd, response);
+
+    const [result] = await results;
+
+    assert.strictEqual(result.error.code, 'EBADCRC');
+  });
+
+  it('bounds the wait for a request to leave the UART', async () => {
+    await start(115200, { responseTimeout: 100 });
+    // A UART held back by flow control never empties its queue.
+    FakeDriver.configure(0, 8);
+
+    const [result] = await Binding.modbusSubmit(master, [
+      { slaveId: 1, pdu: readRegisters(0, 1) }
+    ]);
+
+    assert.strictEqual(result.error.code, 'ETIMEDOUT');
+    assert.strictEqual(result.error.message, 'Timed out sending request');
+  });
+});
+
+
+describe('ModbusMaster', { skip: FakeDriver === null }, () => {
+  let device = null;
+  let master = null;
+
+  async function start(options) {
+    device = await openSerialPort({ baudRate: 115200 });
+    master = device.port.createModbusMaster(options);
+    return new ModbusSlave(device.fd, 7);
+  }
+
+  afterEach(async () => {
+    if (master !== null) {
+      await master.close();
+      master = null;
+    }
+
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('cannot be constructed directly', () => {
+    assert.throws(() => {
+      return new ModbusMaster();
+    }, { name: 'TypeError', message: 'illegal constructor' });
+  });
+
+  it('checks its options', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+
+    assert.throws(() => {
+      port.createModbusMaster({ responseTimeout: 0 });
+    }, /responseTimeout must be a non-zero unsigned integer/);
+    assert.throws(() => {
+      port.createModbusMaster({ turnaroundDelay: -1 });
+    }, /turnaroundDelay must be an unsigned integer/);
+    assert.throws(() => {
+      port.createModbusMaster({ maxGapMicros: 1.5 });
+    }, /maxGapMicros must be an unsigned integer/);
+  });
+
+  it('owns the port until it is closed', async () => {
+    await start();
+
+    const { port } = device;
+
+    assert.throws(() => {
+      port.createModbusMaster();
+    }, { name: 'InvalidStateError' });
+    assert.throws(() => {
+      return port.readable;
+    }, { name: 'InvalidStateError' });
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+
+    const closed = master.close();
+
+    assert.strictEqual(master.close(), closed);
+    await closed;
+    await assert.rejects(master.poll([]), /Modbus master is closed/);
+    master = null;
+
+    // The claim is released once closed settles.
+    await sleep(0);
+    assert.notStrictEqual(port.readable, null);
+  });
+
+  it('reads and writes coils and registers', async () => {
+    const slave = await start();
+    let result;
+
+    result = master.writeSingleCoil(7, 3, true);
+    assert.strictEqual(slave.serve(), 1);
+    await result;
+    result = master.writeSingleCoil(7, 4, false);
+    assert.strictEqual(slave.serve(), 1);
+    await result;
+    assert.deepStrictEqual([...slave.coils.subarray(3, 5)], [1, 0]);
+
+    slave.coils.set([1, 0, 1, 1, 0, 0, 0, 0, 1], 10);
+    result = master.readCoils(7, 10, 9);
+    assert.strictEqual(slave.serve(), 1);
+    assert.deepStrictEqual(await result,
+      [true, false, true, true, false, false, false, false, true]);
+    result = master.readDiscreteInputs(7, 12, 2);
+    assert.strictEqual(slave.serve(), 1);
+    assert.deepStrictEqual(await result, [true, true]);
+
+    result = master.writeSingleRegister(7, 20, 0xBEEF);
+    assert.strictEqual(slave.serve(), 1);
+    await result;
+    result = master.readInputRegisters(7, 20, 1);
+    assert.strictEqual(slave.serve(), 1);
+    assert.deepStrictEqual([...await result], [0xBEEF]);
+
+    const values = Array.from({ length: 123 }, (_, i) => {
+      return i * 3;
+    });
+
+    result = master.writeMultipleRegisters(7, 100, values);
+    assert.strictEqual(slave.serve(), 1);
+    await result;
+    result = master.readHoldingRegisters(7, 100, 123);
+    assert.strictEqual(slave.serve(), 1);
+    assert.deepStrictEqual([...await result], values);
+  });
+
+  it('checks requests before sending them', async () => {
+    await start();
+
+    await assert.rejects(
+      master.writeMultipleRegisters(7, 0, new Array(124).fill(1)),
+      RangeError
+    );
+    await assert.rejects(master.writeMultipleRegisters(7, 0, []),
+      RangeError);
+    await assert.rejects(master.writeMultipleRegisters(7, 0), RangeError);
+    await assert.rejects(master.poll({}), /requests must be an array/);
+    await assert.rejects(master.request(248, new Uint8Array([3])),
+      /slaveId must be an integer from 0 to 247/);
+    await assert.rejects(master.request(7, new Uint8Array(0)),
+      /pdu must contain 1 to 253 bytes/);
+    await assert.rejects(master.request(7, new Uint8Array(254)),
+      /pdu must contain 1 to 253 bytes/);
+  });
+
+  it('reports failed requests', async () => {
+    const slave = await start({ responseTimeout: 50 });
+    let result;
+
+    await assert.rejects(master.readHoldingRegisters(8, 0, 1),
+      { code: 'ETIMEDOUT' });
+    assert.strictEqual(slave.receive()[0], 8);
+
+    // A response whose byte count does not fit the request.
+    result = master.readHoldingRegisters(7, 0, 2);
+    slave.receive();
+    Fs.writeSync(device.fd, frame([7, 0x03, 2, 0, 0]));
+    await assert.rejects(result, { code: 'EBADFRAME' });
+
+    result = master.request(7, new Uint8Array([0x41, 0, 0, 0, 0]));
+    assert.strictEqual(slave.serve(), 1);
+    await assert.rejects(result, { code: 'EMODBUS', exceptionCode: 1 });
+  });
+});
@@ -0,0 +1,144 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, sleep } = require('./fixtures');
+// From termios.h on Linux.
+const CSTOPB = 0o100;
+const CREAD = 0o200;
+const CLOCAL = 0o4000;
+const CRTSCTS = 0o20000000000;
+
+
+describe('opening', { skip: FakeDriver === null }, () => {
+  let devices = [];
+
+  afterEach(async () => {
+    for (const { port, fd } of devices) {
+      await port.close();
+      Fs.closeSync(fd);
+    }
+
+    devices = [];
+    FakeDriver.uninstall();
+  });
+
+  it('configures the port in a single pass', async () => {
+    const device = await openSerialPort({
+      baudRate: 115200,
+      stopBits: 2,
+      flowControl: 'hardware'
+    });
+
+    devices.push(device);
+
+    const { cflag } = FakeDriver.getTermios(device.fd);
+
+    assert.strictEqual(device.port.baudRate, 115200);
+    assert.strictEqual(cflag & (CSTOPB | CRTSCTS | CLOCAL | CREAD),
+      CSTOPB | CRTSCTS | CLOCAL | CREAD);
+    // The modem lines are read once, for both the open and the settings.
+    assert.strictEqual(FakeDriver.getState().calls.TIOCMGET, 1);
+  });
+
+  it('applies the defaults to settings left out', async () => {
+    const device = await openSerialPort({ baudRate: 9600, stopBits: 2 });
+
+    devices.push(device);
+    await device.port.close();
+    await device.port.open({ baudRate: 9600 });
+
+    const { cflag } = FakeDriver.getTermios(device.fd);
+
+    assert.strictEqual(cflag & (CSTOPB | CRTSCTS), 0);
+    assert.strictEqual(cflag & (CLOCAL | CREAD), CLOCAL | CREAD);
+  });
+
+  it('gives up on an open that hangs', async () => {
+    const device = await openSerialPort();
+    const { port } = device;
+
+    devices.push(device);
+    await port.close();
+    FakeDriver.setDelay('TIOCEXCL', 200);
+    await assert.rejects(port.open({ baudRate: 9600, openTimeout: 50 }), {
+      name: 'TimeoutError',
+      message: 'open timed out'
+    });
+    assert.strictEqual(port.readable, null);
+
+    // The late open is undone in the background, before the next one.
+    FakeDriver.setDelay('TIOCEXCL', 0);
+    await port.open({ baudRate: 9600, openTimeout: 1000 });
+    assert.strictEqual(FakeDriver.getState().calls.TIOCEXCL, 3);
+  });
+
+  it('gives up on a close that hangs', async () => {
+    const device = await openSerialPort();
+    const { port } = device;
+
+    devices.push(device);
+
+    // A drain stuck in the driver holds the port until it returns.
+    FakeDriver.configure(0, 100);
+    FakeDriver.setDelay('TIOCOUTQ', 200);
+
+    const draining = port.drain({ timeout: 0 });
+
+    await sleep(20);
+    await Promise.all([
+      assert.rejects(draining, { name: 'AbortError' }),
+      assert.rejects(port.close({ timeout: 50 }), {
+        name: 'TimeoutError',
+        message: 'close timed out'
+      })
+    ]);
+    assert.strictEqual(port.readable, null);
+
+    // The port can be opened again once the close has finished.
+    FakeDriver.configure(0, -1);
+    FakeDriver.setDelay('TIOCOUTQ', 0);
+    await port.open({ baudRate: 9600 });
+  });
+
+  it('cancels pending I/O when closing', async () => {
+    const device = await openSerialPort();
+    const { port } = device;
+
+    devices.push(device);
+
+    const pending = port.transact(Buffer.from('?'), {
+      expectLength: 1,
+      timeout: 10000
+    });
+    const start = Date.now();
+
+    await sleep(20);
+    await Promise.all([
+      assert.rejects(pending, {
+        name: 'NetworkError',
+        message: 'transaction was cancelled'
+      }),
+      port.close()
+    ]);
+    assert(Date.now() - start < 1000);
+    await port.open({ baudRate: 9600 });
+  });
+
+  it('checks the timeouts', async () => {
+    const device = await openSerialPort();
+    const { port } = device;
+
+    devices.push(device);
+    await assert.rejects(port.close({ timeout: -1 }), {
+      name: 'TypeError',
+      message: 'timeout must be an unsigned integer'
+    });
+    await port.close();
+    await assert.rejects(port.open({ baudRate: 9600, openTimeout: 1.5 }), {
+      name: 'TypeError',
+      message: 'openTimeout must be an unsigned integer'
+    });
+    await port.open({ baudRate: 9600 });
+  });
+});
@@ -0,0 +1,126 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const Os = require('node:os');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, readDevice } = require('./fixtures');
+// From termios.h on Linux.
+const CSTOPB = 0o100;
+const CRTSCTS = 0o20000000000;
+
+
+describe('reconfiguring', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('changes the settings of an open port', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port, fd } = device;
+
+    // Data already received is kept.
+    Fs.writeSync(fd, 'kept');
+    await port.reconfigure({ baudRate: 57600, stopBits: 2 });
+    assert.strictEqual(port.baudRate, 57600);
+    assert.strictEqual(FakeDriver.getTermios(fd).cflag & CSTOPB, CSTOPB);
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'kept');
+
+    // Settings left out keep their values.
+    await port.reconfigure({ flowControl: 'hardware' });
+    assert.strictEqual(port.baudRate, 57600);
+    assert.strictEqual(FakeDriver.getTermios(fd).cflag & (CSTOPB | CRTSCTS),
+      CSTOPB | CRTSCTS);
+    await port.reconfigure();
+    assert.strictEqual(port.baudRate, 57600);
+  });
+
+  it('drains with the old settings first if asked to', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port, fd } = device;
+    const writer = port.writable.getWriter();
+
+    await writer.write(Buffer.from('before'));
+    writer.releaseLock();
+    await port.reconfigure({ baudRate: 19200, drain: true });
+    assert.strictEqual(port.baudRate, 19200);
+    assert.deepStrictEqual(readDevice(fd, 6), Buffer.from('before'));
+  });
+
+  it('leaves the settings alone if the drain gives up', async () => {
+    device = await openSerialPort({ baudRate: 9600, drainTimeout: 50 });
+
+    const { port } = device;
+
+    FakeDriver.configure(0, 100);
+    await assert.rejects(port.reconfigure({ baudRate: 19200, drain: true }),
+      { name: 'TimeoutError' });
+    assert.strictEqual(port.baudRate, 9600);
+
+    // Closing the port aborts a drain still waiting.
+    const reconfiguring = port.reconfigure({ baudRate: 19200, drain: true });
+
+    await Promise.all([
+      assert.rejects(reconfiguring, { name: 'AbortError' }),
+      port.close()
+    ]);
+    FakeDriver.configure(0, -1);
+    await port.open({ baudRate: 9600 });
+  });
+
+  it('fails when the driver refuses the settings', async () => {
+    device = await openSerialPort({ baudRate: 9600 });
+
+    const { port } = device;
+
+    FakeDriver.setFailure('TIOCMGET', Os.constants.errno.EIO);
+    await assert.rejects(port.reconfigure({ baudRate: 19200 }),
+      { name: 'NetworkError' });
+    FakeDriver.setFailure('TIOCMGET', 0);
+    assert.strictEqual(port.baudRate, 9600);
+  });
+
+  it('checks its options', async () => {
+    device = await openSerialPort();
+
+    const { port } = device;
+    const invalid = [
+      [{ baudRate: 0 }, /^baudRate must be/],
+      [{ baudRate: 1.5 }, /^baudRate must be/],
+      [{ dataBits: 6 }, /^dataBits must be 7 or 8$/],
+      [{ stopBits: 3 }, /^stopBits must be 1 or 2$/],
+      [{ parity: 'mark' }, /^parity must be/],
+      [{ flowControl: 'software' }, /^flowControl must be/]
+    ];
+
+    for (const [options, message] of invalid) {
+      await assert.rejects(port.reconfigure(options),
+        { name: 'TypeError', message });
+    }
+
+    // Helpers time their work from the settings they started with.
+    const ring = port.createRxRing();
+
+    await assert.rejects(port.reconfigure({ baudRate: 19200 }),
+      { name: 'InvalidStateError' });
+    await ring.close();
+    await port.close();
+    await assert.rejects(port.reconfigure({ baudRate: 19200 }),
+      { name: 'InvalidStateError' });
+    await port.open({ baudRate: 9600 });
+  });
+});
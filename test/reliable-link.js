@@ -0,0 +1,342 @@
+'use strict';
+const assert = require('node:assert');
+const Crypto = require('node:crypto');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { SerialReliableLink } = require('../lib');
+const {
+  Binding,
+  FakeDriver,
+  openFakePort,
+  openSerialPort,
+  sleep
+} = require('./fixtures');
+
+
+// Carries whatever each port sends to the device side of the other, as a
+// null modem cable would, until the returned function is called.
+function connect(a, b) {
+  let running = true;
+  const pumping = (async () => {
+    while (running) {
+      const ab = FakeDriver.read(a, 4096, 0);
+      const ba = FakeDriver.read(b, 4096, 0);
+
+      if (ab.length > 0) {
+        Fs.writeSync(b, ab);
+      }
+
+      if (ba.length > 0) {
+        Fs.writeSync(a, ba);
+      }
+
+      if (ab.length === 0 && ba.length === 0) {
+        await sleep(1);
+      }
+    }
+  })();
+
+  return () => {
+    running = false;
+    return pumping;
+  };
+}
+
+
+describe('Reliable link', { skip: FakeDriver === null }, () => {
+  let ports = [];
+  let links = [];
+  let disconnect = null;
+
+  // Opens two fake ports joined by pump() and runs a link on each, with
+  // the options given for that end.
+  async function start(...options) {
+    ports = [await openFakePort(115200), await openFakePort(115200)];
+    links = ports.map((port, i) => {
+      const {
+        rto = 0,
+        maxRetransmits = 0,
+        receiveBufferSize = 65536,
+        dropRate = 0,
+        bitErrorRate = 0,
+        seed = 0
+      } = options[i] ?? {};
+
+      return Binding.reliableLinkCreate(port.handle, 8, 64, rto,
+        maxRetransmits, receiveBufferSize, dropRate, bitErrorRate, seed,
+        () => {});
+    });
+    disconnect = connect(ports[0].fd, ports[1].fd);
+    return links;
+  }
+
+  // Reads from a link until size bytes have arrived.
+  async function receive(link, size, timeout = 5000) {
+    const chunks = [];
+    let received = 0;
+
+    for (let waited = 0; received < size && waited < timeout; waited += 5) {
+      const chunk = Binding.reliableLinkRead(link);
+
+      if (chunk === null) {
+        await sleep(5);
+        continue;
+      }
+
+      chunks.push(chunk);
+      received += chunk.length;
+    }
+
+    return Buffer.concat(chunks);
+  }
+
+  afterEach(async () => {
+    for (const link of links) {
+      Binding.reliableLinkClose(link);
+      await link.closed.catch(() => {});
+    }
+
+    await disconnect();
+
+    for (const port of ports) {
+      await Binding.closePort(port.handle);
+      Fs.closeSync(port.fd);
+    }
+
+    links = [];
+    ports = [];
+    FakeDriver.uninstall();
+  });
+
+  it('recovers from dropped and damaged frames', async () => {
+    const faults = { dropRate: 0.05, bitErrorRate: 0.0002 };
+    const [a, b] = await start({ ...faults, seed: 1 }, { ...faults, seed: 2 });
+    const ab = Crypto.randomBytes(8192);
+    const ba = Crypto.randomBytes(2048);
+    const flushed = Promise.all([
+      Binding.reliableLinkWrite(a, new Uint8Array(ab).buffer),
+      Binding.reliableLinkFlush(a),
+      Binding.reliableLinkWrite(b, new Uint8Array(ba).buffer),
+      Binding.reliableLinkFlush(b)
+    ]);
+    const [atB, atA] = await Promise.all([
+      receive(b, ab.length),
+      receive(a, ba.length)
+    ]);
+
+    await flushed;
+    assert.deepStrictEqual(atB, ab);
+    assert.deepStrictEqual(atA, ba);
+
+    const statsA = Binding.reliableLinkStats(a);
+    const statsB = Binding.reliableLinkStats(b);
+
+    assert(statsA.retransmits > 0);
+    assert(statsB.crcErrors > 0);
+    assert.strictEqual(statsB.bytesReceived, ab.length);
+    assert.strictEqual(statsA.bytesReceived, ba.length);
+  });
+
+  it('waits for a peer that is slow to read', async () => {
+    const [a, b] = await start(
+      { rto: 20, maxRetransmits: 3 },
+      { receiveBufferSize: 256 }
+    );
+    const data = Crypto.randomBytes(4096);
+    const flushed = Promise.all([
+      Binding.reliableLinkWrite(a, new Uint8Array(data).buffer),
+      Binding.reliableLinkFlush(a)
+    ]);
+    let failed = false;
+
+    a.closed.catch(() => {
+      failed = true;
+    });
+
+    // Far longer than three retransmit timeouts, but the peer keeps
+    // answering, so the link must not give up on it.
+    await sleep(500);
+    assert.strictEqual(failed, false);
+    assert(Binding.reliableLinkStats(a).retransmits > 3);
+    assert.deepStrictEqual(await receive(b, data.length), data);
+    await flushed;
+    assert.strictEqual(failed, false);
+  });
+});
+
+
+describe('SerialReliableLink', { skip: FakeDriver === null }, () => {
+  let devices = [];
+  let links = [];
+  let disconnect = null;
+
+  // Opens two ports through SerialPort, joined by connect() if wanted, and
+  // runs a link on each with the options given for that end.
+  async function start(joined, ...options) {
+    devices = [await openSerialPort(), await openSerialPort()];
+    links = devices.map((device, i) => {
+      return device.port.createReliableLink(options[i]);
+    });
+
+    if (joined) {
+      disconnect = connect(devices[0].fd, devices[1].fd);
+    }
+
+    return links;
+  }
+
+  afterEach(async () => {
+    for (const link of links) {
+      await link.close().catch(() => {});
+    }
+
+    if (disconnect !== null) {
+      await disconnect();
+      disconnect = null;
+    }
+
+    for (const { port, fd } of devices) {
+      await port.close();
+      Fs.closeSync(fd);
+    }
+
+    links = [];
+    devices = [];
+    FakeDriver.uninstall();
+  });
+
+  it('cannot be constructed directly', () => {
+    assert.throws(() => {
+      return new SerialReliableLink();
+    }, { name: 'TypeError', message: 'illegal constructor' });
+  });
+
+  it('checks its options', async () => {
+    devices = [await openSerialPort()];
+
+    const { port } = devices[0];
+    const invalid = [
+      [{ window: 0 }, /^window must be/],
+      [{ window: 128 }, /^window must be/],
+      [{ window: 1.5 }, /^window must be/],
+      [{ maxPayload: 0 }, /^maxPayload must be/],
+      [{ maxPayload: 4097 }, /^maxPayload must be/],
+      [{ retransmitTimeout: -1 }, /^retransmitTimeout must be/],
+      [{ retransmitTimeout: 2 ** 32 }, /^retransmitTimeout must be/],
+      [{ maxRetransmits: -1 }, /^maxRetransmits must be/],
+      [{ maxRetransmits: 2 ** 32 }, /^maxRetransmits must be/],
+      [{ maxPayload: 64, receiveBufferSize: 63 }, /^receiveBufferSize must/],
+      [{ receiveBufferSize: 2 ** 31 }, /^receiveBufferSize must/],
+      [{ faults: null }, /^faults must be an object$/],
+      [{ faults: 1 }, /^faults must be an object$/],
+      [{ faults: { dropRate: 2 } }, /^faults.dropRate must be/],
+      [{ faults: { bitErrorRate: 'x' } }, /^faults.bitErrorRate must be/],
+      [{ faults: { seed: 1.5 } }, /^faults.seed must be an integer$/]
+    ];
+
+    for (const [options, message] of invalid) {
+      assert.throws(() => {
+        port.createReliableLink(options);
+      }, { name: 'TypeError', message });
+    }
+
+    // None of the failures may have left the port claimed.
+    links = [port.createReliableLink()];
+  });
+
+  it('owns the port until closed', async () => {
+    const [link] = await start(false);
+    const { port } = devices[0];
+
+    assert.throws(() => {
+      port.createReliableLink();
+    }, { name: 'InvalidStateError' });
+    assert.throws(() => {
+      port.createModbusMaster();
+    }, { name: 'InvalidStateError' });
+    assert.throws(() => {
+      return port.readable;
+    }, { name: 'InvalidStateError' });
+    assert.throws(() => {
+      return port.writable;
+    }, { name: 'InvalidStateError' });
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+
+    const stats = await link.close();
+
+    assert.strictEqual(stats.framesReceived, 0);
+    assert.strictEqual(link.closed, link.close());
+    await sleep(0);
+    assert.notStrictEqual(port.readable, null);
+  });
+
+  it('carries data through its streams', async () => {
+    const [a, b] = await start(true, { window: 4, maxPayload: 64 });
+    const data = Crypto.randomBytes(1000);
+    const writer = a.writable.getWriter();
+    const reader = b.readable.getReader();
+    const chunks = [];
+    let received = 0;
+
+    await writer.write(data);
+    await writer.write(new Uint16Array([0x6968]));
+    await writer.close();
+
+    while (received < data.length + 2) {
+      const { value } = await reader.read();
+
+      chunks.push(value);
+      received += value.length;
+    }
+
+    assert.deepStrictEqual(Buffer.concat(chunks),
+      Buffer.concat([data, Buffer.from('hi')]));
+    assert.strictEqual(a.stats().bytesSent, data.length + 2);
+    assert.strictEqual(b.stats().bytesReceived, data.length + 2);
+  });
+
+  it('delivers what is left in the link when it closes', async () => {
+    const [a, b] = await start(true);
+    const reader = b.readable.getReader();
+    const writer = a.writable.getWriter();
+
+    // The stream holds one chunk, so the second stays in the link until it
+    // closes.
+    await writer.write(Buffer.from('one'));
+    await sleep(50);
+    await writer.write(Buffer.from('two'));
+    await writer.close();
+    await sleep(50);
+
+    const stats = await b.close();
+
+    assert.strictEqual(stats.bytesReceived, 6);
+    assert.strictEqual(Buffer.from((await reader.read()).value).toString(),
+      'one');
+    assert.strictEqual(Buffer.from((await reader.read()).value).toString(),
+      'two');
+    assert.strictEqual((await reader.read()).done, true);
+  });
+
+  it('closes when its streams are cancelled or aborted', async () => {
+    const [a, b] = await start(false);
+
+    await a.readable.cancel();
+    await a.closed;
+    await b.writable.abort();
+    await b.closed;
+  });
+
+  it('fails when the peer stops answering', async () => {
+    const [link] = await start(false, {
+      retransmitTimeout: 10,
+      maxRetransmits: 1
+    });
+    const reader = link.readable.getReader();
+    const writer = link.writable.getWriter();
+
+    writer.write(Buffer.from('hello')).catch(() => {});
+    await assert.rejects(link.closed);
+    await assert.rejects(reader.read());
+  });
+});
@@ -0,0 +1,210 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { Rfc2217Server } = require('../lib');
+const {
+  Binding,
+  FakeDriver,
+  openFakePort,
+  openSerialPort,
+  readDevice,
+  sleep
+} = require('./fixtures');
+const { TelnetClient, baudRateBytes } = require('./fixtures/telnet-client');
+const kSetBaudRate = 1;
+const kSetStopSize = 4;
+const kSetControl = 5;
+const kTiocmDtr = 0x002;
+
+
+describe('RFC 2217 server', { skip: FakeDriver === null }, () => {
+  let port = null;
+  let server = null;
+  let client = null;
+  let configs = [];
+
+  async function start() {
+    port = await openFakePort(9600);
+    server = Binding.rfc2217Create(port.handle, '127.0.0.1', 0, (config) => {
+      configs.push(config);
+    });
+    client = await TelnetClient.connect(server.port);
+  }
+
+  afterEach(async () => {
+    if (client !== null) {
+      client.close();
+      client = null;
+    }
+
+    if (server !== null) {
+      Binding.rfc2217Close(server);
+      await server.closed;
+      server = null;
+    }
+
+    if (port !== null) {
+      await Binding.closePort(port.handle);
+      Fs.closeSync(port.fd);
+      port = null;
+    }
+
+    configs = [];
+    FakeDriver.uninstall();
+  });
+
+  it('passes data both ways', async () => {
+    await start();
+    // 255 is the Telnet escape, so it is doubled on the network side.
+    client.write(Buffer.from([1, 255, 2]));
+    assert.deepStrictEqual(readDevice(port.fd, 3), Buffer.from([1, 255, 2]));
+    Fs.writeSync(port.fd, Buffer.from([3, 255, 4]));
+    assert.deepStrictEqual(await client.read(3), Buffer.from([3, 255, 4]));
+  });
+
+  it('applies line settings and reports them to JS', async () => {
+    await start();
+
+    let reply = await client.command(kSetBaudRate, baudRateBytes(19200));
+
+    assert.strictEqual(reply.readUInt32BE(), 19200);
+    // A pty keeps 8 data bits and no parity whatever it is told, but it
+    // does take two stop bits.
+    reply = await client.command(kSetStopSize, [2]);
+    assert.strictEqual(reply[0], 2);
+
+    for (let i = 0; i < 100 && configs.at(-1)?.stopBits !== 2; i++) {
+      await sleep(10);
+    }
+
+    assert.deepStrictEqual(configs.at(-1), {
+      baudRate: 19200,
+      dataBits: 8,
+      stopBits: 2,
+      parity: Binding.kParityNone,
+      flowControl: Binding.kFlowControlNone
+    });
+  });
+
+  it('switches between all flow control modes', async () => {
+    await start();
+
+    // XON/XOFF, hardware, XON/XOFF again, then none.
+    for (const mode of [2, 3, 2, 1]) {
+      const reply = await client.command(kSetControl, [mode]);
+
+      assert.strictEqual(reply[0], mode);
+    }
+
+    // Asking for the current mode does not change it.
+    assert.strictEqual((await client.command(kSetControl, [0]))[0], 1);
+  });
+
+  it('sets the modem signals', async () => {
+    await start();
+    assert.strictEqual((await client.command(kSetControl, [9]))[0], 9);
+    assert.strictEqual(FakeDriver.getState().signals & kTiocmDtr, 0);
+    assert.strictEqual((await client.command(kSetControl, [8]))[0], 8);
+    assert.strictEqual(FakeDriver.getState().signals & kTiocmDtr, kTiocmDtr);
+  });
+});
+
+
+describe('Rfc2217Server', { skip: FakeDriver === null }, () => {
+  let device = null;
+  let server = null;
+  let client = null;
+
+  afterEach(async () => {
+    if (client !== null) {
+      client.close();
+      client = null;
+    }
+
+    if (server !== null) {
+      await server.close();
+      server = null;
+    }
+
+    if (device !== null) {
+      await device.port.close();
+
+      if (device.fd !== null) {
+        Fs.closeSync(device.fd);
+      }
+
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('cannot be constructed directly', () => {
+    assert.throws(() => {
+      return new Rfc2217Server();
+    }, { name: 'TypeError', message: 'illegal constructor' });
+  });
+
+  it('checks its options', async () => {
+    device = await openSerialPort();
+
+    const { port } = device;
+
+    assert.throws(() => {
+      port.serveRfc2217({ host: 1 });
+    }, /host must be a numeric IP address string/);
+    assert.throws(() => {
+      port.serveRfc2217({ port: 65536 });
+    }, /port must be an integer from 0 to 65535/);
+    assert.throws(() => {
+      port.serveRfc2217({ port: -1 });
+    }, /port must be an integer from 0 to 65535/);
+  });
+
+  it('owns the port and keeps its baudRate in step', async () => {
+    device = await openSerialPort();
+
+    const { port } = device;
+
+    server = port.serveRfc2217();
+    assert.strictEqual(server.address.host, '127.0.0.1');
+    assert.throws(() => {
+      port.serveRfc2217();
+    }, { name: 'InvalidStateError' });
+    assert.throws(() => {
+      return port.writable;
+    }, { name: 'InvalidStateError' });
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+
+    client = await TelnetClient.connect(server.address.port);
+    await client.command(kSetBaudRate, baudRateBytes(38400));
+
+    // The change reaches JS on its own, a little after the reply.
+    for (let i = 0; i < 100 && port.baudRate !== 38400; i++) {
+      await sleep(10);
+    }
+
+    assert.strictEqual(port.baudRate, 38400);
+    client.write(Buffer.from('hi'));
+    assert.deepStrictEqual(readDevice(device.fd, 2), Buffer.from('hi'));
+    assert.strictEqual(server.getStats().toSerial, 2);
+
+    const stats = await server.close();
+
+    server = null;
+    assert.strictEqual(stats.connections, 1);
+  });
+
+  it('rejects closed if the port fails', async () => {
+    device = await openSerialPort();
+    server = device.port.serveRfc2217();
+    client = await TelnetClient.connect(server.address.port);
+
+    // Hanging up the device side makes the port fail.
+    Fs.closeSync(device.fd);
+    device.fd = null;
+    await assert.rejects(server.closed);
+    server = null;
+  });
+});
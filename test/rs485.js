@@ -0,0 +1,265 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const Os = require('node:os');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const {
+  Binding,
+  FakeDriver,
+  openFakePort,
+  openSerialPort,
+  readDevice,
+  readPort,
+  sleep
+} = require('./fixtures');
+// From linux/serial.h.
+const SER_RS485_ENABLED = 1 << 0;
+const SER_RS485_RTS_ON_SEND = 1 << 1;
+const SER_RS485_RTS_AFTER_SEND = 1 << 2;
+const SER_RS485_RX_DURING_TX = 1 << 4;
+const kTiocmCts = 0x020;
+
+
+function toArrayBuffer(string) {
+  return new TextEncoder().encode(string).buffer;
+}
+
+
+describe('fake driver', { skip: FakeDriver === null }, () => {
+  let port = null;
+
+  afterEach(async () => {
+    if (port !== null) {
+      await Binding.closePort(port.handle);
+      Fs.closeSync(port.fd);
+      port = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('sees the ioctls libserialport makes', async () => {
+    port = await openFakePort();
+
+    const { calls } = FakeDriver.getState();
+
+    // A pty has no modem lines, so opening it at all needs the hook.
+    assert(calls.TIOCMGET > 0);
+    assert(calls.TIOCEXCL > 0);
+  });
+
+  it('reports input signals and sets output signals', async () => {
+    port = await openFakePort();
+    FakeDriver.configure(kTiocmCts, -1);
+
+    const signals = Binding.getSignals(port.handle);
+
+    assert.strictEqual(signals.clearToSend, true);
+    assert.strictEqual(signals.dataSetReady, false);
+
+    Binding.setSignals(port.handle, 1, 1, -1);
+    assert.strictEqual(FakeDriver.getState().signals, 0x002 | 0x004);
+    Binding.setSignals(port.handle, 0, -1, 1);
+    assert.strictEqual(FakeDriver.getState().signals, 0x004);
+    assert.strictEqual(FakeDriver.getState().breakOn, true);
+  });
+
+  it('sets kernel RS-485 mode', {
+    skip: process.platform !== 'linux'
+  }, async () => {
+    port = await openFakePort();
+    Binding.setRs485(port.handle, true, true, false, true, 2, 3);
+
+    let { rs485 } = FakeDriver.getState();
+
+    assert.strictEqual(rs485.flags, SER_RS485_ENABLED |
+      SER_RS485_RTS_ON_SEND | SER_RS485_RX_DURING_TX);
+    assert.strictEqual(rs485.delayRtsBeforeSend, 2);
+    assert.strictEqual(rs485.delayRtsAfterSend, 3);
+
+    Binding.setRs485(port.handle, true, false, true, false, 0, 0);
+    ({ rs485 } = FakeDriver.getState());
+    assert.strictEqual(rs485.flags, SER_RS485_ENABLED |
+      SER_RS485_RTS_AFTER_SEND);
+
+    Binding.setRs485(port.handle, false, false, false, false, 0, 0);
+    assert.strictEqual(FakeDriver.getState().rs485.flags, 0);
+  });
+
+  it('drops the echo of what was written', async () => {
+    port = await openFakePort(115200);
+    Binding.setEchoSuppression(port.handle, true, 200);
+    Binding.writeData(port.handle, toArrayBuffer('hello'));
+
+    const sent = readDevice(port.fd, 5);
+
+    assert.strictEqual(sent.toString(), 'hello');
+    // The adapter hears itself, then the device answers.
+    Fs.writeSync(port.fd, Buffer.concat([sent, Buffer.from('reply')]));
+    await sleep(50);
+    assert.strictEqual(readPort(port.handle, 64).toString(), 'reply');
+    assert.deepStrictEqual(Binding.getEchoStats(port.handle), {
+      suppressed: 5,
+      mismatched: 0,
+      expired: 0
+    });
+  });
+
+  it('bounds drains with the output queue seen through the hook',
+    async () => {
+      port = await openFakePort();
+      // A UART that never sends anything.
+      FakeDriver.configure(0, 100);
+      assert.strictEqual(await Binding.drain(port.handle, 100), 'timeout');
+      assert(FakeDriver.getState().calls.TIOCOUTQ > 0);
+
+      FakeDriver.configure(0, -1);
+      Binding.writeData(port.handle, toArrayBuffer('x'));
+      readDevice(port.fd, 1);
+      assert.strictEqual(await Binding.drain(port.handle, 100), 'drained');
+    });
+});
+
+
+describe('RS-485 open options', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('sets RS-485 mode when the port is opened', {
+    skip: process.platform !== 'linux'
+  }, async () => {
+    device = await openSerialPort({
+      baudRate: 115200,
+      rs485: { rtsAfterSend: true, delayRtsBeforeSend: 2, rxDuringTx: true }
+    });
+
+    const { port } = device;
+    let { rs485 } = FakeDriver.getState();
+
+    assert.strictEqual(rs485.flags, SER_RS485_ENABLED |
+      SER_RS485_RTS_ON_SEND | SER_RS485_RTS_AFTER_SEND |
+      SER_RS485_RX_DURING_TX);
+    assert.strictEqual(rs485.delayRtsBeforeSend, 2);
+    assert.strictEqual(rs485.delayRtsAfterSend, 0);
+
+    await port.close();
+    await port.open({ baudRate: 115200, rs485: true });
+    ({ rs485 } = FakeDriver.getState());
+    assert.strictEqual(rs485.flags, SER_RS485_ENABLED |
+      SER_RS485_RTS_ON_SEND);
+
+    await port.close();
+    await port.open({ baudRate: 115200, rs485: false });
+    assert.strictEqual(FakeDriver.getState().rs485.flags, 0);
+  });
+
+  it('fails to open when the driver has no RS-485 mode', {
+    skip: process.platform !== 'linux'
+  }, async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+
+    FakeDriver.setFailure('TIOCSRS485', Os.constants.errno.ENOTTY);
+
+    // There is nothing to turn off on such a driver.
+    await port.close();
+    await port.open({ baudRate: 115200, rs485: false });
+
+    await port.close();
+    await assert.rejects(port.open({ baudRate: 115200, rs485: true }), {
+      name: 'NetworkError'
+    });
+
+    // The port was closed again, so it can be opened without the option.
+    await port.open({ baudRate: 115200 });
+    assert(port.readable instanceof ReadableStream);
+  });
+
+  it('drops the echo of what the streams wrote', async () => {
+    device = await openSerialPort({
+      baudRate: 115200,
+      echoSuppression: { timeout: 200 }
+    });
+
+    const { port, fd } = device;
+    const writer = port.writable.getWriter();
+
+    await writer.write(Buffer.from('hello'));
+    writer.releaseLock();
+
+    const sent = readDevice(fd, 5);
+
+    assert.strictEqual(sent.toString(), 'hello');
+    Fs.writeSync(fd, Buffer.concat([sent, Buffer.from('reply')]));
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'reply');
+    assert.deepStrictEqual(port.getEchoStats(), {
+      suppressed: 5,
+      mismatched: 0,
+      expired: 0
+    });
+  });
+
+  it('checks its open options', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const invalid = [
+      [{ rs485: 1 }, /^rs485 must be a boolean or an object$/],
+      [{ rs485: { rtsOnSend: 1 } }, /^rtsOnSend must be a boolean$/],
+      [{ rs485: { rtsAfterSend: 1 } }, /^rtsAfterSend must be a boolean$/],
+      [
+        { rs485: { delayRtsBeforeSend: -1 } },
+        /^delayRtsBeforeSend must be an unsigned integer$/
+      ],
+      [
+        { rs485: { delayRtsAfterSend: 0.5 } },
+        /^delayRtsAfterSend must be an unsigned integer$/
+      ],
+      [{ rs485: { rxDuringTx: 'yes' } }, /^rxDuringTx must be a boolean$/],
+      [
+        { echoSuppression: 'on' },
+        /^echoSuppression must be a boolean or an object$/
+      ],
+      [
+        { echoSuppression: { timeout: -1 } },
+        /^timeout must be an unsigned integer$/
+      ]
+    ];
+
+    await port.close();
+
+    for (const [options, message] of invalid) {
+      await assert.rejects(port.open({ baudRate: 115200, ...options }),
+        { name: 'TypeError', message });
+    }
+
+    assert.throws(() => {
+      port.getEchoStats();
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+
+    // null and false leave the driver and the echoes alone.
+    await port.open({ baudRate: 115200, rs485: null, echoSuppression: false });
+    await port.close();
+    await port.open({ baudRate: 115200, echoSuppression: true });
+    assert.deepStrictEqual(port.getEchoStats(), {
+      suppressed: 0,
+      mismatched: 0,
+      expired: 0
+    });
+  });
+});
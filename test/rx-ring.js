@@ -0,0 +1,196 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { SerialRingReader, SerialRxRing } = require('../lib');
+const { FakeDriver, openSerialPort, sleep } = require('./fixtures');
+
+
+describe('receive rings', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  async function start(options) {
+    device = await openSerialPort({ baudRate: 115200 });
+    return device.port.createRxRing(options);
+  }
+
+  // Waits until the native reader has taken everything the device sent.
+  async function settle(reader, bytes) {
+    for (let i = 0; i < 1000 && reader.available + reader.dropped < bytes;
+      i++) {
+      await sleep(1);
+    }
+  }
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('hands received bytes to a consumer', async () => {
+    const ring = await start({ bufferSize: 16 });
+    const reader = new SerialRingReader(ring.buffer);
+    const target = new Uint8Array(16);
+
+    assert(ring instanceof SerialRxRing);
+    assert.strictEqual(ring.buffer.byteLength, 64 + 16);
+
+    // A read started before the data arrives is woken by it.
+    const reading = reader.read(target);
+
+    Fs.writeSync(device.fd, '0123456789');
+    assert.strictEqual(await reading, 10);
+    assert.strictEqual(Buffer.from(target.subarray(0, 10)).toString(),
+      '0123456789');
+
+    // Data that wraps around the end of the ring comes out in order.
+    Fs.writeSync(device.fd, 'abcdefghijkl');
+    await settle(reader, 12);
+    assert.strictEqual(reader.available, 12);
+    assert.strictEqual(reader.readSync(target), 12);
+    assert.strictEqual(Buffer.from(target.subarray(0, 12)).toString(),
+      'abcdefghijkl');
+    assert.strictEqual(reader.readSync(target, 0), 0);
+    assert.strictEqual(await reader.read(target, 10), 0);
+    assert.strictEqual(reader.closed, false);
+    assert.deepStrictEqual(await ring.close(), { received: 22, dropped: 0 });
+    assert.strictEqual(reader.closed, true);
+    assert.strictEqual(await reader.read(target), null);
+    assert.strictEqual(reader.readSync(target), null);
+  });
+
+  it('drops what arrives while the ring is full', async () => {
+    const ring = await start({ bufferSize: 16 });
+    const reader = new SerialRingReader(ring.buffer);
+    const target = new Uint8Array(64);
+
+    Fs.writeSync(device.fd, Buffer.alloc(40, 'x'));
+    await settle(reader, 40);
+    assert.strictEqual(reader.available, 16);
+    assert.strictEqual(reader.dropped, 24);
+
+    // What is left can still be drained once the ring is closed.
+    assert.deepStrictEqual(await ring.close(), { received: 16, dropped: 24 });
+    assert.strictEqual(reader.readSync(target), 16);
+    assert.strictEqual(reader.readSync(target), null);
+  });
+
+  it('lets observers follow without consuming', async () => {
+    const ring = await start({ bufferSize: 16 });
+    const consumer = new SerialRingReader(ring.buffer);
+    const observer = new SerialRingReader(ring.buffer, { observe: true });
+    const target = new Uint8Array(16);
+
+    Fs.writeSync(device.fd, 'abcd');
+    await settle(consumer, 4);
+    assert.strictEqual(await observer.read(target), 4);
+    assert.strictEqual(observer.available, 0);
+    assert.strictEqual(consumer.available, 4);
+    assert.strictEqual(await consumer.read(target), 4);
+
+    // An observer that falls a whole ring behind skips ahead.
+    for (let i = 0; i < 3; i++) {
+      Fs.writeSync(device.fd, Buffer.alloc(12, i));
+      await settle(consumer, 12);
+      assert.strictEqual(await consumer.read(target), 12);
+    }
+
+    assert.strictEqual(observer.readSync(target, 0), 0);
+    assert.strictEqual(observer.missed, 36);
+    Fs.writeSync(device.fd, 'next');
+    assert.strictEqual(await observer.read(target), 4);
+    assert.strictEqual(Buffer.from(target.subarray(0, 4)).toString(), 'next');
+    observer.release();
+    await ring.close();
+  });
+
+  it('rejects closed when the port fails', async () => {
+    const ring = await start();
+    const reader = new SerialRingReader(ring.buffer);
+
+    // Hanging up the device side makes the port fail. The placeholder keeps
+    // the cleanup the same for every test.
+    Fs.closeSync(device.fd);
+    device.fd = Fs.openSync('/dev/null', 'r');
+    await assert.rejects(ring.closed, { message: 'Port was disconnected' });
+    assert.strictEqual(reader.closed, true);
+    assert.strictEqual(await reader.read(new Uint8Array(1)), null);
+  });
+
+  it('checks its arguments and the port', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+
+    assert.throws(() => {
+      new SerialRxRing(); // eslint-disable-line no-new
+    }, { name: 'TypeError', message: 'illegal constructor' });
+
+    for (const bufferSize of [8, 24, 2 ** 31, 1.5]) {
+      assert.throws(() => {
+        port.createRxRing({ bufferSize });
+      }, {
+        name: 'TypeError',
+        message: 'bufferSize must be a power of two from 16 to 1073741824'
+      });
+    }
+
+    const ring = port.createRxRing();
+
+    assert.throws(() => {
+      return port.readable;
+    }, { name: 'InvalidStateError', message: 'port is in use by a helper' });
+    assert.throws(() => {
+      port.createRxRing();
+    }, { name: 'InvalidStateError' });
+    assert(port.writable instanceof WritableStream);
+
+    for (const buffer of [null, new ArrayBuffer(128),
+      new SharedArrayBuffer(64), new SharedArrayBuffer(128)]) {
+      assert.throws(() => {
+        return new SerialRingReader(buffer);
+      }, { name: 'TypeError', message: 'buffer must be a serial ring buffer' });
+    }
+
+    // Only one consumer at a time.
+    const reader = new SerialRingReader(ring.buffer);
+
+    assert.throws(() => {
+      return new SerialRingReader(ring.buffer);
+    }, { message: 'ring already has a consumer' });
+
+    const target = new Uint8Array(1);
+    const reading = reader.read(target);
+
+    assert.throws(() => {
+      reader.readSync(target);
+    }, { message: 'a read is already in progress' });
+    assert.throws(() => {
+      reader.readSync(new Uint8Array(0));
+    }, {
+      name: 'TypeError',
+      message: 'target must be a non-empty Uint8Array'
+    });
+    Fs.writeSync(device.fd, 'z');
+    assert.strictEqual(await reading, 1);
+    reader.release();
+    reader.release();
+    assert.throws(() => {
+      reader.readSync(target);
+    }, { message: 'reader has been released' });
+    new SerialRingReader(ring.buffer).release();
+
+    await assert.rejects(port.close(), { name: 'InvalidStateError' });
+    await ring.close();
+    await port.close();
+    assert.throws(() => {
+      port.createRxRing();
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+    await port.open({ baudRate: 115200 });
+  });
+});
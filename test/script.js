@@ -0,0 +1,170 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, sleep } = require('./fixtures');
+
+
+describe('scripts', { skip: FakeDriver === null }, () => {
+  let device = null;
+  let running = false;
+  let modem = null;
+
+  // Plays a modem on the device side until the test ends: answers each
+  // command line it knows, once it has been sent the given number of times.
+  async function runModem(fd, replies) {
+    const counts = new Map();
+    let line = '';
+
+    while (running) {
+      const data = FakeDriver.read(fd, 64, 0);
+
+      if (data.length === 0) {
+        await sleep(1);
+        continue;
+      }
+
+      line += data.toString();
+
+      let end;
+
+      while ((end = line.indexOf('\r')) !== -1) {
+        const command = line.slice(0, end);
+        const count = (counts.get(command) ?? 0) + 1;
+        const reply = replies[command];
+
+        line = line.slice(end + 1);
+        counts.set(command, count);
+
+        if (reply !== undefined && count >= (reply.after ?? 1)) {
+          Fs.writeSync(fd, reply.text);
+        }
+      }
+    }
+  }
+
+  async function start(replies) {
+    device = await openSerialPort({ baudRate: 115200 });
+    running = true;
+    modem = runModem(device.fd, replies);
+    return device.port;
+  }
+
+  afterEach(async () => {
+    running = false;
+    await modem;
+
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('runs a chat and reports each step', async () => {
+    const port = await start({
+      AT: { text: 'OK\r\n' },
+      'AT+CSQ': { text: '+CSQ: 17,99\r\nOK\r\n' }
+    });
+    const result = await port.runScript([
+      { send: 'AT\r', expect: 'OK' },
+      { send: Buffer.from('AT+CSQ\r'), expect: [/\+CSQ: (\d+),(\d+)/, 'NO'] }
+    ]);
+
+    assert.strictEqual(result.ok, true);
+    assert.strictEqual(result.failedStep, -1);
+    assert.strictEqual(result.steps[0].status, 'ok');
+    assert.strictEqual(result.steps[0].match, 0);
+    assert.strictEqual(result.steps[1].status, 'ok');
+    assert.strictEqual(result.steps[1].match, 0);
+    assert.deepStrictEqual(result.steps[1].groups,
+      ['+CSQ: 17,99', '17', '99']);
+    // A step's output runs up to the end of its match; what follows is left
+    // for the next step.
+    assert(result.steps[1].output instanceof Uint8Array);
+    assert.strictEqual(Buffer.from(result.steps[1].output).toString(),
+      '\r\n+CSQ: 17,99');
+    assert.strictEqual(result.steps[1].attempts, 1);
+    assert.strictEqual(typeof result.steps[1].time, 'number');
+  });
+
+  it('stops at an error pattern or a timeout', async () => {
+    const port = await start({
+      AT: { text: 'OK\r\n' },
+      'AT+FAIL': { text: 'ERROR\r\n' }
+    });
+    let result = await port.runScript([
+      { send: 'AT+FAIL\r', expect: 'OK', error: ['BUSY', /err(or)?/i] },
+      { send: 'AT\r', expect: 'OK' }
+    ]);
+
+    assert.strictEqual(result.ok, false);
+    assert.strictEqual(result.failedStep, 0);
+    assert.strictEqual(result.steps[0].status, 'error');
+    assert.strictEqual(result.steps[0].match, 1);
+    assert.strictEqual(result.steps[1].status, 'skipped');
+
+    result = await port.runScript([
+      { send: 'AT+NONE\r', expect: 'OK', timeout: 30 }
+    ]);
+    assert.strictEqual(result.ok, false);
+    assert.strictEqual(result.steps[0].status, 'timeout');
+  });
+
+  it('retries a step that timed out', async () => {
+    const port = await start({ 'AT+SLOW': { text: 'OK\r\n', after: 3 } });
+    const result = await port.runScript([
+      { send: 'AT+SLOW\r', expect: 'OK', timeout: 30, retries: 2, delay: 5 }
+    ]);
+
+    assert.strictEqual(result.ok, true);
+    assert.strictEqual(result.steps[0].attempts, 3);
+  });
+
+  it('fails when the port does', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const running = device.port.runScript([
+      { send: 'AT\r', expect: 'OK', timeout: 5000 }
+    ]);
+
+    // Hanging up the device side makes the port fail. The placeholder keeps
+    // the cleanup the same for every test.
+    await sleep(20);
+    Fs.closeSync(device.fd);
+    device.fd = Fs.openSync('/dev/null', 'r');
+    await assert.rejects(running, { name: 'NetworkError' });
+  });
+
+  it('checks its steps', async () => {
+    const port = await start({});
+    const invalid = [
+      [null, /^steps must be an array$/],
+      [[null], /^step 0 must be an object$/],
+      [[{ timeout: -1 }], /^timeout must be an unsigned integer$/],
+      [[{ retries: 1.5 }], /^retries must be an unsigned integer$/],
+      [[{ delay: 'x' }], /^delay must be an unsigned integer$/],
+      [[{ expect: /a/m }], /^expect patterns only support the i flag$/],
+      [[{ error: 1 }], /^error patterns must be strings or regular/],
+      [[{ send: 1 }], /send/]
+    ];
+
+    for (const [steps, message] of invalid) {
+      await assert.rejects(port.runScript(steps), { name: 'TypeError',
+        message });
+    }
+
+    const reader = port.readable.getReader();
+
+    await assert.rejects(port.runScript([]),
+      { name: 'InvalidStateError', message: 'readable stream is locked' });
+    reader.releaseLock();
+
+    const ring = port.createRxRing();
+
+    await assert.rejects(port.runScript([]), { name: 'InvalidStateError' });
+    await ring.close();
+  });
+});
@@ -0,0 +1,128 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const Os = require('node:os');
+const Path = require('node:path');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort } = require('./fixtures');
+// From termios.h on Linux.
+const TIOCM_DTR = 0x002;
+const TIOCM_RTS = 0x004;
+
+
+describe('signal sequences', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('steps through the signals and times each step', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    // Resets a board into its bootloader, as esptool does.
+    const result = await port.runSignalSequence([
+      { dtr: false, rts: true, holdMicros: 20000 },
+      { dtr: true, rts: false, holdMicros: 10000 },
+      { dtr: false }
+    ]);
+
+    assert.strictEqual(result.steps.length, 3);
+    assert(result.steps[0].holdMicros >= 20000);
+    assert(result.steps[1].holdMicros >= 10000);
+    assert(result.steps[1].startMicros >= result.steps[0].startMicros +
+      result.steps[0].setMicros + result.steps[0].holdMicros);
+
+    for (const step of result.steps) {
+      assert.strictEqual(typeof step.setMicros, 'number');
+    }
+
+    assert(result.totalMicros >= 30000);
+    assert.strictEqual(FakeDriver.getState().signals, 0);
+  });
+
+  it('leaves signals that a step does not mention alone', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+
+    await port.setSignals({ dataTerminalReady: true });
+    await port.runSignalSequence([{ rts: true }]);
+    assert.strictEqual(FakeDriver.getState().signals, TIOCM_DTR | TIOCM_RTS);
+    await port.runSignalSequence([{ rts: 0 }, {}]);
+    assert.strictEqual(FakeDriver.getState().signals, TIOCM_DTR);
+  });
+
+  it('sends breaks', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+
+    // The break and mark-after-break of a DMX512 frame.
+    await port.runSignalSequence([
+      { break: true, holdMicros: 100 },
+      { break: false, holdMicros: 12 }
+    ]);
+
+    const { breaks, breakOn, calls } = FakeDriver.getState();
+
+    assert.strictEqual(breaks, 1);
+    assert.strictEqual(breakOn, false);
+    assert.strictEqual(calls.TIOCSBRK, 1);
+    assert.strictEqual(calls.TIOCCBRK, 1);
+  });
+
+  it('checks its steps and the port', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const invalid = [
+      [{}, /^steps must be an array$/],
+      [[{}, 1], /^step 1 must be an object$/],
+      [[{ holdMicros: -1 }], /^holdMicros must be an integer from 0 to/],
+      [[{ holdMicros: 2 ** 32 }], /^holdMicros must be an integer from 0 to/],
+      [[{ holdMicros: 0.5 }], /^holdMicros must be an integer from 0 to/]
+    ];
+
+    for (const [steps, message] of invalid) {
+      await assert.rejects(port.runSignalSequence(steps),
+        { name: 'TypeError', message });
+    }
+
+    // Only a helper that owns the output keeps a sequence from running.
+    const ring = port.createRxRing();
+
+    await port.runSignalSequence([{ dtr: true }]);
+    await ring.close();
+
+    const dir = Fs.mkdtempSync(Path.join(Os.tmpdir(), 'webserial-'));
+    const file = Path.join(dir, 'in');
+
+    Fs.writeFileSync(file, 'x');
+
+    const fd = Fs.openSync(file, 'r');
+    const pipe = port.pipeFromFd(fd);
+
+    await assert.rejects(port.runSignalSequence([{ dtr: true }]), {
+      name: 'InvalidStateError',
+      message: 'port is in use by a helper'
+    });
+    await pipe.close();
+    Fs.closeSync(fd);
+    Fs.rmSync(dir, { recursive: true });
+
+    await port.close();
+    await assert.rejects(port.runSignalSequence([]), {
+      name: 'InvalidStateError',
+      message: 'port is not open'
+    });
+    await port.open({ baudRate: 115200 });
+  });
+});
@@ -0,0 +1,127 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, sleep } = require('./fixtures');
+
+
+describe('transactions', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  // Waits for request on the device side, without blocking the event loop
+  // the transaction is started from, and answers it with response.
+  async function answer(request, response) {
+    let received = Buffer.alloc(0);
+
+    for (let i = 0; received.length < request.length && i < 1000; i++) {
+      await sleep(1);
+      received = Buffer.concat([received, FakeDriver.read(device.fd, 64, 0)]);
+    }
+
+    assert.strictEqual(received.toString(), request);
+    Fs.writeSync(device.fd, response);
+  }
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('ends a response by length or delimiter', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    let pending = port.transact(Buffer.from('AT\r'), { expectLength: 4 });
+
+    await answer('AT\r', 'OK\r\n');
+
+    let response = await pending;
+
+    assert(response.data instanceof Uint8Array);
+    assert.strictEqual(Buffer.from(response.data).toString(), 'OK\r\n');
+    assert.strictEqual(response.timedOut, false);
+    assert.strictEqual(typeof response.writeTime, 'number');
+    assert(response.totalTime >= response.writeTime);
+
+    pending = port.transact(new Uint8Array(Buffer.from('READ?\n')), {
+      delimiter: new Uint8Array([0x0a])
+    });
+    await answer('READ?\n', 'VAL=12\nVAL=13\n');
+    response = await pending;
+    assert.strictEqual(Buffer.from(response.data).toString(), 'VAL=12\n');
+
+    // What followed the delimiter is kept for the next transaction, and
+    // maxLength ends a response that has no delimiter in sight.
+    pending = port.transact(Buffer.from('X'), {
+      delimiter: Buffer.from('!'),
+      maxLength: 4
+    });
+    await answer('X', '123456!');
+    response = await pending;
+    assert.strictEqual(Buffer.from(response.data).toString(), 'VAL=');
+  });
+
+  it('returns what arrived before the timeout', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const pending = device.port.transact(Buffer.from('?'), {
+      expectLength: 10,
+      timeout: 50
+    });
+
+    await answer('?', 'part');
+
+    const response = await pending;
+
+    assert.strictEqual(response.timedOut, true);
+    assert.strictEqual(Buffer.from(response.data).toString(), 'part');
+  });
+
+  it('runs transactions one at a time, in order', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const first = port.transact(Buffer.from('1'), { expectLength: 1 });
+    const second = port.transact(Buffer.from('2'), { expectLength: 1 });
+
+    await answer('1', 'a');
+    await answer('2', 'b');
+    assert.strictEqual(Buffer.from((await first).data).toString(), 'a');
+    assert.strictEqual(Buffer.from((await second).data).toString(), 'b');
+  });
+
+  it('checks its arguments and the port', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const request = Buffer.from('x');
+    const invalid = [
+      [{}, /^expectLength or delimiter must be provided$/],
+      [{ expectLength: 0 }, /^expectLength must be/],
+      [{ delimiter: new Uint8Array(0) }, /^delimiter must not be empty$/],
+      [{ expectLength: 1, maxLength: 0 }, /^maxLength must be/],
+      [{ expectLength: 1, timeout: -1 }, /^timeout must be/]
+    ];
+
+    for (const [options, message] of invalid) {
+      await assert.rejects(port.transact(request, options),
+        { name: 'TypeError', message });
+    }
+
+    await assert.rejects(port.transact(request),
+      { name: 'TypeError', message: invalid[0][1] });
+    await assert.rejects(port.transact('x', { expectLength: 1 }),
+      { name: 'TypeError' });
+
+    const reader = port.readable.getReader();
+
+    await assert.rejects(port.transact(request, { expectLength: 1 }),
+      { name: 'InvalidStateError', message: 'readable stream is locked' });
+    reader.releaseLock();
+  });
+});
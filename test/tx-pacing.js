@@ -0,0 +1,143 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const { describe, it, afterEach } = exports.lab = require('@hapi/lab').script();
+const { FakeDriver, openSerialPort, readDevice, sleep } = require('./fixtures');
+
+
+describe('transmit pacing', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  // Writes data as one chunk and returns how long it took, in milliseconds.
+  async function timeWrite(port, data) {
+    const writer = port.writable.getWriter();
+    const start = process.hrtime.bigint();
+
+    try {
+      await writer.write(Buffer.from(data));
+    } finally {
+      writer.releaseLock();
+    }
+
+    return Number(process.hrtime.bigint() - start) / 1e6;
+  }
+
+  afterEach(async () => {
+    if (device !== null) {
+      await device.port.close();
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('limits the rate', async () => {
+    device = await openSerialPort({
+      baudRate: 115200,
+      txPacing: { rate: 1000, burst: 10 }
+    });
+
+    const { port, fd } = device;
+    const data = Buffer.alloc(200, 'r');
+
+    // 190 bytes over the first burst, at a byte per millisecond.
+    assert(await timeWrite(port, data) >= 150);
+    assert.deepStrictEqual(readDevice(fd, 200), data);
+
+    // Turning pacing off lets writes through at once.
+    port.setTxPacing(null);
+    assert(await timeWrite(port, data) < 50);
+    assert.deepStrictEqual(readDevice(fd, 200), data);
+  });
+
+  it('leaves gaps after bytes and chunks', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port, fd } = device;
+
+    port.setTxPacing({ byteGap: 10 });
+    assert(await timeWrite(port, 'abcde') >= 40);
+    assert.deepStrictEqual(readDevice(fd, 5), Buffer.from('abcde'));
+
+    // The gap after a chunk holds up the next one.
+    port.setTxPacing({ chunkGap: 30 });
+    await timeWrite(port, 'ab');
+    assert(await timeWrite(port, 'cd') >= 25);
+    assert.deepStrictEqual(readDevice(fd, 4), Buffer.from('abcd'));
+  });
+
+  it('discards what is left when the stream is aborted', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port, fd } = device;
+    const writer = port.writable.getWriter();
+
+    port.setTxPacing({ rate: 100, burst: 1 });
+
+    const writing = writer.write(Buffer.alloc(100, 'a'));
+
+    await sleep(30);
+    await Promise.all([
+      assert.rejects(writing),
+      writer.abort()
+    ]);
+
+    const sent = readDevice(fd, 100, 50).length;
+
+    assert(sent > 0 && sent < 20);
+  });
+
+  it('fails a write whose gap never comes', async () => {
+    device = await openSerialPort({ baudRate: 115200, drainTimeout: 50 });
+
+    const { port } = device;
+
+    FakeDriver.configure(0, 100);
+    port.setTxPacing({ byteGap: 1 });
+    await assert.rejects(timeWrite(port, 'ab'), {
+      name: 'UnknownError',
+      message: 'drain timed out'
+    });
+    FakeDriver.configure(0, -1);
+
+    // The failed stream is let go of, so the port can still be written to
+    // and closed.
+    assert(await timeWrite(port, 'c') < 50);
+    await port.close();
+    await port.open({ baudRate: 115200 });
+  });
+
+  it('checks its options', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const invalid = [
+      [1, /^txPacing must be an object$/],
+      [{ rate: -1 }, /^rate must be a non-negative number$/],
+      [{ rate: Infinity }, /^rate must be a non-negative number$/],
+      [{ rate: 10, burst: 0 }, /^burst must be a positive integer$/],
+      [{ rate: 10, burst: 1.5 }, /^burst must be a positive integer$/],
+      [{ byteGap: NaN }, /^byteGap must be a non-negative number$/],
+      [{ chunkGap: '1' }, /^chunkGap must be a non-negative number$/]
+    ];
+
+    for (const [options, message] of invalid) {
+      assert.throws(() => {
+        port.setTxPacing(options);
+      }, { name: 'TypeError', message });
+    }
+
+    await port.close();
+    await assert.rejects(port.open({ baudRate: 115200, txPacing: 1 }), {
+      name: 'TypeError'
+    });
+    assert.throws(() => {
+      port.setTxPacing({ rate: 10 });
+    }, { name: 'InvalidStateError', message: 'port is not open' });
+
+    // Options that pace nothing are the same as none.
+    await port.open({ baudRate: 115200, txPacing: { rate: 0 } });
+    assert(await timeWrite(port, 'x') < 50);
+  });
+});
@@ -0,0 +1,240 @@
+'use strict';
+const assert = require('node:assert');
+const Fs = require('node:fs');
+const Path = require('node:path');
+const { Worker } = require('node:worker_threads');
+const {
+  describe,
+  it,
+  after,
+  afterEach
+} = exports.lab = require('@hapi/lab').script();
+const { SerialPort } = require('../lib');
+const {
+  FakeDriver,
+  openSerialPort,
+  readDevice,
+  sleep
+} = require('./fixtures');
+const kWorkerPath = Path.join(__dirname, 'fixtures', 'port-worker.js');
+const kAdoptWorkerPath = Path.join(__dirname, 'fixtures', 'adopt-worker.js');
+const kWorkers = 8;
+
+
+function startWorker(id, iterations) {
+  const worker = new Worker(kWorkerPath, {
+    workerData: { id, iterations },
+    // The pty's device side is opened natively, not through fs.
+    trackUnmanagedFds: false
+  });
+  const exited = new Promise((resolve, reject) => {
+    let done = false;
+
+    worker.on('message', (message) => {
+      if (message === 'done') {
+        done = true;
+      }
+    });
+    worker.on('error', reject);
+    worker.on('exit', (code) => {
+      resolve({ code, done });
+    });
+  });
+
+  return { worker, exited };
+}
+
+
+describe('worker threads', { skip: FakeDriver === null }, () => {
+  after(() => {
+    FakeDriver.uninstall();
+  });
+
+  it('loads and runs the addon in many workers at once', async () => {
+    const workers = [];
+
+    for (let i = 0; i < kWorkers; i++) {
+      workers.push(startWorker(i, 20));
+    }
+
+    for (const { exited } of workers) {
+      assert.deepStrictEqual(await exited, { code: 0, done: true });
+    }
+  });
+
+  it('survives workers terminated in the middle of port work', async () => {
+    for (let round = 0; round < 5; round++) {
+      const workers = [];
+
+      for (let i = 0; i < kWorkers; i++) {
+        workers.push(startWorker(i, 0));
+      }
+
+      // Stagger the terminations so they land at different points: while
+      // the addon is loading, in async work, and with a ring running.
+      for (let i = 0; i < workers.length; i++) {
+        await sleep(i * 3);
+        workers[i].worker.terminate();
+      }
+
+      // A worker stopped before it ran at all exits with 0, so only check
+      // that none of them failed or finished.
+      for (const { exited } of workers) {
+        assert.strictEqual((await exited).done, false);
+      }
+    }
+
+    // The process, and the addon, are still fine for new workers.
+    const { exited } = startWorker(kWorkers, 5);
+
+    assert.deepStrictEqual(await exited, { code: 0, done: true });
+  });
+});
+
+
+describe('port transfer', { skip: FakeDriver === null }, () => {
+  let device = null;
+
+  afterEach(async () => {
+    if (device !== null) {
+      Fs.closeSync(device.fd);
+      device = null;
+    }
+
+    FakeDriver.uninstall();
+  });
+
+  it('hands an open port to a worker', async () => {
+    device = await openSerialPort({ baudRate: 250000 });
+
+    const { port, fd } = device;
+    const transfer = await port.transfer();
+
+    assert.strictEqual(port.baudRate, undefined);
+    assert.strictEqual(transfer.baudRate, 250000);
+    // Reads only see data that is already waiting, so send the worker's
+    // input before it starts.
+    Fs.writeSync(fd, 'pong');
+
+    const worker = new Worker(kAdoptWorkerPath, {
+      workerData: transfer,
+      trackUnmanagedFds: false
+    });
+    const messages = [];
+    const exited = new Promise((resolve, reject) => {
+      worker.on('message', (message) => {
+        messages.push(message);
+      });
+      worker.on('error', reject);
+      worker.on('exit', resolve);
+    });
+
+    assert.deepStrictEqual(readDevice(fd, 4, 2000), Buffer.from('ping'));
+    assert.strictEqual(await exited, 0);
+    assert.deepStrictEqual(messages, [
+      { baudRate: 250000, secondAdopt: 'InvalidStateError' },
+      'pong'
+    ]);
+
+    // The worker has closed it, so the transfer is spent here too.
+    assert.throws(() => {
+      SerialPort.adopt(transfer);
+    }, { name: 'InvalidStateError' });
+  });
+
+  it('adopts a port on the same thread', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const transfer = await device.port.transfer();
+
+    assert.throws(() => {
+      SerialPort.adopt({ handleId: -1 });
+    }, { name: 'TypeError' });
+    assert.throws(() => {
+      SerialPort.adopt(null);
+    }, { name: 'TypeError' });
+
+    const port = SerialPort.adopt(transfer);
+    const writer = port.writable.getWriter();
+
+    assert.throws(() => {
+      SerialPort.adopt(transfer);
+    }, { name: 'InvalidStateError' });
+    assert.strictEqual(port.baudRate, 115200);
+    await writer.write(Buffer.from('out'));
+    writer.releaseLock();
+    assert.deepStrictEqual(readDevice(device.fd, 3), Buffer.from('out'));
+    Fs.writeSync(device.fd, 'in');
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.deepStrictEqual(Buffer.from(value), Buffer.from('in'));
+    await port.close();
+  });
+
+  it('carries the open options and lets go of the streams', async () => {
+    device = await openSerialPort({
+      baudRate: 115200,
+      echoSuppression: { timeout: 200 }
+    });
+
+    const { readable } = device.port;
+    const transfer = await device.port.transfer();
+
+    assert.strictEqual(transfer.echoTimeout, 200);
+    assert.deepStrictEqual(await readable.getReader().read(),
+      { value: undefined, done: true });
+
+    const port = SerialPort.adopt(transfer);
+    const writer = port.writable.getWriter();
+
+    await writer.write(Buffer.from('hello'));
+    writer.releaseLock();
+
+    const sent = readDevice(device.fd, 5);
+
+    // The adopted port still drops the echo.
+    Fs.writeSync(device.fd, Buffer.concat([sent, Buffer.from('reply')]));
+
+    const reader = port.readable.getReader();
+    const { value } = await reader.read();
+
+    reader.releaseLock();
+    assert.strictEqual(Buffer.from(value).toString(), 'reply');
+    assert.strictEqual(port.getEchoStats().suppressed, 5);
+    await port.close();
+  });
+
+  it('refuses to transfer a port that is busy or closed', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const { port } = device;
+    const ring = port.createRxRing();
+
+    await assert.rejects(port.transfer(), {
+      name: 'InvalidStateError',
+      message: 'port is in use by a helper'
+    });
+    await ring.close();
+    await port.close();
+    await assert.rejects(port.transfer(), {
+      name: 'InvalidStateError',
+      message: 'port is not open'
+    });
+  });
+
+  it('closes the port if adopting it fails', async () => {
+    device = await openSerialPort({ baudRate: 115200 });
+
+    const transfer = await device.port.transfer();
+
+    assert.throws(() => {
+      SerialPort.adopt({ ...transfer, txPacing: { rate: 'x' } });
+    });
+    assert.throws(() => {
+      SerialPort.adopt(transfer);
+    }, { name: 'InvalidStateError' });
+  });
+});